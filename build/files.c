@@ -1042,6 +1042,8 @@ static void genCpioListAndHeader(FileList fl,
     int i;
     pgpHashAlgo defaultalgo = PGPHASHALGO_MD5, digestalgo;
     rpm_loff_t totalFileSize = 0;
+    unsigned char * rawdigests = NULL;
+    size_t diglen, ndigests = 0;
 
     /*
      * See if non-md5 file checksum algorithm is requested. If not
@@ -1059,6 +1061,11 @@ static void genCpioListAndHeader(FileList fl,
 		digestalgo);
 	digestalgo = defaultalgo;
     }
+    diglen = rpmDigestLength(digestalgo);
+
+    /* Store file digests in binary rather than as hex strings? */
+    if (!isSrc && rpmExpandNumeric("%{?_binary_filedigests_raw}"))
+	rawdigests = xcalloc(fl->fileListRecsUsed, diglen);
     
     /* Sort the big list */
     qsort(fl->fileList, fl->fileListRecsUsed,
@@ -1190,11 +1197,19 @@ static void genCpioListAndHeader(FileList fl,
 	    headerPutString(h, RPMTAG_FILECAPS, flp->caps);
 	}
 	
-	buf[0] = '\0';
-	if (S_ISREG(flp->fl_mode))
-	    (void) rpmDoDigest(digestalgo, flp->diskPath, 1, 
-			       (unsigned char *)buf, NULL);
-	headerPutString(h, RPMTAG_FILEDIGESTS, buf);
+	if (rawdigests) {
+	    /* All zeros (from xcalloc) for anything but regular files. */
+	    if (S_ISREG(flp->fl_mode))
+		(void) rpmDoDigest(digestalgo, flp->diskPath, 0,
+				   rawdigests + ndigests * diglen, NULL);
+	    ndigests++;
+	} else {
+	    buf[0] = '\0';
+	    if (S_ISREG(flp->fl_mode))
+		(void) rpmDoDigest(digestalgo, flp->diskPath, 1, 
+				   (unsigned char *)buf, NULL);
+	    headerPutString(h, RPMTAG_FILEDIGESTS, buf);
+	}
 	
 	buf[0] = '\0';
 	if (S_ISLNK(flp->fl_mode)) {
@@ -1239,6 +1254,12 @@ static void genCpioListAndHeader(FileList fl,
 	rpmlibNeedsFeature(h, "FileDigests", "4.6.0-1");
     }
 
+    if (rawdigests) {
+	headerPutBin(h, RPMTAG_FILERAWDIGESTS, rawdigests, ndigests * diglen);
+	rpmlibNeedsFeature(h, "FileRawDigests", "4.7.0-1");
+	free(rawdigests);
+    }
+
     if (fl->haveCaps) {
 	rpmlibNeedsFeature(h, "FileCaps", "4.6.1-1");
     }
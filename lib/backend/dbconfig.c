@@ -144,6 +144,8 @@ struct poptOption rdbOptions[] = {
 	NULL, NULL },
  { "nodbsync",	0,POPT_ARG_NONE,	&db3dbi.dbi_no_dbsync, 0,
 	NULL, NULL },
+ { "compact",	0,POPT_ARG_NONE,	&db3dbi.dbi_compact, 0,
+	NULL, NULL },
  { "lockdbfd",	0,POPT_ARG_NONE,	&db3dbi.dbi_lockdbfd, 0,
 	NULL, NULL },
  { "temporary",	0,POPT_ARG_NONE,	&db3dbi.dbi_temporary, 0,
@@ -414,6 +416,7 @@ dbiIndex db3New(rpmdb rpmdb, rpmTag rpmtag)
     case RPMDBI_PACKAGES:
     case RPMDBI_DEPENDS:
 	dbi->dbi_jlen = 1 * sizeof(int32_t);
+	dbi->dbi_compact = 0;	/* only inverted lists can be compact */
 	break;
     default:
 	dbi->dbi_jlen = 2 * sizeof(int32_t);
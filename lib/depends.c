@@ -4,6 +4,8 @@
 
 #include "system.h"
 
+#include <pthread.h>
+
 #include <rpm/rpmcli.h>		/* XXX rpmcliPackagesTotal */
 
 #include <rpm/rpmlib.h>			/* rpmVersionCompare, rpmlib provides */
@@ -15,8 +17,11 @@
 #include <rpm/rpmfi.h>
 
 #include "lib/rpmdb_internal.h"	/* XXX response cache needs dbiOpen et al. */
+#include "lib/rpmps_internal.h"		/* rpmpsMerge */
 #include "lib/rpmte_internal.h"		/* XXX tsortInfo_s */
 #include "lib/rpmts_internal.h"
+#include "lib/misc.h"			/* rpmExpandThreads */
+#include "rpmio/rpmio_internal.h"	/* rpmlogCapture */
 
 #include "debug.h"
 
@@ -42,19 +47,16 @@ const int rpmFLAGS = RPMSENSE_EQUAL;
 
 /* rpmlib provides */
 static rpmds rpmlibP = NULL;
+static pthread_mutex_t rpmlibLock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * Compare removed package instances (qsort/bsearch).
- * @param a		1st instance address
- * @param b		2nd instance address
- * @return		result of comparison
+ * Load the rpmlib provides (until it works). Call with rpmlibLock held.
  */
-static int intcmp(const void * a, const void * b)
+static void rpmlibLoad(void)
 {
-    const int * aptr = a;
-    const int * bptr = b;
-    int rc = (*aptr - *bptr);
-    return rc;
+    static int oneshot = -1;
+    if (oneshot)
+	oneshot = rpmdsRpmlib(&rpmlibP, NULL);
 }
 
 /**
@@ -70,25 +72,8 @@ static int removePackage(rpmts ts, Header h, rpmalKey depends)
     unsigned int dboffset = headerGetInstance(h);
 
     /* Filter out duplicate erasures. */
-    if (ts->numRemovedPackages > 0 && ts->removedPackages != NULL) {
-	if (bsearch(&dboffset, ts->removedPackages, ts->numRemovedPackages,
-			sizeof(*ts->removedPackages), intcmp) != NULL)
-	    return 0;
-    }
-
-    if (ts->numRemovedPackages == ts->allocedRemovedPackages) {
-	ts->allocedRemovedPackages += ts->delta;
-	ts->removedPackages = xrealloc(ts->removedPackages,
-		sizeof(ts->removedPackages) * ts->allocedRemovedPackages);
-    }
-
-    if (ts->removedPackages != NULL) {	/* XXX can't happen. */
-	ts->removedPackages[ts->numRemovedPackages] = dboffset;
-	ts->numRemovedPackages++;
-	if (ts->numRemovedPackages > 1)
-	    qsort(ts->removedPackages, ts->numRemovedPackages,
-			sizeof(*ts->removedPackages), intcmp);
-    }
+    if (!rpmtsAddRemoved(ts, dboffset))
+	return 0;
 
     if (ts->orderCount >= ts->orderAlloced) {
 	ts->orderAlloced += (ts->orderCount - ts->orderAlloced) + ts->delta;
@@ -190,7 +175,7 @@ int rpmtsAddInstallElement(rpmts ts, Header h,
 	if (rpmdsCompare(sameChk, this)) {
 	    skip = 1;
 	    addNEVR = rpmdsDNEVR(sameChk);
-	} else if (upgrade && rpmdsCompare(newChk, this)) {
+	} else if ((upgrade & 0x1) && rpmdsCompare(newChk, this)) {
 	    skip = 1;
 	    addNEVR = rpmdsDNEVR(newChk);
 	}
@@ -211,7 +196,7 @@ int rpmtsAddInstallElement(rpmts ts, Header h,
  	 * then replace old with new. 
  	 */
 	rc = rpmdsCompare(oldChk, this);
-	if (upgrade && rc != 0) {
+	if ((upgrade & 0x1) && rc != 0) {
 	    pkgNEVR = rpmdsDNEVR(this);
 	    addNEVR = rpmdsDNEVR(newChk);
 	    if (rpmIsVerbose())
@@ -266,6 +251,10 @@ addheader:
     if (upgrade & 0x2)
 	(void) rpmteSetHeader(p, h);
 
+    /* XXX Streamed package: header can't be read again at install time. */
+    if (upgrade & 0x4)
+	rpmteSetStreamHeader(p, h);
+
     /* If not upgrading, then we're done. */
     if (!(upgrade & 0x1))
 	goto exit;
@@ -326,8 +315,7 @@ addheader:
 	else
 	    mi = rpmtsInitIterator(ts, RPMTAG_NAME, Name, 0);
 
-	xx = rpmdbPruneIterator(mi,
-	    ts->removedPackages, ts->numRemovedPackages, 1);
+	xx = rpmtsPruneRemoved(ts, mi);
 
 	while((oh = rpmdbNextIterator(mi)) != NULL) {
 	    /* Ignore colored packages not in our rainbow. */
@@ -375,11 +363,12 @@ int rpmtsAddEraseElement(rpmts ts, Header h, int dboffset)
 /**
  * Check dep for an unsatisfied dependency.
  * @param ts		transaction set
+ * @param dbts		transaction set whose database is searched
  * @param dep		dependency
  * @param adding	dependency is from added package set?
  * @return		0 if satisfied, 1 if not satisfied, 2 if error
  */
-static int unsatisfiedDepend(rpmts ts, rpmds dep, int adding)
+static int unsatisfiedDepend(rpmts ts, rpmts dbts, rpmds dep, int adding)
 {
     DBT key;
     DBT data;
@@ -394,10 +383,14 @@ static int unsatisfiedDepend(rpmts ts, rpmds dep, int adding)
     if ((Name = rpmdsN(dep)) == NULL)
 	return 0;	/* XXX can't happen */
 
+    /* The cache isn't locked, dependency check threads (dbts != ts) skip it. */
+    if (dbts != ts)
+	_cacheThisRC = 0;
+
     /*
      * Check if dbiOpen/dbiPut failed (e.g. permissions), we can't cache.
      */
-    if (_cacheDependsRC) {
+    if (_cacheDependsRC && _cacheThisRC) {
 	dbiIndex dbi;
 	dbi = dbiOpen(rpmtsGetRdb(ts), RPMDBI_DEPENDS, 0);
 	if (dbi == NULL)
@@ -448,11 +441,15 @@ retry:
      * Check those dependencies now.
      */
     if (!strncmp(Name, "rpmlib(", sizeof("rpmlib(")-1)) {
-	static int oneshot = -1;
-	if (oneshot) 
-	    oneshot = rpmdsRpmlib(&rpmlibP, NULL);
-	
-	if (rpmlibP != NULL && rpmdsSearch(rpmlibP, dep) >= 0) {
+	int found;
+
+	/* The rpmlib provides are shared, and searching moves them. */
+	(void) pthread_mutex_lock(&rpmlibLock);
+	rpmlibLoad();
+	found = (rpmlibP != NULL && rpmdsSearch(rpmlibP, dep) >= 0);
+	(void) pthread_mutex_unlock(&rpmlibLock);
+
+	if (found) {
 	    rpmdsNotify(dep, _("(rpmlib provides)"), rc);
 	    goto exit;
 	}
@@ -471,14 +468,13 @@ retry:
     }
 
     /* XXX only the installer does not have the database open here. */
-    if (rpmtsGetRdb(ts) != NULL) {
+    if (rpmtsGetRdb(dbts) != NULL) {
 	if (Name[0] == '/') {
 	    /* depFlags better be 0! */
 
-	    mi = rpmtsInitIterator(ts, RPMTAG_BASENAMES, Name, 0);
+	    mi = rpmtsInitIterator(dbts, RPMTAG_BASENAMES, Name, 0);
 
-	    (void) rpmdbPruneIterator(mi,
-			ts->removedPackages, ts->numRemovedPackages, 1);
+	    (void) rpmtsPruneRemoved(ts, mi);
 
 	    while ((h = rpmdbNextIterator(mi)) != NULL) {
 		rpmdsNotify(dep, _("(db files)"), rc);
@@ -488,9 +484,8 @@ retry:
 	    mi = rpmdbFreeIterator(mi);
 	}
 
-	mi = rpmtsInitIterator(ts, RPMTAG_PROVIDENAME, Name, 0);
-	(void) rpmdbPruneIterator(mi,
-			ts->removedPackages, ts->numRemovedPackages, 1);
+	mi = rpmtsInitIterator(dbts, RPMTAG_PROVIDENAME, Name, 0);
+	(void) rpmtsPruneRemoved(ts, mi);
 	while ((h = rpmdbNextIterator(mi)) != NULL) {
 	    if (rpmdsAnyMatchesDep(h, dep, _rpmds_nopromote)) {
 		rpmdsNotify(dep, _("(db provides)"), rc);
@@ -559,6 +554,8 @@ exit:
 /**
  * Check added requires/conflicts against against installed+added packages.
  * @param ts		transaction set
+ * @param dbts		transaction set whose database is searched
+ * @param ps		problem set to report to
  * @param pkgNEVRA	package name-version-release.arch
  * @param requires	Requires: dependencies (or NULL)
  * @param conflicts	Conflicts: dependencies (or NULL)
@@ -567,8 +564,8 @@ exit:
  * @param adding	dependency is from added package set?
  * @return		0 no problems found
  */
-static int checkPackageDeps(rpmts ts, const char * pkgNEVRA,
-		rpmds requires, rpmds conflicts,
+static int checkPackageDeps(rpmts ts, rpmts dbts, rpmps ps,
+		const char * pkgNEVRA, rpmds requires, rpmds conflicts,
 		const char * depName, rpm_color_t tscolor, int adding)
 {
     rpm_color_t dscolor;
@@ -592,13 +589,13 @@ static int checkPackageDeps(rpmts ts, const char * pkgNEVRA,
 	if (tscolor && dscolor && !(tscolor & dscolor))
 	    continue;
 
-	rc = unsatisfiedDepend(ts, requires, adding);
+	rc = unsatisfiedDepend(ts, dbts, requires, adding);
 
 	switch (rc) {
 	case 0:		/* requirements are satisfied. */
 	    break;
 	case 1:		/* requirements are not satisfied. */
-	    rpmdsProblem(ts->probs, pkgNEVRA, requires, NULL, adding);
+	    rpmdsProblem(ps, pkgNEVRA, requires, NULL, adding);
 	    break;
 	case 2:		/* something went wrong! */
 	default:
@@ -623,12 +620,12 @@ static int checkPackageDeps(rpmts ts, const char * pkgNEVRA,
 	if (tscolor && dscolor && !(tscolor & dscolor))
 	    continue;
 
-	rc = unsatisfiedDepend(ts, conflicts, adding);
+	rc = unsatisfiedDepend(ts, dbts, conflicts, adding);
 
 	/* 1 == unsatisfied, 0 == satsisfied */
 	switch (rc) {
 	case 0:		/* conflicts exist. */
-	    rpmdsProblem(ts->probs, pkgNEVRA, conflicts, NULL, adding);
+	    rpmdsProblem(ps, pkgNEVRA, conflicts, NULL, adding);
 	    break;
 	case 1:		/* conflicts don't exist. */
 	    break;
@@ -647,19 +644,20 @@ static int checkPackageDeps(rpmts ts, const char * pkgNEVRA,
  * Adding: check name/provides dep against each conflict match,
  * Erasing: check name/provides/filename dep against each requiredby match.
  * @param ts		transaction set
+ * @param dbts		transaction set whose database is searched
+ * @param ps		problem set to report to
  * @param dep		dependency name
  * @param mi		rpm database iterator
  * @param adding	dependency is from added package set?
  * @return		0 no problems found
  */
-static int checkPackageSet(rpmts ts, const char * dep,
+static int checkPackageSet(rpmts ts, rpmts dbts, rpmps ps, const char * dep,
 		rpmdbMatchIterator mi, int adding)
 {
     Header h;
     int ec = 0;
 
-    (void) rpmdbPruneIterator(mi,
-		ts->removedPackages, ts->numRemovedPackages, 1);
+    (void) rpmtsPruneRemoved(ts, mi);
     while ((h = rpmdbNextIterator(mi)) != NULL) {
 	char * pkgNEVRA;
 	rpmds requires, conflicts;
@@ -670,7 +668,8 @@ static int checkPackageSet(rpmts ts, const char * dep,
 	(void) rpmdsSetNoPromote(requires, _rpmds_nopromote);
 	conflicts = rpmdsNew(h, RPMTAG_CONFLICTNAME, 0);
 	(void) rpmdsSetNoPromote(conflicts, _rpmds_nopromote);
-	rc = checkPackageDeps(ts, pkgNEVRA, requires, conflicts, dep, 0, adding);
+	rc = checkPackageDeps(ts, dbts, ps, pkgNEVRA, requires, conflicts,
+			      dep, 0, adding);
 	conflicts = rpmdsFree(conflicts);
 	requires = rpmdsFree(requires);
 	pkgNEVRA = _free(pkgNEVRA);
@@ -695,23 +694,26 @@ static int checkDependentPackages(rpmts ts, const char * dep)
 {
     rpmdbMatchIterator mi;
     mi = rpmtsInitIterator(ts, RPMTAG_REQUIRENAME, dep, 0);
-    return checkPackageSet(ts, dep, mi, 0);
+    return checkPackageSet(ts, ts, ts->probs, dep, mi, 0);
 }
 
 /**
  * Check to-be-added dependencies against installed conflicts.
  * @param ts		transaction set
+ * @param dbts		transaction set whose database is searched
+ * @param ps		problem set to report to
  * @param dep		conflicts name
  * @return		0 no problems found
  */
-static int checkDependentConflicts(rpmts ts, const char * dep)
+static int checkDependentConflicts(rpmts ts, rpmts dbts, rpmps ps,
+		const char * dep)
 {
     int rc = 0;
 
-    if (rpmtsGetRdb(ts) != NULL) {	/* XXX is this necessary? */
+    if (rpmtsGetRdb(dbts) != NULL) {	/* XXX is this necessary? */
 	rpmdbMatchIterator mi;
-	mi = rpmtsInitIterator(ts, RPMTAG_CONFLICTNAME, dep, 0);
-	rc = checkPackageSet(ts, dep, mi, 1);
+	mi = rpmtsInitIterator(dbts, RPMTAG_CONFLICTNAME, dep, 0);
+	rc = checkPackageSet(ts, dbts, ps, dep, mi, 1);
     }
 
     return rc;
@@ -794,26 +796,6 @@ static int ignoreDep(const rpmts ts, const rpmte p, const rpmte q)
     return 0;
 }
 
-/**
- * Recursively mark all nodes with their predecessors.
- * @param tsi		successor chain
- * @param q		predecessor
- */
-static void markLoop(tsortInfo tsi, rpmte q)
-{
-    rpmte p;
-
-    /* FIX: q is kept */
-    while (tsi != NULL && (p = tsi->tsi_suc) != NULL) {
-	tsi = tsi->tsi_next;
-	if (rpmteTSI(p)->tsi_chain != NULL)
-	    continue;
-	rpmteTSI(p)->tsi_chain = q;
-	if (rpmteTSI(p)->tsi_next != NULL)
-	    markLoop(rpmteTSI(p)->tsi_next, p);
-    }
-}
-
 static inline const char * identifyDepend(rpmsenseFlags f)
 {
     f = _notpre(f);
@@ -833,88 +815,72 @@ static inline const char * identifyDepend(rpmsenseFlags f)
 }
 
 /**
- * Find (and eliminate co-requisites) "q <- p" relation in dependency loop.
- * Search all successors of q for instance of p. Format the specific relation,
- * (e.g. p contains "Requires: q"). Unlink and free co-requisite (i.e.
- * pure Requires: dependencies) successor node(s).
- * @param q		sucessor (i.e. package required by p)
- * @param p		predecessor (i.e. package that "Requires: q")
- * @param requires	relation
- * @param zap		max. no. of co-requisites to remove (-1 is all)?
- * @retval nzaps	address of no. of relations removed
- * @param msglvl	message level at which to spew
- * @return		(possibly NULL) formatted "q <- p" releation (malloc'ed)
+ * A "q <- p" relation (i.e. "p" requires "q") of the dependency graph.
  */
-/* FIX: hack modifies, but -type disables */
-static char *
-zapRelation(rpmte q, rpmte p,
-		rpmds requires,
-		int zap, int * nzaps, int msglvl)
-{
-    tsortInfo tsi_prev;
-    tsortInfo tsi;
-    char *dp = NULL;
-
-    for (tsi_prev = rpmteTSI(q), tsi = rpmteTSI(q)->tsi_next;
-	 tsi != NULL;
-	/* XXX Note: the loop traverses "not found", break on "found". */
-	 tsi_prev = tsi, tsi = tsi->tsi_next)
-    {
-	rpmsenseFlags Flags;
-
-	if (tsi->tsi_suc != p)
-	    continue;
-
-	if (requires == NULL) continue;		/* XXX can't happen */
-
-	(void) rpmdsSetIx(requires, tsi->tsi_reqx);
-
-	Flags = rpmdsFlags(requires);
+typedef struct tsortEdge_s * tsortEdge;
+
+struct tsortEdge_s {
+    int pred;			/*!< predecessor node (q) */
+    int suc;			/*!< successor node (p) */
+    int reqx;			/*!< index of the requirement in p */
+    char prereq;		/*!< pre-requisite (not co-requisite)? */
+    char zapped;		/*!< removed to break a dependency loop? */
+};
 
-	dp = rpmdsNewDNEVR( identifyDepend(Flags), requires);
+/**
+ * Dependency graph of a transaction set, built once by rpmtsOrder().
+ * Nodes are indices into ts->order, the successors of node q are
+ * edges[edgex[q]] ... edges[edgex[q+1]-1] (compressed sparse row).
+ */
+typedef struct tsortGraph_s * tsortGraph;
+
+struct tsortGraph_s {
+    int nnodes;			/*!< no. of nodes (transaction elements) */
+    orderListIndex keys;	/*!< added package key -> node (sorted) */
+    int nkeys;
+    int * selected;		/*!< p node + 1 of last "q <- p" (by q node) */
+    tsortEdge edges;		/*!< relations, by predecessor once indexed */
+    int nedges;
+    int alloced;
+    int * edgex;		/*!< nnodes + 1 edge offsets by predecessor */
+    int * scc;			/*!< loop (SCC) index by node, 0 if none */
+    int nsccs;			/*!< no. of loops */
+};
 
-	/*
-	 * Attempt to unravel a dependency loop by eliminating Requires's.
-	 */
-	if (zap && !(isErasePreReq(Flags) || isInstallPreReq(Flags))) {
-	    rpmlog(msglvl,
-			_("removing %s \"%s\" from tsort relations.\n"),
-			(rpmteNEVRA(p) ?  rpmteNEVRA(p) : "???"), dp);
-	    rpmteTSI(p)->tsi_count--;
-	    if (tsi_prev) tsi_prev->tsi_next = tsi->tsi_next;
-	    tsi->tsi_next = NULL;
-	    tsi->tsi_suc = NULL;
-	    tsi = _free(tsi);
-	    if (nzaps)
-		(*nzaps)++;
-	    if (zap)
-		zap--;
-	}
-	/* XXX Note: the loop traverses "not found", get out now! */
-	break;
-    }
-    return dp;
+/**
+ * Compare ordered list entries by index (qsort/bsearch).
+ * @param one		1st ordered list entry
+ * @param two		2nd ordered list entry
+ * @return		result of comparison
+ */
+static int orderListIndexCmp(const void * one, const void * two)	
+{
+    long a = (long) ((const orderListIndex)one)->pkgKey;
+    long b = (long) ((const orderListIndex)two)->pkgKey;
+    return (a - b);
 }
 
 /**
  * Record next "q <- p" relation (i.e. "p" requires "q").
  * @param ts		transaction set
+ * @param g		dependency graph
+ * @param pix		node of p
  * @param p		predecessor (i.e. package that "Requires: q")
- * @param selected	boolean package selected array
  * @param requires	relation
+ * @param prereq	pre-requisite relation?
  * @return		0 always
  */
-static inline int addRelation(rpmts ts,
+static inline int addRelation(rpmts ts, tsortGraph g, int pix,
 		rpmte p,
-		unsigned char * selected,
-		rpmds requires)
+		rpmds requires, int prereq)
 {
-    rpmtsi qi; rpmte q;
-    tsortInfo tsi;
+    struct orderListIndex_s key;
+    orderListIndex needle;
+    rpmte q;
+    tsortEdge e;
     const char * Name;
-    fnpyKey key;
     rpmalKey pkgKey;
-    int i = 0;
+    int i;
 
     if ((Name = rpmdsN(requires)) == NULL)
 	return 0;
@@ -928,25 +894,19 @@ static inline int addRelation(rpmts ts,
 	return 0;
 
     pkgKey = RPMAL_NOMATCH;
-    key = rpmalSatisfiesDepend(ts->addedPackages, requires, &pkgKey);
+    (void) rpmalSatisfiesDepend(ts->addedPackages, requires, &pkgKey);
 
     /* Ordering depends only on added package relations. */
     if (pkgKey == RPMAL_NOMATCH)
 	return 0;
 
-/* XXX Set q to the added package that has pkgKey == q->u.addedKey */
-/* XXX FIXME: bsearch is possible/needed here */
-    for (qi = rpmtsiInit(ts), i = 0; (q = rpmtsiNext(qi, 0)) != NULL; i++) {
-
-	/* XXX Only added packages need be checked for matches. */
-	if (rpmteType(q) == TR_REMOVED)
-	    continue;
-
-	if (pkgKey == rpmteAddedKey(q))
-	    break;
-    }
-    qi = rpmtsiFree(qi);
-    if (q == NULL || i == ts->orderCount)
+    /* Set q to the added package that has pkgKey == q->u.addedKey */
+    key.pkgKey = pkgKey;
+    needle = bsearch(&key, g->keys, g->nkeys, sizeof(key), orderListIndexCmp);
+    if (needle == NULL)
+	return 0;
+    i = needle->orIndex;
+    if ((q = ts->order[i]) == NULL)
 	return 0;
 
     /* Avoid certain dependency relations. */
@@ -955,9 +915,9 @@ static inline int addRelation(rpmts ts,
 
     /* Avoid redundant relations. */
     /* XXX TODO: add control bit. */
-    if (selected[i] != 0)
+    if (g->selected[i] == pix + 1)
 	return 0;
-    selected[i] = 1;
+    g->selected[i] = pix + 1;
 
     /* T3. Record next "q <- p" relation (i.e. "p" requires "q"). */
     rpmteTSI(p)->tsi_count++;			/* bump p predecessor count */
@@ -967,28 +927,293 @@ static inline int addRelation(rpmts ts,
     if (rpmteDepth(p) > ts->maxDepth)
 	ts->maxDepth = rpmteDepth(p);
 
-    tsi = xcalloc(1, sizeof(*tsi));
-    tsi->tsi_suc = p;
-
-    tsi->tsi_reqx = rpmdsIx(requires);
+    if (g->nedges == g->alloced) {
+	g->alloced = (g->alloced ? 2 * g->alloced : 256);
+	g->edges = xrealloc(g->edges, g->alloced * sizeof(*g->edges));
+    }
+    e = g->edges + g->nedges++;
+    e->pred = i;
+    e->suc = pix;
+    e->reqx = rpmdsIx(requires);
+    e->prereq = (prereq != 0);
+    e->zapped = 0;
 
-    tsi->tsi_next = rpmteTSI(q)->tsi_next;
-    rpmteTSI(q)->tsi_next = tsi;
     rpmteTSI(q)->tsi_qcnt++;			/* bump q successor count */
     return 0;
 }
 
 /**
- * Compare ordered list entries by index (qsort/bsearch).
- * @param one		1st ordered list entry
- * @param two		2nd ordered list entry
- * @return		result of comparison
+ * Sort the recorded relations by predecessor (in the order they were
+ * recorded), and index them by predecessor node.
+ * @param g		dependency graph
+ * @param arena		memory arena (for the index)
  */
-static int orderListIndexCmp(const void * one, const void * two)	
+static void tsortIndex(tsortGraph g, rpmArena arena)
 {
-    long a = (long) ((const orderListIndex)one)->pkgKey;
-    long b = (long) ((const orderListIndex)two)->pkgKey;
-    return (a - b);
+    tsortEdge edges = rpmArenaAlloc(arena, (g->nedges + 1) * sizeof(*edges));
+    int * pos = rpmArenaAlloc(arena, (g->nnodes + 1) * sizeof(*pos));
+    int i;
+
+    g->edgex = rpmArenaCalloc(arena, g->nnodes + 1, sizeof(*g->edgex));
+    for (i = 0; i < g->nedges; i++)
+	g->edgex[g->edges[i].pred + 1]++;
+    for (i = 0; i < g->nnodes; i++)
+	g->edgex[i + 1] += g->edgex[i];
+
+    memcpy(pos, g->edgex, (g->nnodes + 1) * sizeof(*pos));
+    for (i = 0; i < g->nedges; i++)
+	edges[pos[g->edges[i].pred]++] = g->edges[i];
+
+    free(g->edges);
+    g->edges = edges;
+    g->alloced = g->nedges;
+}
+
+/**
+ * Dependency loop member, with its no. of predecessors in the loop.
+ */
+struct loopMember_s {
+    int node;
+    int nprereqs;		/*!< no. of pre-requisite predecessors */
+    int nrequires;		/*!< no. of co-requisite predecessors */
+    int count;			/*!< no. of predecessors not yet ranked */
+    int pcount;			/*!< no. of those that are pre-requisites */
+    int rank;			/*!< position in the loop, -1 if unranked */
+    int queued;
+};
+
+/**
+ * Should a loop member rather be ranked next than another? The one with
+ * fewer unranked pre-requisite predecessors goes first, pre-requisites
+ * weighing more than any no. of co-requisites.
+ * @param a		1st loop member
+ * @param b		2nd loop member
+ * @return		1 if a goes before b, 0 otherwise
+ */
+static int loopMemberBefore(const struct loopMember_s * a,
+		const struct loopMember_s * b)
+{
+    if (a->pcount != b->pcount)
+	return (a->pcount < b->pcount);
+    if (a->count != b->count)
+	return (a->count < b->count);
+    return (a->node < b->node);
+}
+
+/**
+ * Break a dependency loop (strongly connected component). Members are
+ * ranked in dependency order, whenever every member left still has a
+ * predecessor in the loop the one with the fewest unranked (weighted)
+ * predecessors goes next. Relations against that ranking are removed,
+ * pre-requisites only if every member left had one.
+ * @param ts		transaction set
+ * @param g		dependency graph
+ * @param nodes		loop members
+ * @param n		no. of loop members
+ * @param pos		(scratch) member index by node
+ * @return		no. of relations removed
+ */
+static int breakLoop(rpmts ts, tsortGraph g, const int * nodes, int n,
+		int * pos)
+{
+    int msglvl = (rpmtsFlags(ts) & RPMTRANS_FLAG_DEPLOOPS)
+		? RPMLOG_WARNING : RPMLOG_DEBUG;
+    int loop = g->scc[nodes[0]];
+    rpmArena arena = rpmtsArena(ts);
+    struct loopMember_s * members = rpmArenaCalloc(arena, n, sizeof(*members));
+    int * queue = rpmArenaAlloc(arena, n * sizeof(*queue));
+    int head = 0, tail = 0;
+    int nranked = 0;
+    int nzaps = 0;
+    int i, k;
+
+    for (i = 0; i < n; i++) {
+	members[i].node = nodes[i];
+	members[i].rank = -1;
+	pos[nodes[i]] = i;
+    }
+
+    /* Count predecessors within the loop. */
+    for (i = 0; i < n; i++) {
+	for (k = g->edgex[nodes[i]]; k < g->edgex[nodes[i] + 1]; k++) {
+	    tsortEdge e = g->edges + k;
+	    struct loopMember_s * m;
+
+	    if (g->scc[e->suc] != loop)
+		continue;
+	    m = members + pos[e->suc];
+	    if (e->prereq) {
+		m->nprereqs++;
+		m->pcount++;
+	    } else
+		m->nrequires++;
+	    m->count++;
+	}
+    }
+
+    for (i = 0; i < n; i++) {
+	if (members[i].count != 0)
+	    continue;
+	members[i].queued = 1;
+	queue[tail++] = i;
+    }
+
+    while (nranked < n) {
+	struct loopMember_s * m;
+
+	if (head == tail) {
+	    int best = -1;
+
+	    /* Everything left has a predecessor, break the loop here. */
+	    for (i = 0; i < n; i++) {
+		if (members[i].queued)
+		    continue;
+		if (best < 0 || loopMemberBefore(members + i, members + best))
+		    best = i;
+	    }
+	    members[best].queued = 1;
+	    queue[tail++] = best;
+	}
+
+	m = members + queue[head++];
+	m->rank = nranked++;
+	for (k = g->edgex[m->node]; k < g->edgex[m->node + 1]; k++) {
+	    tsortEdge e = g->edges + k;
+	    struct loopMember_s * s;
+
+	    if (g->scc[e->suc] != loop)
+		continue;
+	    s = members + pos[e->suc];
+	    if (s->queued)
+		continue;
+	    if (e->prereq)
+		s->pcount--;
+	    if (--s->count == 0) {
+		s->queued = 1;
+		queue[tail++] = pos[e->suc];
+	    }
+	}
+    }
+
+    rpmlog(msglvl, _("LOOP:\n"));
+    for (i = 0; i < n; i++) {
+	struct loopMember_s * m = members + queue[i];
+	const char * nevra = rpmteNEVRA(ts->order[m->node]);
+	rpmlog(msglvl, "    %-40s %d/%d\n", (nevra ? nevra : "???"),
+		m->nprereqs, m->nrequires);
+    }
+
+    /* Remove the relations against the ranking. */
+    for (i = 0; i < n; i++) {
+	for (k = g->edgex[nodes[i]]; k < g->edgex[nodes[i] + 1]; k++) {
+	    tsortEdge e = g->edges + k;
+	    rpmte p = ts->order[e->suc];
+	    rpmds requires;
+	    const char * nevra;
+	    char * dp;
+
+	    if (g->scc[e->suc] != loop)
+		continue;
+	    if (members[pos[e->suc]].rank > members[i].rank)
+		continue;
+
+	    e->zapped = 1;
+	    rpmteTSI(p)->tsi_count--;
+	    nzaps++;
+
+	    requires = rpmteDS(p, RPMTAG_REQUIRENAME);
+	    (void) rpmdsSetIx(requires, e->reqx);
+	    dp = rpmdsNewDNEVR(identifyDepend(rpmdsFlags(requires)), requires);
+	    nevra = rpmteNEVRA(p);
+	    /* Pre-requisites only get here if every member left had one. */
+	    rpmlog((e->prereq ? RPMLOG_WARNING : msglvl),
+			_("removing %s \"%s\" from tsort relations.\n"),
+			(nevra ? nevra : "???"), (dp ? dp : "???"));
+	    dp = _free(dp);
+	}
+    }
+
+    return nzaps;
+}
+
+/**
+ * Find the dependency loops (strongly connected components with more than
+ * one member) with Tarjan's algorithm, and break each of them. Done once,
+ * without recursion, linear in the no. of relations.
+ * @param ts		transaction set
+ * @param g		dependency graph
+ * @return		no. of relations removed
+ */
+static int tsortLoops(rpmts ts, tsortGraph g)
+{
+    rpmArena arena = rpmtsArena(ts);
+    int n = g->nnodes;
+    /* DFS no. (0 unvisited) */
+    int * index = rpmArenaCalloc(arena, n + 1, sizeof(*index));
+    int * low = rpmArenaAlloc(arena, (n + 1) * sizeof(*low));
+    int * stack = rpmArenaAlloc(arena, (n + 1) * sizeof(*stack));
+    char * onstack = rpmArenaCalloc(arena, n + 1, sizeof(*onstack));
+    int * cnode = rpmArenaAlloc(arena, (n + 1) * sizeof(*cnode)); /* DFS path */
+    int * cedge = rpmArenaAlloc(arena, (n + 1) * sizeof(*cedge)); /* next edge */
+    int * pos = rpmArenaAlloc(arena, (n + 1) * sizeof(*pos));
+    int sp = 0, csp = 0;
+    int counter = 0;
+    int nzaps = 0;
+    int r, v, w, i;
+
+    for (r = 0; r < n; r++) {
+	if (index[r])
+	    continue;
+
+	index[r] = low[r] = ++counter;
+	stack[sp++] = r;
+	onstack[r] = 1;
+	cnode[csp] = r;
+	cedge[csp++] = g->edgex[r];
+
+	while (csp > 0) {
+	    int top;
+
+	    v = cnode[csp-1];
+	    if (cedge[csp-1] < g->edgex[v+1]) {
+		w = g->edges[cedge[csp-1]++].suc;
+		if (index[w] == 0) {
+		    index[w] = low[w] = ++counter;
+		    stack[sp++] = w;
+		    onstack[w] = 1;
+		    cnode[csp] = w;
+		    cedge[csp++] = g->edgex[w];
+		} else if (onstack[w] && index[w] < low[v])
+		    low[v] = index[w];
+		continue;
+	    }
+
+	    /* All successors of v are done, back to its predecessor. */
+	    csp--;
+	    if (csp > 0 && low[v] < low[cnode[csp-1]])
+		low[cnode[csp-1]] = low[v];
+	    if (low[v] != index[v])
+		continue;
+
+	    /* v is the root of a component, pop its members. */
+	    top = sp;
+	    do {
+		w = stack[--sp];
+		onstack[w] = 0;
+	    } while (w != v);
+	    if (top - sp < 2)
+		continue;
+
+	    g->nsccs++;
+	    for (i = sp; i < top; i++) {
+		g->scc[stack[i]] = g->nsccs;
+		(void) rpmteSetLoop(ts->order[stack[i]], g->nsccs);
+	    }
+	    nzaps += breakLoop(ts, g, stack + sp, top - sp, pos);
+	}
+    }
+
+    return nzaps;
 }
 
 /**
@@ -1045,20 +1270,21 @@ int rpmtsOrder(rpmts ts)
     rpmsenseFlags Flags;
     rpm_color_t prefcolor = rpmtsPrefColor(ts);
     rpmtsi pi; rpmte p;
-    rpmtsi qi; rpmte q;
-    rpmtsi ri; rpmte r;
+    rpmte q;
+    rpmte r;
     tsortInfo tsi;
-    tsortInfo tsi_next;
-    rpmalKey * ordering;
+    rpmArena arena = rpmtsArena(ts);
+    struct tsortGraph_s graph;
+    tsortGraph g = &graph;
+    int * ordering;
     int orderingCount = 0;
-    unsigned char *selected = xmalloc(sizeof(*selected) * (ts->orderCount + 1));
     int loopcheck;
     rpmte * newOrder;
     int newOrderCount = 0;
     orderListIndex orderList;
     int numOrderList;
     int npeer = 128;	/* XXX more than deep enough for now. */
-    int *peer = xcalloc(npeer, sizeof(*peer));
+    int *peer = rpmArenaCalloc(arena, npeer, sizeof(*peer));
     int _printed = 0;
     char deptypechar;
     rpm_loff_t tsbytes;
@@ -1067,7 +1293,8 @@ int rpmtsOrder(rpmts ts)
     int depth;
     int breadth;
     int qlen;
-    int i, j;
+    int nzaps;
+    int i, j, k;
     int rc;
 
     /*
@@ -1088,27 +1315,51 @@ int rpmtsOrder(rpmts ts)
 	if (oType & TR_REMOVED)
 	    numOrderList += ts->numRemovedPackages;
      }
-    ordering = xmalloc(sizeof(*ordering) * (numOrderList + 1));
+    ordering = rpmArenaAlloc(arena, sizeof(*ordering) * (numOrderList + 1));
     loopcheck = numOrderList;
     tsbytes = 0;
 
+    /* Index elements by added package key, for looking up relations. */
+    orderList = rpmArenaCalloc(arena, numOrderList + 1, sizeof(*orderList));
+    j = 0;
     pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, oType)) != NULL)
+    while ((p = rpmtsiNext(pi, oType)) != NULL) {
 	rpmteNewTSI(p);
+	rpmteTSI(p)->tsi_node = rpmtsiOc(pi);
+	(void) rpmteSetLoop(p, 0);
+
+	switch (rpmteType(p)) {
+	case TR_ADDED:
+	    orderList[j].pkgKey = rpmteAddedKey(p);
+	    break;
+	case TR_REMOVED:
+	    orderList[j].pkgKey = RPMAL_NOMATCH;
+	    break;
+	}
+	orderList[j].orIndex = rpmtsiOc(pi);
+	j++;
+    }
     pi = rpmtsiFree(pi);
+    qsort(orderList, numOrderList, sizeof(*orderList), orderListIndexCmp);
+
+    memset(g, 0, sizeof(*g));
+    g->nnodes = ts->orderCount;
+    g->keys = orderList;
+    g->nkeys = numOrderList;
+    g->selected = rpmArenaCalloc(arena, g->nnodes + 1, sizeof(*g->selected));
+    g->scc = rpmArenaCalloc(arena, g->nnodes + 1, sizeof(*g->scc));
 
     /* Record all relations. */
     rpmlog(RPMLOG_DEBUG, "========== recording tsort relations\n");
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, oType)) != NULL) {
+	int pix = rpmtsiOc(pi);
 
 	if ((requires = rpmteDS(p, RPMTAG_REQUIRENAME)) == NULL)
 	    continue;
 
-	memset(selected, 0, sizeof(*selected) * ts->orderCount);
-
 	/* Avoid narcisstic relations. */
-	selected[rpmtsiOc(pi)] = 1;
+	g->selected[pix] = pix + 1;
 
 	/* T2. Next "q <- p" relation. */
 
@@ -1133,7 +1384,7 @@ int rpmtsOrder(rpmts ts)
 	    }
 
 	    /* T3. Record next "q <- p" relation (i.e. "p" requires "q"). */
-	    (void) addRelation(ts, p, selected, requires);
+	    (void) addRelation(ts, g, pix, p, requires, 1);
 
 	}
 
@@ -1160,11 +1411,12 @@ int rpmtsOrder(rpmts ts)
 	    }
 
 	    /* T3. Record next "q <- p" relation (i.e. "p" requires "q"). */
-	    (void) addRelation(ts, p, selected, requires);
+	    (void) addRelation(ts, g, pix, p, requires, 0);
 
 	}
     }
     pi = rpmtsiFree(pi);
+    tsortIndex(g, arena);
 
     /* Save predecessor count and mark tree roots. */
     treex = 0;
@@ -1189,11 +1441,15 @@ int rpmtsOrder(rpmts ts)
     pi = rpmtsiFree(pi);
     ts->ntrees = treex;
 
+    /* Break all dependency loops up front, the sort then never stalls. */
+    nzaps = tsortLoops(ts, g);
+    if (g->nsccs > 0)
+	rpmlog(RPMLOG_DEBUG, "========== %d loop(s), %d relation(s) removed\n",
+		g->nsccs, nzaps);
+
     /* T4. Scan for zeroes. */
     rpmlog(RPMLOG_DEBUG, "========== tsorting packages (order, #predecessors, #succesors, tree, depth, breadth)\n");
 
-rescan:
-    if (pi != NULL) pi = rpmtsiFree(pi);
     q = r = NULL;
     qlen = 0;
     pi = rpmtsiInit(ts);
@@ -1208,6 +1464,7 @@ rescan:
 
     /* T5. Output front of queue (T7. Remove from queue.) */
     for (; q != NULL; q = rpmteTSI(q)->tsi_suc) {
+	int qx = rpmteTSI(q)->tsi_node;
 
 	/* Mark the package as unqueued. */
 	rpmteTSI(q)->tsi_reqx = 0;
@@ -1244,26 +1501,19 @@ rescan:
 	(void) rpmteSetDegree(q, 0);
 	tsbytes += rpmtePkgFileSize(q);
 
-	switch (rpmteType(q)) {
-	case TR_ADDED:
-            ordering[orderingCount] = rpmteAddedKey(q);
-            break;
-	case TR_REMOVED:
-            ordering[orderingCount] = RPMAL_NOMATCH;
-            break;
-        }
+	ordering[orderingCount] = qx;
 	orderingCount++;
 	qlen--;
 	loopcheck--;
 
-	/* T6. Erase relations. */
-	tsi_next = rpmteTSI(q)->tsi_next;
-	rpmteTSI(q)->tsi_next = NULL;
-	while ((tsi = tsi_next) != NULL) {
-	    tsi_next = tsi->tsi_next;
-	    tsi->tsi_next = NULL;
-	    p = tsi->tsi_suc;
-	    if (p && (--rpmteTSI(p)->tsi_count) <= 0) {
+	/* T6. Erase relations (most recently recorded first). */
+	for (k = g->edgex[qx + 1] - 1; k >= g->edgex[qx]; k--) {
+	    tsortEdge e = g->edges + k;
+
+	    if (e->zapped)
+		continue;
+	    p = ts->order[e->suc];
+	    if ((--rpmteTSI(p)->tsi_count) <= 0) {
 
 		(void) rpmteSetTree(p, treex);
 		(void) rpmteSetDepth(p, depth+1);
@@ -1275,7 +1525,6 @@ rescan:
 		addQ(p, &rpmteTSI(q)->tsi_suc, &r, prefcolor);
 		qlen++;
 	    }
-	    tsi = _free(tsi);
 	}
 	if (!_printed && loopcheck == qlen && rpmteTSI(q)->tsi_suc != NULL) {
 	    _printed++;
@@ -1298,99 +1547,8 @@ rescan:
 	}
     }
 
-    /* T8. End of process. Check for loops. */
+    /* T8. End of process. All loops were broken, so this can't happen. */
     if (loopcheck != 0) {
-	int nzaps;
-
-	/* T9. Initialize predecessor chain. */
-	nzaps = 0;
-	qi = rpmtsiInit(ts);
-	while ((q = rpmtsiNext(qi, oType)) != NULL) {
-	    rpmteTSI(q)->tsi_chain = NULL;
-	    rpmteTSI(q)->tsi_reqx = 0;
-	    /* Mark packages already sorted. */
-	    if (rpmteTSI(q)->tsi_count == 0)
-		rpmteTSI(q)->tsi_count = -1;
-	}
-	qi = rpmtsiFree(qi);
-
-	/* T10. Mark all packages with their predecessors. */
-	qi = rpmtsiInit(ts);
-	while ((q = rpmtsiNext(qi, oType)) != NULL) {
-	    if ((tsi = rpmteTSI(q)->tsi_next) == NULL)
-		continue;
-	    rpmteTSI(q)->tsi_next = NULL;
-	    markLoop(tsi, q);
-	    rpmteTSI(q)->tsi_next = tsi;
-	}
-	qi = rpmtsiFree(qi);
-
-	/* T11. Print all dependency loops. */
-	ri = rpmtsiInit(ts);
-	while ((r = rpmtsiNext(ri, oType)) != NULL)
-	{
-	    int printed;
-
-	    printed = 0;
-
-	    /* T12. Mark predecessor chain, looking for start of loop. */
-	    for (q = rpmteTSI(r)->tsi_chain; q != NULL;
-		 q = rpmteTSI(q)->tsi_chain)
-	    {
-		if (rpmteTSI(q)->tsi_reqx)
-		    break;
-		rpmteTSI(q)->tsi_reqx = 1;
-	    }
-
-	    /* T13. Print predecessor chain from start of loop. */
-	    while ((p = q) != NULL && (q = rpmteTSI(p)->tsi_chain) != NULL) {
-		char * dp;
-		const char *nevra;
-		int msglvl = (rpmtsFlags(ts) & RPMTRANS_FLAG_DEPLOOPS)
-			? RPMLOG_WARNING : RPMLOG_DEBUG;
-;
-
-		/* Unchain predecessor loop. */
-		rpmteTSI(p)->tsi_chain = NULL;
-
-		if (!printed) {
-		    rpmlog(msglvl, _("LOOP:\n"));
-		    printed = 1;
-		}
-
-		/* Find (and destroy if co-requisite) "q <- p" relation. */
-		requires = rpmteDS(p, RPMTAG_REQUIRENAME);
-		requires = rpmdsInit(requires);
-		if (requires == NULL)
-		    continue;	/* XXX can't happen */
-		dp = zapRelation(q, p, requires, 1, &nzaps, msglvl);
-
-		/* Print next member of loop. */
-		nevra = rpmteNEVRA(p);
-		rpmlog(msglvl, "    %-40s %s\n", (nevra ? nevra : "???"),
-			(dp ? dp : "not found!?!"));
-
-		dp = _free(dp);
-	    }
-
-	    /* Walk (and erase) linear part of predecessor chain as well. */
-	    for (p = r, q = rpmteTSI(r)->tsi_chain; q != NULL;
-		 p = q, q = rpmteTSI(q)->tsi_chain)
-	    {
-		/* Unchain linear part of predecessor loop. */
-		rpmteTSI(p)->tsi_chain = NULL;
-		rpmteTSI(p)->tsi_reqx = 0;
-	    }
-	}
-	ri = rpmtsiFree(ri);
-
-	/* If a relation was eliminated, then continue sorting. */
-	/* XXX TODO: add control bit. */
-	if (nzaps) {
-	    rpmlog(RPMLOG_DEBUG, "========== continuing tsort ...\n");
-	    goto rescan;
-	}
-
 	/* Return no. of packages that could not be ordered. */
 	rpmlog(RPMLOG_ERR, _("rpmtsOrder failed, %d elements remain\n"),
 			loopcheck);
@@ -1410,41 +1568,11 @@ rescan:
      * the new package. This would be easier if we could sort the
      * addedPackages array, but we store indexes into it in various places.
      */
-    orderList = xcalloc(numOrderList, sizeof(*orderList));
-    j = 0;
-    pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, oType)) != NULL) {
-	/* Prepare added package ordering permutation. */
-	switch (rpmteType(p)) {
-	case TR_ADDED:
-	    orderList[j].pkgKey = rpmteAddedKey(p);
-	    break;
-	case TR_REMOVED:
-	    orderList[j].pkgKey = RPMAL_NOMATCH;
-	    break;
-	}
-	orderList[j].orIndex = rpmtsiOc(pi);
-	j++;
-    }
-    pi = rpmtsiFree(pi);
-
-    qsort(orderList, numOrderList, sizeof(*orderList), orderListIndexCmp);
-
     newOrder = xcalloc(ts->orderCount, sizeof(*newOrder));
     for (i = 0, newOrderCount = 0; i < orderingCount; i++)
     {
-	struct orderListIndex_s key;
-	orderListIndex needle;
-
-	key.pkgKey = ordering[i];
-	needle = bsearch(&key, orderList, numOrderList,
-				sizeof(key), orderListIndexCmp);
-	/* bsearch should never, ever fail */
-	if (needle == NULL)
-	    continue;
-
-	j = needle->orIndex;
-	if ((q = ts->order[j]) == NULL || needle->pkgKey == RPMAL_NOMATCH)
+	j = ordering[i];
+	if ((q = ts->order[j]) == NULL || rpmteType(q) == TR_REMOVED)
 	    continue;
 
 	newOrder[newOrderCount++] = q;
@@ -1462,26 +1590,235 @@ assert(newOrderCount == ts->orderCount);
     ts->order = _free(ts->order);
     ts->order = newOrder;
     ts->orderAlloced = ts->orderCount;
-    orderList = _free(orderList);
     rc = 0;
 
 exit:
     freeBadDeps();
-    free(selected);
-    free(peer);
-    free(ordering);
+    /* All of the graph (once indexed) is scratch in the arena. */
+    rpmArenaReset(arena);
 
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_ORDER), 0);
 
     return rc;
 }
 
+/**
+ * Check an added element: its requires and conflicts against installed and
+ * added packages, its provides against installed conflicts.
+ * @param ts		transaction set
+ * @param dbts		transaction set whose database is searched
+ * @param ps		problem set to report to
+ * @param p		added transaction element
+ * @param tscolor	color bits for transaction set (0 disables)
+ * @return		0 no problems found
+ */
+static int checkAddedElement(rpmts ts, rpmts dbts, rpmps ps, rpmte p,
+		rpm_color_t tscolor)
+{
+    rpmds provides;
+    int rc;
+
+    /* FIX: rpmts{A,O} can return null. */
+    rpmlog(RPMLOG_DEBUG, "========== +++ %s %s/%s 0x%x\n",
+	    rpmteNEVR(p), rpmteA(p), rpmteO(p), rpmteColor(p));
+    rc = checkPackageDeps(ts, dbts, ps, rpmteNEVRA(p),
+		    rpmteDS(p, RPMTAG_REQUIRENAME),
+		    rpmteDS(p, RPMTAG_CONFLICTNAME),
+		    NULL,
+		    tscolor, 1);
+    if (rc)
+	return rc;
+
+    provides = rpmteDS(p, RPMTAG_PROVIDENAME);
+    provides = rpmdsInit(provides);
+    if (provides != NULL)
+    while (rpmdsNext(provides) >= 0) {
+	const char * Name;
+
+	if ((Name = rpmdsN(provides)) == NULL)
+	    continue;	/* XXX can't happen */
+
+	/* Adding: check provides key against conflicts matches. */
+	if (!checkDependentConflicts(ts, dbts, ps, Name))
+	    continue;
+	return 1;
+    }
+    return 0;
+}
+
+#define	DEPCHECK_MIN_ELEMENTS	16	/* min. no. of elements per thread */
+
+/**
+ * Result of checking an added element in a thread.
+ */
+struct depCheckItem_s {
+    rpmps probs;		/*!< problems found */
+    rpmlogCapture log;		/*!< messages issued */
+    int rc;
+    int done;
+};
+
+/**
+ * Added elements being checked by a pool of threads.
+ */
+struct depCheck_s {
+    rpmts ts;
+    rpm_color_t tscolor;
+    rpmte * elements;		/*!< added elements, in order */
+    struct depCheckItem_s * items;	/*!< results, per element */
+    int nelements;
+    int next;			/*!< next element to check */
+    int failed;			/*!< a check went wrong, stop handing out */
+    pthread_mutex_t lock;
+};
+
+/**
+ * Check added elements until none are left.
+ * @param ts		transaction set of the thread (shared database)
+ * @param data		added elements being checked
+ */
+static void depCheckWorker(rpmts ts, void * data)
+{
+    struct depCheck_s * dc = data;
+    struct depCheckItem_s * item;
+    rpmte p;
+
+    while (1) {
+	(void) pthread_mutex_lock(&dc->lock);
+	if (dc->failed || dc->next >= dc->nelements) {
+	    (void) pthread_mutex_unlock(&dc->lock);
+	    break;
+	}
+	p = dc->elements[dc->next];
+	item = dc->items + dc->next++;
+	(void) pthread_mutex_unlock(&dc->lock);
+
+	item->probs = rpmpsCreate();
+	rpmlogCaptureBegin();
+	item->rc = checkAddedElement(dc->ts, ts, item->probs, p, dc->tscolor);
+	item->log = rpmlogCaptureEnd();
+	item->done = 1;
+
+	if (item->rc) {
+	    (void) pthread_mutex_lock(&dc->lock);
+	    dc->failed = 1;
+	    (void) pthread_mutex_unlock(&dc->lock);
+	}
+    }
+}
+
+/**
+ * Check dependencies of all added elements, on %{_depcheck_threads}
+ * threads when there are enough of them.
+ *
+ * The threads share the (indexed, from here on read only) added package
+ * set, and look installed packages up in the transaction's database with
+ * iterators (and cursors) of their own. Their problems and messages are
+ * merged in element order afterwards, so the result is the same as
+ * checking one element after the other.
+ * @param ts		transaction set
+ * @param tscolor	color bits for transaction set (0 disables)
+ * @return		0 no problems found
+ */
+static int checkAddedElements(rpmts ts, rpm_color_t tscolor)
+{
+    struct depCheck_s dc;
+    rpmtsPool pool = NULL;
+    rpmHdrCache hdrcache = NULL;
+    rpmdb db = rpmtsGetRdb(ts);
+    int nthreads;
+    rpmtsi pi;
+    rpmte p;
+    int rc = 0;
+    int i;
+
+    memset(&dc, 0, sizeof(dc));
+    dc.ts = ts;
+    dc.tscolor = tscolor;
+    dc.elements = xcalloc(rpmtsNElements(ts) + 1, sizeof(*dc.elements));
+    pi = rpmtsiInit(ts);
+    while ((p = rpmtsiNext(pi, TR_ADDED)) != NULL)
+	dc.elements[dc.nelements++] = p;
+    pi = rpmtsiFree(pi);
+
+    nthreads = rpmExpandThreads("%{?_depcheck_threads}");
+    if (nthreads > dc.nelements / DEPCHECK_MIN_ELEMENTS)
+	nthreads = dc.nelements / DEPCHECK_MIN_ELEMENTS;
+
+    /*
+     * The solve callback may change the transaction set as we go, and
+     * without a database (installer) there's little to win.
+     */
+    if (ts->solve != NULL && !(rpmtsFlags(ts) & RPMTRANS_FLAG_NOSUGGEST))
+	nthreads = 1;
+    if (db == NULL)
+	nthreads = 1;
+
+    if (nthreads <= 1) {
+	for (i = 0; i < dc.nelements; i++) {
+	    rc = checkAddedElement(ts, ts, ts->probs, dc.elements[i], tscolor);
+	    if (rc)
+		break;
+	}
+	goto exit;
+    }
+
+    /*
+     * Prime what the lookups initialize lazily (rpmlib provides, database
+     * indices and signature cache, which expand macros) before going
+     * parallel.
+     */
+    (void) pthread_mutex_lock(&rpmlibLock);
+    rpmlibLoad();
+    (void) pthread_mutex_unlock(&rpmlibLock);
+    (void) dbiOpen(db, RPMDBI_PACKAGES, 0);
+    (void) dbiOpen(db, RPMTAG_BASENAMES, 0);
+    (void) dbiOpen(db, RPMTAG_PROVIDENAME, 0);
+    (void) dbiOpen(db, RPMTAG_CONFLICTNAME, 0);
+    (void) rpmdbSigCache(db);
+
+    dc.items = xcalloc(dc.nelements, sizeof(*dc.items));
+    (void) pthread_mutex_init(&dc.lock, NULL);
+    hdrcache = rpmdbHeaderCacheSuspend(db);
+    /*
+     * Only pool threads check while the pool runs: their private sets
+     * don't use the (unlocked) RPMDBI_DEPENDS cache of the transaction.
+     * If no thread could start, this one checks with the cache.
+     */
+    pool = rpmtsPoolStart(ts, nthreads, 1, depCheckWorker, &dc);
+    if (pool == NULL)
+	depCheckWorker(ts, &dc);
+    pool = rpmtsPoolFree(pool);
+    (void) pthread_mutex_destroy(&dc.lock);
+    rpmdbHeaderCacheResume(db, hdrcache);
+
+    /* Merge in element order, up to the first element that went wrong. */
+    for (i = 0; i < dc.nelements; i++) {
+	struct depCheckItem_s * item = dc.items + i;
+
+	if (rc == 0 && item->done) {
+	    item->log = rpmlogCaptureFlush(item->log);
+	    (void) rpmpsMerge(ts->probs, item->probs);
+	    rc = item->rc;
+	} else {
+	    item->log = rpmlogCaptureFree(item->log);
+	}
+	item->probs = rpmpsFree(item->probs);
+    }
+    dc.items = _free(dc.items);
+
+exit:
+    dc.elements = _free(dc.elements);
+    return rc;
+}
+
 int rpmtsCheck(rpmts ts)
 {
     rpm_color_t tscolor = rpmtsColor(ts);
     rpmdbMatchIterator mi = NULL;
     rpmtsi pi = NULL; rpmte p;
     int closeatexit = 0;
+    int hdrcache = 0;
     int xx;
     int rc;
 
@@ -1494,6 +1831,9 @@ int rpmtsCheck(rpmts ts)
 	closeatexit = 1;
     }
 
+    /* Installed headers matched repeatedly are decoded only once. */
+    hdrcache = rpmdbHeaderCacheBegin(rpmtsGetRdb(ts));
+
     ts->probs = rpmpsFree(ts->probs);
     ts->probs = rpmpsCreate();
 
@@ -1503,41 +1843,9 @@ int rpmtsCheck(rpmts ts)
      * Look at all of the added packages and make sure their dependencies
      * are satisfied.
      */
-    pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, TR_ADDED)) != NULL) {
-	rpmds provides;
-
-	/* FIX: rpmts{A,O} can return null. */
-	rpmlog(RPMLOG_DEBUG, "========== +++ %s %s/%s 0x%x\n",
-		rpmteNEVR(p), rpmteA(p), rpmteO(p), rpmteColor(p));
-	rc = checkPackageDeps(ts, rpmteNEVRA(p),
-			rpmteDS(p, RPMTAG_REQUIRENAME),
-			rpmteDS(p, RPMTAG_CONFLICTNAME),
-			NULL,
-			tscolor, 1);
-	if (rc)
-	    goto exit;
-
-	rc = 0;
-	provides = rpmteDS(p, RPMTAG_PROVIDENAME);
-	provides = rpmdsInit(provides);
-	if (provides != NULL)
-	while (rpmdsNext(provides) >= 0) {
-	    const char * Name;
-
-	    if ((Name = rpmdsN(provides)) == NULL)
-		continue;	/* XXX can't happen */
-
-	    /* Adding: check provides key against conflicts matches. */
-	    if (!checkDependentConflicts(ts, Name))
-		continue;
-	    rc = 1;
-	    break;
-	}
-	if (rc)
-	    goto exit;
-    }
-    pi = rpmtsiFree(pi);
+    rc = checkAddedElements(ts, tscolor);
+    if (rc)
+	goto exit;
 
     /*
      * Look at the removed packages and make sure they aren't critical.
@@ -1595,6 +1903,8 @@ exit:
 
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_CHECK), 0);
 
+    if (hdrcache)
+	rpmdbHeaderCacheEnd(rpmtsGetRdb(ts));
     if (closeatexit)
 	xx = rpmtsCloseDB(ts);
     else if (_cacheDependsRC)
@@ -26,21 +26,48 @@
 fingerPrintCache fpCacheCreate(int sizeHint)
 {
     fingerPrintCache fpc;
+    int i;
 
     fpc = xmalloc(sizeof(*fpc));
-    fpc->ht = rpmFpEntryHashCreate(sizeHint, hashFunctionString, strcmp,
-				   (rpmFpEntryHashFreeKey)free,
-				   (rpmFpEntryHashFreeData)free);
+    for (i = 0; i < FPCACHE_SHARDS; i++) {
+	struct fprintCacheShard_s * shard = fpc->shards + i;
+	(void) pthread_mutex_init(&shard->lock, NULL);
+	shard->ht = rpmFpEntryHashCreate(sizeHint / FPCACHE_SHARDS + 1,
+				   hashFunctionString, strcmp, NULL, NULL);
+	/* Lookups of a single file (rpmdbFindByFile) need little memory. */
+	shard->arena = rpmArenaNew(sizeHint < 1024 ? 256 : 0);
+    }
     return fpc;
 }
 
 fingerPrintCache fpCacheFree(fingerPrintCache cache)
 {
-    cache->ht = rpmFpEntryHashFree(cache->ht);
+    int i;
+
+    for (i = 0; i < FPCACHE_SHARDS; i++) {
+	struct fprintCacheShard_s * shard = cache->shards + i;
+	shard->ht = rpmFpEntryHashFree(shard->ht);
+	shard->arena = rpmArenaFree(shard->arena);
+	(void) pthread_mutex_destroy(&shard->lock);
+    }
     free(cache);
     return NULL;
 }
 
+/**
+ * Return the cache shard of a directory name.
+ * The top bits of the hash pick the shard, the low ones the bucket in it.
+ * @param cache		pointer to fingerprint cache
+ * @param dirName	directory name
+ * @return		cache shard
+ */
+static struct fprintCacheShard_s * cacheShard(fingerPrintCache cache,
+			    const char * dirName)
+{
+    unsigned int hash = hashFunctionString(dirName);
+    return cache->shards + ((hash >> 28) % FPCACHE_SHARDS);
+}
+
 /**
  * Find directory name entry in cache.
  * @param cache		pointer to fingerprint cache
@@ -53,11 +80,45 @@ static const struct fprintCacheEntry_s * cacheContainsDirectory(
 {
     const struct fprintCacheEntry_s ** data;
 
-    if (rpmFpEntryHashGetEntry(cache->ht, dirName, &data, NULL, NULL))
+    if (rpmFpEntryHashGetEntry(cacheShard(cache, dirName)->ht, dirName,
+				&data, NULL, NULL))
 	return data[0];
     return NULL;
 }
 
+/**
+ * Add directory name entry to cache, unless another thread beat us to it.
+ * The entry is allocated from the arena of its shard.
+ * @param cache		pointer to fingerprint cache
+ * @param dirName	directory name
+ * @param sb		stat(2) of directory
+ * @return		the cached directory name entry
+ */
+static const struct fprintCacheEntry_s * cacheAddDirectory(
+			    fingerPrintCache cache,
+			    const char * dirName, const struct stat * sb)
+{
+    struct fprintCacheShard_s * shard = cacheShard(cache, dirName);
+    const struct fprintCacheEntry_s ** data;
+    const struct fprintCacheEntry_s * entry;
+
+    (void) pthread_mutex_lock(&shard->lock);
+    if (rpmFpEntryHashGetEntry(shard->ht, dirName, &data, NULL, NULL)) {
+	entry = data[0];
+    } else {
+	struct fprintCacheEntry_s * newEntry =
+		rpmArenaAlloc(shard->arena, sizeof(*newEntry));
+	newEntry->ino = sb->st_ino;
+	newEntry->dev = sb->st_dev;
+	newEntry->dirName = rpmArenaStrdup(shard->arena, dirName);
+	rpmFpEntryHashAddEntry(shard->ht, newEntry->dirName, newEntry);
+	entry = newEntry;
+    }
+    (void) pthread_mutex_unlock(&shard->lock);
+
+    return entry;
+}
+
 /**
  * Return finger print of a file path.
  * @param cache		pointer to fingerprint cache
@@ -144,14 +205,7 @@ fingerPrint fpLookup(fingerPrintCache cache,
 	if (cacheHit != NULL) {
 	    fp.entry = cacheHit;
 	} else if (!stat((*buf != '\0' ? buf : "/"), &sb)) {
-	    struct fprintCacheEntry_s * newEntry = xmalloc(sizeof(* newEntry));
-
-	    newEntry->ino = sb.st_ino;
-	    newEntry->dev = sb.st_dev;
-	    newEntry->dirName = xstrdup((*buf != '\0' ? buf : "/"));
-	    fp.entry = newEntry;
-
-	    rpmFpEntryHashAddEntry(cache->ht, newEntry->dirName, fp.entry);
+	    fp.entry = cacheAddDirectory(cache, (*buf != '\0' ? buf : "/"), &sb);
 	}
 
         if (fp.entry) {
@@ -6,9 +6,11 @@
  * Identify a file name path by a unique "finger print".
  */
 
+#include <pthread.h>
 #include <rpm/header.h>
 #include <rpm/rpmte.h>
 #include "lib/rpmdb_internal.h"
+#include "rpmio/rpmio_internal.h"	/* rpmArena */
 
 /**
  */
@@ -49,11 +51,20 @@ struct fprintCacheEntry_s {
     ino_t ino;				/*!< stat(2) inode number */
 };
 
+/** Number of (separately locked) finger print cache shards. */
+#define	FPCACHE_SHARDS	16
+
 /**
  * Finger print cache.
+ * Lookups need no locking, adding a directory locks only its shard, so
+ * the cache can be shared by threads fingerprinting different packages.
  */
 struct fprintCache_s {
-    rpmFpEntryHash ht;			/*!< hashed by dirName */
+    struct fprintCacheShard_s {
+	pthread_mutex_t lock;		/*!< serializes additions */
+	rpmFpEntryHash ht;		/*!< hashed by dirName */
+	rpmArena arena;			/*!< entries (freed with the cache) */
+    } shards[FPCACHE_SHARDS];
 };
 
 /* Create new hash table data type */
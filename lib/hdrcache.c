@@ -0,0 +1,272 @@
+/** \ingroup rpmdb
+ * \file lib/hdrcache.c
+ * Transaction scoped cache of headers (and their file info) read from
+ * the database.
+ *
+ * The same installed headers get looked up over and over during a
+ * transaction: by file name when computing file dispositions, by name
+ * for triggers and dependencies, by instance when marking replaced files.
+ * While a cache is active, database iterators return the header decoded
+ * the first time instead of loading it again, and the file info built
+ * from it is kept alongside. The cache is bounded by (approximate) size,
+ * least recently used entries are dropped first.
+ */
+
+#include "system.h"
+
+#include <pthread.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmfi.h>
+#include <rpm/rpmmacro.h>
+#include <rpm/rpmlog.h>
+
+#include "lib/rpmdb_internal.h"
+#include "debug.h"
+
+#define	FI_FILE_BYTES	64	/* approx. size of rpmfi data per file */
+
+typedef struct hdrCacheEntry_s * hdrCacheEntry;
+
+struct hdrCacheEntry_s {
+    unsigned int hdrNum;	/*!< header instance */
+    Header h;
+    rpmfi fi;			/*!< file info (built on demand) */
+    size_t size;		/*!< approx. size of the entry */
+    hdrCacheEntry prev;		/*!< more recently used */
+    hdrCacheEntry next;		/*!< less recently used */
+};
+
+static unsigned int entryHash(hdrCacheEntry e)
+{
+    return e->hdrNum;
+}
+
+static int entryCmp(hdrCacheEntry e1, hdrCacheEntry e2)
+{
+    return (e1->hdrNum != e2->hdrNum);
+}
+
+static hdrCacheEntry entryFree(hdrCacheEntry e)
+{
+    if (e) {
+	e->fi = rpmfiFree(e->fi);
+	e->h = headerFree(e->h);
+	free(e);
+    }
+    return NULL;
+}
+
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+#define HASHTYPE hdrCacheMap
+#define HTKEYTYPE hdrCacheEntry
+#define HTDATATYPE hdrCacheEntry
+#include "lib/rpmhash.H"
+#include "lib/rpmhash.C"
+
+struct rpmHdrCache_s {
+    pthread_mutex_t lock;
+    hdrCacheMap map;		/*!< hdrNum -> entry */
+    hdrCacheEntry head;		/*!< most recently used */
+    hdrCacheEntry tail;		/*!< least recently used */
+    size_t size;		/*!< approx. size of all entries */
+    size_t maxsize;
+    unsigned int hits;
+    unsigned int misses;
+};
+
+static void lruUnlink(rpmHdrCache cache, hdrCacheEntry e)
+{
+    if (e->prev) e->prev->next = e->next; else cache->head = e->next;
+    if (e->next) e->next->prev = e->prev; else cache->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lruPush(rpmHdrCache cache, hdrCacheEntry e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head) cache->head->prev = e; else cache->tail = e;
+    cache->head = e;
+}
+
+static hdrCacheEntry lookup(rpmHdrCache cache, unsigned int hdrNum)
+{
+    struct hdrCacheEntry_s key;
+    hdrCacheEntry * data = NULL;
+
+    key.hdrNum = hdrNum;
+    if (!hdrCacheMapGetEntry(cache->map, &key, &data, NULL, NULL))
+	return NULL;
+    return data[0];
+}
+
+static void drop(rpmHdrCache cache, hdrCacheEntry e)
+{
+    lruUnlink(cache, e);
+    cache->size -= e->size;
+    /* The map owns the entries. */
+    (void) hdrCacheMapDelEntry(cache->map, e);
+}
+
+/* Drop least recently used entries, except keep, until within bounds. */
+static void shrink(rpmHdrCache cache, hdrCacheEntry keep)
+{
+    while (cache->size > cache->maxsize && cache->tail && cache->tail != keep)
+	drop(cache, cache->tail);
+}
+
+rpmHdrCache rpmHdrCacheNew(size_t maxsize)
+{
+    rpmHdrCache cache = xcalloc(1, sizeof(*cache));
+
+    (void) pthread_mutex_init(&cache->lock, NULL);
+    cache->map = hdrCacheMapCreate(1021, entryHash, entryCmp, NULL, entryFree);
+    cache->maxsize = maxsize;
+    return cache;
+}
+
+Header rpmHdrCacheGet(rpmHdrCache cache, unsigned int hdrNum)
+{
+    hdrCacheEntry e;
+    Header h = NULL;
+
+    if (cache == NULL)
+	return NULL;
+
+    (void) pthread_mutex_lock(&cache->lock);
+    if ((e = lookup(cache, hdrNum)) != NULL) {
+	lruUnlink(cache, e);
+	lruPush(cache, e);
+	h = headerLink(e->h);
+	cache->hits++;
+    } else {
+	cache->misses++;
+    }
+    (void) pthread_mutex_unlock(&cache->lock);
+    return h;
+}
+
+void rpmHdrCachePut(rpmHdrCache cache, unsigned int hdrNum, Header h,
+		size_t size)
+{
+    hdrCacheEntry e;
+
+    if (cache == NULL || h == NULL || hdrNum == 0)
+	return;
+
+    (void) pthread_mutex_lock(&cache->lock);
+    if ((e = lookup(cache, hdrNum)) != NULL)
+	drop(cache, e);
+    e = xcalloc(1, sizeof(*e));
+    e->hdrNum = hdrNum;
+    e->h = headerLink(h);
+    e->size = sizeof(*e) + size;
+    hdrCacheMapAddEntry(cache->map, e, e);
+    lruPush(cache, e);
+    cache->size += e->size;
+    shrink(cache, e);
+    (void) pthread_mutex_unlock(&cache->lock);
+}
+
+void rpmHdrCacheDel(rpmHdrCache cache, unsigned int hdrNum)
+{
+    hdrCacheEntry e;
+
+    if (cache == NULL)
+	return;
+
+    (void) pthread_mutex_lock(&cache->lock);
+    if ((e = lookup(cache, hdrNum)) != NULL)
+	drop(cache, e);
+    (void) pthread_mutex_unlock(&cache->lock);
+}
+
+rpmfi rpmHdrCacheFI(rpmHdrCache cache, rpmts ts, Header h)
+{
+    unsigned int hdrNum = headerGetInstance(h);
+    hdrCacheEntry e;
+    rpmfi fi = NULL;
+    int cached = 0;
+
+    if (cache == NULL || hdrNum == 0)
+	return rpmfiNew(ts, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
+
+    (void) pthread_mutex_lock(&cache->lock);
+    /* Only the cached header itself gets its file info cached. */
+    if ((e = lookup(cache, hdrNum)) != NULL && e->h == h) {
+	if (e->fi == NULL) {
+	    e->fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
+	    if (e->fi != NULL) {
+		size_t fisize = rpmfiFC(e->fi) * FI_FILE_BYTES;
+		e->size += fisize;
+		cache->size += fisize;
+	    }
+	}
+	fi = rpmfiLink(e->fi, RPMDBG_M("rpmHdrCacheFI"));
+	shrink(cache, e);
+	cached = 1;
+    }
+    (void) pthread_mutex_unlock(&cache->lock);
+
+    if (!cached)
+	fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
+    return fi;
+}
+
+rpmHdrCache rpmHdrCacheFree(rpmHdrCache cache)
+{
+    if (cache) {
+	rpmlog(RPMLOG_DEBUG, "header cache: %u hits, %u misses, %zu bytes\n",
+		cache->hits, cache->misses, cache->size);
+	cache->map = hdrCacheMapFree(cache->map);
+	(void) pthread_mutex_destroy(&cache->lock);
+	free(cache);
+    }
+    return NULL;
+}
+
+int rpmdbHeaderCacheBegin(rpmdb db)
+{
+    int kb;
+
+    if (db == NULL || db->db_hdrcache != NULL)
+	return 0;
+    kb = rpmExpandNumeric("%{?_rpmdb_header_cache}");
+    if (kb <= 0)
+	return 0;
+    db->db_hdrcache = rpmHdrCacheNew((size_t) kb * 1024);
+    return 1;
+}
+
+void rpmdbHeaderCacheEnd(rpmdb db)
+{
+    if (db != NULL)
+	db->db_hdrcache = rpmHdrCacheFree(db->db_hdrcache);
+}
+
+rpmHdrCache rpmdbHeaderCacheSuspend(rpmdb db)
+{
+    rpmHdrCache cache = NULL;
+
+    if (db != NULL) {
+	cache = db->db_hdrcache;
+	db->db_hdrcache = NULL;
+    }
+    return cache;
+}
+
+void rpmdbHeaderCacheResume(rpmdb db, rpmHdrCache cache)
+{
+    if (db != NULL && db->db_hdrcache == NULL)
+	db->db_hdrcache = cache;
+    else
+	cache = rpmHdrCacheFree(cache);
+}
+
+rpmfi rpmdbHeaderFI(rpmdb db, rpmts ts, Header h)
+{
+    return rpmHdrCacheFI((db ? db->db_hdrcache : NULL), ts, h);
+}
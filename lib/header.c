@@ -228,7 +228,7 @@ unsigned headerSizeof(Header h, enum hMagic magicp)
     unsigned int pad = 0;
     int i;
 
-    if (h == NULL)
+    if (h == NULL || headerMaterialize(h))
 	return size;
 
     headerSort(h);
@@ -363,13 +363,14 @@ static int dataLength(rpmTagType type, rpm_constdata_t p, rpm_count_t count,
  * @param dataStart	header data start
  * @param dataEnd	header data end
  * @param regionid	region offset
+ * @param swab		perform endian conversions (0 if already done)?
  * @return		no. bytes of data in region, -1 on error
  */
 static int regionSwab(indexEntry entry, int il, int dl,
 		entryInfo pe,
 		unsigned char * dataStart,
 		const unsigned char * dataEnd,
-		int regionid)
+		int regionid, int swab)
 {
     unsigned char * tprev = NULL;
     unsigned char * t = NULL;
@@ -437,6 +438,9 @@ static int regionSwab(indexEntry entry, int il, int dl,
 	}
 
 	/* Perform endian conversions */
+	if (!swab) {
+	    t += ie.length;
+	} else
 	switch (ntohl(pe->type)) {
 	case RPM_INT64_TYPE:
 	{   uint64_t * it = (uint64_t *)t;
@@ -489,6 +493,73 @@ static int regionSwab(indexEntry entry, int il, int dl,
     return dl;
 }
 
+/** \ingroup header
+ * Swab and validate a single entry of a lazily loaded header.
+ * Unmaterialized entries carry only their tag and the region offset,
+ * the position of their entryInfo in the header blob is kept in rdlen.
+ * @param h		header
+ * @param entry		header entry to materialize
+ * @return		0 on success, -1 on error
+ */
+static int indexFill(Header h, indexEntry entry)
+{
+    int32_t * ei = h->blob;
+    int32_t il = ntohl(ei[0]);
+    int32_t dl = ntohl(ei[1]);
+    entryInfo pe = (entryInfo) &ei[2];
+    unsigned char * dataStart = (unsigned char *) (pe + il);
+    struct indexEntry_s ie;
+
+    if (entry->data != NULL)
+	return 0;
+
+    if (regionSwab(&ie, 1, 0, pe + entry->rdlen, dataStart, dataStart + dl,
+		   entry->info.offset, 1) < 0)
+	return -1;
+    *entry = ie;	/* structure assignment */
+    return 0;
+}
+
+int headerMaterialize(Header h)
+{
+    int32_t * ei;
+    int32_t il, dl;
+    entryInfo pe;
+    unsigned char * dataStart;
+    indexEntry entry, region = NULL;
+    int i, rdlen;
+
+    if (!(h->flags & HEADERFLAG_LAZY))
+	return 0;
+
+    ei = h->blob;
+    il = ntohl(ei[0]);
+    dl = ntohl(ei[1]);
+    pe = (entryInfo) &ei[2];
+    dataStart = (unsigned char *) (pe + il);
+
+    for (i = 0, entry = h->index; i < h->indexUsed; i++, entry++) {
+	if (ENTRY_IS_REGION(entry) && entry->data == pe) {
+	    region = entry;
+	    continue;
+	}
+	if (indexFill(h, entry))
+	    return -1;
+    }
+    if (region == NULL)
+	return -1;
+
+    /* All data is in host order now, only (re-)compute the region size. */
+    rdlen = regionSwab(NULL, il-1, 0, pe+1, dataStart, dataStart + dl,
+			region->info.offset, 0);
+    if (rdlen < 0)
+	return -1;
+    region->rdlen = rdlen;
+
+    h->flags &= ~HEADERFLAG_LAZY;
+    return 0;
+}
+
 /** \ingroup header
  * doHeaderUnload.
  * @param h		header
@@ -513,6 +584,9 @@ static void * doHeaderUnload(Header h,
     int driplen, ndrips;
     int legacy = 0;
 
+    if (headerMaterialize(h))
+	goto errxit;
+
     /* Sort entries by (offset,tag). */
     headerUnsort(h);
 
@@ -636,7 +710,7 @@ static void * doHeaderUnload(Header h,
 		ril++;
 		rdlen += entry->info.count;
 
-		count = regionSwab(NULL, ril, 0, pe, t, NULL, 0);
+		count = regionSwab(NULL, ril, 0, pe, t, NULL, 0, 1);
 		if (count != rdlen)
 		    goto errxit;
 
@@ -652,7 +726,7 @@ static void * doHeaderUnload(Header h,
 		}
 		te += entry->info.count + drlen;
 
-		count = regionSwab(NULL, ril, 0, pe, t, NULL, 0);
+		count = regionSwab(NULL, ril, 0, pe, t, NULL, 0, 1);
 		if (count != (rdlen + entry->info.count + drlen))
 		    goto errxit;
 	    }
@@ -775,6 +849,23 @@ indexEntry findEntry(Header h, rpmTag tag, rpmTagType type)
     if (entry == NULL)
 	return NULL;
 
+    /* Materialize the tag (all of its entries) on first access. */
+    if (h->flags & HEADERFLAG_LAZY) {
+	if (ENTRY_IS_REGION(entry)) {
+	    if (headerMaterialize(h))
+		return NULL;
+	} else {
+	    while (entry > h->index && (entry - 1)->info.tag == tag)
+		entry--;
+	    for (last = h->index + h->indexUsed;
+		 entry < last && entry->info.tag == tag; entry++) {
+		if (indexFill(h, entry))
+		    return NULL;
+	    }
+	    entry = entry2;
+	}
+    }
+
     if (type == RPM_NULL_TYPE)
 	return entry;
 
@@ -833,7 +924,13 @@ int headerDel(Header h, rpmTag tag)
     return 0;
 }
 
-Header headerLoad(void * uh)
+/** \ingroup header
+ * Convert header blob into header, swabbing entries now or on demand.
+ * @param uh		on-disk header blob (i.e. with no header magic)
+ * @param lazy		defer swab and validation of region entries?
+ * @return		header
+ */
+static Header doHeaderLoad(void * uh, int lazy)
 {
     int32_t * ei = (int32_t *) uh;
     int32_t il = ntohl(ei[0]);		/* index length */
@@ -879,7 +976,7 @@ Header headerLoad(void * uh)
 
 	entry->data = pe;
 	entry->length = pvlen - sizeof(il) - sizeof(dl);
-	rdlen = regionSwab(entry+1, il, 0, pe, dataStart, dataEnd, entry->info.offset);
+	rdlen = regionSwab(entry+1, il, 0, pe, dataStart, dataEnd, entry->info.offset, 1);
 #if 0	/* XXX don't check, the 8/98 i18n bug fails here. */
 	if (rdlen != dl)
 	    goto errxit;
@@ -925,7 +1022,27 @@ Header headerLoad(void * uh)
 
 	entry->data = pe;
 	entry->length = pvlen - sizeof(il) - sizeof(dl);
-	rdlen = regionSwab(entry+1, ril-1, 0, pe+1, dataStart, dataEnd, entry->info.offset);
+
+	/* Without dribbles, only the tags are needed to look up entries. */
+	if (lazy && ril == il) {
+	    int sorted = 1;
+
+	    for (i = 1; i < ril; i++) {
+		entry[i].info.tag = ntohl(pe[i].tag);
+		entry[i].info.offset = entry->info.offset;
+		entry[i].rdlen = i;	/* entryInfo position in blob */
+		if (entry[i].info.tag < entry[i-1].info.tag)
+		    sorted = 0;
+	    }
+	    h->flags |= HEADERFLAG_LAZY;
+	    if (!sorted) {
+		h->flags &= ~HEADERFLAG_SORTED;
+		headerSort(h);
+	    }
+	    return h;
+	}
+
+	rdlen = regionSwab(entry+1, ril-1, 0, pe+1, dataStart, dataEnd, entry->info.offset, 1);
 	if (rdlen < 0)
 	    goto errxit;
 	entry->rdlen = rdlen;
@@ -937,7 +1054,7 @@ Header headerLoad(void * uh)
 	    int rc;
 
 	    /* Load dribble entries from region. */
-	    rc = regionSwab(newEntry, ne, 0, pe+ril, dataStart, dataEnd, rid);
+	    rc = regionSwab(newEntry, ne, 0, pe+ril, dataStart, dataEnd, rid, 1);
 	    if (rc < 0)
 		goto errxit;
 	    rdlen += rc;
@@ -977,6 +1094,16 @@ errxit:
     return h;
 }
 
+Header headerLoad(void * uh)
+{
+    return doHeaderLoad(uh, 0);
+}
+
+Header headerLoadLazy(void * uh)
+{
+    return doHeaderLoad(uh, 1);
+}
+
 Header headerReload(Header h, rpmTag tag)
 {
     Header nh;
@@ -1182,7 +1309,7 @@ static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
 
 	    dataStart = (unsigned char *) memcpy(pe + ril, dataStart, rdl);
 
-	    rc = regionSwab(NULL, ril, 0, pe, dataStart, dataStart + rdl, 0);
+	    rc = regionSwab(NULL, ril, 0, pe, dataStart, dataStart + rdl, 0, 1);
 	    /* XXX 1 on success. */
 	    rc = (rc < 0) ? 0 : 1;
 	} else {
@@ -1882,6 +2009,8 @@ HeaderIterator headerInitIterator(Header h)
 {
     HeaderIterator hi = xmalloc(sizeof(*hi));
 
+    /* XXX entries that fail to materialize are skipped by headerNext() */
+    (void) headerMaterialize(h);
     headerSort(h);
 
     hi->h = headerLink(h);
@@ -1901,7 +2030,7 @@ int headerNext(HeaderIterator hi, rpmtd td)
 
     for (slot = hi->next_index; slot < h->indexUsed; slot++) {
 	entry = h->index + slot;
-	if (!ENTRY_IS_REGION(entry))
+	if (!ENTRY_IS_REGION(entry) && entry->data != NULL)
 	    break;
     }
     hi->next_index = slot;
@@ -285,6 +285,41 @@ int headerDel(Header h, rpmTag tag);
  */
 char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg);
 
+/** \ingroup header
+ * Compiled header format.
+ */
+typedef struct headerFmt_s * headerFmt;
+
+/** \ingroup header
+ * Compile a format for repeated use with headerFormatExec().
+ * Parsing and tag name lookups are done only once, and only the tags
+ * referenced by the format are retrieved from each header.
+ *
+ * @param fmt		format to use
+ * @retval errmsg	error message (if any)
+ * @return		compiled format (NULL on error)
+ */
+headerFmt headerFormatCompile(const char * fmt, errmsg_t * errmsg);
+
+/** \ingroup header
+ * Return formatted output string from header tags using a compiled format.
+ * The returned string is owned by the compiled format and is only valid
+ * until the next headerFormatExec() or headerFormatFree() call on it.
+ *
+ * @param hf		compiled format
+ * @param h		header
+ * @retval errmsg	error message (if any)
+ * @return		formatted output string (NULL on error)
+ */
+const char * headerFormatExec(headerFmt hf, Header h, errmsg_t * errmsg);
+
+/** \ingroup header
+ * Destroy a compiled format.
+ * @param hf		compiled format
+ * @return		NULL always
+ */
+headerFmt headerFormatFree(headerFmt hf);
+
 /** \ingroup header
  * Duplicate tag values from one header into another.
  * @param headerFrom	source header
@@ -44,6 +44,9 @@ void headerDump(Header h, FILE *f, int flags)
     const char * tag;
     const char * type;
 
+    if (headerMaterialize(h))
+	return;
+
     /* First write out the length of the index (count of index entries) */
     fprintf(f, "Entry count: %d\n", h->indexUsed);
 
@@ -45,6 +45,7 @@ typedef enum headerFlags_e {
     HEADERFLAG_ALLOCATED = (1 << 1), /*!< Is 1st header region allocated? */
     HEADERFLAG_LEGACY    = (1 << 2), /*!< Header came from legacy source? */
     HEADERFLAG_DEBUG     = (1 << 3), /*!< Debug this header? */
+    HEADERFLAG_LAZY      = (1 << 4), /*!< Are region entries swabbed on demand? */
 } headerFlags;
 
 /** \ingroup header
@@ -107,6 +108,26 @@ uint64_t htonll( uint64_t n );
 RPM_GNUC_INTERNAL
 void headerSetInstance(Header h, unsigned int instance);
 
+/** \ingroup header
+ * Convert header blob into header, deferring swab and validation of
+ * tag data until each tag is first accessed.
+ * The header blob may be modified in place as tags are materialized.
+ * Headers with dribbles (or from legacy sources) are loaded eagerly.
+ * @param uh		on-disk header blob (i.e. with no header magic)
+ * @return		header
+ */
+RPM_GNUC_INTERNAL
+Header headerLoadLazy(void * uh);
+
+/** \ingroup header
+ * Materialize all entries of a lazily loaded header.
+ * Needed before walking the whole index or the region data directly.
+ * @param h		header
+ * @return		0 on success, -1 on error
+ */
+RPM_GNUC_INTERNAL
+int headerMaterialize(Header h);
+
 /** \ingroup header
  * Return array of locales found in header.
  * The array is terminated with a NULL sentinel.
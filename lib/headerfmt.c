@@ -71,13 +71,38 @@ struct sprintfToken_s {
     } u;
 };
 
+/** \ingroup header
+ * Tag data cache entry.
+ */
+typedef struct tagCache_s * tagCache;
+struct tagCache_s {
+    rpmTag tag;
+    int state;			/*!< 0 not fetched, 1 present, -1 absent */
+    struct rpmtd_s td;
+};
+
+/** \ingroup header
+ * Compiled query format.
+ */
+struct headerFmt_s {
+    char * fmt;			/*!< format string (tokens point here) */
+    sprintfToken format;
+    int numTokens;
+    int isxml;
+    tagCache cache;		/*!< referenced tags, sorted by tag */
+    int ncache;
+    int acache;
+    char * val;			/*!< output buffer, reused between runs */
+    size_t alloced;
+};
+
 /**
  */
 typedef struct headerSprintfArgs_s {
     Header h;
     char * fmt;
     const char * errmsg;
-    rpmtd *cache;
+    headerFmt hf;
     sprintfToken format;
     HeaderIterator hi;
     char * val;
@@ -198,6 +223,17 @@ static sprintfToken hsaNext(headerSprintfArgs hsa)
  */
 static void hsaFini(headerSprintfArgs hsa)
 {
+    if (hsa->hi != NULL) {
+	sprintfTag tag =
+	    (hsa->format->type == PTOK_TAG
+		? &hsa->format->u.tag :
+	    (hsa->format->type == PTOK_ARRAY
+		? &hsa->format->u.array.format->u.tag :
+	    NULL));
+	/* hsaNext() walks the header through the "*" tag, restore it. */
+	if (tag != NULL)
+	    tag->tag = -2;
+    }
     hsa->hi = headerFreeIterator(hsa->hi);
     hsa->i = 0;
 }
@@ -589,39 +625,113 @@ static int parseExpression(headerSprintfArgs hsa, sprintfToken token,
     return 0;
 }
 
-static rpmtd getCached(rpmtd *cache, rpmTag tag)
+/**
+ * Look up a tag in the format cache.
+ * @param hf		compiled format
+ * @param tag		tag to look up
+ * @param add		create the (empty) entry if not found?
+ * @return		cache entry (NULL if not found)
+ */
+static tagCache cacheLookup(headerFmt hf, rpmTag tag, int add)
 {
-    rpmtd td = NULL;
+    int l = 0, u = hf->ncache;
+
+    while (l < u) {
+	int i = (l + u) / 2;
+	if (tag < hf->cache[i].tag)
+	    u = i;
+	else if (tag > hf->cache[i].tag)
+	    l = i + 1;
+	else
+	    return hf->cache + i;
+    }
+
+    if (!add)
+	return NULL;
 
-    if (tag >= HEADER_IMAGE && tag < RPMTAG_FIRSTFREE_TAG && cache[tag]) {
-	td = cache[tag];
+    if (hf->ncache == hf->acache) {
+	hf->acache += 16;
+	hf->cache = xrealloc(hf->cache, hf->acache * sizeof(*hf->cache));
     }
-    return td;
+    if (l < hf->ncache)
+	memmove(hf->cache + l + 1, hf->cache + l,
+		(hf->ncache - l) * sizeof(*hf->cache));
+    hf->ncache++;
+    memset(hf->cache + l, 0, sizeof(*hf->cache));
+    hf->cache[l].tag = tag;
+    return hf->cache + l;
+}
+
+/**
+ * Collect the tags referenced by a format into the cache.
+ * @param hf		compiled format
+ * @param format	sprintf format array
+ * @param num		number of elements
+ */
+static void cacheCollect(headerFmt hf, sprintfToken format, int num)
+{
+    int i;
+
+    for (i = 0; i < num; i++) {
+	switch (format[i].type) {
+	case PTOK_TAG:
+	    if (format[i].u.tag.tag >= 0)
+		(void) cacheLookup(hf, format[i].u.tag.tag, 1);
+	    break;
+	case PTOK_ARRAY:
+	    cacheCollect(hf, format[i].u.array.format,
+			format[i].u.array.numTokens);
+	    break;
+	case PTOK_COND:
+	    if (format[i].u.cond.tag.tag >= 0)
+		(void) cacheLookup(hf, format[i].u.cond.tag.tag, 1);
+	    cacheCollect(hf, format[i].u.cond.ifFormat,
+			format[i].u.cond.numIfTokens);
+	    cacheCollect(hf, format[i].u.cond.elseFormat,
+			format[i].u.cond.numElseTokens);
+	    break;
+	case PTOK_NONE:
+	case PTOK_STRING:
+	default:
+	    break;
+	}
+    }
+}
+
+/**
+ * Release tag data retrieved for the previous header.
+ * @param hf		compiled format
+ */
+static void cacheReset(headerFmt hf)
+{
+    tagCache c = hf->cache;
+    for (int i = 0; i < hf->ncache; i++, c++) {
+	if (c->state > 0)
+	    rpmtdFreeData(&c->td);
+	c->state = 0;
+    }
+}
+
+static rpmtd getCached(headerFmt hf, rpmTag tag)
+{
+    tagCache c = cacheLookup(hf, tag, 0);
+    return (c != NULL && c->state > 0) ? &c->td : NULL;
 }
 
 /**
  * Do headerGet() just once for given tag, cache results.
  * @param hsa		headerSprintf args
  * @param tag
- * @retval *typeptr
- * @retval *data
- * @retval *countptr
- * @return		1 on success, 0 on failure
+ * @return		tag data (NULL if not present)
  */
 static rpmtd getData(headerSprintfArgs hsa, rpmTag tag)
 {
-    rpmtd td = NULL;
+    tagCache c = cacheLookup(hsa->hf, tag, 1);
 
-    if (!(td = getCached(hsa->cache, tag))) {
-	td = rpmtdNew();
-	if (!headerGet(hsa->h, tag, td, HEADERGET_EXT)) {
-	    rpmtdFree(td);
-	    return NULL;
-	}
-	hsa->cache[tag] = td;
-    }
+    if (c->state == 0)
+	c->state = headerGet(hsa->h, tag, &c->td, HEADERGET_EXT) ? 1 : -1;
 
-    return td;
+    return (c->state > 0) ? &c->td : NULL;
 }
 
 /**
@@ -701,7 +811,7 @@ static char * singleSprintf(headerSprintfArgs hsa, sprintfToken token,
 	break;
 
     case PTOK_COND:
-	if (getCached(hsa->cache, token->u.cond.tag.tag) ||
+	if (getCached(hsa->hf, token->u.cond.tag.tag) ||
 		      headerIsEntry(hsa->h, token->u.cond.tag.tag)) {
 	    spft = token->u.cond.ifFormat;
 	    condNumFormats = token->u.cond.numIfTokens;
@@ -801,62 +911,62 @@ static char * singleSprintf(headerSprintfArgs hsa, sprintfToken token,
     return (hsa->val + hsa->vallen);
 }
 
-/**
- * Create tag data cache.
- * This allocates much more space than necessary but playing it
- * simple and stupid for now.
- */
-static rpmtd *cacheCreate(void)
+headerFmt headerFormatCompile(const char * fmt, errmsg_t * errmsg)
 {
-    rpmtd *cache = xcalloc(RPMTAG_FIRSTFREE_TAG, sizeof(*cache));
-    return cache;
-}
+    struct headerSprintfArgs_s hsa;
+    headerFmt hf = xcalloc(1, sizeof(*hf));
+    sprintfTag tag;
 
-/**
- * Free tag data cache contents and destroy cache.
- */
-static void *cacheFree(rpmtd *cache)
-{
-    rpmtd *td = cache;
-    for (int i = 0; i < RPMTAG_FIRSTFREE_TAG; i++, td++) {
-	if (*td) {
-	    rpmtdFreeData(*td);
-	    rpmtdFree(*td);
-	}
+    memset(&hsa, 0, sizeof(hsa));
+    hf->fmt = xstrdup(fmt);
+
+    if (parseFormat(&hsa, hf->fmt, &hf->format, &hf->numTokens, NULL, PARSER_BEGIN)) {
+	hf = headerFormatFree(hf);
+	goto exit;
     }
-    free(cache);
-    return NULL;
+
+    tag =
+	(hf->format->type == PTOK_TAG
+	    ? &hf->format->u.tag :
+	(hf->format->type == PTOK_ARRAY
+	    ? &hf->format->u.array.format->u.tag :
+	NULL));
+    hf->isxml = (tag != NULL && tag->tag == -2 && tag->type != NULL && !strcmp(tag->type, "xml"));
+
+    cacheCollect(hf, hf->format, hf->numTokens);
+
+exit:
+    if (errmsg)
+	*errmsg = hsa.errmsg;
+    return hf;
 }
 
-char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+const char * headerFormatExec(headerFmt hf, Header h, errmsg_t * errmsg)
 {
     struct headerSprintfArgs_s hsa;
     sprintfToken nextfmt;
-    sprintfTag tag;
+    const char * val = NULL;
     char * t, * te;
-    int isxml;
     size_t need;
- 
+    int rc = 0;
+
+    if (hf == NULL)
+	return NULL;
+
     memset(&hsa, 0, sizeof(hsa));
     hsa.h = headerLink(h);
-    hsa.fmt = xstrdup(fmt);
+    hsa.fmt = hf->fmt;
+    hsa.hf = hf;
     hsa.errmsg = NULL;
-
-    if (parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL, PARSER_BEGIN))
-	goto exit;
-
-    hsa.cache = cacheCreate();
-    hsa.val = xstrdup("");
-
-    tag =
-	(hsa.format->type == PTOK_TAG
-	    ? &hsa.format->u.tag :
-	(hsa.format->type == PTOK_ARRAY
-	    ? &hsa.format->u.array.format->u.tag :
-	NULL));
-    isxml = (tag != NULL && tag->tag == -2 && tag->type != NULL && !strcmp(tag->type, "xml"));
-
-    if (isxml) {
+    hsa.format = hf->format;
+    hsa.numTokens = hf->numTokens;
+    if (hf->val == NULL)
+	hf->val = xstrdup("");
+    hsa.val = hf->val;
+    hsa.alloced = hf->alloced;
+    hsa.val[0] = '\0';
+
+    if (hf->isxml) {
 	need = sizeof("<rpmHeader>\n") - 1;
 	t = hsaReserve(&hsa, need);
 	te = stpcpy(t, "<rpmHeader>\n");
@@ -867,30 +977,59 @@ char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg)
     while ((nextfmt = hsaNext(&hsa)) != NULL) {
 	te = singleSprintf(&hsa, nextfmt, 0);
 	if (te == NULL) {
-	    hsa.val = _free(hsa.val);
+	    rc = 1;
 	    break;
 	}
     }
     hsaFini(&hsa);
 
-    if (isxml) {
-	need = sizeof("</rpmHeader>\n") - 1;
-	t = hsaReserve(&hsa, need);
-	te = stpcpy(t, "</rpmHeader>\n");
-	hsa.vallen += (te - t);
+    if (rc == 0) {
+	if (hf->isxml) {
+	    need = sizeof("</rpmHeader>\n") - 1;
+	    t = hsaReserve(&hsa, need);
+	    te = stpcpy(t, "</rpmHeader>\n");
+	    hsa.vallen += (te - t);
+	}
+	val = hsa.val;
     }
 
-    if (hsa.val != NULL && hsa.vallen < hsa.alloced)
-	hsa.val = xrealloc(hsa.val, hsa.vallen+1);	
+    cacheReset(hf);
+    hf->val = hsa.val;
+    hf->alloced = hsa.alloced;
 
-    hsa.cache = cacheFree(hsa.cache);
-    hsa.format = freeFormat(hsa.format, hsa.numTokens);
-
-exit:
     if (errmsg)
 	*errmsg = hsa.errmsg;
     hsa.h = headerFree(hsa.h);
-    hsa.fmt = _free(hsa.fmt);
-    return hsa.val;
+    return val;
 }
 
+headerFmt headerFormatFree(headerFmt hf)
+{
+    if (hf == NULL)
+	return NULL;
+
+    cacheReset(hf);
+    hf->cache = _free(hf->cache);
+    hf->format = freeFormat(hf->format, hf->numTokens);
+    hf->fmt = _free(hf->fmt);
+    hf->val = _free(hf->val);
+    free(hf);
+    return NULL;
+}
+
+char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+{
+    headerFmt hf = headerFormatCompile(fmt, errmsg);
+    char * val = NULL;
+
+    if (hf == NULL)
+	return NULL;
+
+    if (headerFormatExec(hf, h, errmsg) != NULL) {
+	/* Steal the output buffer instead of copying it. */
+	val = xrealloc(hf->val, strlen(hf->val) + 1);
+	hf->val = NULL;
+    }
+    hf = headerFormatFree(hf);
+    return val;
+}
@@ -8,6 +8,7 @@
 const char * const RPMVERSION = VERSION;
 
 #include <rpm/rpmlog.h>
+#include <rpm/rpmmacro.h>
 
 #include "lib/misc.h"
 
@@ -177,3 +178,14 @@ static char * lastGname = NULL;
 	return lastGname;
     }
 }
+
+int rpmExpandThreads(const char * macro)
+{
+    int nthreads = rpmExpandNumeric(macro);
+
+    if (nthreads <= 0) {
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (ncpus > 8 ? 8 : ncpus);
+    }
+    return (nthreads > 0 ? nthreads : 1);
+}
@@ -36,6 +36,13 @@ const char * uidToUname(uid_t uid);
 RPM_GNUC_INTERNAL
 const char * gidToGname(gid_t gid);
 
+/*
+ * Return no. of threads to use as configured by a macro: 0 (or unset)
+ * means one per online CPU (but at most 8), 1 means no threads at all.
+ */
+RPM_GNUC_INTERNAL
+int rpmExpandThreads(const char * macro);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,7 @@
 #include "system.h"
 
 #include <netinet/in.h>
+#include <pthread.h>
 
 #include <rpm/rpmlib.h>			/* XXX RPMSIGTAG, other sig stuff */
 #include <rpm/rpmts.h>
@@ -17,6 +18,7 @@
 #include "rpmio/digest.h"
 #include "rpmio/rpmio_internal.h"	/* fd*Digest(), fd stats */
 #include "lib/header_internal.h"	/* XXX headerCheck */
+#include "lib/rpmdb_internal.h"	/* rpmSigCache */
 
 #include "debug.h"
 
@@ -26,6 +28,7 @@ static const unsigned int nkeyids_max = 256;
 static unsigned int nkeyids = 0;
 static unsigned int nextkeyid  = 0;
 static unsigned int * keyids;
+static pthread_mutex_t keyidsLock = PTHREAD_MUTEX_INITIALIZER;
 
 void headerMergeLegacySigs(Header h, const Header sigh)
 {
@@ -165,6 +168,7 @@ static int stashKeyid(pgpDig dig)
     pgpDigParams sigp = dig ? &dig->signature : NULL;
     unsigned int keyid;
     int i;
+    int rc = 0;
 
     if (dig == NULL || sigp == NULL)
 	return 0;
@@ -173,10 +177,14 @@ static int stashKeyid(pgpDig dig)
     if (keyid == 0)
 	return 0;
 
+    /* Packages may be read on several threads (see rpmInstall) */
+    (void) pthread_mutex_lock(&keyidsLock);
     if (keyids != NULL)
     for (i = 0; i < nkeyids; i++) {
-	if (keyid == keyids[i])
-	    return 1;
+	if (keyid == keyids[i]) {
+	    rc = 1;
+	    goto exit;
+	}
     }
 
     if (nkeyids < nkeyids_max) {
@@ -188,7 +196,72 @@ static int stashKeyid(pgpDig dig)
     nextkeyid++;
     nextkeyid %= nkeyids_max;
 
-    return 0;
+exit:
+    (void) pthread_mutex_unlock(&keyidsLock);
+    return rc;
+}
+
+/**
+ * Compute the signature cache key of a header-only signature.
+ * @param ts		transaction set
+ * @param sigtd		signature tag data
+ * @param pe		header region entries
+ * @param ril		no. of region entries
+ * @param dataStart	header data start
+ * @param regionEnd	header region data end
+ * @retval key		signature cache key
+ * @retval *ctxp	SHA1 context of the region, not finalized (on success)
+ * @return		0 on success
+ */
+static int sigCacheKey(rpmts ts, rpmtd sigtd, entryInfo pe, int32_t ril,
+		const unsigned char * dataStart, const unsigned char * regionEnd,
+		struct rpmSigCacheKey_s * key, DIGEST_CTX * ctxp)
+{
+    rpmKeyring keyring = rpmtsGetKeyring(ts, 1);
+    pgpDig dig = pgpNewDig();
+    DIGEST_CTX ctx;
+    int32_t ildl[2];
+    void * d = NULL;
+    size_t dlen = 0;
+    int rc = -1;
+
+    memset(key, 0, sizeof(*key));
+    key->vsflags = rpmtsVSFlags(ts);
+
+    /* Only the signer key id is needed from the signature. */
+    (void) pgpPrtPkts(sigtd->data, sigtd->count, dig, 0);
+    memcpy(key->keyid, dig->signature.signid, sizeof(key->keyid));
+
+    /* Results are cached against all keys, deferred ones included. */
+    (void) rpmKeyringLoad(keyring);
+    if (rpmKeyringDigest(keyring, key->keyring))
+	goto exit;
+
+    /* The same data as covered by the signature. */
+    ildl[0] = htonl(ril);
+    ildl[1] = htonl(regionEnd - dataStart);
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_DIGEST), 0);
+    ctx = rpmDigestInit(PGPHASHALGO_SHA1, RPMDIGEST_NONE);
+    (void) rpmDigestUpdate(ctx, rpm_header_magic, sizeof(rpm_header_magic));
+    (void) rpmDigestUpdate(ctx, ildl, sizeof(ildl));
+    (void) rpmDigestUpdate(ctx, pe, ril * sizeof(*pe));
+    (void) rpmDigestUpdate(ctx, dataStart, regionEnd - dataStart);
+    (void) rpmDigestFinal(rpmDigestDup(ctx), &d, &dlen, 0);
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_DIGEST), 0);
+
+    if (d != NULL && dlen == sizeof(key->hdrsha1)) {
+	memcpy(key->hdrsha1, d, sizeof(key->hdrsha1));
+	/* A miss verifies the signature over the same data. */
+	*ctxp = ctx;
+	rc = 0;
+    } else
+	(void) rpmDigestFinal(ctx, NULL, NULL, 0);
+
+exit:
+    free(d);
+    pgpFreeDig(dig);
+    rpmKeyringFree(keyring);
+    return rc;
 }
 
 /**
@@ -228,6 +301,8 @@ rpmRC headerCheck(rpmts ts, const void * uh, size_t uc, char ** msg)
     int xx;
     int i;
     struct rpmtd_s sigtd;
+    struct rpmSigCacheKey_s ckey;
+    rpmSigCache cache = NULL;
 
     /* Is the blob the right size? */
     if (uc > 0 && pvlen != uc) {
@@ -392,6 +467,20 @@ verifyinfo_exit:
     sigtd.data = memcpy(xmalloc(siglen), dataStart + info.offset, siglen);
     sigtd.flags = RPMTD_ALLOCED;
 
+    /* Skip the public key operation if verified good before. */
+    if (info.tag == RPMTAG_RSAHEADER || info.tag == RPMTAG_DSAHEADER)
+	cache = rpmdbSigCache(rpmtsGetRdb(ts));
+    if (cache && sigCacheKey(ts, &sigtd, pe, ril, dataStart, regionEnd, &ckey,
+			     &dig->hdrsha1ctx))
+	cache = NULL;
+    if (cache && rpmSigCacheLookup(cache, &ckey)) {
+	char * keyid = pgpHexStr(ckey.keyid+4, sizeof(ckey.keyid)-4);
+	rasprintf(&buf, _("Header signature: OK (cached), key ID %s\n"), keyid);
+	free(keyid);
+	rc = RPMRC_OK;
+	goto verified;
+    }
+
     switch (info.tag) {
     case RPMTAG_RSAHEADER:
 	/* Parse the parameters from the OpenPGP packets that will be needed. */
@@ -405,6 +494,14 @@ verifyinfo_exit:
 	    goto exit;
 	}
 
+	/* Reuse the region digest of the cache key if it is the same. */
+	if (dig->hdrsha1ctx != NULL &&
+		dig->signature.hash_algo == PGPHASHALGO_SHA1) {
+	    dig->hdrmd5ctx = dig->hdrsha1ctx;
+	    dig->hdrsha1ctx = NULL;
+	    break;
+	}
+
 	ildl[0] = htonl(ril);
 	ildl[1] = (regionEnd - dataStart);
 	ildl[1] = htonl(ildl[1]);
@@ -446,6 +543,10 @@ verifyinfo_exit:
 	    goto exit;
 	}
     case RPMTAG_SHA1HEADER:
+	/* Reuse the region digest of the cache key (if any). */
+	if (dig->hdrsha1ctx != NULL)
+	    break;
+
 	ildl[0] = htonl(ril);
 	ildl[1] = (regionEnd - dataStart);
 	ildl[1] = htonl(ildl[1]);
@@ -482,9 +583,12 @@ verifyinfo_exit:
 
     {	rpmKeyring keyring = rpmtsGetKeyring(ts, 1);
     	rc = rpmVerifySignature(keyring, &sigtd, dig, &buf);
+	if (rc == RPMRC_OK && cache)
+	    rpmSigCacheAdd(cache, &ckey);
 	rpmKeyringFree(keyring);
     }
 
+verified:
     if (msg) 
 	*msg = buf;
     else
@@ -575,7 +679,17 @@ exit:
     return rc;
 }
 
-rpmRC rpmReadPackageFile(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
+/**
+ * Read lead, signature and header of a package, verifying what can be.
+ * @param ts		transaction set
+ * @param fd		file handle
+ * @param fn		file name
+ * @retval hdrp		header (or NULL)
+ * @param stream	leave fd at the payload, digesting it as it is read?
+ * @return		RPMRC_OK on success
+ */
+static rpmRC readPackage(rpmts ts, FD_t fd, const char * fn, Header * hdrp,
+		int stream)
 {
     pgpDig dig = NULL;
     char buf[8*BUFSIZ];
@@ -642,6 +756,8 @@ rpmRC rpmReadPackageFile(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
     sigtag = 0;
     opx = 0;
     vsflags = rpmtsVSFlags(ts);
+    if (stream)
+	vsflags |= RPMVSF_NEEDPAYLOAD;
     if (_chk(RPMVSF_NODSAHEADER) && headerIsEntry(sigh, RPMSIGTAG_DSA)) {
 	sigtag = RPMSIGTAG_DSA;
     } else
@@ -673,6 +789,15 @@ rpmRC rpmReadPackageFile(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
 	opx = RPMTS_OP_DIGEST;
     }
 
+    /*
+     * The payload of a stream can't be read here. Start the legacy
+     * header+payload digest anyway, it's completed as the payload is
+     * installed and then checked against the header.
+     */
+    if (stream && !(vsflags & RPMVSF_NOMD5) &&
+	headerIsEntry(sigh, RPMSIGTAG_MD5))
+	fdInitDigest(fd, PGPHASHALGO_MD5, 0);
+
     /* Read the metadata, computing digest(s) on the fly. */
     h = NULL;
     msg = NULL;
@@ -870,6 +995,16 @@ exit:
     return rc;
 }
 
+rpmRC rpmReadPackageFile(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
+{
+    return readPackage(ts, fd, fn, hdrp, 0);
+}
+
+rpmRC rpmReadPackageStream(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
+{
+    return readPackage(ts, fd, fn, hdrp, 1);
+}
+
 /**
  * Check for supported payload format in header.
  * @param h		header to check
@@ -17,11 +17,13 @@
 #include <rpm/argv.h>
 
 #include "rpmio/rpmlua.h"
+#include "rpmio/rpmio_internal.h"	/* fdFiniDigest */
 #include "lib/cpio.h"
 #include "lib/fsm.h"		/* XXX CPIO_FOO/FSM_FOO constants */
 #include "lib/psm.h"
 #include "lib/rpmfi_internal.h" /* XXX replaced/states... */
 #include "lib/rpmte_internal.h"	/* XXX internal apis */
+#include "lib/rpmts_internal.h"	/* rpmtsDeferScript */
 #include "lib/rpmlead.h"		/* writeLead proto */
 #include "lib/signature.h"		/* signature constants */
 #include "lib/misc.h"		/* XXX rpmMkdirPath */
@@ -611,6 +613,30 @@ static void doScriptExec(rpmts ts, ARGV_const_t argv, rpmtd prefixes,
     _exit(127); /* exit 127 for compatibility with bash(1) */
 }
 
+/**
+ * Open the file handle scriptlet stdout is redirected to.
+ * @param scriptFd	scriptlet stdout/stderr from the transaction set
+ * @return		file handle (or NULL on error)
+ */
+static FD_t scriptOutFd(FD_t scriptFd)
+{
+    FD_t out = NULL;
+
+    if (scriptFd != NULL) {
+	if (rpmIsVerbose()) {
+	    out = fdDup(Fileno(scriptFd));
+	} else {
+	    out = Fopen("/dev/null", "w.fdio");
+	    if (Ferror(out)) {
+		out = fdDup(Fileno(scriptFd));
+	    }
+	}
+    } else {
+	out = fdDup(STDOUT_FILENO);
+    }
+    return out;
+}
+
 /**
  * Run scriptlet with args.
  *
@@ -654,6 +680,19 @@ static rpmRC runScript(rpmpsm psm, Header h, rpmTag stag, ARGV_t * argvp,
 
     psm->sq.reaper = 1;
 
+    /*
+     * Cache rebuilders (ldconfig and friends) given as %post -p/%postun -p
+     * only need to run once per transaction, queue them up for the end.
+     */
+    if (script == NULL && (stag == RPMTAG_POSTIN || stag == RPMTAG_POSTUN)
+     && rpmtsDeferScript(ts, *argvp))
+    {
+	rpmlog(RPMLOG_DEBUG, "%s: %s deferring \"%s\" to end of transaction.\n",
+	       psm->stepName, sname, *argvp[0]);
+	free(sname);
+	return RPMRC_OK;
+    }
+
     /*
      * If a successor node, and ldconfig was just run, don't bother.
      */
@@ -725,24 +764,16 @@ static rpmRC runScript(rpmpsm psm, Header h, rpmTag stag, ARGV_t * argvp,
     }
 
     scriptFd = rpmtsScriptFd(ts);
-    if (scriptFd != NULL) {
-	if (rpmIsVerbose()) {
-	    out = fdDup(Fileno(scriptFd));
-	} else {
-	    out = Fopen("/dev/null", "w.fdio");
-	    if (Ferror(out)) {
-		out = fdDup(Fileno(scriptFd));
-	    }
-	}
-    } else {
-	out = fdDup(STDOUT_FILENO);
-    }
+    out = scriptOutFd(scriptFd);
     if (out == NULL) { 
 	rpmlog(RPMLOG_ERR, _("Couldn't duplicate file descriptor: %s: %s\n"),
 	       sname, strerror(errno));
 	goto exit;
     }
 
+    /* Scriptlets may query the rpmdb, write out batched index updates. */
+    xx = rpmdbFlushBatch(rpmtsGetRdb(ts));
+
     xx = rpmsqFork(&psm->sq);
     if (psm->sq.child == 0) {
 	rpmlog(RPMLOG_DEBUG, "%s: %s\texecv(%s) pid %d\n",
@@ -802,6 +833,79 @@ exit:
     return rc;
 }
 
+/**
+ * Run the scriptlet commands deferred to the end of the transaction.
+ * Like other %post/%postun scriptlets, failures are only warned about.
+ * @param psm		package state machine data
+ * @return		RPMRC_OK always
+ */
+static rpmRC runDeferredScripts(rpmpsm psm)
+{
+    const rpmts ts = psm->ts;
+    FD_t scriptFd = rpmtsScriptFd(ts);
+    struct rpmtd_s prefixes;
+    ARGV_t * scripts;
+    int nscripts = 0;
+    int xx;
+
+    scripts = rpmtsTakeDeferredScripts(ts, &nscripts);
+    if (nscripts == 0)
+	return RPMRC_OK;
+
+    rpmlog(RPMLOG_DEBUG, "running %d deferred scriptlet(s)\n", nscripts);
+    psm->stepName = "deferred";
+    rpmtdReset(&prefixes);
+
+    xx = rpmpsmStage(psm, PSM_CHROOT_IN);
+    for (int i = 0; i < nscripts; i++) {
+	ARGV_t argv = scripts[i];
+	FD_t out = scriptOutFd(scriptFd);
+
+	if (out == NULL) {
+	    rpmlog(RPMLOG_ERR, _("Couldn't duplicate file descriptor: %s: %s\n"),
+		   argv[0], strerror(errno));
+	    goto next;
+	}
+
+	psm->sq.reaper = 1;
+	xx = rpmsqFork(&psm->sq);
+	if (psm->sq.child == 0) {
+	    rpmlog(RPMLOG_DEBUG, "%s: \texecv(%s) pid %d\n",
+		   psm->stepName, argv[0], (unsigned)getpid());
+	    doScriptExec(ts, argv, &prefixes, scriptFd, out);
+	}
+
+	if (psm->sq.child == (pid_t)-1) {
+	    rpmlog(RPMLOG_WARNING, _("Couldn't fork %s: %s\n"),
+		   argv[0], strerror(errno));
+	    goto next;
+	}
+
+	(void) psmWait(psm);
+
+	if (psm->sq.reaped < 0) {
+	    rpmlog(RPMLOG_WARNING,
+		   _("deferred %s failed, waitpid(%d) rc %d: %s\n"),
+		   argv[0], psm->sq.child, psm->sq.reaped, strerror(errno));
+	} else if (WIFSIGNALED(psm->sq.status)) {
+	    rpmlog(RPMLOG_WARNING, _("deferred %s failed, signal %d\n"),
+		   argv[0], WTERMSIG(psm->sq.status));
+	} else if (!WIFEXITED(psm->sq.status) || WEXITSTATUS(psm->sq.status)) {
+	    rpmlog(RPMLOG_WARNING, _("deferred %s failed, exit status %d\n"),
+		   argv[0], WEXITSTATUS(psm->sq.status));
+	}
+
+next:
+	if (out)
+	    xx = Fclose(out);	/* XXX dup'd STDOUT_FILENO */
+	argvFree(argv);
+    }
+    xx = rpmpsmStage(psm, PSM_CHROOT_OUT);
+    free(scripts);
+
+    return RPMRC_OK;
+}
+
 /**
  * Retrieve and run scriptlet from header.
  * @param psm		package state machine data
@@ -1054,6 +1158,7 @@ static const char * pkgStageString(pkgStage a)
     case PSM_IMMED_TRIGGERS:	return "immedtriggers";
 
     case PSM_RPMIO_FLAGS:	return "rpmioflags";
+    case PSM_DEFERRED:		return "deferred";
 
     case PSM_RPMDB_ADD:		return "rpmdbadd";
     case PSM_RPMDB_REMOVE:	return "rpmdbremove";
@@ -1140,6 +1245,126 @@ rpmpsm rpmpsmNew(rpmts ts, rpmte te)
     return rpmpsmLink(psm, RPMDBG_M("rpmpsmNew"));
 }
 
+/**
+ * Streamed package payload, pumped into a pipe for the payload reader.
+ */
+struct payloadPump_s {
+    FD_t fd;			/*!< package stream, at the payload */
+    int wfd;			/*!< pipe write end */
+    int rc;			/*!< 0 on success, 1 on read error */
+};
+
+/**
+ * Copy the payload stream to the pipe until EOF. The stream is read to the
+ * end even if the reader goes away, for the digest(s) attached to it.
+ * @param arg		payload pump
+ * @return		NULL always
+ */
+static void * pumpPayload(void * arg)
+{
+    struct payloadPump_s * pump = arg;
+    char buf[BUFSIZ];
+    sigset_t set;
+    ssize_t nb;
+
+    /* A reader gone early must not kill us, EPIPE will do. */
+    (void) sigemptyset(&set);
+    (void) sigaddset(&set, SIGPIPE);
+    (void) pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while ((nb = Fread(buf, sizeof(buf[0]), sizeof(buf), pump->fd)) > 0) {
+	char * b = buf;
+	while (nb > 0 && pump->wfd >= 0) {
+	    ssize_t nw = write(pump->wfd, b, nb);
+	    if (nw < 0 && errno == EINTR)
+		continue;
+	    if (nw <= 0) {
+		(void) close(pump->wfd);
+		pump->wfd = -1;
+		break;
+	    }
+	    b += nw;
+	    nb -= nw;
+	}
+    }
+    if (nb < 0 || Ferror(pump->fd))
+	pump->rc = 1;
+    if (pump->wfd >= 0) {
+	(void) close(pump->wfd);
+	pump->wfd = -1;
+    }
+    return NULL;
+}
+
+/**
+ * Open the payload of a streamed package: a thread reads the stream into
+ * a pipe, so that download, digest and unpacking proceed concurrently.
+ * @param psm		package state machine data
+ * @retval *threadp	payload pump thread
+ * @param pump		payload pump
+ * @return		payload file handle (NULL on error)
+ */
+static FD_t openStreamPayload(rpmpsm psm, void ** threadp,
+		struct payloadPump_s * pump)
+{
+    FD_t cfd = NULL;
+    int pipefd[2];
+
+    if (pipe(pipefd) < 0)
+	return NULL;
+    pump->fd = rpmteFd(psm->te);
+    pump->wfd = pipefd[1];
+    pump->rc = 0;
+    if ((*threadp = rpmsqThread(pumpPayload, pump)) == NULL) {
+	(void) close(pipefd[0]);
+	(void) close(pipefd[1]);
+	return NULL;
+    }
+    cfd = Fdopen(fdDup(pipefd[0]), psm->rpmio_flags);
+    (void) close(pipefd[0]);
+    return cfd;
+}
+
+/**
+ * Finish reading a streamed payload and check its digest.
+ * @param psm		package state machine data
+ * @param thread	payload pump thread
+ * @param pump		payload pump
+ * @return		RPMRC_OK on success
+ */
+static rpmRC closeStreamPayload(rpmpsm psm, void * thread,
+		struct payloadPump_s * pump)
+{
+    Header h = rpmteStreamHeader(psm->te);
+    struct rpmtd_s md5;
+    uint8_t * digest = NULL;
+    size_t diglen = 0;
+    rpmRC rc = RPMRC_OK;
+
+    (void) rpmsqJoin(thread);
+    if (pump->rc) {
+	rpmlog(RPMLOG_ERR, _("%s: read failed: %s\n"),
+		rpmteNEVRA(psm->te), Fstrerror(pump->fd));
+	return RPMRC_FAIL;
+    }
+
+    /* The digest is only there if rpmReadPackageStream() started it. */
+    fdFiniDigest(pump->fd, PGPHASHALGO_MD5, (void **)&digest, &diglen, 0);
+    if (digest != NULL && headerGet(h, RPMTAG_SIGMD5, &md5, HEADERGET_MINMEM)) {
+	if (md5.count != diglen || memcmp(md5.data, digest, diglen)) {
+	    rpmlog(RPMLOG_ERR, _("%s: payload digest mismatch\n"),
+		    rpmteNEVRA(psm->te));
+	    rc = RPMRC_FAIL;
+	} else {
+	    rpmlog(RPMLOG_DEBUG, "%s: payload digest OK\n",
+		    rpmteNEVRA(psm->te));
+	}
+	rpmtdFreeData(&md5);
+    }
+    free(digest);
+    return rc;
+}
+
 static void * rpmpsmThread(void * arg)
 {
     rpmpsm psm = arg;
@@ -1314,6 +1539,8 @@ rpmRC rpmpsmStage(rpmpsm psm, pkgStage stage)
 	if (rpmtsFlags(ts) & RPMTRANS_FLAG_TEST)	break;
 
 	if (psm->goal == PSM_PKGINSTALL) {
+	    struct payloadPump_s pump;
+	    void * pumpThread = NULL;
 
 	    if (rpmtsFlags(ts) & RPMTRANS_FLAG_JUSTDB)	break;
 
@@ -1334,7 +1561,10 @@ rpmRC rpmpsmStage(rpmpsm psm, pkgStage stage)
 	    }
 
 	   	/* LCL: fi->fd != NULL here. */
-	    psm->cfd = Fdopen(fdDup(Fileno(rpmteFd(psm->te))), psm->rpmio_flags);
+	    if (rpmteStreamHeader(psm->te) != NULL)
+		psm->cfd = openStreamPayload(psm, &pumpThread, &pump);
+	    else
+		psm->cfd = Fdopen(fdDup(Fileno(rpmteFd(psm->te))), psm->rpmio_flags);
 	    if (psm->cfd == NULL) {	/* XXX can't happen */
 		rc = RPMRC_FAIL;
 		break;
@@ -1353,6 +1583,12 @@ rpmRC rpmpsmStage(rpmpsm psm, pkgStage stage)
 	    psm->cfd = NULL;
 	    errno = saveerrno; /* XXX FIXME: Fclose with libio destroys errno */
 
+	    if (pumpThread != NULL) {
+		rpmRC prc = closeStreamPayload(psm, pumpThread, &pump);
+		if (!rc && prc != RPMRC_OK)
+		    rc = prc;
+	    }
+
 	    if (!rc)
 		rc = rpmpsmNext(psm, PSM_COMMIT);
 
@@ -1592,6 +1828,10 @@ rpmRC rpmpsmStage(rpmpsm psm, pkgStage stage)
 	/* Run triggers in this package other package(s) set off. */
 	rc = runImmedTriggers(psm);
 	break;
+    case PSM_DEFERRED:
+	/* Run scriptlets the transaction queued up for the end. */
+	rc = runDeferredScripts(psm);
+	break;
 
     case PSM_RPMIO_FLAGS:
     {	const char * payload_compressor = NULL;
@@ -48,6 +48,7 @@ typedef enum pkgStage_e {
     PSM_TRIGGERS	= 54,
     PSM_IMMED_TRIGGERS	= 55,
     PSM_RPMIO_FLAGS	= 56,
+    PSM_DEFERRED	= 57,
 
     PSM_RPMDB_ADD	= 98,
     PSM_RPMDB_REMOVE	= 99
@@ -96,6 +96,19 @@ static void printFileInfo(const char * name,
     free(link);
 }
 
+/*
+ * Compiled qva_queryFormat, reused for every package. Kept here rather
+ * than in QVA_t, whose layout is part of the ABI.
+ */
+static char * qfmtSource = NULL;
+static headerFmt qfmt = NULL;
+
+static void qfmtFree(void)
+{
+    qfmt = headerFormatFree(qfmt);
+    qfmtSource = _free(qfmtSource);
+}
+
 int showQueryPackage(QVA_t qva, rpmts ts, Header h)
 {
     rpmfi fi = NULL;
@@ -104,12 +117,21 @@ int showQueryPackage(QVA_t qva, rpmts ts, Header h)
     int i;
 
     if (qva->qva_queryFormat != NULL) {
-	const char *errstr;
-	char *str = headerFormat(h, qva->qva_queryFormat, &errstr);
+	const char *errstr = NULL;
+	const char *str = NULL;
+
+	/* Parse the format once, reuse it for every package. */
+	if (qfmtSource == NULL || strcmp(qfmtSource, qva->qva_queryFormat)) {
+	    qfmtFree();
+	    qfmt = headerFormatCompile(qva->qva_queryFormat, &errstr);
+	    if (qfmt != NULL)
+		qfmtSource = xstrdup(qva->qva_queryFormat);
+	}
+	if (qfmt != NULL)
+	    str = headerFormatExec(qfmt, h, &errstr);
 
 	if ( str != NULL ) {
 	    rpmlog(RPMLOG_NOTICE, "%s", str);
-	    free(str);
 	} else {
 	    rpmlog(RPMLOG_ERR, _("incorrect format: %s\n"), errstr);
 	}
@@ -677,6 +699,7 @@ int rpmcliQuery(rpmts ts, QVA_t qva, char * const * argv)
     ec = rpmcliArgIter(ts, qva, argv);
     vsflags = rpmtsSetVSFlags(ts, ovsflags);
 
+    qfmtFree();
     if (qva->qva_showPackage == showQueryPackage)
 	qva->qva_showPackage = NULL;
 
@@ -9,6 +9,8 @@
 #include <rpm/rpmds.h>
 #include <rpm/rpmfi.h>
 
+#include "lib/rpmds_internal.h"
+
 #include "debug.h"
 
 typedef struct availablePackage_s * availablePackage;
@@ -570,6 +572,8 @@ void rpmalMakeIndex(rpmal al)
     for (i = 0; i < al->size; i++) {
 	alp = al->list + i;
 	rpmalAddProvides(al, (rpmalKey)i, alp->provides, alp->tscolor);
+	/* Lookups then leave the provides alone (and can run in parallel). */
+	rpmdsSplitEVR(alp->provides);
     }
 
     /* Reset size to the no. of provides added. */
@@ -725,10 +729,7 @@ rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds, rpmalKey * keyp)
 	if (alp->provides != NULL)	/* XXX can't happen */
 	switch (match->type) {
 	case IET_PROVIDES:
-	    /* XXX single step on rpmdsNext to regenerate DNEVR string */
-	    (void) rpmdsSetIx(alp->provides, match->entryIx - 1);
-	    if (rpmdsNext(alp->provides) >= 0)
-		rc = rpmdsCompare(alp->provides, ds);
+	    rc = rpmdsCompareIndex(alp->provides, match->entryIx, ds);
 
 	    if (rc)
 		rpmdsNotify(ds, _("(added provide)"), 0);
@@ -5,6 +5,8 @@
 
 #include "system.h"
 
+#include <pthread.h>
+
 #include <rpm/rpmlib.h>			/* RPMSIGTAG & related */
 #include <rpm/rpmpgp.h>
 #include <rpm/rpmcli.h>
@@ -16,7 +18,10 @@
 #include <rpm/rpmkeyring.h>
 
 #include "rpmio/digest.h"
+#include "rpmio/rpmio_internal.h"	/* rpmlogCapture */
 #include "lib/rpmlead.h"
+#include "lib/misc.h"
+#include "lib/rpmts_internal.h"	/* rpmtsPool */
 #include "lib/signature.h"
 
 #include "debug.h"
@@ -789,13 +794,155 @@ exit:
     return res;
 }
 
-int rpmcliSign(rpmts ts, QVA_t qva, ARGV_const_t argv)
+/**
+ * Check signatures of a package file.
+ * @param qva		parsed query/verify options
+ * @param ts		transaction set
+ * @param fn		package file name
+ * @return		0 if package verifies, 1 otherwise
+ */
+static int checkPackage(QVA_t qva, rpmts ts, const char * fn)
 {
-    const char * arg;
+    FD_t fd;
     int res = 0;
     int xx;
 
-    if (argv == NULL) return res;
+    fd = Fopen(fn, "r.ufdio");
+    if (fd == NULL || Ferror(fd)) {
+	rpmlog(RPMLOG_ERR, _("%s: open failed: %s\n"), 
+		 fn, Fstrerror(fd));
+	res++;
+    } else if (rpmVerifySignatures(qva, ts, fd, fn)) {
+	res++;
+    }
+
+    if (fd != NULL) xx = Fclose(fd);
+    return res;
+}
+
+/**
+ * Package checked by a signature check worker.
+ */
+struct sigCheckItem_s {
+    const char * fn;
+    int done;
+    int res;
+    rpmlogCapture log;		/*!< result/messages of the check */
+};
+
+typedef struct sigCheck_s * sigCheck;
+
+/**
+ * Batch of packages being checked on worker threads.
+ */
+struct sigCheck_s {
+    QVA_t qva;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct sigCheckItem_s * items;
+    int nitems;
+    int next;			/*!< next item to be checked */
+};
+
+/**
+ * Check packages until none are left.
+ * @param ts		private transaction set of the thread
+ * @param data		batch of packages
+ */
+static void sigCheckWorker(rpmts ts, void * data)
+{
+    sigCheck sc = data;
+    struct sigCheckItem_s * item;
+
+    while (1) {
+	(void) pthread_mutex_lock(&sc->lock);
+	if (sc->next >= sc->nitems) {
+	    (void) pthread_mutex_unlock(&sc->lock);
+	    break;
+	}
+	item = sc->items + sc->next++;
+	(void) pthread_mutex_unlock(&sc->lock);
+
+	rpmlogCaptureBegin();
+	item->res = checkPackage(sc->qva, ts, item->fn);
+	item->log = rpmlogCaptureEnd();
+
+	(void) pthread_mutex_lock(&sc->lock);
+	item->done = 1;
+	(void) pthread_cond_broadcast(&sc->cond);
+	(void) pthread_mutex_unlock(&sc->lock);
+    }
+}
+
+/**
+ * Check signatures of a batch of packages.
+ * With %{_checksig_threads} other than 1, packages are checked
+ * concurrently, and their results are reported in argument order.
+ * @param ts		transaction set
+ * @param qva		parsed query/verify options
+ * @param argv		package file names
+ * @return		no. of packages that failed to verify
+ */
+static int checkPackages(rpmts ts, QVA_t qva, ARGV_const_t argv)
+{
+    struct sigCheck_s sc;
+    rpmtsPool pool;
+    int nthreads;
+    int res = 0;
+    int i;
+
+    memset(&sc, 0, sizeof(sc));
+    sc.qva = qva;
+    sc.nitems = argvCount(argv);
+
+    nthreads = rpmExpandThreads("%{?_checksig_threads}");
+    if (nthreads > sc.nitems)
+	nthreads = sc.nitems;
+
+    if (nthreads <= 1) {
+	for (i = 0; i < sc.nitems; i++)
+	    res += checkPackage(qva, ts, argv[i]);
+	return res;
+    }
+
+    sc.items = xcalloc(sc.nitems, sizeof(*sc.items));
+    for (i = 0; i < sc.nitems; i++)
+	sc.items[i].fn = argv[i];
+
+    (void) pthread_mutex_init(&sc.lock, NULL);
+    (void) pthread_cond_init(&sc.cond, NULL);
+    pool = rpmtsPoolStart(ts, nthreads, 0, sigCheckWorker, &sc);
+
+    for (i = 0; i < sc.nitems; i++) {
+	struct sigCheckItem_s * item = sc.items + i;
+
+	(void) pthread_mutex_lock(&sc.lock);
+	/* Check it here if no worker got to it (or there are none). */
+	if (sc.next == i) {
+	    sc.next++;
+	    (void) pthread_mutex_unlock(&sc.lock);
+	    item->res = checkPackage(qva, ts, item->fn);
+	    item->done = 1;
+	} else {
+	    while (!item->done)
+		(void) pthread_cond_wait(&sc.cond, &sc.lock);
+	    (void) pthread_mutex_unlock(&sc.lock);
+	    item->log = rpmlogCaptureFlush(item->log);
+	}
+	res += item->res;
+    }
+
+    pool = rpmtsPoolFree(pool);
+    sc.items = _free(sc.items);
+    (void) pthread_cond_destroy(&sc.cond);
+    (void) pthread_mutex_destroy(&sc.lock);
+
+    return res;
+}
+
+int rpmcliSign(rpmts ts, QVA_t qva, ARGV_const_t argv)
+{
+    if (argv == NULL) return 0;
 
     switch (qva->qva_mode) {
     case RPMSIGN_CHK_SIGNATURE:
@@ -814,20 +961,5 @@ int rpmcliSign(rpmts ts, QVA_t qva, ARGV_const_t argv)
 	break;
     }
 
-    while ((arg = *argv++) != NULL) {
-	FD_t fd;
-
-	fd = Fopen(arg, "r.ufdio");
-	if (fd == NULL || Ferror(fd)) {
-	    rpmlog(RPMLOG_ERR, _("%s: open failed: %s\n"), 
-		     arg, Fstrerror(fd));
-	    res++;
-	} else if (rpmVerifySignatures(qva, ts, fd, arg)) {
-	    res++;
-	}
-
-	if (fd != NULL) xx = Fclose(fd);
-    }
-
-    return res;
+    return checkPackages(ts, qva, argv);
 }
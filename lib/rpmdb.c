@@ -13,6 +13,7 @@
 #endif
 
 #include <regex.h>
+#include <pthread.h>
 
 #include <rpm/rpmtypes.h>
 #include <rpm/rpmurl.h>
@@ -29,7 +30,9 @@
 
 #include "lib/rpmdb_internal.h"
 #include "lib/fprint.h"
+#include "lib/rpmlock.h"
 #include "lib/header_internal.h"	/* XXX for HEADERFLAG_ALLOCATED */
+#include "rpmio/rpmio_internal.h"	/* rpmArena */
 #include "debug.h"
 
 int _rpmdb_debug = 0;
@@ -331,20 +334,6 @@ int dbiPut(dbiIndex dbi, DBC * dbcursor, DBT * key, DBT * data,
     return rc;
 }
 
-/**
- * Create and initialize item for index database set.
- * @param hdrNum	header instance in db
- * @param tagNum	tag index in header
- * @return		new item
- */
-static dbiIndexItem dbiIndexNewItem(unsigned int hdrNum, unsigned int tagNum)
-{
-    dbiIndexItem rec = xcalloc(1, sizeof(*rec));
-    rec->hdrNum = hdrNum;
-    rec->tagNum = tagNum;
-    return rec;
-}
-
 union _dbswap {
     unsigned int ui;
     unsigned char uc[4];
@@ -377,6 +366,154 @@ static inline void dbiGrowSet(dbiIndexSet set, unsigned int nrecs)
     }
 }
 
+/*
+ * Compact index records.
+ *
+ * A compact record holds the (hdrNum, tagNum) pairs sorted, as a magic
+ * byte, the number of pairs and then per pair the hdrNum delta from the
+ * previous pair followed by the tagNum (or, when the hdrNum delta is 0,
+ * the tagNum delta from the previous pair), all as LEB128 varints. The
+ * encoding is byte order independent. Raw records are always a multiple
+ * of dbi_jlen in size, compact records are padded so they never are,
+ * which lets both formats live side by side in the same index.
+ */
+#define	DBIR_COMPACT_MAGIC	0xd1
+
+static inline unsigned char * varintPut(unsigned char * t, uint32_t v)
+{
+    while (v >= 0x80) {
+	*t++ = (v & 0x7f) | 0x80;
+	v >>= 7;
+    }
+    *t++ = v;
+    return t;
+}
+
+static inline const unsigned char * varintGet(const unsigned char * s,
+		const unsigned char * se, uint32_t * vp)
+{
+    uint32_t v = 0;
+    int shift;
+
+    for (shift = 0; s < se && shift < 32; shift += 7) {
+	unsigned char c = *s++;
+	v |= (uint32_t)(c & 0x7f) << shift;
+	if (!(c & 0x80)) {
+	    *vp = v;
+	    return s;
+	}
+    }
+    return NULL;
+}
+
+/**
+ * Is retrieved data a compact index record?
+ * @param dbi		index database handle
+ * @param data		retrieved data
+ * @return		1 if compact, 0 otherwise
+ */
+static int dbiIsCompact(dbiIndex dbi, const DBT * data)
+{
+    const unsigned char * s = data->data;
+    return (dbi->dbi_jlen == 2*sizeof(int32_t) && s != NULL &&
+	    (data->size % dbi->dbi_jlen) != 0 && s[0] == DBIR_COMPACT_MAGIC);
+}
+
+/**
+ * Return number of items in retrieved data, without decoding it.
+ * @param dbi		index database handle
+ * @param data		retrieved data
+ * @return		number of index items
+ */
+static unsigned int dbiRecordCount(dbiIndex dbi, const DBT * data)
+{
+    if (dbiIsCompact(dbi, data)) {
+	const unsigned char * s = data->data;
+	uint32_t count = 0;
+	if (varintGet(s + 1, s + data->size, &count) == NULL)
+	    count = 0;
+	return count;
+    }
+    return data->size / dbi->dbi_jlen;
+}
+
+static int hdrTagNumCmp(const void * one, const void * two)
+{
+    const struct _dbiIndexItem * a = one, * b = two;
+    if (a->hdrNum != b->hdrNum)
+	return (a->hdrNum < b->hdrNum) ? -1 : 1;
+    if (a->tagNum != b->tagNum)
+	return (a->tagNum < b->tagNum) ? -1 : 1;
+    return 0;
+}
+
+/* Worst case size of a compact record of count items. */
+static inline size_t compactSize(unsigned int count)
+{
+    return 1 + 5 + count * (5 + 5) + 1;
+}
+
+/**
+ * Start a compact record.
+ * @param t		output buffer
+ * @param count		number of items that will follow
+ * @return		next output position
+ */
+static unsigned char * compactBegin(unsigned char * t, unsigned int count)
+{
+    *t++ = DBIR_COMPACT_MAGIC;
+    return varintPut(t, count);
+}
+
+/**
+ * Append one item to a compact record. Items must be appended sorted.
+ * @param t		next output position
+ * @param prev		previous item (zeroed before the first item)
+ * @param rec		item to append
+ * @return		next output position
+ */
+static unsigned char * compactPut(unsigned char * t,
+		struct _dbiIndexItem * prev, const struct _dbiIndexItem * rec)
+{
+    uint32_t hdelta = rec->hdrNum - prev->hdrNum;
+    t = varintPut(t, hdelta);
+    t = varintPut(t, (hdelta == 0) ? rec->tagNum - prev->tagNum : rec->tagNum);
+    *prev = *rec;	/* structure assignment */
+    return t;
+}
+
+/**
+ * Decode one item from a compact record.
+ * @param s		next input position
+ * @param se		end of input
+ * @param prev		previous item (zeroed before the first item)
+ * @retval rec		decoded item
+ * @return		next input position, NULL on malformed input
+ */
+static const unsigned char * compactGet(const unsigned char * s,
+		const unsigned char * se, struct _dbiIndexItem * prev,
+		struct _dbiIndexItem * rec)
+{
+    uint32_t hdelta, tagNum;
+
+    if ((s = varintGet(s, se, &hdelta)) == NULL ||
+	(s = varintGet(s, se, &tagNum)) == NULL)
+	return NULL;
+    rec->hdrNum = prev->hdrNum + hdelta;
+    rec->tagNum = (hdelta == 0) ? prev->tagNum + tagNum : tagNum;
+    *prev = *rec;	/* structure assignment */
+    return s;
+}
+
+/* Finish a compact record, padding it off a multiple of dbi_jlen. */
+static void compactEnd(dbiIndex dbi, DBT * data, unsigned char * t)
+{
+    unsigned char * tbuf = data->data;
+    if (((t - tbuf) % dbi->dbi_jlen) == 0)
+	*t++ = '\0';
+    data->size = t - tbuf;
+}
+
 /**
  * Convert retrieved data to index set.
  * @param dbi		index database handle
@@ -400,6 +537,34 @@ static int dbt2set(dbiIndex dbi, DBT * data, dbiIndexSet * setp)
     }
 
     set = xcalloc(1, sizeof(*set));
+
+    if (dbiIsCompact(dbi, data)) {
+	const unsigned char * s = data->data;
+	const unsigned char * se = s + data->size;
+	struct _dbiIndexItem prev = { 0, 0 };
+	uint32_t count = 0;
+
+	s = varintGet(s + 1, se, &count);
+	/* Each item takes at least two bytes, don't trust a bogus count. */
+	if (s == NULL || count > (size_t)(se - s) / 2)
+	    goto corrupt;
+	dbiGrowSet(set, count);
+	for (i = 0; i < count; i++) {
+	    if ((s = compactGet(s, se, &prev, set->recs + i)) == NULL)
+		goto corrupt;
+	}
+	set->count = count;
+	*setp = set;
+	return 0;
+
+corrupt:
+	rpmlog(RPMLOG_ERR, _("malformed compact record in %s index\n"),
+		rpmTagGetName(dbi->dbi_rpmtag));
+	set->count = 0;
+	*setp = set;
+	return 1;
+    }
+
     dbiGrowSet(set, data->size / dbi->dbi_jlen);
     set->count = data->size / dbi->dbi_jlen;
 
@@ -441,6 +606,7 @@ static int dbt2set(dbiIndex dbi, DBT * data, dbiIndexSet * setp)
 
 /**
  * Convert index set to database representation.
+ * Compact records are written sorted, sorting the set in place if needed.
  * @param dbi		index database handle
  * @param data		retrieved data
  * @param set		index set
@@ -455,6 +621,26 @@ static int set2dbt(dbiIndex dbi, DBT * data, dbiIndexSet set)
     if (dbi == NULL || data == NULL || set == NULL)
 	return -1;
 
+    if (dbi->dbi_compact && dbi->dbi_jlen == 2*sizeof(int32_t) &&
+	set->count > 0)
+    {
+	struct _dbiIndexItem prev = { 0, 0 };
+	unsigned char * t;
+
+	for (i = 1; i < set->count; i++) {
+	    if (hdrTagNumCmp(set->recs + i - 1, set->recs + i) > 0) {
+		qsort(set->recs, set->count, sizeof(*set->recs), hdrTagNumCmp);
+		break;
+	    }
+	}
+	t = data->data = xmalloc(compactSize(set->count));
+	t = compactBegin(t, set->count);
+	for (i = 0; i < set->count; i++)
+	    t = compactPut(t, &prev, set->recs + i);
+	compactEnd(dbi, data, t);
+	return 0;
+    }
+
     data->size = set->count * (dbi->dbi_jlen);
     if (data->size == 0) {
 	data->data = NULL;
@@ -575,6 +761,71 @@ static int dbiPruneSet(dbiIndexSet set, void * recs, int nrecs,
     return (numCopied == num);
 }
 
+/**
+ * Remove element(s) from a compact record, without decoding it to a set.
+ * The record is only replaced (by a malloc'ed copy) if items remain.
+ * @param dbi		index database handle
+ * @param data		retrieved compact record
+ * @param recs		array of items to remove from record
+ * @param nrecs		number of items
+ * @param recsize	size of an array item
+ * @param sorted	array is already sorted?
+ * @retval countp	number of items remaining
+ * @return		0 success, 1 failure (no items found or malformed)
+ */
+static int dbiPruneDbt(dbiIndex dbi, DBT * data, void * recs, int nrecs,
+		size_t recsize, int sorted, unsigned int * countp)
+{
+    const unsigned char * s = data->data;
+    const unsigned char * se = s + data->size;
+    struct _dbiIndexItem iprev = { 0, 0 };
+    struct _dbiIndexItem oprev = { 0, 0 };
+    struct _dbiIndexItem rec;
+    unsigned char * tbuf, * t;
+    uint32_t count = 0;
+    unsigned int from, to = 0;
+
+    if (nrecs > 1 && !sorted)
+	qsort(recs, nrecs, recsize, hdrNumCmp);
+
+    if ((s = varintGet(s + 1, se, &count)) == NULL)
+	return 1;
+
+    /* The count can only shrink, so the header never grows. */
+    t = tbuf = xmalloc(data->size + 1);
+    t = compactBegin(t, count);
+    for (from = 0; from < count; from++) {
+	if ((s = compactGet(s, se, &iprev, &rec)) == NULL)
+	    break;
+	if (bsearch(&rec, recs, nrecs, recsize, hdrNumCmp))
+	    continue;
+	t = compactPut(t, &oprev, &rec);
+	to++;
+    }
+
+    if (s == NULL || to == count) {
+	free(tbuf);
+	return 1;
+    }
+
+    /* Rewrite the header now that the real count is known. */
+    if (to > 0) {
+	unsigned char hdr[1 + 5];
+	unsigned char * body = varintPut(tbuf + 1, count);
+	size_t hlen = compactBegin(hdr, to) - hdr;
+	size_t blen = t - body;
+
+	memmove(tbuf + hlen, body, blen);
+	memcpy(tbuf, hdr, hlen);
+	data->data = tbuf;
+	compactEnd(dbi, data, tbuf + hlen + blen);
+    } else
+	free(tbuf);
+
+    *countp = to;
+    return 0;
+}
+
 /* XXX transaction.c */
 unsigned int dbiIndexSetCount(dbiIndexSet set) {
     return set->count;
@@ -599,6 +850,232 @@ dbiIndexSet dbiFreeIndexSet(dbiIndexSet set) {
     return set;
 }
 
+/**
+ * Index updates for a single key, accumulated in a write batch.
+ */
+typedef struct dbiDelta_s * dbiDelta;
+struct dbiDelta_s {
+    DBT key;			/*!< index key (malloc'ed copy) */
+    struct _dbiIndexSet add;	/*!< records to add */
+    struct _dbiIndexSet del;	/*!< records to remove */
+};
+
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+#define HASHTYPE dbiDeltaHash
+#define HTKEYTYPE const DBT *
+#define HTDATATYPE dbiDelta
+#include "lib/rpmhash.H"
+#include "lib/rpmhash.C"
+
+/**
+ */
+struct dbiBatch_s {
+    dbiDeltaHash ht;		/*!< key -> pending updates */
+    dbiDelta * deltas;		/*!< pending updates, in insertion order */
+    int ndeltas;		/*!< no. of keys with pending updates */
+    int nalloced;		/*!< size of deltas array */
+};
+
+static unsigned int dbtHash(const DBT * key)
+{
+    /* Jenkins One-at-a-time hash, see hashFunctionString() */
+    const unsigned char * p = key->data;
+    unsigned int hash = 0xe4721b68;
+
+    for (unsigned int i = 0; i < key->size; i++) {
+	hash += p[i];
+	hash += (hash << 10);
+	hash ^= (hash >> 6);
+    }
+    hash += (hash << 3);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+    return hash;
+}
+
+static int dbtCmp(const DBT * a, const DBT * b)
+{
+    size_t n = (a->size < b->size) ? a->size : b->size;
+    int rc = memcmp(a->data, b->data, n);
+    if (rc == 0)
+	rc = (a->size > b->size) - (a->size < b->size);
+    return rc;
+}
+
+static int deltaCmp(const void * one, const void * two)
+{
+    const dbiDelta * a = one, * b = two;
+    return dbtCmp(&(*a)->key, &(*b)->key);
+}
+
+static dbiDelta deltaFree(dbiDelta d)
+{
+    if (d) {
+	free(d->key.data);
+	free(d->add.recs);
+	free(d->del.recs);
+	free(d);
+    }
+    return NULL;
+}
+
+/**
+ * Return pending updates for a key, creating the batch entry if needed.
+ * @param dbi		index database handle
+ * @param key		index key
+ * @return		pending updates for key
+ */
+static dbiDelta dbiBatchDelta(dbiIndex dbi, const DBT * key)
+{
+    dbiBatch batch = dbi->dbi_batch;
+    dbiDelta * found = NULL;
+    dbiDelta d;
+
+    if (batch == NULL) {
+	batch = dbi->dbi_batch = xcalloc(1, sizeof(*batch));
+	batch->ht = dbiDeltaHashCreate(8191, dbtHash, dbtCmp, NULL, deltaFree);
+    }
+
+    if (dbiDeltaHashGetEntry(batch->ht, key, &found, NULL, NULL))
+	return found[0];
+
+    d = xcalloc(1, sizeof(*d));
+    d->key.size = key->size;
+    d->key.data = memcpy(xmalloc(key->size), key->data, key->size);
+    dbiDeltaHashAddEntry(batch->ht, &d->key, d);
+
+    if (batch->ndeltas == batch->nalloced) {
+	batch->nalloced = batch->nalloced ? 2 * batch->nalloced : 256;
+	batch->deltas = xrealloc(batch->deltas,
+				 batch->nalloced * sizeof(*batch->deltas));
+    }
+    batch->deltas[batch->ndeltas++] = d;
+    return d;
+}
+
+/**
+ * Queue addition of an item to an index key.
+ * @param dbi		index database handle
+ * @param key		index key
+ * @param rec		item to add
+ */
+static void dbiBatchAdd(dbiIndex dbi, const DBT * key, dbiIndexItem rec)
+{
+    dbiDelta d = dbiBatchDelta(dbi, key);
+    (void) dbiAppendSet(&d->add, rec, 1, sizeof(*rec), 0);
+}
+
+/**
+ * Queue removal of all items of a header instance from an index key.
+ * @param dbi		index database handle
+ * @param key		index key
+ * @param rec		item (header instance) to remove
+ */
+static void dbiBatchDel(dbiIndex dbi, const DBT * key, dbiIndexItem rec)
+{
+    dbiDelta d = dbiBatchDelta(dbi, key);
+    /* Cancel out (unlikely) additions from the same batch first. */
+    if (d->add.count > 0)
+	(void) dbiPruneSet(&d->add, rec, 1, sizeof(*rec), 1);
+    (void) dbiAppendSet(&d->del, rec, 1, sizeof(*rec), 0);
+}
+
+int dbiFlushBatch(dbiIndex dbi)
+{
+    dbiBatch batch;
+    DBC * dbcursor = NULL;
+    DBT data;
+    int ret = 0;
+    int xx;
+
+    if (dbi == NULL || (batch = dbi->dbi_batch) == NULL)
+	return 0;
+
+    /* Detach first, the cursor opened below must not flush again. */
+    dbi->dbi_batch = NULL;
+
+    /* Write in key order, keeping btree access sequential. */
+    qsort(batch->deltas, batch->ndeltas, sizeof(*batch->deltas), deltaCmp);
+
+    memset(&data, 0, sizeof(data));
+    xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, DB_WRITECURSOR);
+
+    for (int i = 0; i < batch->ndeltas; i++) {
+	dbiDelta d = batch->deltas[i];
+	DBT key = d->key;	/* structure assignment */
+	dbiIndexSet set = NULL;
+	unsigned int count = 0;
+	int changed = 0;
+	int rc;
+
+	rc = dbiGet(dbi, dbcursor, &key, &data, DB_SET);
+	if (rc == 0) {			/* success */
+	    /* Pure removals from compact records are pruned without decoding. */
+	    if (d->add.count == 0 && dbi->dbi_compact && dbiIsCompact(dbi, &data)) {
+		changed = (dbiPruneDbt(dbi, &data, d->del.recs, d->del.count,
+				       sizeof(*d->del.recs), 0, &count) == 0);
+	    } else
+		(void) dbt2set(dbi, &data, &set);
+	} else if (rc != DB_NOTFOUND) {	/* error */
+	    rpmlog(RPMLOG_ERR,
+		_("error(%d) getting \"%s\" records from %s index\n"),
+		rc, (char*)key.data, rpmTagGetName(dbi->dbi_rpmtag));
+	    ret += 1;
+	    continue;
+	}
+
+	if (set == NULL && !changed)	/* not found, or nothing pruned */
+	    set = xcalloc(1, sizeof(*set));
+
+	if (set != NULL) {
+	    if (d->del.count > 0 && set->count > 0)
+		changed |= (dbiPruneSet(set, d->del.recs, d->del.count,
+					sizeof(*d->del.recs), 0) == 0);
+	    if (d->add.count > 0) {
+		(void) dbiAppendSet(set, d->add.recs, d->add.count,
+				    sizeof(*d->add.recs), 0);
+		changed = 1;
+	    }
+	    count = set->count;
+	}
+
+	/* If nothing changed, then don't bother updating. */
+	if (changed && count > 0) {
+	    if (set != NULL)
+		(void) set2dbt(dbi, &data, set);
+	    key = d->key;	/* structure assignment */
+	    rc = dbiPut(dbi, dbcursor, &key, &data, DB_KEYLAST);
+	    if (rc) {
+		rpmlog(RPMLOG_ERR,
+			_("error(%d) storing record \"%s\" into %s\n"),
+			rc, (char*)key.data, rpmTagGetName(dbi->dbi_rpmtag));
+		ret += 1;
+	    }
+	    data.data = _free(data.data);
+	    data.size = 0;
+	} else if (changed) {
+	    rc = dbiDel(dbi, dbcursor, &key, &data, 0);
+	    if (rc) {
+		rpmlog(RPMLOG_ERR,
+			_("error(%d) removing record \"%s\" from %s\n"),
+			rc, (char*)key.data, rpmTagGetName(dbi->dbi_rpmtag));
+		ret += 1;
+	    }
+	}
+	set = dbiFreeIndexSet(set);
+    }
+
+    xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
+
+    batch->ht = dbiDeltaHashFree(batch->ht);
+    free(batch->deltas);
+    free(batch);
+
+    return ret;
+}
+
 typedef struct miRE_s {
     rpmTag		tag;		/*!< header tag */
     rpmMireMode		mode;		/*!< pattern match mode */
@@ -632,6 +1109,8 @@ struct rpmdbMatchIterator_s {
     miRE		mi_re;
     rpmts		mi_ts;
     rpmRC (*mi_hdrchk) (rpmts ts, const void * uh, size_t uc, char ** msg);
+    int			mi_snap;	/* served from snapshot? */
+    rpmArena		mi_arena;	/* holds the iterator and its key */
 
 };
 
@@ -639,6 +1118,33 @@ static rpmdb rpmdbRock;
 
 static rpmdbMatchIterator rpmmiRock;
 
+/* Iterators may come and go in several threads (see rpmtsCheck). */
+static pthread_mutex_t rpmmiRockLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Chain an iterator for teardown on abnormal exit. */
+static void miChain(rpmdbMatchIterator mi)
+{
+    (void) pthread_mutex_lock(&rpmmiRockLock);
+    mi->mi_next = rpmmiRock;
+    rpmmiRock = mi;
+    (void) pthread_mutex_unlock(&rpmmiRockLock);
+}
+
+static void miUnchain(rpmdbMatchIterator mi)
+{
+    rpmdbMatchIterator * prev, next;
+
+    (void) pthread_mutex_lock(&rpmmiRockLock);
+    prev = &rpmmiRock;
+    while ((next = *prev) != NULL && next != mi)
+	prev = &next->mi_next;
+    if (next) {
+	*prev = next->mi_next;
+	next->mi_next = NULL;
+    }
+    (void) pthread_mutex_unlock(&rpmmiRockLock);
+}
+
 int rpmdbCheckTerminate(int terminate)
 {
     sigset_t newMask, oldMask;
@@ -661,11 +1167,15 @@ int rpmdbCheckTerminate(int terminate)
 	rpmdb db;
 	rpmdbMatchIterator mi;
 
+	(void) pthread_mutex_lock(&rpmmiRockLock);
 	while ((mi = rpmmiRock) != NULL) {
 	    rpmmiRock = mi->mi_next;
 	    mi->mi_next = NULL;
+	    (void) pthread_mutex_unlock(&rpmmiRockLock);
 	    mi = rpmdbFreeIterator(mi);
+	    (void) pthread_mutex_lock(&rpmmiRockLock);
 	}
+	(void) pthread_mutex_unlock(&rpmmiRockLock);
 
 	while ((db = rpmdbRock) != NULL) {
 	    rpmdbRock = db->db_next;
@@ -803,6 +1313,7 @@ int rpmdbCloseDBI(rpmdb db, rpmTag rpmtag)
 	    continue;
 	if (db->_dbi[dbix] != NULL) {
 	    int xx;
+	    xx = dbiFlushBatch(db->_dbi[dbix]);
 	   		/* FIX: double indirection. */
 	    xx = dbiClose(db->_dbi[dbix], 0);
 	    if (xx && rc == 0) rc = xx;
@@ -813,72 +1324,339 @@ int rpmdbCloseDBI(rpmdb db, rpmTag rpmtag)
     return rc;
 }
 
-/* XXX query.c, rpminstall.c, verify.c */
-int rpmdbClose(rpmdb db)
+/**
+ * Return path of a file kept in the database directory.
+ * @param db		rpm database
+ * @param fnmacro	macro expanding to the file name
+ * @param suffix	file name suffix (or NULL)
+ * @return		(malloc'ed) path, NULL if the macro is unset
+ */
+static char * dbFilePath(rpmdb db, const char * fnmacro, const char * suffix)
+{
+    char * fn = rpmExpand(fnmacro, NULL);
+    char * path = NULL;
+
+    if (fn && *fn != '\0') {
+	const char * root = db->db_root;
+	char * home;
+
+	if ((root[0] == '/' && root[1] == '\0') || db->db_chrootDone)
+	    root = NULL;
+	home = rpmGenPath(root, db->db_home, NULL);
+	path = rpmGetPath(home, "/", fn, suffix, NULL);
+	free(home);
+    }
+    free(fn);
+    return path;
+}
+
+/* XXX query.c, rpminstall.c, verify.c */
+int rpmdbClose(rpmdb db)
+{
+    rpmdb * prev, next;
+    int dbix;
+    int rc = 0;
+
+    if (db == NULL)
+	goto exit;
+
+    (void) rpmdbUnlink(db, RPMDBG_M("rpmdbClose"));
+
+    if (db->nrefs > 0)
+	goto exit;
+
+    if (db->_dbi)
+    for (dbix = db->db_ndbi; --dbix >= 0; ) {
+	int xx;
+	if (db->_dbi[dbix] == NULL)
+	    continue;
+	xx = dbiFlushBatch(db->_dbi[dbix]);
+    	xx = dbiClose(db->_dbi[dbix], 0);
+	if (xx && rc == 0) rc = xx;
+    	db->_dbi[dbix] = NULL;
+    }
+    db->db_snap = rpmdbSnapFree(db->db_snap);
+    if (db->db_sigcache) {
+	char * fn = dbFilePath(db, "%{?_rpmdb_sigcache}", NULL);
+	(void) rpmSigCacheWrite(db->db_sigcache, fn);
+	free(fn);
+	db->db_sigcache = rpmSigCacheFree(db->db_sigcache);
+    }
+    db->db_hdrcache = rpmHdrCacheFree(db->db_hdrcache);
+    db->db_errpfx = _free(db->db_errpfx);
+    db->db_root = _free(db->db_root);
+    db->db_home = _free(db->db_home);
+    db->db_bits = PBM_FREE(db->db_bits);
+    db->_dbi = _free(db->_dbi);
+
+    prev = &rpmdbRock;
+    while ((next = *prev) != NULL && next != db)
+	prev = &next->db_next;
+    if (next) {
+        *prev = next->db_next;
+	next->db_next = NULL;
+    }
+
+    (void) pthread_mutex_destroy(&db->db_lock);
+    db = _free(db);
+
+    dbiTagsFree();
+
+exit:
+    (void) rpmsqEnable(-SIGHUP,	NULL);
+    (void) rpmsqEnable(-SIGINT,	NULL);
+    (void) rpmsqEnable(-SIGTERM,NULL);
+    (void) rpmsqEnable(-SIGQUIT,NULL);
+    (void) rpmsqEnable(-SIGPIPE,NULL);
+    return rc;
+}
+
+int rpmdbSync(rpmdb db)
+{
+    int dbix;
+    int rc = 0;
+
+    if (db == NULL) return 0;
+    /* While batching, syncing is deferred to rpmdbEndBatch(). */
+    if (db->db_batch) return 0;
+    for (dbix = 0; dbix < db->db_ndbi; dbix++) {
+	int xx;
+	if (db->_dbi[dbix] == NULL)
+	    continue;
+	if (db->_dbi[dbix]->dbi_no_dbsync)
+	    continue;
+    	xx = dbiSync(db->_dbi[dbix], 0);
+	if (xx && rc == 0) rc = xx;
+    }
+    return rc;
+}
+
+int rpmdbBeginBatch(rpmdb db)
+{
+    if (db == NULL) return -2;
+    db->db_batch = 1;
+    return 0;
+}
+
+int rpmdbFlushBatch(rpmdb db)
+{
+    int dbix;
+    int rc = 0;
+
+    if (db == NULL) return 0;
+    for (dbix = 0; dbix < db->db_ndbi; dbix++) {
+	int xx = dbiFlushBatch(db->_dbi[dbix]);
+	if (xx && rc == 0) rc = xx;
+    }
+    return rc;
+}
+
+int rpmdbEndBatch(rpmdb db)
+{
+    sigset_t signalMask;
+    int rc, xx;
+
+    if (db == NULL) return 0;
+
+    (void) blockSignals(&signalMask);
+    rc = rpmdbFlushBatch(db);
+    db->db_batch = 0;
+    xx = rpmdbSync(db);
+    if (xx && rc == 0) rc = xx;
+    (void) unblockSignals(&signalMask);
+    return rc;
+}
+
+/**
+ * Return path of the snapshot (or a file next to it).
+ * @param db		rpm database
+ * @param suffix	file name suffix (or NULL)
+ * @return		(malloc'ed) path, NULL if snapshots are disabled
+ */
+static char * snapPath(rpmdb db, const char * suffix)
+{
+    return dbFilePath(db, "%{?_rpmdb_snapshot}", suffix);
+}
+
+rpmSigCache rpmdbSigCache(rpmdb db)
+{
+    if (db == NULL)
+	return NULL;
+
+    if (!db->db_sigcacheinit) {
+	char * fn = dbFilePath(db, "%{?_rpmdb_sigcache}", NULL);
+	db->db_sigcacheinit = 1;
+	if (fn != NULL)
+	    db->db_sigcache = rpmSigCacheOpen(fn);
+	free(fn);
+    }
+    return db->db_sigcache;
+}
+
+/**
+ * Map the snapshot of a database opened read-only, if it is current.
+ * @param db		rpm database
+ * @return		snapshot, NULL if unusable
+ */
+static rpmdbSnap snapAttach(rpmdb db)
+{
+    char * fn = snapPath(db, NULL);
+    char * pending = snapPath(db, ".pending");
+    rpmdbSnap snap = NULL;
+
+    if (fn == NULL)
+	goto exit;
+
+    /*
+     * A pending snapshot is left behind by a transaction. While that is
+     * still running the snapshot is its consistent "before" state, but
+     * the transaction's own scriptlets (same session) need to see its
+     * changes. Without a running transaction, it crashed: stale.
+     */
+    if (access(pending, F_OK) == 0) {
+	pid_t pid = rpmtsLockHolder(db->db_chrootDone ? "/" : db->db_root);
+	if (pid <= 0 || getsid(pid) == getsid(0))
+	    goto exit;
+    }
+
+    if ((snap = rpmdbSnapOpen(fn)) != NULL)
+	rpmlog(RPMLOG_DEBUG, "using snapshot %s\n", fn);
+
+exit:
+    free(pending);
+    free(fn);
+    return snap;
+}
+
+/**
+ * Remove the snapshot before the first database change, unless it is
+ * pending regeneration anyway.
+ * @param db		rpm database
+ */
+static void snapInvalidate(rpmdb db)
+{
+    char * fn;
+
+    if (db->db_snapdirty)
+	return;
+    db->db_snapdirty = 1;
+    if ((fn = snapPath(db, NULL)) != NULL) {
+	if (unlink(fn) == 0)
+	    rpmlog(RPMLOG_DEBUG, "removed snapshot %s\n", fn);
+	free(fn);
+    }
+}
+
+int rpmdbSnapshotBegin(rpmdb db)
+{
+    char * pending;
+    int rc = 0;
+
+    if (db == NULL || (pending = snapPath(db, ".pending")) == NULL)
+	return 0;
+
+    if (!db->db_snapdirty && access(pending, F_OK) == 0) {
+	/*
+	 * The marker of a transaction that didn't finish: its changes may
+	 * already be in the database, the snapshot is stale. Remove it before
+	 * taking the marker over, readers can't tell the two apart.
+	 */
+	snapInvalidate(db);
+    } else if (!db->db_snapdirty) {
+	int fdno = open(pending, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fdno < 0) {
+	    /* Without the marker, the snapshot must go now. */
+	    snapInvalidate(db);
+	    rc = 1;
+	} else
+	    (void) close(fdno);
+	db->db_snapdirty = 1;
+    }
+    free(pending);
+    return rc;
+}
+
+int rpmdbSnapshotWrite(rpmdb db)
 {
-    rpmdb * prev, next;
+    rpmdbSnapWriter w;
+    DBC * dbcursor = NULL;
+    DBT key, data;
+    dbiIndex dbi;
+    char * fn = NULL;
+    char * pending = NULL;
     int dbix;
-    int rc = 0;
+    int rc = 1;
+    int xx;
 
-    if (db == NULL)
+    if (db == NULL || (fn = snapPath(db, NULL)) == NULL)
+	return 0;
+    pending = snapPath(db, ".pending");
+
+    if ((w = rpmdbSnapCreate(fn)) == NULL)
 	goto exit;
 
-    (void) rpmdbUnlink(db, RPMDBG_M("rpmdbClose"));
+    memset(&key, 0, sizeof(key));
+    memset(&data, 0, sizeof(data));
 
-    if (db->nrefs > 0)
+    if ((dbi = dbiOpen(db, RPMDBI_PACKAGES, 0)) == NULL)
 	goto exit;
+    xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, 0);
+    while (dbiGet(dbi, dbcursor, &key, &data, DB_NEXT) == 0) {
+	union _dbswap hdrNum;
 
-    if (db->_dbi)
-    for (dbix = db->db_ndbi; --dbix >= 0; ) {
-	int xx;
-	if (db->_dbi[dbix] == NULL)
+	memcpy(&hdrNum.ui, key.data, sizeof(hdrNum.ui));
+	if (dbiByteSwapped(dbi) == 1)
+	    _DBSWAP(hdrNum);
+	/* Instance 0 holds the largest instance, not a header. */
+	if (hdrNum.ui == 0)
 	    continue;
-    	xx = dbiClose(db->_dbi[dbix], 0);
-	if (xx && rc == 0) rc = xx;
-    	db->_dbi[dbix] = NULL;
+	if (rpmdbSnapAddHeader(w, hdrNum.ui, data.data, data.size))
+	    break;
     }
-    db->db_errpfx = _free(db->db_errpfx);
-    db->db_root = _free(db->db_root);
-    db->db_home = _free(db->db_home);
-    db->db_bits = PBM_FREE(db->db_bits);
-    db->_dbi = _free(db->_dbi);
+    xx = dbiCclose(dbi, dbcursor, 0);
+    dbcursor = NULL;
 
-    prev = &rpmdbRock;
-    while ((next = *prev) != NULL && next != db)
-	prev = &next->db_next;
-    if (next) {
-        *prev = next->db_next;
-	next->db_next = NULL;
-    }
+    if (dbiTags.tags != NULL)
+    for (dbix = 0; dbix < dbiTags.max; dbix++) {
+	rpmTag rpmtag = dbiTags.tags[dbix];
 
-    db = _free(db);
+	if (rpmtag == RPMDBI_PACKAGES || isTemporaryDB(rpmtag))
+	    continue;
+	/* Keys with duplicate records aren't supported, use the db. */
+	if ((dbi = dbiOpen(db, rpmtag, 0)) == NULL || dbi->dbi_permit_dups)
+	    continue;
 
-    dbiTagsFree();
+	memset(&key, 0, sizeof(key));
+	memset(&data, 0, sizeof(data));
+	xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, 0);
+	while (dbiGet(dbi, dbcursor, &key, &data, DB_NEXT) == 0) {
+	    dbiIndexSet set = NULL;
+	    (void) dbt2set(dbi, &data, &set);
+	    if (set != NULL)
+		xx = rpmdbSnapAddKey(w, key.data, key.size, set);
+	    set = dbiFreeIndexSet(set);
+	}
+	xx = dbiCclose(dbi, dbcursor, 0);
+	dbcursor = NULL;
+	xx = rpmdbSnapEndIndex(w, rpmtag);
+    }
+    rc = 0;
 
 exit:
-    (void) rpmsqEnable(-SIGHUP,	NULL);
-    (void) rpmsqEnable(-SIGINT,	NULL);
-    (void) rpmsqEnable(-SIGTERM,NULL);
-    (void) rpmsqEnable(-SIGQUIT,NULL);
-    (void) rpmsqEnable(-SIGPIPE,NULL);
-    return rc;
-}
-
-int rpmdbSync(rpmdb db)
-{
-    int dbix;
-    int rc = 0;
-
-    if (db == NULL) return 0;
-    for (dbix = 0; dbix < db->db_ndbi; dbix++) {
-	int xx;
-	if (db->_dbi[dbix] == NULL)
-	    continue;
-	if (db->_dbi[dbix]->dbi_no_dbsync)
-	    continue;
-    	xx = dbiSync(db->_dbi[dbix], 0);
-	if (xx && rc == 0) rc = xx;
+    if (w != NULL && rpmdbSnapFinish(w, (rc == 0)))
+	rc = 1;
+    if (rc == 0) {
+	rpmlog(RPMLOG_DEBUG, "wrote snapshot %s\n", fn);
+	(void) unlink(pending);
+	db->db_snapdirty = 0;
+    } else {
+	/* Keep the stale snapshot away from readers. */
+	(void) unlink(fn);
+	(void) unlink(pending);
+	db->db_snapdirty = 1;
     }
+    free(pending);
+    free(fn);
     return rc;
 }
 
@@ -899,6 +1677,13 @@ rpmdb newRpmdb(const char * root,
 
     *db = dbTemplate;	/* structure assignment */
 
+    {	pthread_mutexattr_t attr;
+	(void) pthread_mutexattr_init(&attr);
+	(void) pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	(void) pthread_mutex_init(&db->db_lock, &attr);
+	(void) pthread_mutexattr_destroy(&attr);
+    }
+
     db->_dbi = NULL;
 
     if (!(perms & 0600)) perms = 0644;	/* XXX sanity */
@@ -917,6 +1702,7 @@ rpmdb newRpmdb(const char * root,
 	rpmlog(RPMLOG_ERR, _("no dbpath has been set\n"));
 	db->db_root = _free(db->db_root);
 	db->db_home = _free(db->db_home);
+	(void) pthread_mutex_destroy(&db->db_lock);
 	db = _free(db);
 	return NULL;
     }
@@ -964,6 +1750,14 @@ static int openDatabase(const char * prefix,
 
     db->db_api = _dbapi;
 
+    /* Read-only lookups are served from a current snapshot, if any. */
+    if ((mode & O_ACCMODE) == O_RDONLY && !justCheck &&
+	(db->db_snap = snapAttach(db)) != NULL)
+    {
+	rc = 0;
+	goto exit;
+    }
+
     {	int dbix;
 
 	rc = 0;
@@ -1105,7 +1899,8 @@ static int rpmdbFindByFile(rpmdb db, const char * filespec,
     dbiIndex dbi = NULL;
     DBC * dbcursor;
     dbiIndexSet allMatches = NULL;
-    dbiIndexItem rec = NULL;
+    struct _dbiIndexItem item = { .hdrNum = 0, .tagNum = 0 };
+    dbiIndexItem rec = &item;
     unsigned int i;
     int rc;
     int xx;
@@ -1129,8 +1924,12 @@ static int rpmdbFindByFile(rpmdb db, const char * filespec,
     fp1 = fpLookup(fpc, dirName, baseName, 1);
     free(dirName);
 
-    dbi = dbiOpen(db, RPMTAG_BASENAMES, 0);
-    if (dbi != NULL) {
+    if (rpmdbSnapHasTag(db->db_snap, RPMTAG_BASENAMES)) {
+	/* XXX "/" fixup, as below. */
+	size_t blen = strlen(baseName);
+	rc = rpmdbSnapGet(db->db_snap, RPMTAG_BASENAMES, baseName,
+			  (blen ? blen : 1), &allMatches);
+    } else if ((dbi = dbiOpen(db, RPMTAG_BASENAMES, 0)) != NULL) {
 	dbcursor = NULL;
 	xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, 0);
 
@@ -1161,7 +1960,6 @@ static int rpmdbFindByFile(rpmdb db, const char * filespec,
     }
 
     *matches = xcalloc(1, sizeof(**matches));
-    rec = dbiIndexNewItem(0, 0);
     i = 0;
     if (allMatches != NULL)
     while (i < allMatches->count) {
@@ -1215,7 +2013,6 @@ static int rpmdbFindByFile(rpmdb db, const char * filespec,
 	h = headerFree(h);
     }
 
-    rec = _free(rec);
     allMatches = dbiFreeIndexSet(allMatches);
 
     fpc = fpCacheFree(fpc);
@@ -1259,14 +2056,7 @@ int rpmdbCountPackages(rpmdb db, const char * name)
 #endif
 
     if (rc == 0) {		/* success */
-	dbiIndexSet matches;
-	/* FIX: matches might be NULL */
-	matches = NULL;
-	(void) dbt2set(dbi, &data, &matches);
-	if (matches) {
-	    rc = dbiIndexSetCount(matches);
-	    matches = dbiFreeIndexSet(matches);
-	}
+	rc = dbiRecordCount(dbi, &data);
     } else
     if (rc == DB_NOTFOUND) {	/* not found */
 	rc = 0;
@@ -1287,7 +2077,8 @@ int rpmdbCountPackages(rpmdb db, const char * name)
 
 /**
  * Attempt partial matches on name[-version[-release]] strings.
- * @param dbi		index database handle (always RPMTAG_NAME)
+ * @param db		rpm database
+ * @param dbi		index database handle (always RPMTAG_NAME, NULL for snapshot)
  * @param dbcursor	index database cursor
  * @param key		search key/length/flags
  * @param data		search data/length/flags
@@ -1297,7 +2088,7 @@ int rpmdbCountPackages(rpmdb db, const char * name)
  * @retval matches	set of header instances that match
  * @return 		RPMRC_OK on match, RPMRC_NOMATCH or RPMRC_FAIL
  */
-static rpmRC dbiFindMatches(dbiIndex dbi, DBC * dbcursor,
+static rpmRC dbiFindMatches(rpmdb db, dbiIndex dbi, DBC * dbcursor,
 		DBT * key, DBT * data,
 		const char * name,
 		const char * version,
@@ -1311,10 +2102,16 @@ static rpmRC dbiFindMatches(dbiIndex dbi, DBC * dbcursor,
     key->data = (void *) name;
     key->size = strlen(name);
 
-    rc = dbiGet(dbi, dbcursor, key, data, DB_SET);
+    if (dbi == NULL) {		/* served from snapshot */
+	rc = rpmdbSnapGet(db->db_snap, RPMTAG_NAME, key->data, key->size,
+			  matches);
+    } else {
+	rc = dbiGet(dbi, dbcursor, key, data, DB_SET);
+	if (rc == 0)
+	    (void) dbt2set(dbi, data, matches);
+    }
 
     if (rc == 0) {		/* success */
-	(void) dbt2set(dbi, data, matches);
 	if (version == NULL && release == NULL)
 	    return RPMRC_OK;
     } else
@@ -1336,8 +2133,7 @@ static rpmRC dbiFindMatches(dbiIndex dbi, DBC * dbcursor,
 	if (recoff == 0)
 	    continue;
 
-	mi = rpmdbInitIterator(dbi->dbi_rpmdb,
-			RPMDBI_PACKAGES, &recoff, sizeof(recoff));
+	mi = rpmdbInitIterator(db, RPMDBI_PACKAGES, &recoff, sizeof(recoff));
 
 	/* Set iterator selectors for version/release if available. */
 	if (version &&
@@ -1378,7 +2174,8 @@ exit:
  * Lookup by name, name-version, and finally by name-version-release.
  * Both version and release can be patterns.
  * @todo Name must be an exact match, as name is a db key.
- * @param dbi		index database handle (always RPMTAG_NAME)
+ * @param db		rpm database
+ * @param dbi		index database handle (always RPMTAG_NAME, NULL for snapshot)
  * @param dbcursor	index database cursor
  * @param key		search key/length/flags
  * @param data		search data/length/flags
@@ -1386,7 +2183,8 @@ exit:
  * @retval matches	set of header instances that match
  * @return 		RPMRC_OK on match, RPMRC_NOMATCH or RPMRC_FAIL
  */
-static rpmRC dbiFindByLabel(dbiIndex dbi, DBC * dbcursor, DBT * key, DBT * data,
+static rpmRC dbiFindByLabel(rpmdb db, dbiIndex dbi, DBC * dbcursor,
+		DBT * key, DBT * data,
 		const char * arg, dbiIndexSet * matches)
 {
     const char * release;
@@ -1399,7 +2197,7 @@ static rpmRC dbiFindByLabel(dbiIndex dbi, DBC * dbcursor, DBT * key, DBT * data,
     if (arg == NULL || strlen(arg) == 0) return RPMRC_NOTFOUND;
 
     /* did they give us just a name? */
-    rc = dbiFindMatches(dbi, dbcursor, key, data, arg, NULL, NULL, matches);
+    rc = dbiFindMatches(db, dbi, dbcursor, key, data, arg, NULL, NULL, matches);
     if (rc != RPMRC_NOTFOUND) return rc;
 
     /* FIX: double indirection */
@@ -1432,7 +2230,7 @@ static rpmRC dbiFindByLabel(dbiIndex dbi, DBC * dbcursor, DBT * key, DBT * data,
     }
 
     *s = '\0';
-    rc = dbiFindMatches(dbi, dbcursor, key, data, localarg, s + 1, NULL, matches);
+    rc = dbiFindMatches(db, dbi, dbcursor, key, data, localarg, s + 1, NULL, matches);
     if (rc != RPMRC_NOTFOUND) goto exit;
 
     /* FIX: double indirection */
@@ -1465,7 +2263,7 @@ static rpmRC dbiFindByLabel(dbiIndex dbi, DBC * dbcursor, DBT * key, DBT * data,
 
     *s = '\0';
    	/* FIX: *matches may be NULL. */
-    rc = dbiFindMatches(dbi, dbcursor, key, data, localarg, s + 1, release, matches);
+    rc = dbiFindMatches(db, dbi, dbcursor, key, data, localarg, s + 1, release, matches);
 exit:
     free(localarg);
     return rc;
@@ -1513,6 +2311,7 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
 
 	if (data->data != NULL && rpmrc != RPMRC_FAIL) {
 	    (void) blockSignals(&signalMask);
+	    snapInvalidate(dbi->dbi_rpmdb);
 	    rc = dbiPut(dbi, mi->mi_dbc, key, data, DB_KEYLAST);
 	    if (rc) {
 		rpmlog(RPMLOG_ERR,
@@ -1531,9 +2330,14 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
     return rc;
 }
 
-rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
+/**
+ * Destroy an iterator (with the database locked).
+ * @param mi		rpm database iterator
+ * @return		NULL always
+ */
+static rpmdbMatchIterator miFree(rpmdbMatchIterator mi)
 {
-    rpmdbMatchIterator * prev, next;
+    rpmArena arena;
     dbiIndex dbi;
     int xx;
     int i;
@@ -1541,17 +2345,14 @@ rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
     if (mi == NULL)
 	return NULL;
 
-    prev = &rpmmiRock;
-    while ((next = *prev) != NULL && next != mi)
-	prev = &next->mi_next;
-    if (next) {
-	*prev = next->mi_next;
-	next->mi_next = NULL;
-    }
+    miUnchain(mi);
 
-    dbi = dbiOpen(mi->mi_db, RPMDBI_PACKAGES, 0);
-    if (dbi == NULL)	/* XXX can't happen */
-	return NULL;
+    dbi = NULL;
+    if (!mi->mi_snap) {
+	dbi = dbiOpen(mi->mi_db, RPMDBI_PACKAGES, 0);
+	if (dbi == NULL)	/* XXX can't happen */
+	    return NULL;
+    }
 
     xx = miFreeHeader(mi, dbi);
 
@@ -1572,13 +2373,30 @@ rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
     mi->mi_re = _free(mi->mi_re);
 
     mi->mi_set = dbiFreeIndexSet(mi->mi_set);
-    mi->mi_keyp = _free(mi->mi_keyp);
+    mi->mi_keyp = NULL;
     mi->mi_db = rpmdbUnlink(mi->mi_db, RPMDBG_M("matchIterator"));
 
-    mi = _free(mi);
-
     (void) rpmdbCheckSignals();
 
+    /* The iterator itself lives in its arena, this must come last. */
+    arena = mi->mi_arena;
+    mi = NULL;
+    arena = rpmArenaFree(arena);
+
+    return NULL;
+}
+
+rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
+{
+    rpmdb db;
+
+    if (mi == NULL)
+	return NULL;
+
+    db = mi->mi_db;
+    (void) pthread_mutex_lock(&db->db_lock);
+    mi = miFree(mi);
+    (void) pthread_mutex_unlock(&db->db_lock);
     return mi;
 }
 
@@ -1940,7 +2758,57 @@ int rpmdbSetHdrChk(rpmdbMatchIterator mi, rpmts ts,
 
 
 /* FIX: mi->mi_key.data may be NULL */
-Header rpmdbNextIterator(rpmdbMatchIterator mi)
+/**
+ * Return next header blob of an iterator served from a snapshot.
+ * @param mi		rpm database iterator
+ * @retval uhp		header blob
+ * @retval uhlenp	header blob size
+ * @return		0 on success, 1 if header instance is unchanged, -1 at end
+ */
+static int miSnapNext(rpmdbMatchIterator mi, void ** uhp, size_t * uhlenp)
+{
+    rpmdbSnap snap = mi->mi_db->db_snap;
+    const void * uh = NULL;
+    size_t uhlen = 0;
+
+    do {
+	if (mi->mi_set) {
+	    if (!(mi->mi_setx < mi->mi_set->count))
+		return -1;
+	    mi->mi_offset = dbiIndexRecordOffset(mi->mi_set, mi->mi_setx);
+	    mi->mi_filenum = dbiIndexRecordFileNumber(mi->mi_set, mi->mi_setx);
+	} else if (mi->mi_keyp) {
+	    if (mi->mi_setx > 0)
+		return -1;
+	    memcpy(&mi->mi_offset, mi->mi_keyp, sizeof(mi->mi_offset));
+	} else {
+	    if (!(mi->mi_setx < rpmdbSnapCount(snap)))
+		return -1;
+	    mi->mi_offset = rpmdbSnapInstance(snap, mi->mi_setx);
+	}
+	mi->mi_setx++;
+
+	/* If next header is identical, return it now. */
+	if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset)
+	    return 1;
+    } while (mi->mi_offset == 0 ||
+	     rpmdbSnapHeader(snap, mi->mi_offset, &uh, &uhlen));
+
+#if !defined(_USE_COPY_LOAD)
+    /* headerLoad() takes ownership of the blob. */
+    uh = memcpy(xmalloc(uhlen), uh, uhlen);
+#endif
+    *uhp = (void *) uh;
+    *uhlenp = uhlen;
+    return 0;
+}
+
+/**
+ * Return next header of an iterator (with the database locked).
+ * @param mi		rpm database iterator
+ * @return		next header, NULL at end
+ */
+static Header miNext(rpmdbMatchIterator mi)
 {
     dbiIndex dbi;
     void * uh;
@@ -1955,9 +2823,13 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
     if (mi == NULL)
 	return NULL;
 
-    dbi = dbiOpen(mi->mi_db, RPMDBI_PACKAGES, 0);
-    if (dbi == NULL)
-	return NULL;
+    /* Iterators served from a snapshot don't touch the database. */
+    dbi = NULL;
+    if (!mi->mi_snap) {
+	dbi = dbiOpen(mi->mi_db, RPMDBI_PACKAGES, 0);
+	if (dbi == NULL)
+	    return NULL;
+    }
 
     /*
      * Cursors are per-iterator, not per-dbi, so get a cursor for the
@@ -1965,7 +2837,7 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
      * CDB model is used for the database, then the cursor needs to
      * marked with DB_WRITECURSOR as well.
      */
-    if (mi->mi_dbc == NULL)
+    if (dbi && mi->mi_dbc == NULL)
 	xx = dbiCopen(dbi, dbi->dbi_txnid, &mi->mi_dbc, mi->mi_cflags);
 
     key = &mi->mi_key;
@@ -1977,6 +2849,17 @@ top:
     uh = NULL;
     uhlen = 0;
 
+    if (mi->mi_snap) {
+	switch (miSnapNext(mi, &uh, &uhlen)) {
+	case 0:
+	    goto loaded;
+	case 1:
+	    return mi->mi_h;
+	default:
+	    return NULL;
+	}
+    }
+
     do {
 	union _dbswap mi_offset;
 
@@ -2032,6 +2915,24 @@ top:
     if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset)
 	return mi->mi_h;
 
+    /* Reuse the header if already decoded in this transaction. */
+    if (mi->mi_db && mi->mi_db->db_hdrcache != NULL) {
+	Header h = rpmHdrCacheGet(mi->mi_db->db_hdrcache, mi->mi_offset);
+	if (h != NULL) {
+#if !defined(_USE_COPY_LOAD)
+	    uh = _free(uh);
+#endif
+	    xx = miFreeHeader(mi, dbi);
+	    mi->mi_h = h;
+	    if (mireSkip(mi)) {
+		if (mi->mi_set || mi->mi_keyp == NULL)
+		    goto top;
+		return NULL;
+	    }
+	    goto exit;
+	}
+    }
+
     /* Retrieve next header blob for index iterator. */
     if (uh == NULL) {
 	key->data = keyp;
@@ -2049,6 +2950,7 @@ top:
 	    return NULL;
     }
 
+loaded:
     /* Rewrite current header (if necessary) and unlink. */
     xx = miFreeHeader(mi, dbi);
 
@@ -2099,7 +3001,7 @@ top:
 
     /* Did the header blob load correctly? */
 #if !defined(_USE_COPY_LOAD)
-    mi->mi_h = headerLoad(uh);
+    mi->mi_h = headerLoadLazy(uh);
     if (mi->mi_h)
 	mi->mi_h->flags |= HEADERFLAG_ALLOCATED;
 #else
@@ -2123,12 +3025,31 @@ top:
     }
     headerSetInstance(mi->mi_h, mi->mi_offset);
 
+    /* Cache headers looked up by key, full database scans would thrash. */
+    if (mi->mi_db && mi->mi_db->db_hdrcache != NULL && !mi->mi_snap &&
+	(mi->mi_set || mi->mi_keyp))
+	rpmHdrCachePut(mi->mi_db->db_hdrcache, mi->mi_offset, mi->mi_h, uhlen);
+
+exit:
     mi->mi_prevoffset = mi->mi_offset;
     mi->mi_modified = 0;
 
     return mi->mi_h;
 }
 
+Header rpmdbNextIterator(rpmdbMatchIterator mi)
+{
+    Header h;
+
+    if (mi == NULL)
+	return NULL;
+
+    (void) pthread_mutex_lock(&mi->mi_db->db_lock);
+    h = miNext(mi);
+    (void) pthread_mutex_unlock(&mi->mi_db->db_lock);
+    return h;
+}
+
 /** \ingroup rpmdb
  * sort the iterator by (recnum, filenum)
  * Return database iterator.
@@ -2227,6 +3148,31 @@ int rpmdbPruneIterator(rpmdbMatchIterator mi, int * hdrNums,
     return 0;
 }
 
+int rpmdbPruneIteratorMap(rpmdbMatchIterator mi,
+			const uint32_t * map, unsigned int nbits)
+{
+    dbiIndexSet set;
+    unsigned int from, to = 0;
+
+    if (mi == NULL || map == NULL || nbits == 0)
+	return 1;
+
+    set = mi->mi_set;
+    if (set == NULL)
+	return 0;
+
+    for (from = 0; from < set->count; from++) {
+	unsigned int hdrNum = set->recs[from].hdrNum;
+	if (hdrNum < nbits && (map[hdrNum >> 5] & (1U << (hdrNum & 0x1f))))
+	    continue;
+	if (from != to)
+	    set->recs[to] = set->recs[from];
+	to++;
+    }
+    set->count = to;
+    return 0;
+}
+
 int rpmdbAppendIterator(rpmdbMatchIterator mi, const int * hdrNums, int nHdrNums)
 {
     if (mi == NULL || hdrNums == NULL || nHdrNums <= 0)
@@ -2238,7 +3184,15 @@ int rpmdbAppendIterator(rpmdbMatchIterator mi, const int * hdrNums, int nHdrNums
     return 0;
 }
 
-rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
+/**
+ * Create an iterator (with the database locked).
+ * @param db		rpm database
+ * @param rpmtag	rpm tag
+ * @param keyp		key data (NULL for sequential access)
+ * @param keylen	key data length (0 will use strlen(keyp))
+ * @return		NULL on failure
+ */
+static rpmdbMatchIterator miInit(rpmdb db, rpmTag rpmtag,
 		const void * keyp, size_t keylen)
 {
     rpmdbMatchIterator mi;
@@ -2247,6 +3201,7 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
     dbiIndexSet set = NULL;
     dbiIndex dbi;
     void * mi_keyp = NULL;
+    rpmArena arena;
     int isLabel = 0;
 
     if (db == NULL)
@@ -2260,14 +3215,27 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
 	isLabel = 1;
     }
 
-    dbi = dbiOpen(db, rpmtag, 0);
-    if (dbi == NULL)
-	return NULL;
+    /*
+     * Lookups by instance, by exact key and by label are served from the
+     * snapshot (if any) with neither a database environment nor locks.
+     */
+    if (db->db_snap != NULL && (rpmtag == RPMDBI_PACKAGES ||
+	(keyp && rpmdbSnapHasTag(db->db_snap, rpmtag))))
+    {
+	dbi = NULL;
+    } else {
+	dbi = dbiOpen(db, rpmtag, 0);
+	if (dbi == NULL)
+	    return NULL;
+    }
+
+    /* The iterator and its copy of the key are freed together. */
+    arena = rpmArenaNew(512);
+    mi = rpmArenaCalloc(arena, 1, sizeof(*mi));
+    mi->mi_arena = arena;
 
     /* Chain cursors for teardown on abnormal exit. */
-    mi = xcalloc(1, sizeof(*mi));
-    mi->mi_next = rpmmiRock;
-    rpmmiRock = mi;
+    miChain(mi);
 
     key = &mi->mi_key;
     data = &mi->mi_data;
@@ -2282,12 +3250,19 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
 	int xx;
 
 	if (isLabel) {
-	    xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, 0);
-	    rc = dbiFindByLabel(dbi, dbcursor, key, data, keyp, &set);
-	    xx = dbiCclose(dbi, dbcursor, 0);
+	    if (dbi)
+		xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, 0);
+	    rc = dbiFindByLabel(db, dbi, dbcursor, key, data, keyp, &set);
+	    if (dbi)
+		xx = dbiCclose(dbi, dbcursor, 0);
 	    dbcursor = NULL;
 	} else if (rpmtag == RPMTAG_BASENAMES) {
 	    rc = rpmdbFindByFile(db, keyp, key, data, &set);
+	} else if (dbi == NULL) {
+	    if (keylen == 0)
+		keylen = strlen(keyp);
+	    rc = rpmdbSnapGet(db->db_snap, rpmtag, keyp,
+			      (keylen ? keylen : 1), &set);	/* XXX "/" fixup. */
 	} else {
 	    xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, 0);
 
@@ -2315,9 +3290,8 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
 	}
 	if (rc)	{	/* error/not found */
 	    set = dbiFreeIndexSet(set);
-	    rpmmiRock = mi->mi_next;
-	    mi->mi_next = NULL;
-	    mi = _free(mi);
+	    miUnchain(mi);
+	    arena = rpmArenaFree(arena);
 	    return NULL;
 	}
     }
@@ -2329,9 +3303,9 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
 	  { union _dbswap *k;
 
 	    assert(keylen == sizeof(k->ui));	/* xxx programmer error */
-	    k = xmalloc(sizeof(*k));
+	    k = rpmArenaAlloc(arena, sizeof(*k));
 	    memcpy(k, keyp, keylen);
-	    if (dbiByteSwapped(dbi) == 1)
+	    if (dbi && dbiByteSwapped(dbi) == 1)
 		_DBSWAP(*k);
 	    mi_keyp = k;
 	  } break;
@@ -2339,7 +3313,7 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
 	  { char * k;
 	    if (keylen == 0)
 		keylen = strlen(keyp);
-	    k = xmalloc(keylen + 1);
+	    k = rpmArenaAlloc(arena, keylen + 1);
 	    memcpy(k, keyp, keylen);
 	    k[keylen] = '\0';	/* XXX assumes strings */
 	    mi_keyp = k;
@@ -2368,7 +3342,27 @@ rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
 
     mi->mi_ts = NULL;
     mi->mi_hdrchk = NULL;
+    mi->mi_snap = (db->db_snap != NULL && dbi == NULL);
+
+    return mi;
+}
+
+/*
+ * Threads may share a database, each with iterators (and cursors) of its
+ * own. The Berkeley DB handles aren't free-threaded, database access by
+ * iterators is serialized per database.
+ */
+rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmTag rpmtag,
+		const void * keyp, size_t keylen)
+{
+    rpmdbMatchIterator mi;
+
+    if (db == NULL)
+	return NULL;
 
+    (void) pthread_mutex_lock(&db->db_lock);
+    mi = miInit(db, rpmtag, keyp, keylen);
+    (void) pthread_mutex_unlock(&db->db_lock);
     return mi;
 }
 
@@ -2531,16 +3525,20 @@ int rpmdbRemove(rpmdb db, int rid, unsigned int hdrNum,
     }
 
     (void) blockSignals(&signalMask);
+    snapInvalidate(db);
+    rpmHdrCacheDel(db->db_hdrcache, hdrNum);
 
 	/* FIX: rpmvals heartburn */
     {	int dbix;
-	dbiIndexItem rec = dbiIndexNewItem(hdrNum, 0);
+	struct _dbiIndexItem item = { .hdrNum = hdrNum, .tagNum = 0 };
+	dbiIndexItem rec = &item;
 
 	if (dbiTags.tags != NULL)
 	for (dbix = 0; dbix < dbiTags.max; dbix++) {
 	    dbiIndex dbi;
 	    rpmTag rpmtag;
 	    int xx = 0;
+	    int batch;
 	    struct rpmtd_s tagdata;
 
 	    dbi = NULL;
@@ -2571,29 +3569,40 @@ int rpmdbRemove(rpmdb db, int rid, unsigned int hdrNum,
 		    rc = dbiDel(dbi, dbcursor, &key, &data, 0);
 		xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
 		dbcursor = NULL;
-		if (!dbi->dbi_no_dbsync)
+		if (!dbi->dbi_no_dbsync && !db->db_batch)
 		    xx = dbiSync(dbi, 0);
 		continue;
 	    }
 	
-	    if (!headerGet(h, rpmtag, &tagdata, HEADERGET_MINMEM))
+	    /* Binary file digests are indexed as if they were hex. */
+	    if (!headerGet(h, rpmtag, &tagdata, (rpmtag == RPMTAG_FILEDIGESTS ?
+				HEADERGET_EXT : HEADERGET_MINMEM)))
 		continue;
 
 	    if (!(dbi = dbiOpen(db, rpmtag, 0))) {
 		rpmtdFreeData(&tagdata);
 		continue;
 	    }
-	    xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, DB_WRITECURSOR);
+	    batch = (db->db_batch && !dbi->dbi_permit_dups);
+	    if (!batch)
+		xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, DB_WRITECURSOR);
 
 	    logAddRemove(1, &tagdata);
 	    while (rpmtdNext(&tagdata) >= 0) {
 		dbiIndexSet set;
+		unsigned int count;
 		int freedata = 0;
 
 		if (!td2key(&tagdata, &key, &freedata)) {
 		    continue;
 		}
 
+		/* Batched: prune the index set once, at flush time. */
+		if (batch) {
+		    dbiBatchDel(dbi, &key, rec);
+		    goto cont;
+		}
+
 		/* XXX
 		 * This is almost right, but, if there are duplicate tag
 		 * values, there will be duplicate attempts to remove
@@ -2609,7 +3618,8 @@ int rpmdbRemove(rpmdb db, int rid, unsigned int hdrNum,
 
 		rc = dbiGet(dbi, dbcursor, &key, &data, DB_SET);
 		if (rc == 0) {			/* success */
-		    (void) dbt2set(dbi, &data, &set);
+		    if (!(dbi->dbi_compact && dbiIsCompact(dbi, &data)))
+			(void) dbt2set(dbi, &data, &set);
 		} else if (rc == DB_NOTFOUND) {	/* not found */
 		    goto cont;
 		} else {			/* error */
@@ -2620,7 +3630,13 @@ int rpmdbRemove(rpmdb db, int rid, unsigned int hdrNum,
 		    goto cont;
 		}
 
-		rc = dbiPruneSet(set, rec, 1, sizeof(*rec), 1);
+		/* Compact records are pruned without decoding. */
+		if (set == NULL) {
+		    rc = dbiPruneDbt(dbi, &data, rec, 1, sizeof(*rec), 1, &count);
+		} else {
+		    rc = dbiPruneSet(set, rec, 1, sizeof(*rec), 1);
+		    count = set->count;
+		}
 
 		/* If nothing was pruned, then don't bother updating. */
 		if (rc) {
@@ -2628,8 +3644,9 @@ int rpmdbRemove(rpmdb db, int rid, unsigned int hdrNum,
 		    goto cont;
 		}
 
-		if (set->count > 0) {
-		    (void) set2dbt(dbi, &data, set);
+		if (count > 0) {
+		    if (set != NULL)
+			(void) set2dbt(dbi, &data, set);
 		    rc = dbiPut(dbi, dbcursor, &key, &data, DB_KEYLAST);
 		    if (rc) {
 			rpmlog(RPMLOG_ERR,
@@ -2655,16 +3672,16 @@ cont:
 		}
 	    }
 
-	    xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
-	    dbcursor = NULL;
+	    if (dbcursor) {
+		xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
+		dbcursor = NULL;
+	    }
 
-	    if (!dbi->dbi_no_dbsync)
+	    if (!dbi->dbi_no_dbsync && !db->db_batch)
 		xx = dbiSync(dbi, 0);
 
 	    rpmtdFreeData(&tagdata);
 	}
-
-	rec = _free(rec);
     }
 
     (void) unblockSignals(&signalMask);
@@ -2708,6 +3725,7 @@ int rpmdbAdd(rpmdb db, int iid, Header h,
     }
 
     (void) blockSignals(&signalMask);
+    snapInvalidate(db);
 
     {
 	unsigned int firstkey = 0;
@@ -2761,7 +3779,8 @@ int rpmdbAdd(rpmdb db, int iid, Header h,
 	data.size = datalen;
 
 	ret = dbiPut(dbi, dbcursor, &key, &data, DB_KEYLAST);
-	xx = dbiSync(dbi, 0);
+	if (!db->db_batch)
+	    xx = dbiSync(dbi, 0);
 
 	xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
 	dbcursor = NULL;
@@ -2779,12 +3798,14 @@ int rpmdbAdd(rpmdb db, int iid, Header h,
 
     if (hdrNum)
     {	
-	dbiIndexItem rec = dbiIndexNewItem(hdrNum, 0);
+	struct _dbiIndexItem item = { .hdrNum = hdrNum, .tagNum = 0 };
+	dbiIndexItem rec = &item;
 
 	if (dbiTags.tags != NULL)
 	for (dbix = 0; dbix < dbiTags.max; dbix++) {
 	    rpmTag rpmtag;
 	    rpmRC rpmrc;
+	    int batch;
 	    int j;
 	    struct rpmtd_s tagdata, reqflags;
 
@@ -2826,13 +3847,14 @@ int rpmdbAdd(rpmdb db, int iid, Header h,
 
 		if (data.data != NULL && rpmrc != RPMRC_FAIL) {
 		    xx = dbiPut(dbi, dbcursor, &key, &data, DB_KEYLAST);
-		    xx = dbiSync(dbi, 0);
+		    if (!db->db_batch)
+			xx = dbiSync(dbi, 0);
 		}
 		data.data = _free(data.data);
 		data.size = 0;
 		xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
 		dbcursor = NULL;
-		if (!dbi->dbi_no_dbsync)
+		if (!dbi->dbi_no_dbsync && !db->db_batch)
 		    xx = dbiSync(dbi, 0);
 		continue;
 		break;
@@ -2840,6 +3862,10 @@ int rpmdbAdd(rpmdb db, int iid, Header h,
 		headerGet(h, rpmtag, &tagdata, HEADERGET_MINMEM);
 		headerGet(h, RPMTAG_REQUIREFLAGS, &reqflags, HEADERGET_MINMEM);
 		break;
+	    case RPMTAG_FILEDIGESTS:
+		/* Index binary file digests too, as if they were hex. */
+		headerGet(h, rpmtag, &tagdata, HEADERGET_EXT);
+		break;
 	    default:
 		headerGet(h, rpmtag, &tagdata, HEADERGET_MINMEM);
 		break;
@@ -2859,7 +3885,9 @@ int rpmdbAdd(rpmdb db, int iid, Header h,
 		rpmtdFreeData(&tagdata);
 		continue;
 	    }
-	    xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, DB_WRITECURSOR);
+	    batch = (db->db_batch && !dbi->dbi_permit_dups);
+	    if (!batch)
+		xx = dbiCopen(dbi, dbi->dbi_txnid, &dbcursor, DB_WRITECURSOR);
 
 	    logAddRemove(0, &tagdata);
 	    while (rpmtdNext(&tagdata) >= 0) {
@@ -2899,6 +3927,12 @@ int rpmdbAdd(rpmdb db, int iid, Header h,
 		    continue;
 		}
 
+		/* Batched: merge into the index set once, at flush time. */
+		if (batch) {
+		    dbiBatchAdd(dbi, &key, rec);
+		    goto cont;
+		}
+
 		/* 
  		 * XXX with duplicates, an accurate data value and 
  		 * DB_GET_BOTH is needed. 
@@ -2942,16 +3976,17 @@ cont:
 		}
 	    }
 
-	    xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
-	    dbcursor = NULL;
+	    if (dbcursor) {
+		xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
+		dbcursor = NULL;
+	    }
 
-	    if (!dbi->dbi_no_dbsync)
+	    if (!dbi->dbi_no_dbsync && !db->db_batch)
 		xx = dbiSync(dbi, 0);
 
 	    rpmtdFreeData(&tagdata);
 	}
 
-	rec = _free(rec);
 	/* If everthing ok, mark header as installed now */
 	if (ret == 0) {
 	    headerSetInstance(h, hdrNum);
@@ -3178,6 +4213,15 @@ int rpmdbRebuild(const char * prefix, rpmts ts,
     }
     removedir = 1;
 
+    /* Header instances change, the snapshot (if any) must go. */
+    tfn = rpmExpand("%{?_rpmdb_snapshot}", NULL);
+    if (*tfn != '\0') {
+	char * fn = rpmGetPath(prefix, "/", dbpath, "/", tfn, NULL);
+	xx = unlink(fn);
+	free(fn);
+    }
+    tfn = _free(tfn);
+
     _rebuildinprogress = 0;
 
     rpmlog(RPMLOG_DEBUG, "opening old database with dbapi %d\n",
@@ -3200,6 +4244,12 @@ int rpmdbRebuild(const char * prefix, rpmts ts,
     _rebuildinprogress = 0;
 
     _dbapi_rebuild = newdb->db_api;
+
+    /*
+     * Load the new indices in bulk: index items for all headers are
+     * accumulated in memory and each key is written once, in key order.
+     */
+    xx = rpmdbBeginBatch(newdb);
     
     {	Header h = NULL;
 	rpmdbMatchIterator mi;
@@ -3266,6 +4316,11 @@ int rpmdbRebuild(const char * prefix, rpmts ts,
 
     }
 
+    if (rpmdbEndBatch(newdb)) {
+	rpmlog(RPMLOG_ERR, _("cannot write indices of rebuilt database\n"));
+	failed = 1;
+    }
+
     xx = rpmdbClose(olddb);
     xx = rpmdbClose(newdb);
 
@@ -112,6 +112,30 @@ int rpmdbClose (rpmdb db);
  */
 int rpmdbSync (rpmdb db);
 
+/** \ingroup rpmdb
+ * Start batching index updates.
+ * Until rpmdbEndBatch(), rpmdbAdd() and rpmdbRemove() accumulate the
+ * secondary index changes in memory and rpmdbSync() is a no-op. Readers
+ * of an index see the pending changes as they are written out on demand.
+ * @param db		rpm database
+ * @return		0 on success
+ */
+int rpmdbBeginBatch(rpmdb db);
+
+/** \ingroup rpmdb
+ * Write out index updates pending in a batch, batching continues.
+ * @param db		rpm database
+ * @return		0 on success
+ */
+int rpmdbFlushBatch(rpmdb db);
+
+/** \ingroup rpmdb
+ * Write out pending index updates, sync and stop batching.
+ * @param db		rpm database
+ * @return		0 on success
+ */
+int rpmdbEndBatch(rpmdb db);
+
 /** \ingroup rpmdb
  * Open all database indices.
  * @param db		rpm database
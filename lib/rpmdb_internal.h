@@ -2,6 +2,7 @@
 #define H_RPMDB_INTERNAL
 
 #include <assert.h>
+#include <pthread.h>
 #include <db.h>
 
 #include <rpm/rpmsw.h>
@@ -21,6 +22,41 @@ typedef struct _dbiIndexSet * dbiIndexSet;
  */
 typedef struct _dbiIndex * dbiIndex;
 
+/**
+ * Index updates pending in a write batch.
+ */
+typedef struct dbiBatch_s * dbiBatch;
+
+/**
+ * Read-only, mmap'ed database snapshot.
+ */
+typedef struct rpmdbSnap_s * rpmdbSnap;
+
+/**
+ * Snapshot under construction.
+ */
+typedef struct rpmdbSnapWriter_s * rpmdbSnapWriter;
+
+/**
+ * Persistent cache of header signature verification results.
+ */
+typedef struct rpmSigCache_s * rpmSigCache;
+
+/**
+ * Transaction scoped cache of headers read from the database.
+ */
+typedef struct rpmHdrCache_s * rpmHdrCache;
+
+/**
+ * Signature cache key, also the on-disk entry.
+ */
+struct rpmSigCacheKey_s {
+    uint8_t hdrsha1[20];	/*!< SHA1 of the immutable header region */
+    uint8_t keyring[20];	/*!< keyring digest */
+    uint8_t keyid[8];		/*!< signer key id */
+    uint32_t vsflags;		/*!< verification flags */
+};
+
 /* this will break if sizeof(int) != 4 */
 /** \ingroup dbi
  * A single item from an index database (i.e. the "data returned").
@@ -185,6 +221,7 @@ struct _dbiIndex {
     int	dbi_permit_dups;	/*!< permit duplicate entries? */
     int	dbi_no_fsync;		/*!< no-op fsync for db */
     int	dbi_no_dbsync;		/*!< don't call dbiSync */
+    int	dbi_compact;		/*!< write compact (delta/varint) records */
     int	dbi_lockdbfd;		/*!< do fcntl lock on db fd */
     int	dbi_temporary;		/*!< non-persistent */
     int	dbi_debug;
@@ -255,6 +292,8 @@ unsigned char * dbi_lk_conflicts;
 
     const struct _dbiVec * dbi_vec;	/*!< private methods */
 
+    dbiBatch dbi_batch;		/*!< index updates not yet written */
+
 };
 
 /** \ingroup rpmdb
@@ -271,6 +310,12 @@ struct rpmdb_s {
     int		db_remove_env;
     int		db_filter_dups;
     int		db_chrootDone;	/*!< If chroot(2) done, ignore db_root. */
+    int		db_batch;	/*!< Batch index updates in memory? */
+    rpmdbSnap	db_snap;	/*!< Snapshot serving lookups (read-only). */
+    int		db_snapdirty;	/*!< Snapshot removed or pending rewrite? */
+    rpmSigCache	db_sigcache;	/*!< Signature verification cache. */
+    int		db_sigcacheinit;	/*!< Signature cache looked up? */
+    rpmHdrCache	db_hdrcache;	/*!< Header cache (during transactions). */
     void (*db_errcall) (const char *db_errpfx, char *buffer);
     FILE *	db_errfile;
     void * (*db_malloc) (size_t nbytes);
@@ -289,6 +334,7 @@ struct rpmdb_s {
     struct rpmop_s db_putops;
     struct rpmop_s db_delops;
 
+    pthread_mutex_t db_lock;	/*!< Serializes iterators (recursive). */
     int nrefs;			/*!< Reference count. */
 };
 
@@ -343,6 +389,14 @@ RPM_GNUC_INTERNAL
 dbiIndex dbiOpen(rpmdb db, rpmTag rpmtag,
 		unsigned int flags);
 
+/** \ingroup dbi
+ * Write out index updates pending in a write batch.
+ * @param dbi		index database handle
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int dbiFlushBatch(dbiIndex dbi);
+
 /* FIX: vector annotations */
 /** \ingroup dbi
  * Open a database cursor.
@@ -356,6 +410,9 @@ static inline
 int dbiCopen(dbiIndex dbi, DB_TXN * txnid,
 		DBC ** dbcp, unsigned int flags)
 {
+    /* Readers must see index updates still pending in a write batch. */
+    if (dbi->dbi_batch != NULL && !(flags & DB_WRITECURSOR))
+	(void) dbiFlushBatch(dbi);
     return (*dbi->dbi_vec->copen) (dbi, txnid, dbcp, flags);
 }
 
@@ -530,6 +587,291 @@ unsigned int dbiIndexRecordOffset(dbiIndexSet set, int recno);
 RPM_GNUC_INTERNAL
 unsigned int dbiIndexRecordFileNumber(dbiIndexSet set, int recno);
 
+/** \ingroup rpmdb
+ * Create a snapshot, written to a temporary file until finished.
+ * @param fn		snapshot path
+ * @return		snapshot writer, NULL on error
+ */
+RPM_GNUC_INTERNAL
+rpmdbSnapWriter rpmdbSnapCreate(const char * fn);
+
+/** \ingroup rpmdb
+ * Add a header blob to a snapshot.
+ * @param w		snapshot writer
+ * @param hdrNum	header instance
+ * @param uh		header blob
+ * @param uhlen		header blob size
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapAddHeader(rpmdbSnapWriter w, unsigned int hdrNum,
+		const void * uh, size_t uhlen);
+
+/** \ingroup rpmdb
+ * Add a key of the current index to a snapshot. Keys can be in any order.
+ * @param w		snapshot writer
+ * @param key		index key
+ * @param keylen	index key length
+ * @param set		index items of key
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapAddKey(rpmdbSnapWriter w, const void * key, size_t keylen,
+		dbiIndexSet set);
+
+/** \ingroup rpmdb
+ * Finish the current index of a snapshot.
+ * @param w		snapshot writer
+ * @param tag		index tag of the keys added since the last call
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapEndIndex(rpmdbSnapWriter w, rpmTag tag);
+
+/** \ingroup rpmdb
+ * Finish a snapshot, atomically replacing the previous one on commit.
+ * @param w		snapshot writer
+ * @param commit	install the snapshot (or discard it)?
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapFinish(rpmdbSnapWriter w, int commit);
+
+/** \ingroup rpmdb
+ * Map a snapshot for reading.
+ * @param fn		snapshot path
+ * @return		snapshot, NULL if missing or invalid
+ */
+RPM_GNUC_INTERNAL
+rpmdbSnap rpmdbSnapOpen(const char * fn);
+
+/** \ingroup rpmdb
+ * Unmap a snapshot.
+ * @param snap		snapshot
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+rpmdbSnap rpmdbSnapFree(rpmdbSnap snap);
+
+/** \ingroup rpmdb
+ * Return number of headers in a snapshot.
+ * @param snap		snapshot
+ * @return		number of headers
+ */
+RPM_GNUC_INTERNAL
+unsigned int rpmdbSnapCount(rpmdbSnap snap);
+
+/** \ingroup rpmdb
+ * Return header instance of the ix'th header (in instance order).
+ * @param snap		snapshot
+ * @param ix		header index
+ * @return		header instance, 0 if out of range
+ */
+RPM_GNUC_INTERNAL
+unsigned int rpmdbSnapInstance(rpmdbSnap snap, unsigned int ix);
+
+/** \ingroup rpmdb
+ * Retrieve a header blob from a snapshot.
+ * @param snap		snapshot
+ * @param hdrNum	header instance
+ * @retval uhp		header blob (in the mapping)
+ * @retval uhlenp	header blob size
+ * @return		0 on success, 1 if not found
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapHeader(rpmdbSnap snap, unsigned int hdrNum,
+		const void ** uhp, size_t * uhlenp);
+
+/** \ingroup rpmdb
+ * Does a snapshot contain an index?
+ * @param snap		snapshot
+ * @param tag		index tag
+ * @return		1 if index is present
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapHasTag(rpmdbSnap snap, rpmTag tag);
+
+/** \ingroup rpmdb
+ * Retrieve the index items of a key from a snapshot.
+ * @param snap		snapshot
+ * @param tag		index tag
+ * @param key		index key
+ * @param keylen	index key length
+ * @retval setp		(malloc'ed) index set
+ * @return		0 on success, DB_NOTFOUND otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapGet(rpmdbSnap snap, rpmTag tag, const void * key, size_t keylen,
+		dbiIndexSet * setp);
+
+/** \ingroup rpmdb
+ * Load a signature verification cache (empty if missing or invalid).
+ * @param fn		cache path
+ * @return		signature cache
+ */
+RPM_GNUC_INTERNAL
+rpmSigCache rpmSigCacheOpen(const char * fn);
+
+/** \ingroup rpmdb
+ * Was a header signature verified good before?
+ * @param cache		signature cache
+ * @param key		header, keyring, key id and flags of verification
+ * @return		1 if verified before, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmSigCacheLookup(rpmSigCache cache, const struct rpmSigCacheKey_s * key);
+
+/** \ingroup rpmdb
+ * Remember a good header signature verification.
+ * @param cache		signature cache
+ * @param key		header, keyring, key id and flags of verification
+ */
+RPM_GNUC_INTERNAL
+void rpmSigCacheAdd(rpmSigCache cache, const struct rpmSigCacheKey_s * key);
+
+/** \ingroup rpmdb
+ * Write a signature cache, if anything was added to it.
+ * Only entries made against the most recently used keyring are kept.
+ * @param cache		signature cache
+ * @param fn		cache path
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmSigCacheWrite(rpmSigCache cache, const char * fn);
+
+/** \ingroup rpmdb
+ * Destroy a signature cache.
+ * @param cache		signature cache
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+rpmSigCache rpmSigCacheFree(rpmSigCache cache);
+
+/** \ingroup rpmdb
+ * Return the signature verification cache (if enabled) of a database,
+ * loading it on first use.
+ * @param db		rpm database
+ * @return		signature cache, NULL if disabled
+ */
+RPM_GNUC_INTERNAL
+rpmSigCache rpmdbSigCache(rpmdb db);
+
+/** \ingroup rpmdb
+ * Create a header cache.
+ * @param maxsize	max. (approximate) size of cached data in bytes
+ * @return		header cache
+ */
+RPM_GNUC_INTERNAL
+rpmHdrCache rpmHdrCacheNew(size_t maxsize);
+
+/** \ingroup rpmdb
+ * Retrieve a cached header, making it the most recently used.
+ * @param cache		header cache
+ * @param hdrNum	header instance
+ * @return		header (new reference), NULL if not cached
+ */
+RPM_GNUC_INTERNAL
+Header rpmHdrCacheGet(rpmHdrCache cache, unsigned int hdrNum);
+
+/** \ingroup rpmdb
+ * Add a header to the cache, dropping least recently used ones if needed.
+ * @param cache		header cache
+ * @param hdrNum	header instance
+ * @param h		header
+ * @param size		size of the header blob
+ */
+RPM_GNUC_INTERNAL
+void rpmHdrCachePut(rpmHdrCache cache, unsigned int hdrNum, Header h,
+		size_t size);
+
+/** \ingroup rpmdb
+ * Forget a cached header (if any), e.g. when removed from the database.
+ * @param cache		header cache
+ * @param hdrNum	header instance
+ */
+RPM_GNUC_INTERNAL
+void rpmHdrCacheDel(rpmHdrCache cache, unsigned int hdrNum);
+
+/** \ingroup rpmdb
+ * Return file info of a header, built once per cached header.
+ * @param cache		header cache (NULL builds uncached file info)
+ * @param ts		transaction set
+ * @param h		header (as returned by a database iterator)
+ * @return		file info (new reference)
+ */
+RPM_GNUC_INTERNAL
+rpmfi rpmHdrCacheFI(rpmHdrCache cache, rpmts ts, Header h);
+
+/** \ingroup rpmdb
+ * Destroy a header cache.
+ * @param cache		header cache
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+rpmHdrCache rpmHdrCacheFree(rpmHdrCache cache);
+
+/** \ingroup rpmdb
+ * Start caching headers read by database iterators (if enabled by
+ * %_rpmdb_header_cache). Caching lasts until rpmdbHeaderCacheEnd().
+ * @param db		rpm database
+ * @return		1 if started now, 0 if already active or disabled
+ */
+RPM_GNUC_INTERNAL
+int rpmdbHeaderCacheBegin(rpmdb db);
+
+/** \ingroup rpmdb
+ * Stop caching headers, dropping the cache.
+ * @param db		rpm database
+ */
+RPM_GNUC_INTERNAL
+void rpmdbHeaderCacheEnd(rpmdb db);
+
+/** \ingroup rpmdb
+ * Stop caching headers for a while, keeping the cache. Headers from the
+ * cache are shared, threads sharing a database must not use one.
+ * @param db		rpm database
+ * @return		header cache (NULL if none)
+ */
+RPM_GNUC_INTERNAL
+rpmHdrCache rpmdbHeaderCacheSuspend(rpmdb db);
+
+/** \ingroup rpmdb
+ * Resume caching headers with a suspended cache.
+ * @param db		rpm database
+ * @param cache		header cache (from rpmdbHeaderCacheSuspend())
+ */
+RPM_GNUC_INTERNAL
+void rpmdbHeaderCacheResume(rpmdb db, rpmHdrCache cache);
+
+/** \ingroup rpmdb
+ * Return file info of a header read from the database, shared through the
+ * header cache while one is active.
+ * @param db		rpm database
+ * @param ts		transaction set
+ * @param h		header (as returned by a database iterator)
+ * @return		file info (new reference)
+ */
+RPM_GNUC_INTERNAL
+rpmfi rpmdbHeaderFI(rpmdb db, rpmts ts, Header h);
+
+/** \ingroup rpmdb
+ * Mark the snapshot (if enabled) as pending regeneration. Until then,
+ * readers outside of the transaction keep using the previous snapshot,
+ * and database writes don't remove it.
+ * @param db		rpm database
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapshotBegin(rpmdb db);
+
+/** \ingroup rpmdb
+ * Regenerate the snapshot (if enabled) from the database.
+ * @param db		rpm database
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapshotWrite(rpmdb db);
+
 /** \ingroup rpmdb
  * Return database iterator.
  * @param mi		rpm database iterator
@@ -540,6 +882,19 @@ unsigned int dbiIndexRecordFileNumber(dbiIndexSet set, int recno);
 int rpmdbExtendIterator(rpmdbMatchIterator mi,
 			const void * keyp, size_t keylen);
 
+/** \ingroup rpmdb
+ * Remove all instances found in a bitmap from iterator.
+ * Unlike rpmdbPruneIterator() this is a single pass over the iterator set,
+ * independent of the number of instances to remove.
+ * @param mi		rpm database iterator
+ * @param map		bitmap of header instances to remove
+ * @param nbits		number of bits in bitmap
+ * @return		0 on success, 1 on failure (bad args)
+ */
+RPM_GNUC_INTERNAL
+int rpmdbPruneIteratorMap(rpmdbMatchIterator mi,
+			const uint32_t * map, unsigned int nbits);
+
 /** \ingroup rpmdb
  * sort the iterator by (recnum, filenum)
  * Return database iterator.
@@ -0,0 +1,431 @@
+/** \ingroup rpmdb
+ * \file lib/rpmdbsnap.c
+ * Read-only rpmdb snapshots.
+ *
+ * A snapshot is a single immutable file holding the header blobs of all
+ * installed packages and a copy of the secondary indices, with every
+ * index sorted by key. Readers mmap(2) it and need neither the Berkeley
+ * DB environment nor any locks. The file is written under a temporary
+ * name and renamed into place, so readers always see a complete file.
+ *
+ * Layout (native byte order, rejected when foreign):
+ *	struct snapHdr_s
+ *	header blobs and index data, 8 byte aligned
+ *	nheaders * struct snapEntry_s, sorted by header instance
+ *	ntags * struct snapTag_s, sorted by tag, each pointing at
+ *	nkeys * struct snapKey_s, sorted by key
+ */
+
+#include "system.h"
+
+#include <sys/mman.h>
+
+#include <rpm/rpmlog.h>
+#include <rpm/rpmstring.h>
+
+#include "lib/rpmdb_internal.h"
+#include "debug.h"
+
+#define	SNAP_MAGIC	"RPMSNAP"
+#define	SNAP_VERSION	1
+#define	SNAP_BYTEORDER	0x01020304
+
+struct snapHdr_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t nheaders;		/*!< no. of header blobs */
+    uint32_t ntags;		/*!< no. of indices */
+    uint64_t headers;		/*!< offset of header table */
+    uint64_t tags;		/*!< offset of index table */
+};
+
+struct snapEntry_s {
+    uint32_t hdrNum;		/*!< header instance */
+    uint32_t size;		/*!< size of header blob */
+    uint64_t offset;		/*!< offset of header blob */
+};
+
+struct snapTag_s {
+    uint32_t tag;		/*!< index tag */
+    uint32_t nkeys;		/*!< no. of keys */
+    uint64_t keys;		/*!< offset of key table */
+};
+
+struct snapKey_s {
+    uint64_t offset;		/*!< offset of key, followed by items */
+    uint32_t keylen;		/*!< key length */
+    uint32_t nrecs;		/*!< no. of (hdrNum, tagNum) items */
+};
+
+struct rpmdbSnap_s {
+    unsigned char * map;	/*!< mmap'ed snapshot */
+    size_t len;			/*!< snapshot size */
+    const struct snapHdr_s * hdr;
+    const struct snapEntry_s * headers;
+    const struct snapTag_s * tags;
+};
+
+struct rpmdbSnapWriter_s {
+    char * fn;			/*!< final snapshot path */
+    char * tfn;			/*!< temporary path */
+    FILE * f;
+    uint64_t off;		/*!< current write offset */
+    int err;
+    struct snapEntry_s * headers;
+    int nheaders;
+    int halloced;
+    struct snapTag_s * tags;
+    int ntags;
+    int talloced;
+    struct snapKey_s * keys;	/*!< keys of the index being written */
+    void ** keydata;		/*!< key copies, for sorting */
+    int nkeys;
+    int kalloced;
+};
+
+static int snapWrite(rpmdbSnapWriter w, const void * buf, size_t len)
+{
+    static const char zeros[8];
+    size_t pad = (8 - (len % 8)) % 8;
+
+    if (w->err == 0 &&
+	(fwrite(buf, 1, len, w->f) != len || fwrite(zeros, 1, pad, w->f) != pad))
+	w->err = errno;
+    w->off += len + pad;
+    return w->err;
+}
+
+rpmdbSnapWriter rpmdbSnapCreate(const char * fn)
+{
+    rpmdbSnapWriter w = xcalloc(1, sizeof(*w));
+    struct snapHdr_s hdr;
+
+    w->fn = xstrdup(fn);
+    rasprintf(&w->tfn, "%s.%d", fn, (int) getpid());
+    if ((w->f = fopen(w->tfn, "w")) == NULL) {
+	rpmlog(RPMLOG_ERR, _("cannot create %s: %s\n"), w->tfn, strerror(errno));
+	free(w->tfn);
+	free(w->fn);
+	free(w);
+	return NULL;
+    }
+
+    /* Placeholder, rewritten once the tables are known. */
+    memset(&hdr, 0, sizeof(hdr));
+    (void) snapWrite(w, &hdr, sizeof(hdr));
+    return w;
+}
+
+int rpmdbSnapAddHeader(rpmdbSnapWriter w, unsigned int hdrNum,
+		const void * uh, size_t uhlen)
+{
+    struct snapEntry_s * e;
+
+    if (w->nheaders == w->halloced) {
+	w->halloced = w->halloced ? 2 * w->halloced : 1024;
+	w->headers = xrealloc(w->headers, w->halloced * sizeof(*w->headers));
+    }
+    e = w->headers + w->nheaders++;
+    e->hdrNum = hdrNum;
+    e->size = uhlen;
+    e->offset = w->off;
+    return snapWrite(w, uh, uhlen);
+}
+
+int rpmdbSnapAddKey(rpmdbSnapWriter w, const void * key, size_t keylen,
+		dbiIndexSet set)
+{
+    struct snapKey_s * k;
+    unsigned int i;
+
+    if (w->nkeys == w->kalloced) {
+	w->kalloced = w->kalloced ? 2 * w->kalloced : 1024;
+	w->keys = xrealloc(w->keys, w->kalloced * sizeof(*w->keys));
+	w->keydata = xrealloc(w->keydata, w->kalloced * sizeof(*w->keydata));
+    }
+    k = w->keys + w->nkeys;
+    k->offset = w->off;
+    k->keylen = keylen;
+    k->nrecs = set->count;
+    w->keydata[w->nkeys++] = memcpy(xmalloc(keylen + 1), key, keylen);
+
+    (void) snapWrite(w, key, keylen);
+    for (i = 0; i < set->count; i++) {
+	uint32_t rec[2];
+	rec[0] = set->recs[i].hdrNum;
+	rec[1] = set->recs[i].tagNum;
+	if (w->err == 0 && fwrite(rec, sizeof(rec), 1, w->f) != 1)
+	    w->err = errno;
+	w->off += sizeof(rec);
+    }
+    return w->err;
+}
+
+static int keyCmp(const void * k1, size_t l1, const void * k2, size_t l2)
+{
+    int rc = memcmp(k1, k2, (l1 < l2 ? l1 : l2));
+    if (rc == 0)
+	rc = (l1 > l2) - (l1 < l2);
+    return rc;
+}
+
+/* XXX qsort(3) has no context argument, sort (key, keydata) pairs instead. */
+struct keyPair_s {
+    struct snapKey_s k;
+    void * data;
+};
+
+static int keyPairCmp(const void * one, const void * two)
+{
+    const struct keyPair_s * a = one, * b = two;
+    return keyCmp(a->data, a->k.keylen, b->data, b->k.keylen);
+}
+
+int rpmdbSnapEndIndex(rpmdbSnapWriter w, rpmTag tag)
+{
+    struct keyPair_s * pairs = xmalloc((w->nkeys + 1) * sizeof(*pairs));
+    struct snapTag_s * t;
+    int i;
+
+    for (i = 0; i < w->nkeys; i++) {
+	pairs[i].k = w->keys[i];	/* structure assignment */
+	pairs[i].data = w->keydata[i];
+    }
+    qsort(pairs, w->nkeys, sizeof(*pairs), keyPairCmp);
+
+    if (w->ntags == w->talloced) {
+	w->talloced = w->talloced ? 2 * w->talloced : 32;
+	w->tags = xrealloc(w->tags, w->talloced * sizeof(*w->tags));
+    }
+    t = w->tags + w->ntags++;
+    t->tag = tag;
+    t->nkeys = w->nkeys;
+    t->keys = w->off;
+
+    for (i = 0; i < w->nkeys; i++) {
+	w->keys[i] = pairs[i].k;	/* structure assignment */
+	free(pairs[i].data);
+    }
+    free(pairs);
+    (void) snapWrite(w, w->keys, w->nkeys * sizeof(*w->keys));
+    w->nkeys = 0;
+    return w->err;
+}
+
+static int entryCmp(const void * one, const void * two)
+{
+    const struct snapEntry_s * a = one, * b = two;
+    return (a->hdrNum > b->hdrNum) - (a->hdrNum < b->hdrNum);
+}
+
+static int tagCmp(const void * one, const void * two)
+{
+    const struct snapTag_s * a = one, * b = two;
+    return (a->tag > b->tag) - (a->tag < b->tag);
+}
+
+int rpmdbSnapFinish(rpmdbSnapWriter w, int commit)
+{
+    struct snapHdr_s hdr;
+    int rc = 0;
+    int i;
+
+    if (w == NULL)
+	return 1;
+
+    for (i = 0; i < w->nkeys; i++)
+	free(w->keydata[i]);
+
+    if (commit) {
+	qsort(w->headers, w->nheaders, sizeof(*w->headers), entryCmp);
+	qsort(w->tags, w->ntags, sizeof(*w->tags), tagCmp);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+	hdr.version = SNAP_VERSION;
+	hdr.byteorder = SNAP_BYTEORDER;
+	hdr.nheaders = w->nheaders;
+	hdr.ntags = w->ntags;
+	hdr.headers = w->off;
+	(void) snapWrite(w, w->headers, w->nheaders * sizeof(*w->headers));
+	hdr.tags = w->off;
+	(void) snapWrite(w, w->tags, w->ntags * sizeof(*w->tags));
+
+	if (w->err == 0 && (fseeko(w->f, 0, SEEK_SET) != 0 ||
+			    fwrite(&hdr, sizeof(hdr), 1, w->f) != 1 ||
+			    fflush(w->f) != 0 || fsync(fileno(w->f)) != 0))
+	    w->err = errno;
+    }
+
+    if (fclose(w->f) != 0 && w->err == 0)
+	w->err = errno;
+
+    if (commit && w->err == 0 && rename(w->tfn, w->fn) != 0)
+	w->err = errno;
+
+    if (!commit || w->err) {
+	if (w->err)
+	    rpmlog(RPMLOG_ERR, _("cannot write %s: %s\n"),
+			w->fn, strerror(w->err));
+	(void) unlink(w->tfn);
+	rc = 1;
+    }
+
+    free(w->headers);
+    free(w->tags);
+    free(w->keys);
+    free(w->keydata);
+    free(w->tfn);
+    free(w->fn);
+    free(w);
+    return rc;
+}
+
+/* Is [off, off + len) inside the snapshot? */
+static int snapValid(rpmdbSnap snap, uint64_t off, uint64_t len)
+{
+    return (off <= snap->len && len <= snap->len - off);
+}
+
+rpmdbSnap rpmdbSnapOpen(const char * fn)
+{
+    rpmdbSnap snap = NULL;
+    struct stat sb;
+    void * map;
+    int fd;
+
+    if ((fd = open(fn, O_RDONLY)) < 0)
+	return NULL;
+
+    if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(struct snapHdr_s))
+	goto exit;
+
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+	goto exit;
+
+    snap = xcalloc(1, sizeof(*snap));
+    snap->map = map;
+    snap->len = sb.st_size;
+    snap->hdr = map;
+
+    if (memcmp(snap->hdr->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) ||
+	snap->hdr->version != SNAP_VERSION ||
+	snap->hdr->byteorder != SNAP_BYTEORDER ||
+	!snapValid(snap, snap->hdr->headers,
+		(uint64_t) snap->hdr->nheaders * sizeof(*snap->headers)) ||
+	!snapValid(snap, snap->hdr->tags,
+		(uint64_t) snap->hdr->ntags * sizeof(*snap->tags)))
+    {
+	rpmlog(RPMLOG_DEBUG, "ignoring invalid snapshot %s\n", fn);
+	snap = rpmdbSnapFree(snap);
+	goto exit;
+    }
+    snap->headers = (const void *) (snap->map + snap->hdr->headers);
+    snap->tags = (const void *) (snap->map + snap->hdr->tags);
+
+exit:
+    (void) close(fd);
+    return snap;
+}
+
+rpmdbSnap rpmdbSnapFree(rpmdbSnap snap)
+{
+    if (snap) {
+	(void) munmap(snap->map, snap->len);
+	free(snap);
+    }
+    return NULL;
+}
+
+unsigned int rpmdbSnapCount(rpmdbSnap snap)
+{
+    return (snap ? snap->hdr->nheaders : 0);
+}
+
+unsigned int rpmdbSnapInstance(rpmdbSnap snap, unsigned int ix)
+{
+    return (ix < rpmdbSnapCount(snap) ? snap->headers[ix].hdrNum : 0);
+}
+
+int rpmdbSnapHeader(rpmdbSnap snap, unsigned int hdrNum,
+		const void ** uhp, size_t * uhlenp)
+{
+    struct snapEntry_s needle;
+    const struct snapEntry_s * e;
+
+    needle.hdrNum = hdrNum;
+    e = bsearch(&needle, snap->headers, snap->hdr->nheaders,
+		sizeof(*snap->headers), entryCmp);
+    if (e == NULL || !snapValid(snap, e->offset, e->size))
+	return 1;
+    *uhp = snap->map + e->offset;
+    *uhlenp = e->size;
+    return 0;
+}
+
+static const struct snapTag_s * snapFindTag(rpmdbSnap snap, rpmTag tag)
+{
+    struct snapTag_s needle;
+    const struct snapTag_s * t;
+
+    needle.tag = tag;
+    t = bsearch(&needle, snap->tags, snap->hdr->ntags,
+		sizeof(*snap->tags), tagCmp);
+    if (t && !snapValid(snap, t->keys, (uint64_t) t->nkeys * sizeof(struct snapKey_s)))
+	t = NULL;
+    return t;
+}
+
+int rpmdbSnapHasTag(rpmdbSnap snap, rpmTag tag)
+{
+    return (snap && snapFindTag(snap, tag) != NULL);
+}
+
+int rpmdbSnapGet(rpmdbSnap snap, rpmTag tag, const void * key, size_t keylen,
+		dbiIndexSet * setp)
+{
+    const struct snapTag_s * t = snapFindTag(snap, tag);
+    const struct snapKey_s * keys;
+    const uint32_t * recs;
+    dbiIndexSet set;
+    size_t l = 0, u;
+
+    if (t == NULL)
+	return DB_NOTFOUND;
+
+    keys = (const void *) (snap->map + t->keys);
+    u = t->nkeys;
+    while (l < u) {
+	size_t i = (l + u) / 2;
+	const struct snapKey_s * k = keys + i;
+	int cmp;
+
+	if (!snapValid(snap, k->offset, k->keylen))
+	    return DB_NOTFOUND;
+	cmp = keyCmp(key, keylen, snap->map + k->offset, k->keylen);
+	if (cmp < 0)
+	    u = i;
+	else if (cmp > 0)
+	    l = i + 1;
+	else {
+	    uint64_t roff = k->offset + k->keylen + (8 - (k->keylen % 8)) % 8;
+	    if (!snapValid(snap, roff, (uint64_t) k->nrecs * 2 * sizeof(*recs)))
+		return DB_NOTFOUND;
+	    recs = (const void *) (snap->map + roff);
+
+	    set = xcalloc(1, sizeof(*set));
+	    set->count = k->nrecs;
+	    set->alloced = (set->count ? set->count : 1) * sizeof(*set->recs);
+	    set->recs = xmalloc(set->alloced);
+	    for (i = 0; i < set->count; i++) {
+		set->recs[i].hdrNum = recs[2*i];
+		set->recs[i].tagNum = recs[2*i+1];
+	    }
+	    *setp = set;
+	    return 0;
+	}
+    }
+    return DB_NOTFOUND;
+}
@@ -9,6 +9,8 @@
 #include <rpm/rpmlog.h>
 #include <rpm/rpmds.h>
 
+#include "lib/rpmds_internal.h"
+
 #include "debug.h"
 
 /**
@@ -22,6 +24,18 @@ int _rpmds_nopromote = 1;
 
 int _rpmds_unspecified_epoch_noise = 0;
 
+#define	DSPOOL_CHUNK	16384	/* min. size of a string pool chunk */
+
+/**
+ * Strings of a merged dependency set, in chunks that never move.
+ */
+typedef struct dsPool_s * dsPool;
+struct dsPool_s {
+    dsPool next;		/*!< Previous (full) chunk. */
+    size_t size;		/*!< Chunk size. */
+    size_t used;		/*!< Bytes used. */
+};
+
 /**
  * A package dependency set.
  */
@@ -40,9 +54,34 @@ struct rpmds_s {
     unsigned l;			/*!< Low element (bsearch). */
     unsigned u;			/*!< High element (bsearch). */
     int nopromote;		/*!< Don't promote Epoch: in rpmdsCompare()? */
+    int alloced;		/*!< No. of allocated elements (merged sets) */
+    dsPool pool;		/*!< N/EVR string pool (merged sets) */
+    rpmStrPool strpool;		/*!< Shared N/EVR string pool (interned sets) */
+    struct rpmdsEVR_s * evr;	/*!< Split EVR(s) (on first compare) */
+    struct rpmverSeg_s * evrsegs;	/*!< Version/release segments */
     int nrefs;			/*!< Reference count. */
 };
 
+/**
+ * Epoch-version-release of a dependency, split for comparison. The
+ * version and release segments point into the EVR string, so comparing
+ * doesn't need to copy (or even look at) anything else.
+ */
+struct rpmdsEVR_s {
+    uint64_t E;			/*!< Epoch (if EVR_EPOCH). */
+    uint32_t seg;		/*!< Index of 1st version segment. */
+    uint32_t nv;		/*!< No. of version segments. */
+    uint32_t nr;		/*!< No. of release segments. */
+    uint32_t flags;
+};
+
+enum evrFlags_e {
+    EVR_EPOCH	= (1 << 0),	/*!< has epoch */
+    EVR_RELEASE	= (1 << 1),	/*!< has (non-empty) release */
+    EVR_VTAIL	= (1 << 2),	/*!< characters after last version segment */
+    EVR_RTAIL	= (1 << 3),	/*!< characters after last release segment */
+};
+
 static const char ** rpmdsDupArgv(const char ** argv, int argc);
 
 static int dsType(rpmTag tag, 
@@ -118,13 +157,19 @@ fprintf(stderr, "*** ds %p\t%s[%d]\n", ds, ds->Type, ds->Count);
     if (dsType(ds->tagN, NULL, &tagEVR, &tagF))
 	return NULL;
 
-    if (ds->Count > 0) {
-	ds->N = _free(ds->N);
-	ds->EVR = _free(ds->EVR);
-	ds->Flags = _free(ds->Flags);
+    ds->N = _free(ds->N);
+    ds->EVR = _free(ds->EVR);
+    ds->Flags = _free(ds->Flags);
+    while (ds->pool != NULL) {
+	dsPool next = ds->pool->next;
+	free(ds->pool);
+	ds->pool = next;
     }
+    ds->strpool = rpmStrPoolFree(ds->strpool);
 
     ds->DNEVR = _free(ds->DNEVR);
+    ds->evr = _free(ds->evr);
+    ds->evrsegs = _free(ds->evrsegs);
     ds->Color = _free(ds->Color);
     ds->Refs = _free(ds->Refs);
 
@@ -182,6 +227,25 @@ exit:
     return ds;
 }
 
+void rpmdsIntern(rpmds ds, rpmStrPool pool)
+{
+    const char ** N, ** EVR;
+
+    /* Merged sets have a pool of their own. */
+    if (ds == NULL || pool == NULL || ds->strpool != NULL || ds->alloced > 0)
+	return;
+
+    N = rpmStrPoolInternArray(pool, ds->N, ds->Count);
+    /* XXX rpm prior to 3.0.2 did not always supply EVR and Flags. */
+    EVR = (ds->EVR ? rpmStrPoolInternArray(pool, ds->EVR, ds->Count) : NULL);
+
+    free(ds->N);
+    free(ds->EVR);
+    ds->N = N;
+    ds->EVR = EVR;
+    ds->strpool = rpmStrPoolLink(pool);
+}
+
 char * rpmdsNewDNEVR(const char * dspfx, const rpmds ds)
 {
     char * tbuf, * t;
@@ -524,35 +588,116 @@ assert(argv[ac] != NULL);
     return av;
 }
 
-static rpmds rpmdsDup(const rpmds ods)
+/**
+ * Copy a string into the string pool of a merged dependency set.
+ * @param ds		dependency set
+ * @param str		string
+ * @return		pooled copy of string
+ */
+static const char * dsPoolStr(rpmds ds, const char * str)
 {
-    rpmds ds = xcalloc(1, sizeof(*ds));
-    size_t nb;
+    size_t len = strlen(str) + 1;
+    dsPool p = ds->pool;
+    char * t;
 
-    ds->Type = ods->Type;
-    ds->tagN = ods->tagN;
-    ds->Count = ods->Count;
-    ds->i = ods->i;
-    ds->l = ods->l;
-    ds->u = ods->u;
-    ds->nopromote = ods->nopromote;
+    if (p == NULL || p->size - p->used < len) {
+	size_t size = (len > DSPOOL_CHUNK) ? len : DSPOOL_CHUNK;
+	p = xmalloc(sizeof(*p) + size);
+	p->next = ds->pool;
+	p->size = size;
+	p->used = 0;
+	ds->pool = p;
+    }
+    t = (char *) (p + 1) + p->used;
+    p->used += len;
+    return memcpy(t, str, len);
+}
 
-    nb = (ds->Count+1) * sizeof(*ds->N);
-    ds->N = rpmdsDupArgv(ods->N, ods->Count);
+/**
+ * Make sure a merged dependency set has room for more elements.
+ * Capacity grows geometrically, so inserting one by one is amortized.
+ * @param ds		dependency set
+ * @param n		no. of elements to add
+ */
+static void dsGrow(rpmds ds, int n)
+{
+    int alloced = (ds->alloced > 0 ? ds->alloced : 8);
 
-    /* XXX rpm prior to 3.0.2 did not always supply EVR and Flags. */
-assert(ods->EVR != NULL);
-assert(ods->Flags != NULL);
+    if (ds->Count + n <= ds->alloced)
+	return;
+    while (alloced < ds->Count + n)
+	alloced *= 2;
+
+    /* N and EVR stay NULL terminated, as rpmdsDupArgv() does it. */
+    ds->N = xrealloc(ds->N, (alloced + 1) * sizeof(*ds->N));
+    ds->EVR = xrealloc(ds->EVR, (alloced + 1) * sizeof(*ds->EVR));
+    ds->Flags = xrealloc(ds->Flags, alloced * sizeof(*ds->Flags));
+    if (ds->Color != NULL) {
+	ds->Color = xrealloc(ds->Color, alloced * sizeof(*ds->Color));
+	memset(ds->Color + ds->Count, 0,
+		(alloced - ds->Count) * sizeof(*ds->Color));
+    }
+    if (ds->Refs != NULL) {
+	ds->Refs = xrealloc(ds->Refs, alloced * sizeof(*ds->Refs));
+	memset(ds->Refs + ds->Count, 0,
+		(alloced - ds->Count) * sizeof(*ds->Refs));
+    }
+    ds->alloced = alloced;
+}
+
+/**
+ * Turn a dependency set into a merged one, with pooled strings and
+ * growable arrays.
+ * @param ds		dependency set
+ */
+static void dsPoolInit(rpmds ds)
+{
+    const char ** N, ** EVR;
+    rpmsenseFlags * Flags;
+    int i;
 
-    nb = (ds->Count+1) * sizeof(*ds->EVR);
-    ds->EVR = rpmdsDupArgv(ods->EVR, ods->Count);
+    if (ds->alloced > 0)
+	return;
 
-    nb = (ds->Count * sizeof(*ds->Flags));
-    ds->Flags = memcpy(xmalloc(nb), ods->Flags, nb);
+    N = xmalloc((ds->Count + 1) * sizeof(*N));
+    EVR = xmalloc((ds->Count + 1) * sizeof(*EVR));
+    Flags = xcalloc(ds->Count + 1, sizeof(*Flags));
+    for (i = 0; i < ds->Count; i++) {
+	N[i] = dsPoolStr(ds, ds->N[i]);
+	/* XXX rpm prior to 3.0.2 did not always supply EVR and Flags. */
+	EVR[i] = dsPoolStr(ds, (ds->EVR ? ds->EVR[i] : ""));
+	if (ds->Flags)
+	    Flags[i] = ds->Flags[i];
+    }
+    N[ds->Count] = EVR[ds->Count] = NULL;
+
+    free(ds->N);
+    free(ds->EVR);
+    free(ds->Flags);
+    ds->N = N;
+    ds->EVR = EVR;
+    ds->Flags = Flags;
+    ds->alloced = ds->Count;
+}
 
-/* FIX: ds->Flags is kept, not only */
-    return rpmdsLink(ds, (ds ? ds->Type : NULL));
+/**
+ * Create an empty merged dependency set of the same type as another.
+ * @param ods		dependency set
+ * @return		new dependency set
+ */
+static rpmds rpmdsNewMerged(const rpmds ods)
+{
+    rpmds ds = xcalloc(1, sizeof(*ds));
 
+    ds->Type = ods->Type;
+    ds->tagN = ods->tagN;
+    ds->Count = 0;
+    ds->i = -1;
+    ds->nopromote = ods->nopromote;
+    dsGrow(ds, 1);
+    ds->N[0] = ds->EVR[0] = NULL;
+
+    return rpmdsLink(ds, (ds ? ds->Type : NULL));
 }
 
 int rpmdsFind(rpmds ds, const rpmds ods)
@@ -585,82 +730,213 @@ int rpmdsFind(rpmds ds, const rpmds ods)
     return -1;
 }
 
+/**
+ * An element of a dependency set to be merged.
+ */
+struct dsElem_s {
+    const char * N;
+    const char * EVR;
+    rpmsenseFlags Flags;
+};
+
+/* Same order as rpmdsFind() expects. */
+static int dsElemCmp(const struct dsElem_s * a, const struct dsElem_s * b)
+{
+    int comparison = strcmp(a->N, b->N);
+
+    if (comparison == 0)
+	comparison = strcmp(a->EVR, b->EVR);
+    if (comparison == 0)
+	comparison = (a->Flags - b->Flags);
+    return comparison;
+}
+
+static int dsElemSort(const void * a, const void * b)
+{
+    return dsElemCmp(a, b);
+}
+
+/**
+ * Insert an element into a merged dependency set.
+ * @param ds		merged dependency set
+ * @param ix		index to insert at
+ * @param e		element
+ */
+static void dsInsert(rpmds ds, int ix, const struct dsElem_s * e)
+{
+    int n = ds->Count - ix;
+
+    dsGrow(ds, 1);
+    memmove(ds->N + ix + 1, ds->N + ix, n * sizeof(*ds->N));
+    memmove(ds->EVR + ix + 1, ds->EVR + ix, n * sizeof(*ds->EVR));
+    memmove(ds->Flags + ix + 1, ds->Flags + ix, n * sizeof(*ds->Flags));
+    if (ds->Color != NULL) {
+	memmove(ds->Color + ix + 1, ds->Color + ix, n * sizeof(*ds->Color));
+	ds->Color[ix] = 0;
+    }
+    if (ds->Refs != NULL) {
+	memmove(ds->Refs + ix + 1, ds->Refs + ix, n * sizeof(*ds->Refs));
+	ds->Refs[ix] = 0;
+    }
+    ds->N[ix] = dsPoolStr(ds, e->N);
+    ds->EVR[ix] = dsPoolStr(ds, e->EVR);
+    ds->Flags[ix] = e->Flags;
+    ds->Count++;
+    ds->N[ds->Count] = ds->EVR[ds->Count] = NULL;
+}
+
+/**
+ * Merge sorted elements (without duplicates) into a merged dependency set,
+ * in one pass.
+ * @param ds		merged dependency set
+ * @param elems		sorted elements
+ * @param nelems	no. of elements
+ * @return		no. of elements added
+ */
+static int dsMergeSorted(rpmds ds, const struct dsElem_s * elems, int nelems)
+{
+    const char ** N, ** EVR;
+    rpmsenseFlags * Flags;
+    rpm_color_t * Color = NULL;
+    int32_t * Refs = NULL;
+    int alloced, count = 0;
+    int i = 0, j = 0;
+
+    /* Capacity for the worst case, the old arrays are replaced. */
+    alloced = (ds->alloced > 0 ? ds->alloced : 8);
+    while (alloced < ds->Count + nelems)
+	alloced *= 2;
+    N = xmalloc((alloced + 1) * sizeof(*N));
+    EVR = xmalloc((alloced + 1) * sizeof(*EVR));
+    Flags = xmalloc(alloced * sizeof(*Flags));
+    if (ds->Color != NULL)
+	Color = xcalloc(alloced, sizeof(*Color));
+    if (ds->Refs != NULL)
+	Refs = xcalloc(alloced, sizeof(*Refs));
+
+    while (i < ds->Count || j < nelems) {
+	int comparison;
+
+	if (i == ds->Count) {
+	    comparison = -1;
+	} else if (j == nelems) {
+	    comparison = 1;
+	} else {
+	    struct dsElem_s old;
+	    old.N = ds->N[i];
+	    old.EVR = ds->EVR[i];
+	    old.Flags = ds->Flags[i];
+	    comparison = dsElemCmp(elems + j, &old);
+	}
+
+	if (comparison < 0) {
+	    N[count] = dsPoolStr(ds, elems[j].N);
+	    EVR[count] = dsPoolStr(ds, elems[j].EVR);
+	    Flags[count] = elems[j].Flags;
+	    j++;
+	} else {
+	    N[count] = ds->N[i];
+	    EVR[count] = ds->EVR[i];
+	    Flags[count] = ds->Flags[i];
+	    if (Color) Color[count] = ds->Color[i];
+	    if (Refs) Refs[count] = ds->Refs[i];
+	    i++;
+	    /* If this entry is already present, don't bother. */
+	    if (comparison == 0)
+		j++;
+	}
+	count++;
+    }
+    N[count] = EVR[count] = NULL;
+
+    free(ds->N);
+    free(ds->EVR);
+    free(ds->Flags);
+    free(ds->Color);
+    free(ds->Refs);
+    ds->N = N;
+    ds->EVR = EVR;
+    ds->Flags = Flags;
+    ds->Color = Color;
+    ds->Refs = Refs;
+    ds->alloced = alloced;
+
+    nelems = count - ds->Count;
+    ds->Count = count;
+    return nelems;
+}
+
 int rpmdsMerge(rpmds * dsp, rpmds ods)
 {
     rpmds ds;
-    const char ** N;
-    const char ** EVR;
-    rpmsenseFlags * Flags;
-    int j;
-    int save;
+    struct dsElem_s * elems;
+    int nelems;
+    int added;
+    int i;
 
     if (dsp == NULL || ods == NULL)
 	return -1;
 
-    /* If not initialized yet, dup the 1st entry. */
-    if (*dsp == NULL) {
-	save = ods->Count;
-	ods->Count = 1;
-	*dsp = rpmdsDup(ods);
-	ods->Count = save;
-    }
+    /*
+     * If not initialized yet, start an empty set. This used to copy the
+     * 1st entry and insert the others (sorted, without duplicates) behind
+     * it, merging all of them into an empty set gives the same result.
+     */
+    if (*dsp == NULL)
+	*dsp = rpmdsNewMerged(ods);
     ds = *dsp;
     if (ds == NULL)
 	return -1;
 
-    /*
-     * Add new entries.
-     */
-    save = ods->i;
-    ods = rpmdsInit(ods);
-    if (ods != NULL)
-    while (rpmdsNext(ods) >= 0) {
-	/*
-	 * If this entry is already present, don't bother.
-	 */
-	if (rpmdsFind(ds, ods) >= 0)
-	    continue;
+    if (ods->Count <= 0)
+	return 0;
 
-	/*
-	 * Insert new entry.
-	 */
-	for (j = ds->Count; j > ds->u; j--)
-	    ds->N[j] = ds->N[j-1];
-	ds->N[ds->u] = ods->N[ods->i];
-	N = rpmdsDupArgv(ds->N, ds->Count+1);
-	ds->N = _free(ds->N);
-	ds->N = N;
-	
-	/* XXX rpm prior to 3.0.2 did not always supply EVR and Flags. */
+    /* XXX rpm prior to 3.0.2 did not always supply EVR and Flags. */
 assert(ods->EVR != NULL);
 assert(ods->Flags != NULL);
 
-	for (j = ds->Count; j > ds->u; j--)
-	    ds->EVR[j] = ds->EVR[j-1];
-	ds->EVR[ds->u] = ods->EVR[ods->i];
-	EVR = rpmdsDupArgv(ds->EVR, ds->Count+1);
-	ds->EVR = _free(ds->EVR);
-	ds->EVR = EVR;
-
-	Flags = xmalloc((ds->Count+1) * sizeof(*Flags));
-	if (ds->u > 0)
-	    memcpy(Flags, ds->Flags, ds->u * sizeof(*Flags));
-	if (ds->u < ds->Count)
-	    memcpy(Flags + ds->u + 1, ds->Flags + ds->u, 
-		   (ds->Count - ds->u) * sizeof(*Flags));
-	Flags[ds->u] = ods->Flags[ods->i];
-	ds->Flags = _free(ds->Flags);
-	ds->Flags = Flags;
-
-	ds->i = ds->Count;
-	ds->Count++;
+    dsPoolInit(ds);
+
+    if (ods->Count == 1) {
+	struct dsElem_s e;
+	int save = ods->i;
+
+	ods->i = 0;
+	e.N = ods->N[0];
+	e.EVR = ods->EVR[0];
+	e.Flags = ods->Flags[0];
+	/* Insert new entry, unless already present. */
+	added = (rpmdsFind(ds, ods) < 0);
+	if (added)
+	    dsInsert(ds, ds->u, &e);
+	ods->i = save;
+    } else {
+	/* Sort the new entries once, then merge them in one go. */
+	elems = xmalloc(ods->Count * sizeof(*elems));
+	for (i = 0; i < ods->Count; i++) {
+	    elems[i].N = ods->N[i];
+	    elems[i].EVR = ods->EVR[i];
+	    elems[i].Flags = ods->Flags[i];
+	}
+	qsort(elems, ods->Count, sizeof(*elems), dsElemSort);
+	for (i = 0, nelems = 0; i < ods->Count; i++) {
+	    if (nelems > 0 && dsElemCmp(elems + nelems - 1, elems + i) == 0)
+		continue;
+	    elems[nelems++] = elems[i];
+	}
+	added = dsMergeSorted(ds, elems, nelems);
+	free(elems);
+    }
 
+    if (added) {
+	ds->i = ds->Count - 1;
+	/* Entries moved, split EVR(s) again when needed. */
+	ds->evr = _free(ds->evr);
+	ds->evrsegs = _free(ds->evrsegs);
     }
-    ods->i = save;
     return 0;
 }
 
-
 int rpmdsSearch(rpmds ds, rpmds ods)
 {
     int comparison;
@@ -718,59 +994,93 @@ int rpmdsSearch(rpmds ds, rpmds ods)
     return i;
 }
 /**
- * Split EVR into epoch, version, and release components.
+ * Split EVR into epoch, version, and release segments.
  * @param evr		[epoch:]version[-release] string
- * @retval *ep		pointer to epoch
- * @retval *vp		pointer to version
- * @retval *rp		pointer to release
+ * @retval e		split EVR (except e->seg)
+ * @retval segs		version, then release segments (NULL only counts)
+ * @return		no. of segments
  */
 static
-void parseEVR(char * evr,
-		const char ** ep,
-		const char ** vp,
-		const char ** rp)
+int splitEVR(const char * evr, struct rpmdsEVR_s * e, struct rpmverSeg_s * segs)
 {
-    const char *epoch;
-    const char *version;		/* assume only version is present */
-    const char *release;
-    char *s, *se;
+    const char * s, * se, * v;
+    int tail;
+
+    e->E = 0;
+    e->nv = e->nr = 0;
+    e->flags = 0;
+    if (evr == NULL)
+	return 0;
 
     s = evr;
     while (*s && risdigit(*s)) s++;	/* s points to epoch terminator */
     se = strrchr(s, '-');		/* se points to version terminator */
 
     if (*s == ':') {
-	epoch = evr;
-	*s++ = '\0';
-	version = s;
-	if (*epoch == '\0') epoch = "0";
+	e->flags |= EVR_EPOCH;
+	for (v = evr; v < s; v++)	/* XXX saturates, epochs are 32 bit */
+	    e->E = (e->E > (UINT64_MAX - 9) / 10) ? UINT64_MAX
+						   : 10 * e->E + (*v - '0');
+	v = s + 1;
     } else {
-	epoch = NULL;	/* XXX disable epoch compare if missing */
-	version = evr;
+	v = evr;
     }
-    if (se) {
-	*se++ = '\0';
-	release = se;
-    } else {
-	release = NULL;
+    if (se == NULL)
+	se = v + strlen(v);
+
+    e->nv = rpmverSplit(v, se - v, v - evr, segs, &tail);
+    if (tail)
+	e->flags |= EVR_VTAIL;
+
+    if (*se == '-' && se[1] != '\0') {
+	se++;
+	e->flags |= EVR_RELEASE;
+	e->nr = rpmverSplit(se, strlen(se), se - evr,
+			    (segs ? segs + e->nv : NULL), &tail);
+	if (tail)
+	    e->flags |= EVR_RTAIL;
     }
+    return e->nv + e->nr;
+}
+
+void rpmdsSplitEVR(rpmds ds)
+{
+    uint32_t nsegs = 0;
+    int i;
+
+    if (ds == NULL || ds->evr != NULL || ds->EVR == NULL || ds->Count <= 0)
+	return;
 
-    if (ep) *ep = epoch;
-    if (vp) *vp = version;
-    if (rp) *rp = release;
+    ds->evr = xcalloc(ds->Count, sizeof(*ds->evr));
+    for (i = 0; i < ds->Count; i++) {
+	ds->evr[i].seg = nsegs;
+	nsegs += splitEVR(ds->EVR[i], ds->evr + i, NULL);
+    }
+    ds->evrsegs = xmalloc((nsegs + 1) * sizeof(*ds->evrsegs));
+    for (i = 0; i < ds->Count; i++)
+	(void) splitEVR(ds->EVR[i], ds->evr + i, ds->evrsegs + ds->evr[i].seg);
 }
 
-int rpmdsCompare(const rpmds A, const rpmds B)
+/**
+ * Compare A[ai] and B[bi] for overlap. Neither set's iterator is used.
+ * @param A		1st dependency set
+ * @param ai		index into 1st set
+ * @param aDepend	1st dependency as text (for messages)
+ * @param B		2nd dependency set
+ * @param bi		index into 2nd set
+ * @param bDepend	2nd dependency as text (for messages)
+ * @return		1 if dependencies overlap, 0 otherwise
+ */
+static int dsCompare(const rpmds A, int ai, const char * aDepend,
+		     const rpmds B, int bi, const char * bDepend)
 {
-    char *aDepend = (A->DNEVR != NULL ? xstrdup(A->DNEVR+2) : "");
-    char *bDepend = (B->DNEVR != NULL ? xstrdup(B->DNEVR+2) : "");
-    char *aEVR, *bEVR;
-    const char *aE, *aV, *aR, *bE, *bV, *bR;
+    const char *aEVR, *bEVR;
+    const struct rpmdsEVR_s *a, *b;
     int result;
     int sense;
 
     /* Different names don't overlap. */
-    if (strcmp(A->N[A->i], B->N[B->i])) {
+    if (strcmp(A->N[ai], B->N[bi])) {
 	result = 0;
 	goto exit;
     }
@@ -782,28 +1092,30 @@ int rpmdsCompare(const rpmds A, const rpmds B)
     }
 
     /* Same name. If either A or B is an existence test, always overlap. */
-    if (!((A->Flags[A->i] & RPMSENSE_SENSEMASK) && (B->Flags[B->i] & RPMSENSE_SENSEMASK))) {
+    if (!((A->Flags[ai] & RPMSENSE_SENSEMASK) && (B->Flags[bi] & RPMSENSE_SENSEMASK))) {
 	result = 1;
 	goto exit;
     }
 
     /* If either EVR is non-existent or empty, always overlap. */
-    if (!(A->EVR[A->i] && *A->EVR[A->i] && B->EVR[B->i] && *B->EVR[B->i])) {
+    if (!(A->EVR[ai] && *A->EVR[ai] && B->EVR[bi] && *B->EVR[bi])) {
 	result = 1;
 	goto exit;
     }
 
     /* Both AEVR and BEVR exist. */
-    aEVR = xstrdup(A->EVR[A->i]);
-    parseEVR(aEVR, &aE, &aV, &aR);
-    bEVR = xstrdup(B->EVR[B->i]);
-    parseEVR(bEVR, &bE, &bV, &bR);
+    rpmdsSplitEVR(A);
+    rpmdsSplitEVR(B);
+    aEVR = A->EVR[ai];
+    a = A->evr + ai;
+    bEVR = B->EVR[bi];
+    b = B->evr + bi;
 
     /* Compare {A,B} [epoch:]version[-release] */
     sense = 0;
-    if (aE && *aE && bE && *bE)
-	sense = rpmvercmp(aE, bE);
-    else if (aE && *aE && atol(aE) > 0) {
+    if ((a->flags & EVR_EPOCH) && (b->flags & EVR_EPOCH))
+	sense = (a->E < b->E) ? -1 : (a->E > b->E);
+    else if ((a->flags & EVR_EPOCH) && a->E > 0) {
 	if (!B->nopromote) {
 	    int lvl = (_rpmds_unspecified_epoch_noise  ? RPMLOG_WARNING : RPMLOG_DEBUG);
 	    rpmlog(lvl, _("The \"B\" dependency needs an epoch (assuming same epoch as \"A\")\n\tA = \"%s\"\tB = \"%s\"\n"),
@@ -811,27 +1123,31 @@ int rpmdsCompare(const rpmds A, const rpmds B)
 	    sense = 0;
 	} else
 	    sense = 1;
-    } else if (bE && *bE && atol(bE) > 0)
+    } else if ((b->flags & EVR_EPOCH) && b->E > 0)
 	sense = -1;
 
     if (sense == 0) {
-	sense = rpmvercmp(aV, bV);
-	if (sense == 0 && aR && *aR && bR && *bR)
-	    sense = rpmvercmp(aR, bR);
+	sense = rpmverCmpSplit(aEVR, A->evrsegs + a->seg, a->nv,
+			       (a->flags & EVR_VTAIL),
+			       bEVR, B->evrsegs + b->seg, b->nv,
+			       (b->flags & EVR_VTAIL));
+	if (sense == 0 && (a->flags & EVR_RELEASE) && (b->flags & EVR_RELEASE))
+	    sense = rpmverCmpSplit(aEVR, A->evrsegs + a->seg + a->nv, a->nr,
+				   (a->flags & EVR_RTAIL),
+				   bEVR, B->evrsegs + b->seg + b->nv, b->nr,
+				   (b->flags & EVR_RTAIL));
     }
-    aEVR = _free(aEVR);
-    bEVR = _free(bEVR);
 
     /* Detect overlap of {A,B} range. */
     result = 0;
-    if (sense < 0 && ((A->Flags[A->i] & RPMSENSE_GREATER) || (B->Flags[B->i] & RPMSENSE_LESS))) {
+    if (sense < 0 && ((A->Flags[ai] & RPMSENSE_GREATER) || (B->Flags[bi] & RPMSENSE_LESS))) {
 	result = 1;
-    } else if (sense > 0 && ((A->Flags[A->i] & RPMSENSE_LESS) || (B->Flags[B->i] & RPMSENSE_GREATER))) {
+    } else if (sense > 0 && ((A->Flags[ai] & RPMSENSE_LESS) || (B->Flags[bi] & RPMSENSE_GREATER))) {
 	result = 1;
     } else if (sense == 0 &&
-	(((A->Flags[A->i] & RPMSENSE_EQUAL) && (B->Flags[B->i] & RPMSENSE_EQUAL)) ||
-	 ((A->Flags[A->i] & RPMSENSE_LESS) && (B->Flags[B->i] & RPMSENSE_LESS)) ||
-	 ((A->Flags[A->i] & RPMSENSE_GREATER) && (B->Flags[B->i] & RPMSENSE_GREATER)))) {
+	(((A->Flags[ai] & RPMSENSE_EQUAL) && (B->Flags[bi] & RPMSENSE_EQUAL)) ||
+	 ((A->Flags[ai] & RPMSENSE_LESS) && (B->Flags[bi] & RPMSENSE_LESS)) ||
+	 ((A->Flags[ai] & RPMSENSE_GREATER) && (B->Flags[bi] & RPMSENSE_GREATER)))) {
 	result = 1;
     }
 
@@ -839,11 +1155,23 @@ exit:
     if (_noisy_range_comparison_debug_message)
     rpmlog(RPMLOG_DEBUG, "  %s    A %s\tB %s\n",
 	(result ? "YES" : "NO "), aDepend, bDepend);
-    aDepend = _free(aDepend);
-    bDepend = _free(bDepend);
     return result;
 }
 
+int rpmdsCompare(const rpmds A, const rpmds B)
+{
+    return dsCompare(A, A->i, (A->DNEVR != NULL ? A->DNEVR+2 : ""),
+		     B, B->i, (B->DNEVR != NULL ? B->DNEVR+2 : ""));
+}
+
+int rpmdsCompareIndex(const rpmds A, int aix, const rpmds B)
+{
+    if (A == NULL || aix < 0 || aix >= A->Count)
+	return 0;
+    return dsCompare(A, aix, A->N[aix],
+		     B, B->i, (B->DNEVR != NULL ? B->DNEVR+2 : ""));
+}
+
 void rpmdsProblem(rpmps ps, const char * pkgNEVR, const rpmds ds,
 	const fnpyKey * suggestedKeys, int adding)
 {
@@ -1000,6 +1328,9 @@ static const struct rpmlibProvides_s rpmlibProvides[] = {
     { "rpmlib(FileDigests)", 		"4.6.0-1",
 	(		 RPMSENSE_EQUAL),
     N_("file checksum digest algorithm is per package configurable") },
+    { "rpmlib(FileRawDigests)",		"4.7.0-1",
+	(		 RPMSENSE_EQUAL),
+    N_("file checksum digests can be stored in binary") },
 #ifdef WITH_CAP
     { "rpmlib(FileCaps)", 		"4.6.1-1",
 	(		 RPMSENSE_EQUAL),
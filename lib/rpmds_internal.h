@@ -0,0 +1,81 @@
+#ifndef _RPMDS_INTERNAL_H
+#define _RPMDS_INTERNAL_H
+
+#include <rpm/rpmutil.h>
+#include <rpm/rpmds.h>
+
+#include "lib/strpool.h"
+
+/** \ingroup rpmds
+ * An alpha or numeric segment of a version (or release) string.
+ */
+struct rpmverSeg_s {
+    uint32_t off;		/*!< Offset of segment (past leading zeros). */
+    uint32_t len : 31;		/*!< Length of segment. */
+    uint32_t isnum : 1;		/*!< Numeric segment? */
+};
+
+/** \ingroup rpmds
+ * Split a version (or release) string into its segments, the way
+ * rpmvercmp() sees them.
+ * @param s		version string
+ * @param len		length of version string
+ * @param base		offset of s (added to segment offsets)
+ * @retval segs		segments (NULL just counts them)
+ * @retval *tail	1 if anything follows the last segment (or NULL)
+ * @return		no. of segments
+ */
+RPM_GNUC_INTERNAL
+int rpmverSplit(const char * s, size_t len, uint32_t base,
+		struct rpmverSeg_s * segs, int * tail);
+
+/** \ingroup rpmds
+ * Compare two split version (or release) strings, without copying.
+ * Returns the same as rpmvercmp() on the original strings.
+ * @param a		1st string (segment offsets are relative to it)
+ * @param asegs		1st string segments
+ * @param an		no. of 1st string segments
+ * @param atail		1st string has characters after last segment?
+ * @param b		2nd string (segment offsets are relative to it)
+ * @param bsegs		2nd string segments
+ * @param bn		no. of 2nd string segments
+ * @param btail		2nd string has characters after last segment?
+ * @return		1: a is newer than b, 0: same, -1: b is newer
+ */
+RPM_GNUC_INTERNAL
+int rpmverCmpSplit(const char * a, const struct rpmverSeg_s * asegs,
+		int an, int atail,
+		const char * b, const struct rpmverSeg_s * bsegs,
+		int bn, int btail);
+
+/** \ingroup rpmds
+ * Split all EVR(s) of a dependency set for comparison, unless already
+ * done. Comparisons do this on demand, doing it up front leaves the set
+ * unmodified by them.
+ * @param ds		dependency set
+ */
+RPM_GNUC_INTERNAL
+void rpmdsSplitEVR(rpmds ds);
+
+/** \ingroup rpmds
+ * Compare an element of a dependency set against the current element of
+ * another for overlap, without moving (or otherwise modifying) the first
+ * set. With its EVRs already split, the 1st set can be shared by threads.
+ * @param A		1st dependency set
+ * @param aix		index into 1st set
+ * @param B		2nd dependency set
+ * @return		1 if dependencies overlap, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmdsCompareIndex(const rpmds A, int aix, const rpmds B);
+
+/** \ingroup rpmds
+ * Move the N/EVR strings of a dependency set into a (shared) string pool.
+ * The set keeps a reference to the pool.
+ * @param ds		dependency set
+ * @param pool		string pool
+ */
+RPM_GNUC_INTERNAL
+void rpmdsIntern(rpmds ds, rpmStrPool pool);
+
+#endif	/* _RPMDS_INTERNAL_H */
@@ -5,6 +5,8 @@
 
 #include "system.h"
 
+#include <pthread.h>
+
 #include <rpm/rpmlog.h>
 #include <rpm/rpmts.h>
 #include <rpm/rpmfileutil.h>	/* XXX rpmDoDigest */
@@ -16,67 +18,101 @@
 #include "lib/rpmte_internal.h"	/* relocations */
 #include "lib/cpio.h"	/* XXX CPIO_FOO */
 #include "lib/fsm.h"	/* XXX newFSM() */
+#include "lib/rpmhash.h"
 
 #include "debug.h"
 
 /*
- * Simple and stupid string "cache."
+ * Simple string "cache."
  * Store each unique string just once, retrieve by index value. 
- * For data where number of unique names is typically very low,
- * the dumb linear lookup appears to be fast enough and hash table seems
- * like an overkill.
+ * The number of unique strings is typically very low for user, group
+ * and language names, but packages can have tens of thousands of distinct
+ * symlink targets, so lookups go through a hash index. The user/group
+ * and language caches are shared by all file info sets, and are locked
+ * so that headers can be decoded in parallel.
  */
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+#define HASHTYPE strIndex
+#define HTKEYTYPE const char *
+#define HTDATATYPE scidx_t
+#include "lib/rpmhash.H"
+#include "lib/rpmhash.C"
+
 struct strcache_s {
-    char **uniq;
-    scidx_t num;
+    char **uniq;		/*!< unique strings */
+    scidx_t num;		/*!< no. of unique strings */
+    int alloced;		/*!< allocated size of uniq */
+    int nbuckets;		/*!< no. of index buckets */
+    strIndex index;		/*!< string to uniq index (lazily created) */
+    pthread_mutex_t * lock;	/*!< lock (for shared caches) */
 };
 
-static struct strcache_s _ugcache = { NULL, 0 };
+static pthread_mutex_t ugcacheLock = PTHREAD_MUTEX_INITIALIZER;
+static struct strcache_s _ugcache = { NULL, 0, 0, 127, NULL, &ugcacheLock };
 static strcache ugcache = &_ugcache;
-static struct strcache_s _langcache = { NULL, 0 };
+static pthread_mutex_t langcacheLock = PTHREAD_MUTEX_INITIALIZER;
+static struct strcache_s _langcache = { NULL, 0, 0, 127, NULL, &langcacheLock };
 static strcache langcache = &_langcache;
 
 static scidx_t strcachePut(strcache cache, const char *str)
 {
-    int found = 0;
+    scidx_t *data = NULL;
     scidx_t ret;
 
-    for (scidx_t i = 0; i < cache->num; i++) {
-	if (strcmp(str, cache->uniq[i]) == 0) {
-	    ret = i;
-	    found = 1;
-	    break;
-	}
-    }
-    if (!found) {
+    if (cache->lock)
+	(void) pthread_mutex_lock(cache->lock);
+
+    if (cache->index == NULL)
+	cache->index = strIndexCreate(cache->nbuckets, hashFunctionString,
+				      strcmp, NULL, NULL);
+
+    if (strIndexGetEntry(cache->index, str, &data, NULL, NULL)) {
+	ret = data[0];
+    } else {
 	/* blow up on index wraparound */
 	assert((scidx_t)(cache->num + 1) > cache->num);
-	cache->uniq = xrealloc(cache->uniq, 
-				sizeof(cache->uniq) * (cache->num+1));
+	if (cache->num == cache->alloced) {
+	    cache->alloced = cache->alloced ? 2 * cache->alloced : 16;
+	    cache->uniq = xrealloc(cache->uniq,
+				sizeof(*cache->uniq) * cache->alloced);
+	}
 	cache->uniq[cache->num] = xstrdup(str);
 	ret = cache->num;
+	strIndexAddEntry(cache->index, cache->uniq[ret], ret);
 	cache->num++;
     }
+
+    if (cache->lock)
+	(void) pthread_mutex_unlock(cache->lock);
     return ret;
 }
 
 static const char *strcacheGet(strcache cache, scidx_t idx)
 {
     const char *name = NULL;
+
+    if (cache->lock)
+	(void) pthread_mutex_lock(cache->lock);
     if (idx >= 0 && idx < cache->num && cache->uniq != NULL)
 	name = cache->uniq[idx];
+    if (cache->lock)
+	(void) pthread_mutex_unlock(cache->lock);
     return name;
 }
     
-static strcache strcacheNew(void)
+static strcache strcacheNew(int nbuckets)
 {
     strcache cache = xcalloc(1, sizeof(*cache));
+    cache->nbuckets = (nbuckets > 0) ? nbuckets : 31;
     return cache;
 }
 
 static strcache strcacheFree(strcache cache)
 {
     if (cache != NULL) {
+	cache->index = strIndexFree(cache->index);
 	for (scidx_t i = 0; i < cache->num; i++) {
 	    free(cache->uniq[i]);
 	}
@@ -1064,11 +1100,15 @@ fprintf(stderr, "*** fi %p\t%s[%d]\n", fi, fi->Type, fi->fc);
     if (fi->fc > 0) {
 	fi->bnl = _free(fi->bnl);
 	fi->dnl = _free(fi->dnl);
+	fi->strpool = rpmStrPoolFree(fi->strpool);
 
 	fi->flinkcache = strcacheFree(fi->flinkcache);
 	fi->flinks = _free(fi->flinks);
 	fi->flangs = _free(fi->flangs);
-	fi->digests = _free(fi->digests);
+	/* Decoded from hex, otherwise the (scareMem) header data. */
+	if (fi->digests == fi->digestbuf)
+	    fi->digests = NULL;
+	fi->digestbuf = _free(fi->digestbuf);
 	fi->fcapcache = strcacheFree(fi->fcapcache);
 	fi->fcaps = _free(fi->fcaps);
 
@@ -1086,6 +1126,7 @@ fprintf(stderr, "*** fi %p\t%s[%d]\n", fi, fi->Type, fi->fc);
 	    fi->fflags = _constfree(fi->fflags);
 	    fi->vflags = _constfree(fi->vflags);
 	    fi->fsizes = _constfree(fi->fsizes);
+	    fi->digests = _constfree(fi->digests);
 	    fi->frdevs = _constfree(fi->frdevs);
 	    fi->finodes = _constfree(fi->finodes);
 	    fi->dil = _free(fi->dil);
@@ -1105,6 +1146,7 @@ fprintf(stderr, "*** fi %p\t%s[%d]\n", fi, fi->Type, fi->fc);
     fi->apath = _free(fi->apath);
 
     fi->replacedSizes = _free(fi->replacedSizes);
+    fi->zeros = _free(fi->zeros);
 
     fi->h = headerFree(fi->h);
 
@@ -1115,6 +1157,23 @@ fprintf(stderr, "*** fi %p\t%s[%d]\n", fi, fi->Type, fi->fc);
     return NULL;
 }
 
+/*
+ * Convert a hex string (of twice len characters) to binary. Branch free
+ * so the compiler can vectorize it: for [0-9a-fA-F], the low nibble is
+ * the value of the digit, plus 9 for letters (which have bit 6 set).
+ */
+static void hex2bin(unsigned char * t, const char * s, size_t len)
+{
+    const unsigned char * u = (const unsigned char *) s;
+
+    for (size_t i = 0; i < len; i++) {
+	unsigned char hi = u[2 * i];
+	unsigned char lo = u[2 * i + 1];
+	t[i] = (((hi & 0x0f) + 9 * (hi >> 6)) << 4) |
+		((lo & 0x0f) + 9 * (lo >> 6));
+    }
+}
+
 /* Helper to push header tag data into a string cache */
 static scidx_t *cacheTag(strcache cache, Header h, rpmTag tag)
 {
@@ -1218,12 +1277,12 @@ rpmfi rpmfiNew(const rpmts ts, Header h, rpmTag tagN, rpmfiFlags flags)
 	_hgfi(h, RPMTAG_FILESTATES, &td, defFlags, fi->fstates);
 
     if (!(flags & RPMFI_NOFILECAPS)) {
-	fi->fcapcache = strcacheNew();
+	fi->fcapcache = strcacheNew(31);
 	fi->fcaps = cacheTag(fi->fcapcache, h, RPMTAG_FILECAPS);
     }
 
     if (!(flags & RPMFI_NOFILELINKTOS)) {
-	fi->flinkcache = strcacheNew();
+	fi->flinkcache = strcacheNew(fi->fc);
 	fi->flinks = cacheTag(fi->flinkcache, h, RPMTAG_FILELINKTOS);
     }
     /* FILELANGS are only interesting when installing */
@@ -1241,23 +1300,34 @@ rpmfi rpmfiNew(const rpmts ts, Header h, rpmTag tagN, rpmfiFlags flags)
     }
 
     fi->digests = NULL;
-    /* grab hex digests from header and store in binary format */
-    if (!(flags & RPMFI_NOFILEDIGESTS) &&
-	headerGet(h, RPMTAG_FILEDIGESTS, &fdigests, HEADERGET_MINMEM)) {
-	const char *fdigest;
+    fi->digestbuf = NULL;
+    if (!(flags & RPMFI_NOFILEDIGESTS)) {
 	size_t diglen = rpmDigestLength(fi->digestalgo);
-	fi->digests = t = xmalloc(rpmtdCount(&fdigests) * diglen);
 
-	while ((fdigest = rpmtdNextString(&fdigests))) {
-	    if (!(fdigest && *fdigest != '\0')) {
-		memset(t, 0, diglen);
+	/* use binary digests from header as is, if there are any */
+	if (headerGet(h, RPMTAG_FILERAWDIGESTS, &td, scareFlags)) {
+	    if (rpmtdType(&td) == RPM_BIN_TYPE && td.count == fi->fc * diglen)
+		fi->digests = td.data;
+	    else
+		rpmtdFreeData(&td);
+	}
+
+	/* otherwise grab hex digests and store in binary format */
+	if (fi->digests == NULL &&
+	    headerGet(h, RPMTAG_FILEDIGESTS, &fdigests, HEADERGET_MINMEM)) {
+	    const char *fdigest;
+	    fi->digestbuf = t = xmalloc(rpmtdCount(&fdigests) * diglen);
+
+	    while ((fdigest = rpmtdNextString(&fdigests))) {
+		if (!(fdigest && *fdigest != '\0'))
+		    memset(t, 0, diglen);
+		else
+		    hex2bin(t, fdigest, diglen);
 		t += diglen;
-		continue;
 	    }
-	    for (int j = 0; j < diglen; j++, t++, fdigest += 2)
-		*t = (rnibble(fdigest[0]) << 4) | rnibble(fdigest[1]);
+	    rpmtdFreeData(&fdigests);
+	    fi->digests = fi->digestbuf;
 	}
-	rpmtdFreeData(&fdigests);
     }
 
     /* XXX TR_REMOVED doesn;t need fmtimes, frdevs, finodes */
@@ -1310,6 +1380,46 @@ rpm_loff_t rpmfiFReplacedSize(rpmfi fi)
     return rsize;
 }
 
+rpm_count_t rpmfiColumns(rpmfi fi, struct rpmfiCols_s * cols)
+{
+    const uint32_t * zeros;
+
+    memset(cols, 0, sizeof(*cols));
+    if (fi == NULL || fi->fc <= 0)
+	return 0;
+
+    /* One zeroed column (of the widest type) stands in for missing data. */
+    if (fi->zeros == NULL)
+	fi->zeros = xcalloc(fi->fc, sizeof(*fi->zeros));
+    zeros = fi->zeros;
+
+    cols->fc = fi->fc;
+    cols->fmodes = fi->fmodes ? fi->fmodes : (const rpm_mode_t *) zeros;
+    cols->fsizes = fi->fsizes ? fi->fsizes : zeros;
+    cols->fflags = fi->fflags ? fi->fflags : zeros;
+    cols->fcolors = fi->fcolors ? fi->fcolors : zeros;
+    cols->dil = fi->dil ? fi->dil : zeros;
+    cols->replacedSizes = fi->replacedSizes ? fi->replacedSizes : zeros;
+    return cols->fc;
+}
+
+void rpmfiIntern(rpmfi fi, rpmStrPool pool)
+{
+    const char ** bnl, ** dnl;
+
+    if (fi == NULL || pool == NULL || fi->fc <= 0 || fi->strpool != NULL)
+	return;
+
+    bnl = rpmStrPoolInternArray(pool, fi->bnl, fi->fc);
+    dnl = rpmStrPoolInternArray(pool, fi->dnl, fi->dc);
+
+    free(fi->bnl);
+    free(fi->dnl);
+    fi->bnl = bnl;
+    fi->dnl = dnl;
+    fi->strpool = rpmStrPoolLink(pool);
+}
+
 void rpmfiFpLookup(rpmfi fi, fingerPrintCache fpc)
 {
     if (fi->fc > 0 && fi->fps == NULL) {
@@ -5,6 +5,7 @@
 #include <rpm/rpmfi.h>
 #include "lib/fsm.h"		/* for FSM_t */
 #include "lib/fprint.h"
+#include "lib/strpool.h"
 
 /* 
  * This limits maximum unique strings (user + group names) from packages to 
@@ -29,6 +30,7 @@ struct rpmfi_s {
     const char ** bnl;		/*!< Base name(s) (from header) */
 /*?null?*/
     const char ** dnl;		/*!< Directory name(s) (from header) */
+    rpmStrPool strpool;		/*!< Pool of base/dir name(s) (or NULL) */
 
     strcache flinkcache;	/*!< File link cache */
     scidx_t * flinks;		/*!< Index to file link(s) cache */
@@ -79,7 +81,8 @@ struct rpmfi_s {
     struct fingerPrint_s * fps;	/*!< File fingerprint(s). */
 
     pgpHashAlgo digestalgo;	/*!< File checksum algorithm */
-    unsigned char * digests;	/*!< File checksums in binary. */
+    const unsigned char * digests;	/*!< File checksums in binary. */
+    unsigned char * digestbuf;	/*!< File checksums decoded from hex */
 
     char * fn;			/*!< File name buffer. */
 
@@ -88,6 +91,7 @@ struct rpmfi_s {
     char ** apath;
     FSM_t fsm;			/*!< File state machine data. */
     rpm_off_t * replacedSizes;	/*!< (TR_ADDED) */
+    uint32_t * zeros;		/*!< Column for data missing from header */
     int magic;
 #define	RPMFIMAGIC	0x09697923
 /*=============================*/
@@ -95,6 +99,40 @@ struct rpmfi_s {
 int nrefs;		/*!< Reference count. */
 };
 
+/**
+ * Per-file data of a file info set as contiguous arrays, for passes over
+ * all files at once. Each column has fc entries, data missing from the
+ * header reads as zeros. Colors are as in the header, unmasked.
+ */
+struct rpmfiCols_s {
+    rpm_count_t fc;			/*!< No. of files. */
+    const rpm_mode_t * fmodes;		/*!< File mode(s). */
+    const rpm_off_t * fsizes;		/*!< File size(s). */
+    const rpm_flag_t * fflags;		/*!< File flag(s). */
+    const rpm_color_t * fcolors;	/*!< File color bits. */
+    const uint32_t * dil;		/*!< Directory indice(s). */
+    const rpm_off_t * replacedSizes;	/*!< Size(s) of replaced files. */
+};
+
+/**
+ * Return per-file columns of a file info set. The columns stay valid
+ * until the file info set is freed or replaced sizes are first set.
+ * @param fi		file info set
+ * @retval cols		file info columns
+ * @return		no. of files
+ */
+RPM_GNUC_INTERNAL
+rpm_count_t rpmfiColumns(rpmfi fi, struct rpmfiCols_s * cols);
+
+/**
+ * Move the base and directory names of a file info set into a (shared)
+ * string pool. The file info set keeps a reference to the pool.
+ * @param fi		file info set
+ * @param pool		string pool
+ */
+RPM_GNUC_INTERNAL
+void rpmfiIntern(rpmfi fi, rpmStrPool pool);
+
 RPM_GNUC_INTERNAL
 int rpmfiDIIndex(rpmfi fi, int dx);
 
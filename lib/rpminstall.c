@@ -4,6 +4,8 @@
 
 #include "system.h"
 
+#include <pthread.h>
+
 #include <rpm/rpmcli.h>
 #include <rpm/rpmtag.h>
 #include <rpm/rpmlib.h>		/* rpmReadPackageFile, vercmp etc */
@@ -14,6 +16,10 @@
 #include <rpm/rpmfileutil.h>
 
 #include "lib/manifest.h"
+#include "lib/misc.h"
+#include "lib/rpmts_internal.h"	/* rpmtsPool */
+#include "lib/signature.h"	/* rpmReadPackageStream */
+#include "rpmio/rpmio_internal.h"	/* rpmlogCapture */
 #include "debug.h"
 
 int rpmcliPackagesTotal = 0;
@@ -71,6 +77,56 @@ static void printHash(const rpm_loff_t amount, const rpm_loff_t total)
     }
 }
 
+/**
+ * Package streamed from a non-seekable fd, positioned at the payload.
+ */
+struct rpmStream_s {
+    fnpyKey key;		/*!< package retrieval key */
+    FD_t fd;			/*!< package stream */
+    pid_t pid;			/*!< url helper process (if any) */
+};
+
+static struct rpmStream_s * streams = NULL;
+static int nstreams = 0;
+
+/**
+ * Close a package stream, reaping its url helper (if any).
+ * @param fd		package stream
+ * @param pid		url helper process (-1 if none)
+ */
+static void streamClose(FD_t fd, pid_t pid)
+{
+    if (fd != NULL)
+	(void) Fclose(fd);
+    if (pid > 0)
+	(void) waitpid(pid, NULL, 0);
+}
+
+/**
+ * Return the stream of a package.
+ * @param key		package retrieval key
+ * @return		package stream, NULL if not streamed
+ */
+static FD_t streamFd(fnpyKey key)
+{
+    for (int i = 0; i < nstreams; i++) {
+	if (streams[i].key == key)
+	    return streams[i].fd;
+    }
+    return NULL;
+}
+
+/**
+ * Close all package streams.
+ */
+static void streamsFree(void)
+{
+    for (int i = 0; i < nstreams; i++)
+	streamClose(streams[i].fd, streams[i].pid);
+    streams = _free(streams);
+    nstreams = 0;
+}
+
 void * rpmShowProgress(const void * arg,
 			const rpmCallbackType what,
 			const rpm_loff_t amount,
@@ -90,6 +146,9 @@ void * rpmShowProgress(const void * arg,
     case RPMCALLBACK_INST_OPEN_FILE:
 	if (filename == NULL || filename[0] == '\0')
 	    return NULL;
+	/* Streams can't be reopened, they're closed by rpmInstall(). */
+	if ((rc = streamFd(key)) != NULL)
+	    return rc;
 	fd = Fopen(filename, "r.ufdio");
 	/* FIX: still necessary? */
 	if (fd == NULL || Ferror(fd)) {
@@ -105,6 +164,8 @@ void * rpmShowProgress(const void * arg,
 	break;
 
     case RPMCALLBACK_INST_CLOSE_FILE:
+	if (streamFd(key) != NULL)
+	    break;
 	/* FIX: still necessary? */
 	fd = fdFree(fd, RPMDBG_M("persist (showProgress)"));
 	if (fd != NULL) {
@@ -185,9 +246,244 @@ void * rpmShowProgress(const void * arg,
     return rc;
 }	
 
+/**
+ * Package read ahead item.
+ */
+struct rpmIngestItem_s {
+    char * fn;			/*!< package file name */
+    int stream;			/*!< read from a non-seekable stream? */
+    FD_t fd;			/*!< stream, positioned at the payload */
+    pid_t pid;			/*!< url helper process (if any) */
+    int state;			/*!< 0 queued, 1 reading, 2 done */
+    int opened;			/*!< was the package file opened? */
+    rpmRC rc;			/*!< rpmReadPackageFile() result */
+    Header h;			/*!< package header */
+    rpmlogCapture log;		/*!< messages issued while reading */
+};
+
+typedef struct rpmIngest_s * rpmIngest;
+
+/**
+ * Package headers read (and signatures checked) ahead on worker threads.
+ */
+struct rpmIngest_s {
+    rpmts ts;
+    rpmVSFlags vsflags;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct rpmIngestItem_s * items;
+    int nitems;
+    int next;			/*!< next item to be read */
+    int stop;
+    rpmtsPool pool;		/*!< read ahead threads (or NULL) */
+};
+
+/**
+ * Open and read a package, verifying signatures (if present).
+ * @param ts		transaction set
+ * @param vsflags	verify signature flags to use
+ * @param item		package to read
+ */
+static void ingestRead(rpmts ts, rpmVSFlags vsflags,
+		struct rpmIngestItem_s * item)
+{
+    rpmVSFlags ovsflags;
+    FD_t fd;
+
+    item->rc = RPMRC_FAIL;
+    item->pid = -1;
+    if (item->stream && urlIsURL(item->fn) != URL_IS_DASH)
+	fd = ufdStream(item->fn, &item->pid);
+    else
+	fd = Fopen(item->fn, "r.ufdio");
+    if (fd == NULL || Ferror(fd)) {
+	rpmlog(RPMLOG_ERR, _("open of %s failed: %s\n"), item->fn,
+			Fstrerror(fd));
+	streamClose(fd, item->pid);
+	item->pid = -1;
+	return;
+    }
+    item->opened = 1;
+
+    ovsflags = rpmtsSetVSFlags(ts, vsflags);
+    if (item->stream)
+	item->rc = rpmReadPackageStream(ts, fd, item->fn, &item->h);
+    else
+	item->rc = rpmReadPackageFile(ts, fd, item->fn, &item->h);
+    ovsflags = rpmtsSetVSFlags(ts, ovsflags);
+
+    /* Keep the stream (at the payload) of packages to be installed. */
+    switch (item->rc) {
+    case RPMRC_OK:
+    case RPMRC_NOTTRUSTED:
+    case RPMRC_NOKEY:
+	if (item->stream) {
+	    item->fd = fd;
+	    break;
+	}
+	/* fallthrough */
+    default:
+	streamClose(fd, item->pid);
+	item->pid = -1;
+	break;
+    }
+}
+
+/**
+ * Read packages until none are left (or reading is stopped).
+ * @param ts		private transaction set of the thread
+ * @param data		package reader
+ */
+static void ingestWorker(rpmts ts, void * data)
+{
+    rpmIngest ing = data;
+    struct rpmIngestItem_s * item;
+
+    while (1) {
+	(void) pthread_mutex_lock(&ing->lock);
+	if (ing->stop || ing->next >= ing->nitems) {
+	    (void) pthread_mutex_unlock(&ing->lock);
+	    break;
+	}
+	item = ing->items + ing->next++;
+	item->state = 1;
+	(void) pthread_mutex_unlock(&ing->lock);
+
+	rpmlogCaptureBegin();
+	ingestRead(ts, ing->vsflags, item);
+	item->log = rpmlogCaptureEnd();
+
+	(void) pthread_mutex_lock(&ing->lock);
+	item->state = 2;
+	(void) pthread_cond_broadcast(&ing->cond);
+	(void) pthread_mutex_unlock(&ing->lock);
+    }
+}
+
+/**
+ * Start reading packages, in parallel if %{_install_read_threads} permits.
+ * @param ts		transaction set
+ * @param vsflags	verify signature flags to use
+ * @param fnp		NULL terminated array of package file names
+ * @param state		package states (2 for streams)
+ * @return		package reader
+ */
+static rpmIngest ingestNew(rpmts ts, rpmVSFlags vsflags, char ** fnp,
+		const char * state)
+{
+    rpmIngest ing = xcalloc(1, sizeof(*ing));
+    int nthreads;
+    int i;
+
+    ing->ts = rpmtsLink(ts, RPMDBG_M("ingest"));
+    ing->vsflags = vsflags;
+    for (i = 0; fnp[i] != NULL; i++)
+	;
+    ing->nitems = i;
+    ing->items = xcalloc(ing->nitems + 1, sizeof(*ing->items));
+    for (i = 0; i < ing->nitems; i++) {
+	ing->items[i].fn = xstrdup(fnp[i]);
+	ing->items[i].stream = (state[i] == 2);
+    }
+
+    (void) pthread_mutex_init(&ing->lock, NULL);
+    (void) pthread_cond_init(&ing->cond, NULL);
+
+    nthreads = rpmExpandThreads("%{?_install_read_threads}");
+    if (nthreads > ing->nitems)
+	nthreads = ing->nitems;
+    if (nthreads > 1)
+	ing->pool = rpmtsPoolStart(ts, nthreads, 0, ingestWorker, ing);
+
+    return ing;
+}
+
+/**
+ * Return the result of reading a package, waiting for it if necessary.
+ * Messages issued while reading are emitted now, in package order.
+ * @param ing		package reader
+ * @param ix		package index
+ * @retval *opened	was the package file opened?
+ * @retval *hdrp	package header
+ * @retval *sfdp	package stream, at the payload (NULL if not streamed)
+ * @retval *pidp	url helper process of the stream (-1 if none)
+ * @return		rpmReadPackageFile() result
+ */
+static rpmRC ingestGet(rpmIngest ing, int ix, int * opened, Header * hdrp,
+		FD_t * sfdp, pid_t * pidp)
+{
+    struct rpmIngestItem_s * item = ing->items + ix;
+
+    if (ing->pool != NULL) {
+	(void) pthread_mutex_lock(&ing->lock);
+	/* Read it here if no worker got to it yet. */
+	if (item->state == 0 && ix == ing->next) {
+	    ing->next++;
+	    item->state = 1;
+	    (void) pthread_mutex_unlock(&ing->lock);
+	    ingestRead(ing->ts, ing->vsflags, item);
+	    (void) pthread_mutex_lock(&ing->lock);
+	    item->state = 2;
+	}
+	while (item->state != 2)
+	    (void) pthread_cond_wait(&ing->cond, &ing->lock);
+	(void) pthread_mutex_unlock(&ing->lock);
+	item->log = rpmlogCaptureFlush(item->log);
+    } else {
+	ingestRead(ing->ts, ing->vsflags, item);
+    }
+
+    *opened = item->opened;
+    *hdrp = item->h;
+    item->h = NULL;
+    *sfdp = item->fd;
+    item->fd = NULL;
+    *pidp = item->pid;
+    item->pid = -1;
+    return item->rc;
+}
+
+/**
+ * Stop reading packages and free the reader.
+ * @param ing		package reader
+ * @return		NULL always
+ */
+static rpmIngest ingestFree(rpmIngest ing)
+{
+    int i;
+
+    if (ing == NULL)
+	return NULL;
+
+    if (ing->pool != NULL) {
+	(void) pthread_mutex_lock(&ing->lock);
+	ing->stop = 1;
+	(void) pthread_mutex_unlock(&ing->lock);
+	ing->pool = rpmtsPoolFree(ing->pool);
+    }
+    (void) pthread_cond_destroy(&ing->cond);
+    (void) pthread_mutex_destroy(&ing->lock);
+
+    for (i = 0; i < ing->nitems; i++) {
+	struct rpmIngestItem_s * item = ing->items + i;
+	item->fn = _free(item->fn);
+	item->h = headerFree(item->h);
+	if (item->fd != NULL)
+	    streamClose(item->fd, item->pid);
+	/* Results nobody asked for, drop their messages as well. */
+	item->log = rpmlogCaptureFree(item->log);
+    }
+    ing->items = _free(ing->items);
+    ing->ts = rpmtsFree(ing->ts);
+    free(ing);
+    return NULL;
+}
+
 struct rpmEIU {
     Header h;
     FD_t fd;
+    FD_t sfd;			/*!< package stream, at the payload */
+    pid_t spid;			/*!< url helper process of the stream */
     int numFailed;
     int numPkgs;
     char ** pkgURL;
@@ -203,6 +499,7 @@ struct rpmEIU {
     char ** argv;
     rpmRelocation * relocations;
     rpmRC rpmrc;
+    rpmIngest ingest;
 };
 
 /** @todo Generalize --freshen policies. */
@@ -214,7 +511,7 @@ int rpmInstall(rpmts ts, struct rpmInstallArguments_s * ia, ARGV_t fileArgv)
     rpmRelocation * relocations;
     char * fileURL = NULL;
     int stopInstall = 0;
-    rpmVSFlags vsflags, ovsflags, tvsflags;
+    rpmVSFlags vsflags, ovsflags;
     int rc;
     int xx;
     int i;
@@ -297,6 +594,15 @@ restart:
 	case URL_IS_HTTPS:
 	case URL_IS_HTTP:
 	case URL_IS_FTP:
+	    if (rpmExpandNumeric("%{?_install_stream}")) {
+		if (rpmIsVerbose())
+		    fprintf(stdout, _("Retrieving %s\n"), fileURL);
+		eiu->pkgState[eiu->pkgx] = 2;
+		eiu->pkgURL[eiu->pkgx] = fileURL;
+		fileURL = NULL;
+		eiu->pkgx++;
+		break;
+	    }
 	{   char *tfn;
 	    FD_t tfd;
 
@@ -323,8 +629,13 @@ restart:
 	    eiu->pkgURL[eiu->pkgx] = tfn;
 	    eiu->pkgx++;
 	}   break;
+	case URL_IS_DASH:
+	    eiu->pkgState[eiu->pkgx] = 2;
+	    eiu->pkgURL[eiu->pkgx] = fileURL;
+	    fileURL = NULL;
+	    eiu->pkgx++;
+	    break;
 	case URL_IS_PATH:
-	case URL_IS_DASH:	/* WRONG WRONG WRONG */
 	case URL_IS_HKP:	/* WRONG WRONG WRONG */
 	default:
 	    eiu->pkgURL[eiu->pkgx] = fileURL;
@@ -337,36 +648,30 @@ restart:
 
     if (eiu->numFailed) goto exit;
 
+    /* Read the headers, verifying signatures (if present), ahead of use. */
+    eiu->ingest = ingestFree(eiu->ingest);
+    eiu->ingest = ingestNew(ts, vsflags, eiu->pkgURL+eiu->prevx,
+			eiu->pkgState+eiu->prevx);
+
     /* Continue processing file arguments, building transaction set. */
-    for (eiu->fnp = eiu->pkgURL+eiu->prevx;
+    for (eiu->fnp = eiu->pkgURL+eiu->prevx, i = 0;
 	 *eiu->fnp != NULL;
-	 eiu->fnp++, eiu->prevx++)
+	 eiu->fnp++, eiu->prevx++, i++)
     {
 	const char * fileName;
+	int opened;
 
 	rpmlog(RPMLOG_DEBUG, "============== %s\n", *eiu->fnp);
 	(void) urlPath(*eiu->fnp, &fileName);
 
 	/* Try to read the header from a package file. */
-	eiu->fd = Fopen(*eiu->fnp, "r.ufdio");
-	if (eiu->fd == NULL || Ferror(eiu->fd)) {
-	    rpmlog(RPMLOG_ERR, _("open of %s failed: %s\n"), *eiu->fnp,
-			Fstrerror(eiu->fd));
-	    if (eiu->fd != NULL) {
-		xx = Fclose(eiu->fd);
-		eiu->fd = NULL;
-	    }
+	eiu->rpmrc = ingestGet(eiu->ingest, i, &opened, &eiu->h,
+			&eiu->sfd, &eiu->spid);
+	if (!opened) {
 	    eiu->numFailed++; *eiu->fnp = NULL;
 	    continue;
 	}
 
-	/* Read the header, verifying signatures (if present). */
-	tvsflags = rpmtsSetVSFlags(ts, vsflags);
-	eiu->rpmrc = rpmReadPackageFile(ts, eiu->fd, *eiu->fnp, &eiu->h);
-	tvsflags = rpmtsSetVSFlags(ts, tvsflags);
-	xx = Fclose(eiu->fd);
-	eiu->fd = NULL;
-
 	switch (eiu->rpmrc) {
 	case RPMRC_FAIL:
 	    rpmlog(RPMLOG_ERR, _("%s cannot be installed\n"), *eiu->fnp);
@@ -374,6 +679,11 @@ restart:
 	    continue;
 	    break;
 	case RPMRC_NOTFOUND:
+	    if (eiu->pkgState[eiu->prevx] == 2) {
+		rpmlog(RPMLOG_ERR, _("%s: not an rpm package\n"), *eiu->fnp);
+		eiu->numFailed++; *eiu->fnp = NULL;
+		continue;
+	    }
 	    goto maybe_manifest;
 	    break;
 	case RPMRC_NOTTRUSTED:
@@ -385,6 +695,17 @@ restart:
 
 	eiu->isSource = headerIsSource(eiu->h);
 
+	if (eiu->isSource && eiu->sfd != NULL) {
+	    rpmlog(RPMLOG_ERR,
+		_("%s: source packages can't be installed from a stream\n"),
+		*eiu->fnp);
+	    streamClose(eiu->sfd, eiu->spid);
+	    eiu->sfd = NULL;
+	    eiu->h = headerFree(eiu->h);
+	    eiu->numFailed++; *eiu->fnp = NULL;
+	    continue;
+	}
+
 	if (eiu->isSource) {
 	    rpmlog(RPMLOG_DEBUG, "\tadded source package [%d]\n",
 		eiu->numSRPMS);
@@ -434,15 +755,35 @@ restart:
 	    mi = rpmdbFreeIterator(mi);
 	    if (count == 0) {
 		eiu->h = headerFree(eiu->h);
+		if (eiu->sfd != NULL) {
+		    streamClose(eiu->sfd, eiu->spid);
+		    eiu->sfd = NULL;
+		}
 		continue;
 	    }
 	    /* Package is newer than those currently installed. */
 	}
 
+	/* XXX 0x4: streamed, keep the header in the transaction element. */
 	rc = rpmtsAddInstallElement(ts, eiu->h, (fnpyKey)fileName,
-			(ia->installInterfaceFlags & INSTALL_UPGRADE) != 0,
+			((ia->installInterfaceFlags & INSTALL_UPGRADE) != 0) |
+			(eiu->sfd != NULL ? 0x4 : 0),
 			relocations);
 
+	/* The stream is handed out by rpmShowProgress() at install time. */
+	if (eiu->sfd != NULL) {
+	    if (rc == 0) {
+		streams = xrealloc(streams, (nstreams + 1) * sizeof(*streams));
+		streams[nstreams].key = (fnpyKey)fileName;
+		streams[nstreams].fd = eiu->sfd;
+		streams[nstreams].pid = eiu->spid;
+		nstreams++;
+	    } else {
+		streamClose(eiu->sfd, eiu->spid);
+	    }
+	    eiu->sfd = NULL;
+	}
+
 	/* XXX reference held by transaction set */
 	eiu->h = headerFree(eiu->h);
 	if (eiu->relocations)
@@ -507,6 +848,7 @@ maybe_manifest:
 	eiu->numFailed++; *eiu->fnp = NULL;
 	break;
     }
+    eiu->ingest = ingestFree(eiu->ingest);
 
     rpmlog(RPMLOG_DEBUG, "found %d source and %d binary packages\n",
 		eiu->numSRPMS, eiu->numRPMS);
@@ -586,6 +928,9 @@ maybe_manifest:
     }
 
 exit:
+    eiu->ingest = ingestFree(eiu->ingest);
+    if (eiu->sfd != NULL)
+	streamClose(eiu->sfd, eiu->spid);
     if (eiu->pkgURL != NULL)
     for (i = 0; i < eiu->numPkgs; i++) {
 	if (eiu->pkgURL[i] == NULL) continue;
@@ -600,6 +945,7 @@ exit:
     free(eiu);
 
     rpmtsEmpty(ts);
+    streamsFree();
 
     return rc;
 }
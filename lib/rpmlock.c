@@ -140,4 +140,24 @@ void rpmtsFreeLock(void *lock)
     rpmlock_free((rpmlock)lock);
 }
 
+pid_t rpmtsLockHolder(const char *rootDir)
+{
+    rpmlock lock;
+    pid_t pid = 0;
 
+    if (!rootDir)
+	rootDir = "/";
+    lock = rpmlock_new(rootDir);
+    if (lock) {
+	struct flock info;
+	info.l_type = F_WRLCK;
+	info.l_whence = SEEK_SET;
+	info.l_start = 0;
+	info.l_len = 0;
+	info.l_pid = 0;
+	if (fcntl(lock->fd, F_GETLK, &info) != -1 && info.l_type != F_UNLCK)
+	    pid = info.l_pid;
+	rpmlock_free(lock);
+    }
+    return pid;
+}
@@ -4,4 +4,7 @@
 void * rpmtsAcquireLock(rpmts ts);
 void rpmtsFreeLock(void *lock);
 
+/* Return pid of another process holding the transaction lock, or 0. */
+pid_t rpmtsLockHolder(const char *rootDir);
+
 #endif
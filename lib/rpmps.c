@@ -9,6 +9,8 @@
 #include <rpm/rpmstring.h>
 #include <rpm/rpmps.h>
 
+#include "lib/rpmps_internal.h"
+
 #include "debug.h"
 
 /**
@@ -164,6 +166,19 @@ void rpmpsAppend(rpmps ps, rpmProblemType type,
     rpmpsAppendProblem(ps, p);
 }
 
+int rpmpsMerge(rpmps dest, rpmps src)
+{
+    int i, n = rpmpsNumProblems(src);
+
+    if (dest == NULL || n == 0)
+	return 0;
+
+    for (i = 0; i < n; i++)
+	rpmpsAppendProblem(dest, src->probs[i]);
+    src->numProblems = 0;
+    return n;
+}
+
 #define XSTRCMP(a, b) ((!(a) && !(b)) || ((a) && (b) && !strcmp((a), (b))))
 
 /* XXX TODO: implement with iterators */
@@ -0,0 +1,16 @@
+#ifndef _RPMPS_INTERNAL_H
+#define _RPMPS_INTERNAL_H
+
+#include <rpm/rpmutil.h>
+#include <rpm/rpmps.h>
+
+/** \ingroup rpmps
+ * Move all problems of a set to the end of another, in order.
+ * @param dest		problem set to append to
+ * @param src		problem set to take problems from (left empty)
+ * @return		no. of problems moved
+ */
+RPM_GNUC_INTERNAL
+int rpmpsMerge(rpmps dest, rpmps src);
+
+#endif	/* _RPMPS_INTERNAL_H */
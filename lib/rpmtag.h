@@ -282,6 +282,7 @@ typedef enum rpmTag_e {
     RPMTAG_LONGSIZE		= 5009, /* l */
     RPMTAG_FILECAPS		= 5010, /* s[] */
     RPMTAG_FILEDIGESTALGO	= 5011, /* i file checksum algorithm */
+    RPMTAG_FILERAWDIGESTS	= 5012, /* x file checksums in binary */
 
     RPMTAG_FIRSTFREE_TAG	/*!< internal */
 } rpmTag;
@@ -11,7 +11,10 @@
 #include <rpm/rpmts.h>
 #include <rpm/rpmdb.h>
 
+#include "lib/rpmds_internal.h"	/* rpmdsIntern */
+#include "lib/rpmfi_internal.h"	/* rpmfiIntern */
 #include "lib/rpmte_internal.h"
+#include "lib/rpmts_internal.h"	/* rpmtsStrPool */
 
 #include "debug.h"
 
@@ -42,6 +45,7 @@ struct rpmte_s {
     int tree;			/*!< Tree index. */
     int depth;			/*!< Depth in dependency tree. */
     int breadth;		/*!< Breadth in dependency tree. */
+    int loop;			/*!< Dependency loop index (0 if none). */
     unsigned int db_instance;	/*!< Database instance (of removed pkgs) */
     tsortInfo tsi;		/*!< Dependency ordering chains. */
 
@@ -59,6 +63,7 @@ struct rpmte_s {
     rpmRelocation * relocs;	/*!< (TR_ADDED) Payload file relocations. */
     int nrelocs;		/*!< (TR_ADDED) No. of relocations. */
     FD_t fd;			/*!< (TR_ADDED) Payload file descriptor. */
+    Header streamh;		/*!< (TR_ADDED) Header of a streamed package. */
 
 #define RPMTE_HAVE_PRETRANS	(1 << 0)
 #define RPMTE_HAVE_POSTTRANS	(1 << 1)
@@ -111,6 +116,7 @@ static void delTE(rpmte p)
     p->NEVRA = _free(p->NEVRA);
 
     p->h = headerFree(p->h);
+    p->streamh = headerFree(p->streamh);
     p->fs = rpmfsFree(p->fs);
 
 
@@ -122,6 +128,7 @@ static void delTE(rpmte p)
 static rpmfi getFI(rpmte p, rpmts ts, Header h)
 {
     rpmfiFlags fiflags;
+    rpmfi fi;
     fiflags = (p->type == TR_ADDED) ? (RPMFI_NOHEADER | RPMFI_FLAGS_INSTALL) :
 				      (RPMFI_NOHEADER | RPMFI_FLAGS_ERASE);
 
@@ -131,7 +138,10 @@ static rpmfi getFI(rpmte p, rpmts ts, Header h)
 	    rpmRelocateFileList(p->relocs, p->nrelocs, p->fs, h);
 	}
     }
-    return rpmfiNew(ts, h, RPMTAG_BASENAMES, fiflags);
+    fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, fiflags);
+    /* Compact mode: share file names across elements. */
+    rpmfiIntern(fi, rpmtsStrPool(ts));
+    return fi;
 }
 
 /* stupid bubble sort, but it's probably faster here */
@@ -236,6 +246,7 @@ static void addTE(rpmts ts, rpmte p, Header h,
 {
     const char *name, *version, *release, *arch, *os;
     struct rpmtd_s td;
+    rpmStrPool pool;
 
     name = version = release = arch = NULL;
     headerNEVRA(h, &name, NULL, &version, &release, &arch);
@@ -281,6 +292,15 @@ static void addTE(rpmts ts, rpmte p, Header h,
     p->conflicts = rpmdsNew(h, RPMTAG_CONFLICTNAME, 0);
     p->obsoletes = rpmdsNew(h, RPMTAG_OBSOLETENAME, 0);
 
+    /* Compact mode: share dependency strings across elements. */
+    if ((pool = rpmtsStrPool(ts)) != NULL) {
+	rpmdsIntern(p->this, pool);
+	rpmdsIntern(p->provides, pool);
+	rpmdsIntern(p->requires, pool);
+	rpmdsIntern(p->conflicts, pool);
+	rpmdsIntern(p->obsoletes, pool);
+    }
+
     {
 	// get number of files by hand as rpmfiNew needs p->fs
 	struct rpmtd_s bnames;
@@ -339,6 +359,7 @@ rpmte rpmteNew(const rpmts ts, Header h,
 	/* nothing to do */
 	break;
     }
+    rpmtsAccountElement(ts, p);
 
     return p;
 }
@@ -369,6 +390,20 @@ Header rpmteSetHeader(rpmte te, Header h)
     return NULL;
 }
 
+void rpmteSetStreamHeader(rpmte te, Header h)
+{
+    if (te != NULL) {
+	te->streamh = headerFree(te->streamh);
+	if (h != NULL)
+	    te->streamh = headerLink(h);
+    }
+}
+
+Header rpmteStreamHeader(rpmte te)
+{
+    return (te != NULL ? te->streamh : NULL);
+}
+
 rpmElementType rpmteType(rpmte te)
 {
     /* XXX returning negative for unsigned type */
@@ -520,6 +555,21 @@ int rpmteSetDegree(rpmte te, int ndegree)
     return odegree;
 }
 
+int rpmteLoop(rpmte te)
+{
+    return (te != NULL ? te->loop : 0);
+}
+
+int rpmteSetLoop(rpmte te, int nloop)
+{
+    int oloop = 0;
+    if (te != NULL) {
+	oloop = te->loop;
+	te->loop = nloop;
+    }
+    return oloop;
+}
+
 tsortInfo rpmteTSI(rpmte te)
 {
     return te->tsi;
@@ -800,7 +850,10 @@ static Header rpmteFDHeader(rpmts ts, rpmte te)
 {
     Header h = NULL;
     te->fd = rpmtsNotify(ts, te, RPMCALLBACK_INST_OPEN_FILE, 0, 0);
-    if (te->fd != NULL) {
+    /* A stream is already at the payload, use the header it was added with. */
+    if (te->fd != NULL && te->streamh != NULL) {
+	h = headerLink(te->streamh);
+    } else if (te->fd != NULL) {
 	rpmVSFlags ovsflags;
 	rpmRC pkgrc;
 
@@ -993,6 +1046,11 @@ rpmfileState * rpmfsGetStates(rpmfs fs)
     return fs->states;
 }
 
+rpmFileAction * rpmfsGetActions(rpmfs fs)
+{
+    return fs->actions;
+}
+
 rpmFileAction rpmfsGetAction(rpmfs fs, unsigned int ix)
 {
     rpmFileAction action;
@@ -257,6 +257,21 @@ int rpmteDegree(rpmte te);
  */
 int rpmteSetDegree(rpmte te, int ndegree);
 
+/** \ingroup rpmte
+ * Retrieve dependency loop index of transaction element.
+ * @param te		transaction element
+ * @return		loop index (0 if not in a dependency loop)
+ */
+int rpmteLoop(rpmte te);
+
+/** \ingroup rpmte
+ * Set dependency loop index of transaction element.
+ * @param te		transaction element
+ * @param nloop		new loop index
+ * @return		previous loop index
+ */
+int rpmteSetLoop(rpmte te, int nloop);
+
 /** \ingroup rpmte
  * Retrieve tsort info for transaction element.
  * @param te		transaction element
@@ -17,6 +17,7 @@ struct tsortInfo_s {
     rpmte tsi_chain;
     int		tsi_reqx;
     int		tsi_qcnt;
+    int		tsi_node;	/*!< Dependency graph node (order index). */
 };
 
 /**
@@ -63,6 +64,23 @@ rpmfi rpmteSetFI(rpmte te, rpmfi fi);
 RPM_GNUC_INTERNAL
 FD_t rpmteSetFd(rpmte te, FD_t fd);
 
+/** \ingroup rpmte
+ * Mark transaction element as streamed: its package fd is not seekable and
+ * already positioned at the payload, the header can't be read again.
+ * @param te		transaction element
+ * @param h		header read from the stream (NULL to unmark)
+ */
+RPM_GNUC_INTERNAL
+void rpmteSetStreamHeader(rpmte te, Header h);
+
+/** \ingroup rpmte
+ * Retrieve header of a streamed transaction element.
+ * @param te		transaction element
+ * @return		header (weak reference), NULL if not streamed
+ */
+RPM_GNUC_INTERNAL
+Header rpmteStreamHeader(rpmte te);
+
 RPM_GNUC_INTERNAL
 int rpmteOpen(rpmte te, rpmts ts, int reload_fi);
 
@@ -111,6 +129,12 @@ rpmfileState * rpmfsGetStates(rpmfs fs);
 RPM_GNUC_INTERNAL
 rpmFileAction rpmfsGetAction(rpmfs fs, unsigned int ix);
 
+/*
+ * File dispositions, one per file (rpmfsFC() of them).
+ */
+RPM_GNUC_INTERNAL
+rpmFileAction * rpmfsGetActions(rpmfs fs);
+
 //RPM_GNUC_INTERNAL
 void rpmfsSetAction(rpmfs fs, unsigned int ix, rpmFileAction action);
 
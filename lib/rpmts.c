@@ -5,6 +5,7 @@
 #include "system.h"
 
 #include <inttypes.h>
+#include <pthread.h>
 
 #include <rpm/rpmtypes.h>
 #include <rpm/rpmlib.h>			/* rpmReadPackage etc */
@@ -23,8 +24,10 @@
 
 #include "rpmio/digest.h"
 #include "lib/rpmlock.h"
+#include "lib/rpmdb_internal.h"	/* rpmdbPruneIteratorMap */
 #include "lib/rpmts_internal.h"
 #include "lib/misc.h"
+#include "rpmio/rpmio_internal.h"	/* rpmArena */
 
 /* XXX FIXME: merge with existing (broken?) tests in system.h */
 /* portability fiddles */
@@ -263,6 +266,8 @@ int rpmtsSetKeyring(rpmts ts, rpmKeyring keyring)
     if (ts == NULL || rpmtsGetRdb(ts) != NULL)
 	return -1;
 
+    /* The deferred loader refers to this transaction set. */
+    rpmKeyringSetLoader(ts->keyring, NULL, NULL);
     rpmKeyringFree(ts->keyring);
     ts->keyring = rpmKeyringLink(keyring);
     return 0;
@@ -337,15 +342,24 @@ static int loadKeyringFromDB(rpmts ts)
     return nkeys;
 }
 
+static int loadKeyringDeferred(rpmKeyring keyring, void * data)
+{
+    rpmts ts = data;
+    int nkeys = loadKeyringFromDB(ts);
+
+    if (nkeys > 0) {
+	/* XXX make this a warning someday... */
+	rpmlog(RPMLOG_DEBUG, "Using legacy gpg-pubkey(s) from rpmdb\n");
+    }
+    return nkeys;
+}
+
 static void loadKeyring(rpmts ts)
 {
     ts->keyring = rpmKeyringNew();
-    if (loadKeyringFromFiles(ts) == 0) {
-	if (loadKeyringFromDB(ts) > 0) {
-	    /* XXX make this a warning someday... */
-	    rpmlog(RPMLOG_DEBUG, "Using legacy gpg-pubkey(s) from rpmdb\n");
-	}
-    }
+    /* Legacy rpmdb keys are only loaded on the first keyring lookup miss. */
+    if (loadKeyringFromFiles(ts) == 0)
+	rpmKeyringSetLoader(ts->keyring, loadKeyringDeferred, ts);
 }
 
 rpmRC rpmtsFindPubkey(rpmts ts, pgpDig dig)
@@ -453,6 +467,8 @@ rpmRC rpmtsImportPubkey(const rpmts ts, const unsigned char * pkt, size_t pktlen
 
     if ((pubkey = rpmPubkeyNew(pkt, pktlen)) == NULL)
 	goto exit;
+    /* Check for duplicates against rpmdb keys too. */
+    (void) rpmKeyringLoad(keyring);
     if (rpmKeyringAddKey(keyring, pubkey) != 0)
 	goto exit;
     if (makePubkeyHeader(ts, pubkey, h) != 0) 
@@ -537,6 +553,9 @@ void rpmtsEmpty(rpmts ts)
     ts->ntrees = 0;
     ts->maxDepth = 0;
 
+    if (ts->removedPackages != NULL)
+	memset(ts->removedPackages, 0,
+		(ts->removedPackagesBits / 32) * sizeof(*ts->removedPackages));
     ts->numRemovedPackages = 0;
     return;
 }
@@ -551,6 +570,40 @@ static void rpmtsPrintStat(const char * name, struct rpmop_s * op)
 		op->usecs/scale, op->usecs%scale);
 }
 
+static void rpmtsPrintMemStats(rpmts ts)
+{
+    static const unsigned int scale = (1000 * 1000);
+    struct rpmStrPoolStats_s ps;
+
+    if (ts->memstats.nelements == 0)
+	return;
+
+    fprintf(stderr, "   elements:    %6u %8u deps %8u files\n",
+		ts->memstats.nelements, ts->memstats.ndeps, ts->memstats.nfiles);
+    if (ts->strpool == NULL)
+	return;
+    rpmStrPoolStats(ts->strpool, &ps);
+    fprintf(stderr, "   strings:     %6u %6lu.%06lu MB %6lu.%06lu MB saved\n",
+		ps.nstrs,
+		(unsigned long)ps.size/scale, (unsigned long)ps.size%scale,
+		(unsigned long)ps.saved/scale, (unsigned long)ps.saved%scale);
+}
+
+static void rpmtsPrintArenaStats(void)
+{
+    static const unsigned int scale = (1000 * 1000);
+    struct rpmMallocStats_s ms;
+
+    rpmMallocStats(&ms);
+    if (ms.nallocs == 0)
+	return;
+    fprintf(stderr, "   arenas:      %6lu %6lu.%06lu MB %6lu mallocs %6lu resets\n",
+		(unsigned long)ms.nallocs,
+		(unsigned long)ms.allocbytes/scale,
+		(unsigned long)ms.allocbytes%scale,
+		(unsigned long)ms.nchunks, (unsigned long)ms.nresets);
+}
+
 static void rpmtsPrintStats(rpmts ts)
 {
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_TOTAL), 0);
@@ -571,6 +624,8 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("dbget:       ", rpmtsOp(ts, RPMTS_OP_DBGET));
     rpmtsPrintStat("dbput:       ", rpmtsOp(ts, RPMTS_OP_DBPUT));
     rpmtsPrintStat("dbdel:       ", rpmtsOp(ts, RPMTS_OP_DBDEL));
+    rpmtsPrintMemStats(ts);
+    rpmtsPrintArenaStats();
 }
 
 rpmts rpmtsFree(rpmts ts)
@@ -599,13 +654,25 @@ rpmts rpmtsFree(rpmts ts)
     ts->order = _free(ts->order);
     ts->orderAlloced = 0;
 
+    rpmKeyringSetLoader(ts->keyring, NULL, NULL);
     ts->keyring = rpmKeyringFree(ts->keyring);
     ts->netsharedPaths = argvFree(ts->netsharedPaths);
     ts->installLangs = argvFree(ts->installLangs);
+    ts->deferredProgs = argvFree(ts->deferredProgs);
+    {	int nscripts = 0;
+	ARGV_t * scripts = rpmtsTakeDeferredScripts(ts, &nscripts);
+	for (int i = 0; i < nscripts; i++)
+	    argvFree(scripts[i]);
+	free(scripts);
+    }
+
+    ts->arena = rpmArenaFree(ts->arena);
 
     if (_rpmts_stats)
 	rpmtsPrintStats(ts);
 
+    ts->strpool = rpmStrPoolFree(ts->strpool);
+
     (void) rpmtsUnlink(ts, RPMDBG_M("tsCreate"));
 
     ts = _free(ts);
@@ -613,6 +680,124 @@ rpmts rpmtsFree(rpmts ts)
     return NULL;
 }
 
+rpmStrPool rpmtsStrPool(rpmts ts)
+{
+    return (ts != NULL ? ts->strpool : NULL);
+}
+
+rpmArena rpmtsArena(rpmts ts)
+{
+    return ts->arena;
+}
+
+void rpmtsAccountElement(rpmts ts, rpmte te)
+{
+    static const rpmTag dsTags[] = {
+	RPMTAG_PROVIDENAME, RPMTAG_REQUIRENAME,
+	RPMTAG_CONFLICTNAME, RPMTAG_OBSOLETENAME, 0
+    };
+
+    if (ts == NULL || te == NULL)
+	return;
+
+    ts->memstats.nelements++;
+    for (const rpmTag * tag = dsTags; *tag; tag++)
+	ts->memstats.ndeps += rpmdsCount(rpmteDS(te, *tag));
+    ts->memstats.nfiles += rpmfiFC(rpmteFI(te));
+}
+
+int rpmtsDeferScript(rpmts ts, ARGV_const_t argv)
+{
+    int deferrable = 0;
+
+    if (ts == NULL || argvCount(argv) == 0)
+	return 0;
+
+    for (ARGV_const_t p = ts->deferredProgs; p && *p; p++) {
+	if (strcmp(*p, argv[0]) == 0) {
+	    deferrable = 1;
+	    break;
+	}
+    }
+    if (!deferrable)
+	return 0;
+
+    /* Identical commands only need to run once. */
+    for (int i = 0; i < ts->numDeferredScripts; i++) {
+	ARGV_const_t q = ts->deferredScripts[i];
+	int j;
+	if (argvCount(q) != argvCount(argv))
+	    continue;
+	for (j = 0; argv[j] != NULL; j++) {
+	    if (strcmp(q[j], argv[j]))
+		break;
+	}
+	if (argv[j] == NULL)
+	    return 1;
+    }
+
+    ts->deferredScripts = xrealloc(ts->deferredScripts,
+		(ts->numDeferredScripts + 1) * sizeof(*ts->deferredScripts));
+    ts->deferredScripts[ts->numDeferredScripts] = argvNew();
+    argvAppend(&ts->deferredScripts[ts->numDeferredScripts], argv);
+    ts->numDeferredScripts++;
+    return 1;
+}
+
+ARGV_t * rpmtsTakeDeferredScripts(rpmts ts, int * nscripts)
+{
+    ARGV_t * scripts = NULL;
+    int n = 0;
+
+    if (ts != NULL) {
+	scripts = ts->deferredScripts;
+	n = ts->numDeferredScripts;
+	ts->deferredScripts = NULL;
+	ts->numDeferredScripts = 0;
+    }
+    if (nscripts) *nscripts = n;
+    return scripts;
+}
+
+int rpmtsIsRemoved(rpmts ts, unsigned int hdrNum)
+{
+    if (ts == NULL || hdrNum >= ts->removedPackagesBits)
+	return 0;
+    return (ts->removedPackages[hdrNum >> 5] & (1U << (hdrNum & 0x1f))) != 0;
+}
+
+int rpmtsAddRemoved(rpmts ts, unsigned int hdrNum)
+{
+    if (ts == NULL || rpmtsIsRemoved(ts, hdrNum))
+	return 0;
+
+    /* Grow the bitmap geometrically to cover the instance. */
+    if (hdrNum >= ts->removedPackagesBits) {
+	unsigned int nbits = ts->removedPackagesBits ?
+				ts->removedPackagesBits : 1024;
+	while (nbits <= hdrNum)
+	    nbits *= 2;
+	ts->removedPackages = xrealloc(ts->removedPackages,
+			(nbits / 32) * sizeof(*ts->removedPackages));
+	memset(ts->removedPackages + ts->removedPackagesBits / 32, 0,
+		((nbits - ts->removedPackagesBits) / 32) *
+			sizeof(*ts->removedPackages));
+	ts->removedPackagesBits = nbits;
+    }
+
+    ts->removedPackages[hdrNum >> 5] |= (1U << (hdrNum & 0x1f));
+    ts->numRemovedPackages++;
+    return 1;
+}
+
+int rpmtsPruneRemoved(rpmts ts, rpmdbMatchIterator mi)
+{
+    if (ts == NULL || mi == NULL || ts->numRemovedPackages == 0)
+	return 0;
+    return rpmdbPruneIteratorMap(mi, ts->removedPackages,
+				 ts->removedPackagesBits);
+}
+
 rpmVSFlags rpmtsVSFlags(rpmts ts)
 {
     rpmVSFlags vsflags = 0;
@@ -850,31 +1035,36 @@ int rpmtsInitDSI(const rpmts ts)
     return rc;
 }
 
-void rpmtsUpdateDSI(const rpmts ts, dev_t dev,
-		rpm_loff_t fileSize, rpm_loff_t prevSize, rpm_loff_t fixupSize,
-		rpmFileAction action)
+/* Find the file system a device is on (NULL if unknown). */
+static rpmDiskSpaceInfo dsiLookup(const rpmts ts, dev_t dev)
 {
-    rpmDiskSpaceInfo dsi;
-    int64_t bneeded;
+    rpmDiskSpaceInfo dsi = ts->dsi;
 
-    dsi = ts->dsi;
     if (dsi) {
 	while (dsi->bsize && dsi->dev != dev)
 	    dsi++;
 	if (dsi->bsize == 0)
 	    dsi = NULL;
     }
-    if (dsi == NULL)
-	return;
+    return dsi;
+}
 
-    bneeded = BLOCK_ROUND(fileSize, dsi->bsize);
+/*
+ * Add the blocks and inodes needed by a file to the counters of a file
+ * system with block size bsize.
+ */
+static void dsiFileNeeds(int64_t bsize,
+		rpm_loff_t fileSize, rpm_loff_t prevSize, rpm_loff_t fixupSize,
+		rpmFileAction action, int64_t * bneededp, int64_t * ineededp)
+{
+    int64_t bneeded = BLOCK_ROUND(fileSize, bsize);
 
     switch (action) {
     case FA_BACKUP:
     case FA_SAVE:
     case FA_ALTNAME:
-	dsi->ineeded++;
-	dsi->bneeded += bneeded;
+	(*ineededp)++;
+	*bneededp += bneeded;
 	break;
 
     /*
@@ -883,13 +1073,13 @@ void rpmtsUpdateDSI(const rpmts ts, dev_t dev,
      * adjusted twice? Quite probably!
      */
     case FA_CREATE:
-	dsi->bneeded += bneeded;
-	dsi->bneeded -= BLOCK_ROUND(prevSize, dsi->bsize);
+	*bneededp += bneeded;
+	*bneededp -= BLOCK_ROUND(prevSize, bsize);
 	break;
 
     case FA_ERASE:
-	dsi->ineeded--;
-	dsi->bneeded -= bneeded;
+	(*ineededp)--;
+	*bneededp -= bneeded;
 	break;
 
     default:
@@ -897,7 +1087,75 @@ void rpmtsUpdateDSI(const rpmts ts, dev_t dev,
     }
 
     if (fixupSize)
-	dsi->bneeded -= BLOCK_ROUND(fixupSize, dsi->bsize);
+	*bneededp -= BLOCK_ROUND(fixupSize, bsize);
+}
+
+void rpmtsUpdateDSI(const rpmts ts, dev_t dev,
+		rpm_loff_t fileSize, rpm_loff_t prevSize, rpm_loff_t fixupSize,
+		rpmFileAction action)
+{
+    rpmDiskSpaceInfo dsi;
+
+    dsi = dsiLookup(ts, dev);
+    if (dsi == NULL)
+	return;
+
+    dsiFileNeeds(dsi->bsize, fileSize, prevSize, fixupSize, action,
+		 &dsi->bneeded, &dsi->ineeded);
+}
+
+void rpmtsUpdateDSIFiles(const rpmts ts, rpm_count_t fc,
+		const struct fingerPrint_s * fps, const rpm_off_t * fsizes,
+		const rpm_off_t * prevSizes, const rpm_loff_t * fixupSizes,
+		const rpmFileAction * actions)
+{
+    const struct fprintCacheEntry_s * entry;
+    rpmDiskSpaceInfo dsi = NULL;
+    int64_t * bneeded;
+    int64_t * ineeded;
+    dev_t dev = 0;
+    int looked = 0;
+    rpm_count_t i, j, n;
+    int k;
+
+    if (ts->dsi == NULL || ts->filesystemCount <= 0 || fps == NULL)
+	return;
+
+    bneeded = xcalloc(ts->filesystemCount, sizeof(*bneeded));
+    ineeded = xcalloc(ts->filesystemCount, sizeof(*ineeded));
+
+    for (i = 0; i < fc; i = j) {
+	/* Files in one directory are adjacent, take them all at once. */
+	entry = fps[i].entry;
+	for (j = i + 1; j < fc && fps[j].entry == entry; j++)
+	    {};
+	if (entry == NULL)
+	    continue;
+
+	/* Consecutive directories are mostly on the same device, too. */
+	if (!looked || entry->dev != dev) {
+	    dev = entry->dev;
+	    dsi = dsiLookup(ts, dev);
+	    looked = 1;
+	}
+	if (dsi == NULL)
+	    continue;
+
+	k = dsi - ts->dsi;
+	for (n = i; n < j; n++)
+	    dsiFileNeeds(dsi->bsize, fsizes[n], prevSizes[n],
+			 (fixupSizes ? fixupSizes[n] : 0), actions[n],
+			 &bneeded[k], &ineeded[k]);
+    }
+
+    /* Apply the sums once per file system. */
+    for (k = 0; k < ts->filesystemCount; k++) {
+	ts->dsi[k].bneeded += bneeded[k];
+	ts->dsi[k].ineeded += ineeded[k];
+    }
+
+    free(bneeded);
+    free(ineeded);
 }
 
 void rpmtsCheckDSIProblems(const rpmts ts, const rpmte te)
@@ -1098,6 +1356,10 @@ rpmts rpmtsCreate(void)
 
     ts->color = rpmExpandNumeric("%{?_transaction_color}");
     ts->prefcolor = rpmExpandNumeric("%{?_prefer_color}")?:2;
+    ts->strpool = rpmExpandNumeric("%{?_transaction_compact}") ?
+		rpmStrPoolNew() : NULL;
+    memset(&ts->memstats, 0, sizeof(ts->memstats));
+    ts->arena = rpmArenaNew(65536);
 
     ts->netsharedPaths = NULL;
     ts->installLangs = NULL;
@@ -1121,12 +1383,19 @@ rpmts rpmtsCreate(void)
 	    ts->installLangs = langs;
 	}
 	free(tmp);
+
+	tmp = rpmExpand("%{?_deferred_scriptlet_progs}", NULL);
+	if (tmp && *tmp != '\0') {
+	    argvSplit(&ts->deferredProgs, tmp, ":");
+	}
+	free(tmp);
     }
+    ts->deferredScripts = NULL;
+    ts->numDeferredScripts = 0;
 
     ts->numRemovedPackages = 0;
-    ts->allocedRemovedPackages = ts->delta;
-    ts->removedPackages = xcalloc(ts->allocedRemovedPackages,
-			sizeof(*ts->removedPackages));
+    ts->removedPackagesBits = 0;
+    ts->removedPackages = NULL;
 
     ts->rootDir = NULL;
     ts->currDir = NULL;
@@ -1155,3 +1424,107 @@ rpmts rpmtsCreate(void)
     return rpmtsLink(ts, RPMDBG_M("tsCreate"));
 }
 
+
+/**
+ * Worker thread of a pool.
+ */
+struct rpmtsPoolWorker_s {
+    rpmtsPool pool;
+    rpmts ts;			/*!< private transaction set */
+    pthread_t thread;
+};
+
+struct rpmtsPool_s {
+    rpmts ts;			/*!< transaction set the pool was cloned from */
+    rpmdb rdb;			/*!< database shared with the workers (or NULL) */
+    rpmtsPoolFunc func;
+    void * data;
+    int nworkers;
+    struct rpmtsPoolWorker_s * workers;
+};
+
+static void * rpmtsPoolThread(void * arg)
+{
+    struct rpmtsPoolWorker_s * w = arg;
+    w->pool->func(w->ts, w->pool->data);
+    return NULL;
+}
+
+rpmtsPool rpmtsPoolStart(rpmts ts, int nthreads, int sharedb,
+		rpmtsPoolFunc func, void * data)
+{
+    rpmtsPool pool;
+    rpmKeyring keyring;
+    int i;
+
+    if (nthreads <= 0)
+	return NULL;
+
+    /*
+     * Transaction sets are neither locked nor have thread safe reference
+     * counts: each worker gets a set (and keyring copy) of its own. Prime
+     * the lazily built tag tables before going parallel.
+     */
+    (void) rpmTagGetName(RPMTAG_NAME);
+    (void) rpmTagGetValue("name");
+    keyring = rpmtsGetKeyring(ts, 1);
+
+    pool = xcalloc(1, sizeof(*pool));
+    pool->ts = rpmtsLink(ts, RPMDBG_M("rpmtsPool"));
+    pool->rdb = (sharedb ? rpmtsGetRdb(ts) : NULL);
+    pool->func = func;
+    pool->data = data;
+    pool->workers = xcalloc(nthreads, sizeof(*pool->workers));
+    for (i = 0; i < nthreads; i++) {
+	struct rpmtsPoolWorker_s * w = pool->workers + i;
+	rpmKeyring wkeyring = rpmKeyringDup(keyring);
+
+	w->pool = pool;
+	w->ts = rpmtsCreate();
+	(void) rpmtsSetRootDir(w->ts, rpmtsRootDir(ts));
+	(void) rpmtsSetVSFlags(w->ts, rpmtsVSFlags(ts));
+	(void) rpmtsSetKeyring(w->ts, wkeyring);
+	wkeyring = rpmKeyringFree(wkeyring);
+	/* One database (and lock) per process, one cursor per iterator. */
+	if (pool->rdb != NULL)
+	    w->ts->rdb = rpmdbLink(pool->rdb, RPMDBG_M("rpmtsPool"));
+	if (pthread_create(&w->thread, NULL, rpmtsPoolThread, w)) {
+	    if (pool->rdb != NULL)
+		w->ts->rdb = rpmdbUnlink(pool->rdb, RPMDBG_M("rpmtsPool"));
+	    w->ts = rpmtsFree(w->ts);
+	    break;
+	}
+	pool->nworkers++;
+    }
+    keyring = rpmKeyringFree(keyring);
+
+    if (pool->nworkers == 0)
+	pool = rpmtsPoolFree(pool);
+    return pool;
+}
+
+rpmtsPool rpmtsPoolFree(rpmtsPool pool)
+{
+    int i;
+
+    if (pool == NULL)
+	return NULL;
+
+    for (i = 0; i < pool->nworkers; i++) {
+	struct rpmtsPoolWorker_s * w = pool->workers + i;
+
+	(void) pthread_join(w->thread, NULL);
+	(void) rpmswAdd(rpmtsOp(pool->ts, RPMTS_OP_DIGEST),
+			rpmtsOp(w->ts, RPMTS_OP_DIGEST));
+	(void) rpmswAdd(rpmtsOp(pool->ts, RPMTS_OP_SIGNATURE),
+			rpmtsOp(w->ts, RPMTS_OP_SIGNATURE));
+	/* A shared database is not to be closed with the worker's set. */
+	if (pool->rdb != NULL)
+	    w->ts->rdb = rpmdbUnlink(pool->rdb, RPMDBG_M("rpmtsPool"));
+	w->ts = rpmtsFree(w->ts);
+    }
+    pool->workers = _free(pool->workers);
+    pool->ts = rpmtsFree(pool->ts);
+    free(pool);
+    return NULL;
+}
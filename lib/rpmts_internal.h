@@ -6,6 +6,8 @@
 
 #include "lib/rpmhash.h"	/* XXX hashTable */
 #include "lib/fprint.h"
+#include "lib/strpool.h"
+#include "rpmio/rpmio_internal.h"	/* rpmArena */
 
 /** \ingroup rpmts
  */
@@ -32,6 +34,15 @@ struct diskspaceInfo_s {
 #define BLOCK_ROUND(size, block) (((size) + (block) - 1) / (block))
 
 
+/** \ingroup rpmts
+ * Transaction element accounting (for --stats).
+ */
+struct rpmtsMemStats_s {
+    unsigned int nelements;	/*!< No. of elements created. */
+    unsigned int ndeps;		/*!< No. of dependencies of elements. */
+    unsigned int nfiles;	/*!< No. of files of elements. */
+};
+
 /** \ingroup rpmts
  * The set of packages to be installed/removed atomically.
  */
@@ -57,9 +68,9 @@ struct rpmts_s {
     int dbmode;			/*!< Install database open mode. */
     rpmFpHash ht;		/*!< Fingerprint hash table. */
 
-    int * removedPackages;	/*!< Set of packages being removed. */
+    uint32_t * removedPackages;	/*!< Bitmap of packages being removed. */
+    unsigned int removedPackagesBits;	/*!< Size of removed packages bitmap. */
     int numRemovedPackages;	/*!< No. removed package instances. */
-    int allocedRemovedPackages;	/*!< Size of removed packages array. */
 
     rpmal addedPackages;	/*!< Set of packages being installed. */
     int numAddedPackages;	/*!< No. added package instances. */
@@ -88,12 +99,148 @@ struct rpmts_s {
 
     ARGV_t netsharedPaths;	/*!< From %{_netsharedpath} */
     ARGV_t installLangs;	/*!< From %{_install_langs} */
+    ARGV_t deferredProgs;	/*!< From %{_deferred_scriptlet_progs} */
+
+    ARGV_t * deferredScripts;	/*!< Queued (coalesced) scriptlet commands. */
+    int numDeferredScripts;	/*!< No. of queued scriptlet commands. */
 
     struct rpmop_s ops[RPMTS_OP_MAX];
 
+    rpmStrPool strpool;		/*!< Element string pool (compact mode). */
+    struct rpmtsMemStats_s memstats;	/*!< Element accounting. */
+    rpmArena arena;		/*!< Scratch memory of transaction operations. */
+
     rpmSpec spec;		/*!< Spec file control structure. */
 
     int nrefs;			/*!< Reference count. */
 };
 
+/** \ingroup rpmts
+ * Return the string pool shared by the elements of a transaction set.
+ * @param ts		transaction set
+ * @return		string pool, NULL unless %{_transaction_compact} is set
+ */
+RPM_GNUC_INTERNAL
+rpmStrPool rpmtsStrPool(rpmts ts);
+
+/** \ingroup rpmts
+ * Account a new transaction element (for --stats).
+ * @param ts		transaction set
+ * @param te		transaction element
+ */
+RPM_GNUC_INTERNAL
+void rpmtsAccountElement(rpmts ts, rpmte te);
+
+/** \ingroup rpmts
+ * Return the scratch memory arena of a transaction set. An operation
+ * (like rpmtsOrder()) allocates its temporary data from it, and resets it
+ * when done. Not for use by threads.
+ * @param ts		transaction set
+ * @return		memory arena
+ */
+RPM_GNUC_INTERNAL
+rpmArena rpmtsArena(rpmts ts);
+
+/** \ingroup rpmts
+ * Queue a scriptlet command to be run once at the end of the transaction.
+ * Only commands whose program is listed in %{_deferred_scriptlet_progs}
+ * are deferred, identical commands are coalesced into a single run.
+ * @param ts		transaction set
+ * @param argv		scriptlet program and its arguments
+ * @return		1 if deferred, 0 if the command must run now
+ */
+RPM_GNUC_INTERNAL
+int rpmtsDeferScript(rpmts ts, ARGV_const_t argv);
+
+/** \ingroup rpmts
+ * Take over the queue of deferred scriptlet commands.
+ * The caller is responsible for freeing the returned commands.
+ * @param ts		transaction set
+ * @retval nscripts	no. of returned commands
+ * @return		array of queued commands (or NULL)
+ */
+RPM_GNUC_INTERNAL
+ARGV_t * rpmtsTakeDeferredScripts(rpmts ts, int * nscripts);
+
+/** \ingroup rpmts
+ * Is an installed package instance being removed by the transaction?
+ * @param ts		transaction set
+ * @param hdrNum	package instance (header number)
+ * @return		1 if being removed, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmtsIsRemoved(rpmts ts, unsigned int hdrNum);
+
+/** \ingroup rpmts
+ * Mark an installed package instance as being removed by the transaction.
+ * @param ts		transaction set
+ * @param hdrNum	package instance (header number)
+ * @return		1 if newly added, 0 if already present
+ */
+RPM_GNUC_INTERNAL
+int rpmtsAddRemoved(rpmts ts, unsigned int hdrNum);
+
+/** \ingroup rpmts
+ * Prune package instances being removed from a database iterator.
+ * @param ts		transaction set
+ * @param mi		rpm database iterator
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmtsPruneRemoved(rpmts ts, rpmdbMatchIterator mi);
+
+/** \ingroup rpmts
+ * Update disk space needs on each partition for a package's files at
+ * once. Files are grouped by the device of their directory fingerprint,
+ * the sums are applied once per file system.
+ * @param ts		transaction set
+ * @param fc		no. of files
+ * @param fps		file fingerprints
+ * @param fsizes	file sizes
+ * @param prevSizes	sizes of files being replaced
+ * @param fixupSizes	sizes of overlapped files in other packages (or NULL)
+ * @param actions	file dispositions
+ */
+RPM_GNUC_INTERNAL
+void rpmtsUpdateDSIFiles(const rpmts ts, rpm_count_t fc,
+		const struct fingerPrint_s * fps, const rpm_off_t * fsizes,
+		const rpm_off_t * prevSizes, const rpm_loff_t * fixupSizes,
+		const rpmFileAction * actions);
+
+/** \ingroup rpmts
+ * Threads working for a transaction set, each with a private copy of it.
+ */
+typedef struct rpmtsPool_s * rpmtsPool;
+
+/** \ingroup rpmts
+ * Function run by the threads of a pool.
+ * @param ts		private transaction set of the thread
+ * @param data		private data of the pool
+ */
+typedef void (*rpmtsPoolFunc) (rpmts ts, void * data);
+
+/** \ingroup rpmts
+ * Start threads, each running func() with a transaction set of its own.
+ * The private sets have the root directory, verify signature flags and
+ * (a copy of) the keyring of ts.
+ * @param ts		transaction set
+ * @param nthreads	no. of threads to start
+ * @param sharedb	also share the (open) database of ts?
+ * @param func		thread function
+ * @param data		private data passed to func()
+ * @return		pool, NULL if no thread was started
+ */
+RPM_GNUC_INTERNAL
+rpmtsPool rpmtsPoolStart(rpmts ts, int nthreads, int sharedb,
+		rpmtsPoolFunc func, void * data);
+
+/** \ingroup rpmts
+ * Wait for the threads of a pool to finish, add their digest and
+ * signature timings to the transaction set, and free the pool.
+ * @param pool		pool (or NULL)
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+rpmtsPool rpmtsPoolFree(rpmtsPool pool);
+
 #endif /* _RPMTS_INTERNAL_H */
@@ -7,30 +7,53 @@
 #include <rpm/rpmlib.h>		/* rpmvercmp proto */
 #include <rpm/rpmstring.h>
 
+#include "lib/rpmds_internal.h"
+
 #include "debug.h"
 
+/* compare two alpha or two numeric segments (not NUL terminated) */
+static int segcmp(const char * one, size_t onelen,
+		  const char * two, size_t twolen, int isnum)
+{
+    int rc;
+
+    if (isnum) {
+	/* this used to be done by converting the digit segments */
+	/* to ints using atoi() - it's changed because long  */
+	/* digit segments can overflow an int - this should fix that. */
+
+	/* throw away any leading zeros - it's a number, right? */
+	while (onelen > 0 && *one == '0') one++, onelen--;
+	while (twolen > 0 && *two == '0') two++, twolen--;
+
+	/* whichever number has more digits wins */
+	if (onelen > twolen) return 1;
+	if (twolen > onelen) return -1;
+    }
+
+    /* memcmp will return which one is greater - even if the two */
+    /* segments are alpha or if they are numeric. if the common */
+    /* part is equal, the longer (alpha) segment is greater */
+    rc = memcmp(one, two, (onelen < twolen ? onelen : twolen));
+    if (rc) return (rc < 1 ? -1 : 1);
+    if (onelen == twolen) return 0;
+    return (onelen < twolen ? -1 : 1);
+}
+
 /* compare alpha and numeric segments of two versions */
 /* return 1: a is newer than b */
 /*        0: a and b are the same version */
 /*       -1: b is newer than a */
 int rpmvercmp(const char * a, const char * b)
 {
-    char oldch1, oldch2;
-    char abuf[strlen(a)+1], bbuf[strlen(b)+1];
-    char *str1 = abuf, *str2 = bbuf;
-    char * one, * two;
+    const char * str1, * str2;
+    const char * one = a, * two = b;
     int rc;
     int isnum;
 
     /* easy comparison to see if versions are identical */
     if (!strcmp(a, b)) return 0;
 
-    strcpy(str1, a);
-    strcpy(str2, b);
-
-    one = str1;
-    two = str2;
-
     /* loop through each version segment of str1 and str2 and compare them */
     while (*one && *two) {
 	while (*one && !risalnum(*one)) one++;
@@ -55,48 +78,19 @@ int rpmvercmp(const char * a, const char * b)
 	    isnum = 0;
 	}
 
-	/* save character at the end of the alpha or numeric segment */
-	/* so that they can be restored after the comparison */
-	oldch1 = *str1;
-	*str1 = '\0';
-	oldch2 = *str2;
-	*str2 = '\0';
-
-	/* this cannot happen, as we previously tested to make sure that */
-	/* the first string has a non-null segment */
-	if (one == str1) return -1;	/* arbitrary */
-
 	/* take care of the case where the two version segments are */
 	/* different types: one numeric, the other alpha (i.e. empty) */
 	/* numeric segments are always newer than alpha segments */
 	/* XXX See patch #60884 (and details) from bugzilla #50977. */
 	if (two == str2) return (isnum ? 1 : -1);
 
-	if (isnum) {
-	    /* this used to be done by converting the digit segments */
-	    /* to ints using atoi() - it's changed because long  */
-	    /* digit segments can overflow an int - this should fix that. */
-
-	    /* throw away any leading zeros - it's a number, right? */
-	    while (*one == '0') one++;
-	    while (*two == '0') two++;
-
-	    /* whichever number has more digits wins */
-	    if (strlen(one) > strlen(two)) return 1;
-	    if (strlen(two) > strlen(one)) return -1;
-	}
-
-	/* strcmp will return which one is greater - even if the two */
-	/* segments are alpha or if they are numeric.  don't return  */
-	/* if they are equal because there might be more segments to */
-	/* compare */
-	rc = strcmp(one, two);
-	if (rc) return (rc < 1 ? -1 : 1);
+	/* segments compare by length, not NUL terminated, so there */
+	/* is no need to copy the strings. don't return if they are */
+	/* equal because there might be more segments to compare */
+	rc = segcmp(one, str1 - one, two, str2 - two, isnum);
+	if (rc) return rc;
 
-	/* restore character that was replaced by null above */
-	*str1 = oldch1;
 	one = str1;
-	*str2 = oldch2;
 	two = str2;
     }
 
@@ -108,3 +102,80 @@ int rpmvercmp(const char * a, const char * b)
     /* whichever version still has characters left over wins */
     if (!*one) return -1; else return 1;
 }
+
+int rpmverSplit(const char * s, size_t len, uint32_t base,
+		struct rpmverSeg_s * segs, int * tail)
+{
+    const char * se = s + len;
+    const char * t = s;
+    int nsegs = 0;
+
+    if (tail) *tail = (len > 0);
+
+    while (t < se) {
+	const char * b;
+	int isnum;
+
+	while (t < se && !risalnum(*t)) t++;
+	if (t == se) break;
+
+	b = t;
+	if (risdigit(*t)) {
+	    while (t < se && risdigit(*t)) t++;
+	    isnum = 1;
+	} else {
+	    while (t < se && risalpha(*t)) t++;
+	    isnum = 0;
+	}
+
+	if (segs) {
+	    struct rpmverSeg_s * seg = segs + nsegs;
+	    /* leading zeros never matter, skip them once and for all */
+	    if (isnum)
+		while (b < t && *b == '0') b++;
+	    seg->off = base + (b - s);
+	    seg->len = t - b;
+	    seg->isnum = isnum;
+	}
+	nsegs++;
+	if (tail) *tail = (t < se);
+    }
+    return nsegs;
+}
+
+int rpmverCmpSplit(const char * a, const struct rpmverSeg_s * asegs,
+		int an, int atail,
+		const char * b, const struct rpmverSeg_s * bsegs,
+		int bn, int btail)
+{
+    int i;
+
+    for (i = 0; ; i++) {
+	/* are there any characters left at all? */
+	int arest = (i < an || (i == an && atail));
+	int brest = (i < bn || (i == bn && btail));
+	const struct rpmverSeg_s * sa, * sb;
+	int rc;
+
+	/* whichever version still has characters left over wins */
+	if (!(arest && brest)) {
+	    if (!arest && !brest) return 0;
+	    return (arest ? 1 : -1);
+	}
+
+	/* only separators left in either, whichever has a segment wins */
+	if (i >= an || i >= bn) {
+	    if (i >= an && i >= bn) return 0;
+	    return (i < an ? 1 : -1);
+	}
+
+	sa = asegs + i;
+	sb = bsegs + i;
+	/* numeric segments are always newer than alpha segments */
+	if (sa->isnum != sb->isnum) return (sa->isnum ? 1 : -1);
+
+	rc = segcmp(a + sa->off, sa->len, b + sb->off, sb->len, sa->isnum);
+	if (rc) return rc;
+    }
+    return 0;
+}
@@ -0,0 +1,227 @@
+/** \ingroup rpmdb
+ * \file lib/sigcache.c
+ * Persistent cache of header signature verification results.
+ *
+ * An entry records that an immutable header region with a given SHA1
+ * digest carried a good signature from a given key id, verified with the
+ * given flags against a keyring with the given digest. Entries only match
+ * when all of these are identical, so any change to the header or to the
+ * keyring makes the lookup miss and the signature gets verified again.
+ *
+ * The cache is a flat file next to the database, loaded on first use and
+ * rewritten under a temporary name (then renamed into place) when the
+ * database is closed.
+ *
+ * Layout (native byte order, rejected when foreign):
+ *	struct cacheHdr_s
+ *	nentries * struct rpmSigCacheKey_s
+ */
+
+#include "system.h"
+
+#include <pthread.h>
+
+#include <rpm/rpmlog.h>
+#include <rpm/rpmstring.h>
+
+#include "lib/rpmdb_internal.h"
+#include "debug.h"
+
+#define	SIGCACHE_MAGIC		"RPMSIGC"
+#define	SIGCACHE_VERSION	1
+#define	SIGCACHE_BYTEORDER	0x01020304
+#define	SIGCACHE_MAX		65536	/* max. no. of entries kept */
+
+struct cacheHdr_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t nentries;		/*!< no. of entries */
+    uint32_t keysize;		/*!< size of an entry */
+};
+
+typedef const struct rpmSigCacheKey_s * sigCacheEntry;
+
+static unsigned int entryHash(sigCacheEntry e)
+{
+    return ((e->hdrsha1[0] << 24) | (e->hdrsha1[1] << 16) |
+	    (e->hdrsha1[2] << 8) | e->hdrsha1[3]);
+}
+
+static int entryCmp(sigCacheEntry e1, sigCacheEntry e2)
+{
+    return memcmp(e1, e2, sizeof(*e1));
+}
+
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+#define HASHTYPE sigCacheSet
+#define HTKEYTYPE sigCacheEntry
+#include "lib/rpmhash.H"
+#include "lib/rpmhash.C"
+
+struct rpmSigCache_s {
+    pthread_mutex_t lock;
+    sigCacheSet set;		/*!< all entries */
+    struct rpmSigCacheKey_s * loaded;	/*!< entries read from file */
+    int nloaded;
+    struct rpmSigCacheKey_s ** added;	/*!< entries added since */
+    int nadded;
+    int alloced;
+    uint8_t keyring[20];	/*!< last keyring digest seen */
+    int havekeyring;
+};
+
+rpmSigCache rpmSigCacheOpen(const char * fn)
+{
+    rpmSigCache cache = xcalloc(1, sizeof(*cache));
+    struct cacheHdr_s hdr;
+    FILE * f;
+
+    (void) pthread_mutex_init(&cache->lock, NULL);
+
+    if (fn != NULL && (f = fopen(fn, "r")) != NULL) {
+	if (fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+	    !memcmp(hdr.magic, SIGCACHE_MAGIC, sizeof(SIGCACHE_MAGIC)) &&
+	    hdr.version == SIGCACHE_VERSION &&
+	    hdr.byteorder == SIGCACHE_BYTEORDER &&
+	    hdr.keysize == sizeof(*cache->loaded) &&
+	    hdr.nentries <= SIGCACHE_MAX)
+	{
+	    cache->loaded = xmalloc((hdr.nentries + 1) * sizeof(*cache->loaded));
+	    if (fread(cache->loaded, sizeof(*cache->loaded), hdr.nentries, f)
+			== hdr.nentries)
+		cache->nloaded = hdr.nentries;
+	}
+	if (cache->nloaded == 0)
+	    rpmlog(RPMLOG_DEBUG, "ignoring signature cache %s\n", fn);
+	(void) fclose(f);
+    }
+
+    cache->set = sigCacheSetCreate(2 * cache->nloaded + 257,
+				entryHash, entryCmp, NULL);
+    for (int i = 0; i < cache->nloaded; i++)
+	sigCacheSetAddEntry(cache->set, cache->loaded + i);
+    return cache;
+}
+
+int rpmSigCacheLookup(rpmSigCache cache, const struct rpmSigCacheKey_s * key)
+{
+    int rc = 0;
+
+    if (cache != NULL && key != NULL) {
+	(void) pthread_mutex_lock(&cache->lock);
+	rc = sigCacheSetHasEntry(cache->set, key);
+	memcpy(cache->keyring, key->keyring, sizeof(cache->keyring));
+	cache->havekeyring = 1;
+	(void) pthread_mutex_unlock(&cache->lock);
+    }
+    return rc;
+}
+
+void rpmSigCacheAdd(rpmSigCache cache, const struct rpmSigCacheKey_s * key)
+{
+    if (cache == NULL || key == NULL)
+	return;
+
+    (void) pthread_mutex_lock(&cache->lock);
+    if (!sigCacheSetHasEntry(cache->set, key)) {
+	struct rpmSigCacheKey_s * e = memcpy(xmalloc(sizeof(*e)), key, sizeof(*e));
+
+	if (cache->nadded == cache->alloced) {
+	    cache->alloced = cache->alloced ? 2 * cache->alloced : 64;
+	    cache->added = xrealloc(cache->added,
+				cache->alloced * sizeof(*cache->added));
+	}
+	cache->added[cache->nadded++] = e;
+	sigCacheSetAddEntry(cache->set, e);
+    }
+    memcpy(cache->keyring, key->keyring, sizeof(cache->keyring));
+    cache->havekeyring = 1;
+    (void) pthread_mutex_unlock(&cache->lock);
+}
+
+/* Is the entry worth keeping, i.e. made against the current keyring? */
+static int entryKeep(rpmSigCache cache, sigCacheEntry e)
+{
+    return !memcmp(e->keyring, cache->keyring, sizeof(cache->keyring));
+}
+
+int rpmSigCacheWrite(rpmSigCache cache, const char * fn)
+{
+    struct cacheHdr_s hdr;
+    char * tfn = NULL;
+    FILE * f = NULL;
+    int nkeep = 0;
+    int err = 0;
+    int i, skip;
+
+    /* Nothing new learned, or nothing to tell valid entries apart? */
+    if (cache == NULL || fn == NULL || cache->nadded == 0 || !cache->havekeyring)
+	return 0;
+
+    for (i = 0; i < cache->nloaded; i++)
+	nkeep += entryKeep(cache, cache->loaded + i);
+    for (i = 0; i < cache->nadded; i++)
+	nkeep += entryKeep(cache, cache->added[i]);
+    /* Drop the oldest entries beyond the limit. */
+    skip = (nkeep > SIGCACHE_MAX) ? nkeep - SIGCACHE_MAX : 0;
+
+    rasprintf(&tfn, "%s.%d", fn, (int) getpid());
+    if ((f = fopen(tfn, "w")) == NULL) {
+	/* Unprivileged readers can't update the cache, that's fine. */
+	rpmlog(RPMLOG_DEBUG, "cannot create %s: %s\n", tfn, strerror(errno));
+	free(tfn);
+	return 1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SIGCACHE_MAGIC, sizeof(SIGCACHE_MAGIC));
+    hdr.version = SIGCACHE_VERSION;
+    hdr.byteorder = SIGCACHE_BYTEORDER;
+    hdr.nentries = nkeep - skip;
+    hdr.keysize = sizeof(*cache->loaded);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+	err = errno;
+
+    for (i = 0; err == 0 && i < cache->nloaded + cache->nadded; i++) {
+	sigCacheEntry e = (i < cache->nloaded) ?
+		cache->loaded + i : cache->added[i - cache->nloaded];
+	if (!entryKeep(cache, e))
+	    continue;
+	if (skip > 0) {
+	    skip--;
+	    continue;
+	}
+	if (fwrite(e, sizeof(*e), 1, f) != 1)
+	    err = errno;
+    }
+
+    if (fclose(f) != 0 && err == 0)
+	err = errno;
+    if (err == 0 && rename(tfn, fn) != 0)
+	err = errno;
+    if (err) {
+	rpmlog(RPMLOG_DEBUG, "cannot write %s: %s\n", fn, strerror(err));
+	(void) unlink(tfn);
+    } else {
+	rpmlog(RPMLOG_DEBUG, "wrote signature cache %s\n", fn);
+    }
+    free(tfn);
+    return (err ? 1 : 0);
+}
+
+rpmSigCache rpmSigCacheFree(rpmSigCache cache)
+{
+    if (cache) {
+	cache->set = sigCacheSetFree(cache->set);
+	for (int i = 0; i < cache->nadded; i++)
+	    free(cache->added[i]);
+	free(cache->added);
+	free(cache->loaded);
+	(void) pthread_mutex_destroy(&cache->lock);
+	free(cache);
+    }
+    return NULL;
+}
@@ -47,6 +47,21 @@ Header rpmNewSignature(void);
  */
 rpmRC rpmReadSignature(FD_t fd, Header *sighp, sigType sig_type, char ** msg);
 
+/** \ingroup signature
+ * Read a package from a (possibly non-seekable) stream, leaving fd
+ * positioned at the payload. Only header-only signatures and digests are
+ * verified, the legacy header+payload MD5 digest (if any and not disabled)
+ * is left attached to fd, to be finished once the payload has been read
+ * and compared to RPMTAG_SIGMD5 of the header.
+ * @param ts		transaction set
+ * @param fd		file handle
+ * @param fn		file name
+ * @retval hdrp		header (or NULL)
+ * @return		RPMRC_OK on success
+ */
+RPM_GNUC_INTERNAL
+rpmRC rpmReadPackageStream(rpmts ts, FD_t fd, const char * fn, Header * hdrp);
+
 /** \ingroup signature
  * Write signature header.
  * @param fd		file handle
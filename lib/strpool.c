@@ -0,0 +1,161 @@
+/** \ingroup rpmts
+ * \file lib/strpool.c
+ * Pool of interned strings.
+ *
+ * The dependency sets and file info of thousands of transaction elements
+ * repeat the same names over and over ("/bin/sh", "libc.so.6", the same
+ * few hundred directories). In a pool each distinct string is stored once,
+ * in chunks that never move, so pooled strings stay valid (and can be
+ * shared by any no. of users) until the pool itself is destroyed.
+ */
+
+#include "system.h"
+
+#include <pthread.h>
+
+#include "lib/rpmhash.h"
+#include "lib/strpool.h"
+#include "debug.h"
+
+#define	STRPOOL_CHUNK	65536	/* min. size of a string chunk */
+
+typedef struct strChunk_s * strChunk;
+
+struct strChunk_s {
+    strChunk next;		/*!< Previous (full) chunk. */
+    size_t size;		/*!< Chunk size. */
+    size_t used;		/*!< Bytes used. */
+};
+
+static int strCmp(const char * s1, const char * s2)
+{
+    return strcmp(s1, s2);
+}
+
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+#define HASHTYPE strPoolMap
+#define HTKEYTYPE const char *
+#define HTDATATYPE const char *
+#include "lib/rpmhash.H"
+#include "lib/rpmhash.C"
+
+struct rpmStrPool_s {
+    pthread_mutex_t lock;
+    strPoolMap map;		/*!< all pooled strings (to themselves) */
+    strChunk chunks;		/*!< string data, current chunk first */
+    struct rpmStrPoolStats_s stats;
+    int nrefs;			/*!< Reference count. */
+};
+
+rpmStrPool rpmStrPoolNew(void)
+{
+    rpmStrPool pool = xcalloc(1, sizeof(*pool));
+
+    (void) pthread_mutex_init(&pool->lock, NULL);
+    pool->map = strPoolMapCreate(65521, hashFunctionString, strCmp,
+				NULL, NULL);
+    pool->nrefs = 1;
+    return pool;
+}
+
+rpmStrPool rpmStrPoolLink(rpmStrPool pool)
+{
+    if (pool) {
+	(void) pthread_mutex_lock(&pool->lock);
+	pool->nrefs++;
+	(void) pthread_mutex_unlock(&pool->lock);
+    }
+    return pool;
+}
+
+rpmStrPool rpmStrPoolFree(rpmStrPool pool)
+{
+    int nrefs;
+
+    if (pool == NULL)
+	return NULL;
+
+    (void) pthread_mutex_lock(&pool->lock);
+    nrefs = --pool->nrefs;
+    (void) pthread_mutex_unlock(&pool->lock);
+    if (nrefs > 0)
+	return NULL;
+
+    pool->map = strPoolMapFree(pool->map);
+    while (pool->chunks != NULL) {
+	strChunk next = pool->chunks->next;
+	free(pool->chunks);
+	pool->chunks = next;
+    }
+    (void) pthread_mutex_destroy(&pool->lock);
+    free(pool);
+    return NULL;
+}
+
+/* Copy a string into the pool, the lock is held. */
+static const char * poolCopy(rpmStrPool pool, const char * s, size_t len)
+{
+    strChunk c = pool->chunks;
+    char * t;
+
+    if (c == NULL || c->size - c->used < len) {
+	size_t size = (len > STRPOOL_CHUNK) ? len : STRPOOL_CHUNK;
+	c = xmalloc(sizeof(*c) + size);
+	c->next = pool->chunks;
+	c->size = size;
+	c->used = 0;
+	pool->chunks = c;
+	pool->stats.size += size;
+    }
+    t = (char *) (c + 1) + c->used;
+    c->used += len;
+    return memcpy(t, s, len);
+}
+
+const char * rpmStrPoolIntern(rpmStrPool pool, const char * s)
+{
+    const char ** data = NULL;
+    const char * t;
+    size_t len;
+
+    if (pool == NULL || s == NULL)
+	return s;
+
+    len = strlen(s) + 1;
+    (void) pthread_mutex_lock(&pool->lock);
+    pool->stats.nlookups++;
+    if (strPoolMapGetEntry(pool->map, s, &data, NULL, NULL)) {
+	t = data[0];
+	pool->stats.saved += len;
+    } else {
+	t = poolCopy(pool, s, len);
+	strPoolMapAddEntry(pool->map, t, t);
+	pool->stats.nstrs++;
+    }
+    (void) pthread_mutex_unlock(&pool->lock);
+    return t;
+}
+
+const char ** rpmStrPoolInternArray(rpmStrPool pool, const char ** av, int ac)
+{
+    const char ** nav = xmalloc((ac + 1) * sizeof(*nav));
+    int i;
+
+    for (i = 0; i < ac; i++)
+	nav[i] = rpmStrPoolIntern(pool, av[i]);
+    nav[ac] = NULL;
+    return nav;
+}
+
+void rpmStrPoolStats(rpmStrPool pool, struct rpmStrPoolStats_s * stats)
+{
+    if (pool == NULL) {
+	memset(stats, 0, sizeof(*stats));
+	return;
+    }
+    (void) pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    (void) pthread_mutex_unlock(&pool->lock);
+}
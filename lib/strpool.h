@@ -0,0 +1,77 @@
+#ifndef _RPMSTRPOOL_H
+#define _RPMSTRPOOL_H
+
+/** \ingroup rpmts
+ * \file lib/strpool.h
+ * Pool of interned (shared, immutable) strings.
+ */
+
+#include <rpm/rpmutil.h>
+
+/** \ingroup rpmts
+ */
+typedef struct rpmStrPool_s * rpmStrPool;
+
+/** \ingroup rpmts
+ * String pool usage.
+ */
+struct rpmStrPoolStats_s {
+    unsigned int nstrs;		/*!< No. of distinct strings. */
+    unsigned int nlookups;	/*!< No. of strings interned. */
+    size_t size;		/*!< Bytes allocated for string data. */
+    size_t saved;		/*!< Bytes of (string) copies avoided. */
+};
+
+/** \ingroup rpmts
+ * Create a string pool.
+ * @return		new string pool
+ */
+RPM_GNUC_INTERNAL
+rpmStrPool rpmStrPoolNew(void);
+
+/** \ingroup rpmts
+ * Reference a string pool.
+ * @param pool		string pool
+ * @return		new string pool reference
+ */
+RPM_GNUC_INTERNAL
+rpmStrPool rpmStrPoolLink(rpmStrPool pool);
+
+/** \ingroup rpmts
+ * Dereference a string pool, destroying it (and its strings) on last.
+ * @param pool		string pool
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+rpmStrPool rpmStrPoolFree(rpmStrPool pool);
+
+/** \ingroup rpmts
+ * Intern a string: return the pooled copy, adding it on first use.
+ * The copy lives as long as the pool.
+ * @param pool		string pool
+ * @param s		string
+ * @return		pooled string
+ */
+RPM_GNUC_INTERNAL
+const char * rpmStrPoolIntern(rpmStrPool pool, const char * s);
+
+/** \ingroup rpmts
+ * Intern an array of strings.
+ * @param pool		string pool
+ * @param av		array of strings (NULL entries are kept)
+ * @param ac		no. of strings
+ * @return		NULL terminated array of pooled strings (malloc'ed)
+ */
+RPM_GNUC_INTERNAL
+const char ** rpmStrPoolInternArray(rpmStrPool pool,
+		const char ** av, int ac);
+
+/** \ingroup rpmts
+ * Return string pool usage.
+ * @param pool		string pool
+ * @retval stats	usage
+ */
+RPM_GNUC_INTERNAL
+void rpmStrPoolStats(rpmStrPool pool, struct rpmStrPoolStats_s * stats);
+
+#endif	/* _RPMSTRPOOL_H */
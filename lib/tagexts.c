@@ -631,6 +631,68 @@ static int longsigsizeTag(Header h, rpmtd td)
     return get64(h, td, RPMTAG_LONGSIGSIZE, RPMTAG_SIGSIZE);
 }
 
+/**
+ * Retrieve file digests as hex strings, regardless of how they're stored.
+ * @param h		header
+ * @retval td		tag data container
+ * @return		1 on success
+ */
+static int filedigestsTag(Header h, rpmtd td)
+{
+    struct rpmtd_s raw, digalgo;
+    pgpHashAlgo algo = PGPHASHALGO_MD5;
+    size_t diglen, nfiles;
+    const uint8_t * digest;
+    char ** digests, * t;
+    int rc = 0;
+
+    if (headerIsEntry(h, RPMTAG_FILEDIGESTS))
+	return headerGet(h, RPMTAG_FILEDIGESTS, td, HEADERGET_MINMEM);
+
+    if (!headerGet(h, RPMTAG_FILERAWDIGESTS, &raw, HEADERGET_MINMEM))
+	return 0;
+    if (headerGet(h, RPMTAG_FILEDIGESTALGO, &digalgo, HEADERGET_MINMEM)) {
+	uint32_t * a = rpmtdGetUint32(&digalgo);
+	if (a) algo = *a;
+    }
+
+    diglen = rpmDigestLength(algo);
+    if (diglen == 0 || rpmtdType(&raw) != RPM_BIN_TYPE || raw.count % diglen)
+	goto exit;
+
+    /* Pointers and strings in one allocation, like HEADERGET_ALLOC does. */
+    nfiles = raw.count / diglen;
+    digests = xmalloc(nfiles * (sizeof(*digests) + 2 * diglen + 1));
+    t = (char *) (digests + nfiles);
+    digest = raw.data;
+    for (size_t i = 0; i < nfiles; i++, digest += diglen) {
+	static const char hex[] = "0123456789abcdef";
+	size_t j = 0;
+
+	digests[i] = t;
+	/* All zeros means no digest (not a regular file). */
+	while (j < diglen && digest[j] == 0)
+	    j++;
+	if (j < diglen) {
+	    for (j = 0; j < diglen; j++) {
+		*t++ = hex[(digest[j] >> 4) & 0x0f];
+		*t++ = hex[(digest[j]   ) & 0x0f];
+	    }
+	}
+	*t++ = '\0';
+    }
+
+    td->type = RPM_STRING_ARRAY_TYPE;
+    td->count = nfiles;
+    td->data = digests;
+    td->flags = RPMTD_ALLOCED;
+    rc = 1;
+
+exit:
+    rpmtdFreeData(&raw);
+    return rc;
+}
+
 void *rpmHeaderTagFunc(rpmTag tag)
 {
     const struct headerTagFunc_s * ext;
@@ -660,6 +722,7 @@ static const struct headerTagFunc_s rpmHeaderTagExtensions[] = {
     { RPMTAG_TRIGGERCONDS,	triggercondsTag },
     { RPMTAG_TRIGGERTYPE,	triggertypeTag },
     { RPMTAG_LONGFILESIZES,	longfilesizesTag },
+    { RPMTAG_FILEDIGESTS,	filedigestsTag },
     { RPMTAG_LONGARCHIVESIZE,	longarchivesizeTag },
     { RPMTAG_LONGSIZE,		longsizeTag },
     { RPMTAG_LONGSIGSIZE,	longsigsizeTag },
@@ -4,6 +4,8 @@
 
 #include "system.h"
 
+#include <pthread.h>
+
 #include <rpm/rpmlib.h>		/* rpmMachineScore, rpmReadPackageFile */
 #include <rpm/rpmmacro.h>	/* XXX for rpmExpand */
 #include <rpm/rpmlog.h>
@@ -21,6 +23,7 @@
 #include "lib/rpmte_internal.h"	/* only internal apis */
 #include "lib/rpmts_internal.h"
 #include "lib/cpio.h"
+#include "lib/misc.h"
 #include "rpmio/rpmhook.h"
 
 #include "debug.h"
@@ -127,7 +130,8 @@ static int handleInstInstalledFile(const rpmts ts, rpmte p, rpmfi fi,
 }
 
 /**
- * Update disk space needs on each partition for this package's files.
+ * Decide the fate of overlapped files, and update disk space needs on
+ * each partition for this package's files.
  */
 /* XXX only ts->{probs,di} modified */
 static void handleOverlappedFiles(const rpmts ts, const rpmte p, rpmfi fi)
@@ -139,12 +143,14 @@ static void handleOverlappedFiles(const rpmts ts, const rpmte p, rpmfi fi)
     rpm_color_t tscolor = rpmtsColor(ts);
     rpm_color_t prefcolor = rpmtsPrefColor(ts);
     rpmfs fs = rpmteGetFileStates(p);
+    rpmFileAction * actions = rpmfsGetActions(fs);
     rpmfs otherFs;
+    struct rpmfiCols_s cols;
+    rpm_count_t fc = rpmfiColumns(fi, &cols);
+    rpm_loff_t * fixupSizes = NULL;
 
     ps = rpmtsProblems(ts);
-    fi = rpmfiInit(fi, 0);
-    if (fi != NULL)
-    while ((i = rpmfiNext(fi)) >= 0) {
+    for (i = 0; i < fc; i++) {
 	rpm_color_t oFColor, FColor;
 	struct fingerPrint_s * fiFps;
 	int otherPkgNum, otherFileNum;
@@ -155,14 +161,16 @@ static void handleOverlappedFiles(const rpmts ts, const rpmte p, rpmfi fi)
 	struct rpmffi_s * recs;
 	int numRecs;
 
-	if (XFA_SKIPPING(rpmfsGetAction(fs, i)))
+	if (XFA_SKIPPING(actions[i]))
 	    continue;
 
+	(void) rpmfiSetFX(fi, i);
 	fn = rpmfiFN(fi);
 	fiFps = rpmfiFpsIndex(fi, i);
-	FFlags = rpmfiFFlags(fi);
-	FMode = rpmfiFMode(fi);
-	FColor = rpmfiFColor(fi);
+	FFlags = cols.fflags[i];
+	FMode = cols.fmodes[i];
+	/* XXX ignore all but lsnibble for now. */
+	FColor = cols.fcolors[i] & 0x0f;
 	FColor &= tscolor;
 
 	fixupSize = 0;
@@ -236,7 +244,7 @@ static void handleOverlappedFiles(const rpmts ts, const rpmte p, rpmfi fi)
 	    if (otherPkgNum < 0) {
 		/* XXX is this test still necessary? */
 		rpmFileAction action;
-		if (rpmfsGetAction(fs, i) != FA_UNKNOWN)
+		if (actions[i] != FA_UNKNOWN)
 		    break;
 		if (rpmfiConfigConflict(fi)) {
 		    /* Here is a non-overlapped pre-existing config file. */
@@ -259,7 +267,7 @@ assert(otherFi != NULL);
 		if (tscolor != 0) {
 		    if (FColor & prefcolor) {
 			/* ... last file of preferred colour is installed ... */
-			if (!XFA_SKIPPING(rpmfsGetAction(fs, i))) {
+			if (!XFA_SKIPPING(actions[i])) {
 			    /* XXX static helpers are order dependent. Ick. */
 			    if (strcmp(fn, "/usr/sbin/libgcc_post_upgrade")
 			     && strcmp(fn, "/usr/sbin/glibc_post_upgrade"))
@@ -270,7 +278,7 @@ assert(otherFi != NULL);
 		    } else
 		    if (oFColor & prefcolor) {
 			/* ... first file of preferred colour is installed ... */
-			if (XFA_SKIPPING(rpmfsGetAction(fs, i)))
+			if (XFA_SKIPPING(actions[i]))
 			    rpmfsSetAction(otherFs, otherFileNum, FA_CREATE);
 			rpmfsSetAction(fs, i, FA_SKIPCOLOR);
 			rConflicts = 0;
@@ -312,7 +320,7 @@ assert(otherFi != NULL);
 		/* Here is an overlapped removed file: skip in previous. */
 		rpmfsSetAction(otherFs, otherFileNum, FA_SKIP);
 	    }
-	    if (XFA_SKIPPING(rpmfsGetAction(fs, i)))
+	    if (XFA_SKIPPING(actions[i]))
 		break;
 	    if (rpmfiFState(fi) != RPMFILE_STATE_NORMAL)
 		break;
@@ -338,12 +346,19 @@ assert(otherFi != NULL);
 	    break;
 	}
 
-	/* Update disk space info for a file. */
-	rpmtsUpdateDSI(ts, fiFps->entry->dev, rpmfiFSize(fi),
-		       rpmfiFReplacedSize(fi), fixupSize, rpmfsGetAction(fs, i));
-
+	/* Remember overlapped size for disk space accounting below. */
+	if (fixupSize) {
+	    if (fixupSizes == NULL)
+		fixupSizes = xcalloc(fc, sizeof(*fixupSizes));
+	    fixupSizes[i] = fixupSize;
+	}
     }
     ps = rpmpsFree(ps);
+
+    /* Update disk space info for all of the package's files. */
+    rpmtsUpdateDSIFiles(ts, fc, rpmfiFpsIndex(fi, 0), cols.fsizes,
+			cols.replacedSizes, fixupSizes, actions);
+    free(fixupSizes);
 }
 
 /**
@@ -392,9 +407,9 @@ static int ensureOlder(rpmts ts,
 static void skipFiles(const rpmts ts, rpmte p)
 {
     rpm_color_t tscolor = rpmtsColor(ts);
-    rpm_color_t FColor;
     int noConfigs = (rpmtsFlags(ts) & RPMTRANS_FLAG_NOCONFIGS);
     int noDocs = (rpmtsFlags(ts) & RPMTRANS_FLAG_NODOCS);
+    rpm_flag_t skipFlags = 0;
     const char * dn, * bn;
     size_t dnlen, bnlen;
     char * s;
@@ -404,51 +419,61 @@ static void skipFiles(const rpmts ts, rpmte p)
     int i, j, ix;
     rpmfi fi = rpmteFI(p);
     rpmfs fs = rpmteGetFileStates(p);
+    rpmFileAction * actions = rpmfsGetActions(fs);
+    struct rpmfiCols_s cols;
+    rpm_count_t fc = rpmfiColumns(fi, &cols);
 
     if (!noDocs)
 	noDocs = rpmExpandNumeric("%{_excludedocs}");
+    if (noConfigs)
+	skipFlags |= RPMFILE_CONFIG;
+    if (noDocs)
+	skipFlags |= RPMFILE_DOC;
 
     /* Compute directory refcount, skip directory if now empty. */
     dc = rpmfiDC(fi);
     drc = xcalloc(dc, sizeof(*drc));
     dff = xcalloc(dc, sizeof(*dff));
 
-    fi = rpmfiInit(fi, 0);
-    if (fi != NULL)	/* XXX lclint */
-    while ((i = rpmfiNext(fi)) >= 0)
+    /*
+     * Cheap column checks first: already skipped files and files of
+     * the wrong color.
+     */
+    for (i = 0; i < fc; i++) {
+	/* XXX ignore all but lsnibble for now. */
+	rpm_color_t FColor = cols.fcolors[i] & 0x0f;
+	if (tscolor && FColor && !(tscolor & FColor) &&
+	    !XFA_SKIPPING(actions[i]))
+	    actions[i] = FA_SKIPCOLOR;
+    }
+
+    for (i = 0; i < fc; i++)
     {
 	char ** nsp;
 	const char *flangs;
 
-	bn = rpmfiBN(fi);
-	bnlen = strlen(bn);
-	ix = rpmfiDX(fi);
-	dn = rpmfiDN(fi);
-	dnlen = strlen(dn);
-	if (dn == NULL)
-	    continue;	/* XXX can't happen */
-
+	ix = cols.dil[i];
 	drc[ix]++;
 
-	/* Don't bother with skipped files */
-	if (XFA_SKIPPING(rpmfsGetAction(fs, i))) {
+	/* Don't bother with skipped files (including colored ones above) */
+	if (XFA_SKIPPING(actions[i])) {
 	    drc[ix]--; dff[ix] = 1;
 	    continue;
 	}
 
-	/* Ignore colored files not in our rainbow. */
-	FColor = rpmfiFColor(fi);
-	if (tscolor && FColor && !(tscolor & FColor)) {
-	    drc[ix]--;	dff[ix] = 1;
-	    rpmfsSetAction(fs, i, FA_SKIPCOLOR);
-	    continue;
-	}
-
 	/*
 	 * Skip net shared paths.
 	 * Net shared paths are not relative to the current root (though
 	 * they do need to take package relocations into account).
 	 */
+	dn = bn = NULL;
+	dnlen = bnlen = 0;
+	if (ts->netsharedPaths != NULL) {
+	    bn = rpmfiBNIndex(fi, i);
+	    bnlen = strlen(bn);
+	    dn = rpmfiDNIndex(fi, ix);
+	    dnlen = strlen(dn);
+	}
 	for (nsp = ts->netsharedPaths; nsp && *nsp; nsp++) {
 	    size_t len;
 
@@ -480,14 +505,15 @@ static void skipFiles(const rpmts ts, rpmte p)
 
 	if (nsp && *nsp) {
 	    drc[ix]--;	dff[ix] = 1;
-	    rpmfsSetAction(fs, i, FA_SKIPNETSHARED);
+	    actions[i] = FA_SKIPNETSHARED;
 	    continue;
 	}
 
 	/*
 	 * Skip i18n language specific files.
 	 */
-	if (ts->installLangs != NULL && (flangs = rpmfiFLangs(fi)) != NULL) {
+	if (ts->installLangs != NULL &&
+	    (flangs = rpmfiFLangsIndex(fi, i)) != NULL) {
 	    const char *l, *le;
 	    char **lang;
 	    for (lang = ts->installLangs; *lang != NULL; lang++) {
@@ -503,26 +529,17 @@ static void skipFiles(const rpmts ts, rpmte p)
 	    }
 	    if (*lang == NULL) {
 		drc[ix]--;	dff[ix] = 1;
-		rpmfsSetAction(fs, i, FA_SKIPNSTATE);
+		actions[i] = FA_SKIPNSTATE;
 		continue;
 	    }
 	}
 
 	/*
-	 * Skip config files if requested.
+	 * Skip config files and/or documentation if requested.
 	 */
-	if (noConfigs && (rpmfiFFlags(fi) & RPMFILE_CONFIG)) {
+	if (cols.fflags[i] & skipFlags) {
 	    drc[ix]--;	dff[ix] = 1;
-	    rpmfsSetAction(fs, i, FA_SKIPNSTATE);
-	    continue;
-	}
-
-	/*
-	 * Skip documentation if requested.
-	 */
-	if (noDocs && (rpmfiFFlags(fi) & RPMFILE_DOC)) {
-	    drc[ix]--;	dff[ix] = 1;
-	    rpmfsSetAction(fs, i, FA_SKIPNSTATE);
+	    actions[i] = FA_SKIPNSTATE;
 	    continue;
 	}
     }
@@ -550,31 +567,25 @@ static void skipFiles(const rpmts ts, rpmte p)
 	}
 
 	/* If explicitly included in the package, skip the directory. */
-	fi = rpmfiInit(fi, 0);
-	if (fi != NULL)		/* XXX lclint */
-	while ((i = rpmfiNext(fi)) >= 0) {
+	for (i = 0; i < fc; i++) {
 	    const char * fdn, * fbn;
-	    rpm_mode_t fFMode;
 
-	    if (XFA_SKIPPING(rpmfsGetAction(fs, i)))
+	    if (XFA_SKIPPING(actions[i]))
 		continue;
-
-	    fFMode = rpmfiFMode(fi);
-
-	    if (rpmfiWhatis(fFMode) != XDIR)
+	    if (!S_ISDIR(cols.fmodes[i]))
 		continue;
-	    fdn = rpmfiDN(fi);
+	    fdn = rpmfiDNIndex(fi, cols.dil[i]);
 	    if (strlen(fdn) != dnlen)
 		continue;
 	    if (strncmp(fdn, dn, dnlen))
 		continue;
-	    fbn = rpmfiBN(fi);
+	    fbn = rpmfiBNIndex(fi, i);
 	    if (strlen(fbn) != bnlen)
 		continue;
 	    if (strncmp(fbn, bn, bnlen))
 		continue;
 	    rpmlog(RPMLOG_DEBUG, "excluding directory %s\n", dn);
-	    rpmfsSetAction(fs, i, FA_SKIPNSTATE);
+	    actions[i] = FA_SKIPNSTATE;
 	    break;
 	}
     }
@@ -704,14 +715,7 @@ void checkInstalledFiles(rpmts ts, fingerPrintCache fpc)
 
 	/* Is this package being removed? */
 	installedPkg = rpmdbGetIteratorOffset(mi);
-	beingRemoved = 0;
-	if (ts->removedPackages != NULL)
-	for (j = 0; j < ts->numRemovedPackages; j++) {
-	    if (ts->removedPackages[j] != installedPkg)
-	        continue;
-	    beingRemoved = 1;
-	    break;
-	}
+	beingRemoved = rpmtsIsRemoved(ts, installedPkg);
 
 	h = headerLink(h);
 	headerGet(h, RPMTAG_BASENAMES, &bnames, hgflags);
@@ -757,7 +761,7 @@ void checkInstalledFiles(rpmts ts, fingerPrintCache fpc)
 		switch (rpmteType(p)) {
 		case TR_ADDED:
 		    if (!otherFi) {
-		        otherFi = rpmfiNew(ts, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
+		        otherFi = rpmdbHeaderFI(rpmtsGetRdb(ts), ts, h);
 		    }
 		    rpmfiSetFX(fi, recs[j].fileno);
 		    rpmfiSetFX(otherFi, fileNum);
@@ -789,6 +793,122 @@ void checkInstalledFiles(rpmts ts, fingerPrintCache fpc)
     mi = rpmdbFreeIterator(mi);
 }
 
+/**
+ * Elements being fingerprinted by a pool of threads.
+ */
+struct fpLookupPool_s {
+    fingerPrintCache fpc;
+    rpmfi * fis;
+    int nfis;
+    int next;			/*!< next element to fingerprint */
+    pthread_mutex_t lock;
+};
+
+/**
+ * Fingerprint elements until none are left.
+ * @param arg		fingerprint pool
+ * @return		NULL always
+ */
+static void * fpLookupWorker(void * arg)
+{
+    struct fpLookupPool_s * pool = arg;
+    rpmfi fi;
+
+    while (1) {
+	(void) pthread_mutex_lock(&pool->lock);
+	fi = (pool->next < pool->nfis ? pool->fis[pool->next++] : NULL);
+	(void) pthread_mutex_unlock(&pool->lock);
+	if (fi == NULL)
+	    break;
+	rpmfiFpLookup(fi, pool->fpc);
+    }
+    return NULL;
+}
+
+/**
+ * Compute file fingerprints of all transaction elements and collect
+ * the symlinks among them. The (stat(2) bound) lookups are spread over
+ * %{_transaction_threads} threads sharing the fingerprint cache.
+ * @param ts		transaction set
+ * @param fpc		fingerprint cache
+ * @param symlinks	hash to collect symlink fingerprints into
+ */
+static void fpLookupElements(rpmts ts, fingerPrintCache fpc, rpmFpHash symlinks)
+{
+    struct fpLookupPool_s pool;
+    pthread_t * threads = NULL;
+    int nthreads, nstarted = 0;
+    size_t fc = 0;
+    rpmtsi pi;
+    rpmte p;
+    rpmfi fi;
+    int i;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.fpc = fpc;
+    pool.fis = xcalloc(rpmtsNElements(ts) + 1, sizeof(*pool.fis));
+    pi = rpmtsiInit(ts);
+    while ((p = rpmtsiNext(pi, 0)) != NULL) {
+	if ((fi = rpmteFI(p)) == NULL)
+	    continue;	/* XXX can't happen */
+	pool.fis[pool.nfis++] = fi;
+	fc += rpmfiFC(fi);
+    }
+    pi = rpmtsiFree(pi);
+
+    (void) rpmdbCheckSignals();
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
+
+    nthreads = rpmExpandThreads("%{?_transaction_threads}");
+    if (nthreads > pool.nfis)
+	nthreads = pool.nfis;
+    (void) pthread_mutex_init(&pool.lock, NULL);
+    if (nthreads > 1) {
+	threads = xcalloc(nthreads - 1, sizeof(*threads));
+	for (i = 0; i < nthreads - 1; i++) {
+	    if (pthread_create(threads + nstarted, NULL, fpLookupWorker, &pool))
+		break;
+	    nstarted++;
+	}
+    }
+    /* This thread does its share too (and all of it without threads). */
+    (void) fpLookupWorker(&pool);
+    for (i = 0; i < nstarted; i++)
+	(void) pthread_join(threads[i], NULL);
+    threads = _free(threads);
+    (void) pthread_mutex_destroy(&pool.lock);
+
+    /* collect symbolic links */
+    pi = rpmtsiInit(ts);
+    while ((p = rpmtsiNext(pi, 0)) != NULL) {
+	if ((fi = rpmteFI(p)) == NULL)
+	    continue;	/* XXX can't happen */
+ 	fi = rpmfiInit(fi, 0);
+ 	if (fi != NULL)		/* XXX lclint */
+	while ((i = rpmfiNext(fi)) >= 0) {
+	    struct rpmffi_s ffi;
+	    char const *linktarget;
+	    linktarget = rpmfiFLink(fi);
+	    if (!(linktarget && *linktarget != '\0'))
+		continue;
+	    if (XFA_SKIPPING(rpmfsGetAction(rpmteGetFileStates(p), i)))
+		continue;
+	    ffi.p = p;
+	    ffi.fileno = i;
+	    rpmFpHashAddEntry(symlinks, rpmfiFpsIndex(fi, i), ffi);
+	}
+    }
+    pi = rpmtsiFree(pi);
+
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), fc);
+    /* XXX one operation per element, as when they were timed one by one */
+    if (pool.nfis > 1)
+	rpmtsOp(ts, RPMTS_OP_FINGERPRINT)->count += pool.nfis - 1;
+    (void) rpmdbCheckSignals();
+
+    pool.fis = _free(pool.fis);
+}
+
 /*
  * Run pre/post transaction scripts for transaction set
  * param ts	Transaction set
@@ -904,6 +1024,7 @@ int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
     int numAdded;
     int numRemoved;
     void * lock = NULL;
+    int hdrcache;
     int xx;
 
     /* XXX programmer error segfault avoidance. */
@@ -952,6 +1073,9 @@ int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
 	}
     }
 
+    /* Decode each installed header (at most) once during the transaction. */
+    hdrcache = rpmdbHeaderCacheBegin(rpmtsGetRdb(ts));
+
     ts->ignoreSet = ignoreSet;
     {	char * currDir = rpmGetCwd();
 	rpmtsSetCurrDir(ts, currDir);
@@ -1108,6 +1232,8 @@ int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
 	    xx = rpmdbOpenAll(ts->rdb);
 	    if (chroot(rootDir) == -1) {
 		rpmlog(RPMLOG_ERR, _("Unable to change root directory: %m\n"));
+		if (hdrcache)
+		    rpmdbHeaderCacheEnd(rpmtsGetRdb(ts));
 		return -1;
 	    }
 	}
@@ -1122,37 +1248,7 @@ int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
     /* ===============================================
      * Add fingerprint for each file not skipped.
      */
-    pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, 0)) != NULL) {
-	int fc;
-
-	(void) rpmdbCheckSignals();
-
-	if ((fi = rpmteFI(p)) == NULL)
-	    continue;	/* XXX can't happen */
-	fc = rpmfiFC(fi);
-
-	(void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
-	rpmfiFpLookup(fi, fpc);
-	/* collect symbolic links */
- 	fi = rpmfiInit(fi, 0);
- 	if (fi != NULL)		/* XXX lclint */
-	while ((i = rpmfiNext(fi)) >= 0) {
-	    struct rpmffi_s ffi;
-	    char const *linktarget;
-	    linktarget = rpmfiFLink(fi);
-	    if (!(linktarget && *linktarget != '\0'))
-		continue;
-	    if (XFA_SKIPPING(rpmfsGetAction(rpmteGetFileStates(p), i)))
-		continue;
-	    ffi.p = p;
-	    ffi.fileno = i;
-	    rpmFpHashAddEntry(symlinks, rpmfiFpsIndex(fi, i), ffi);
-	}
-	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), fc);
-
-    }
-    pi = rpmtsiFree(pi);
+    fpLookupElements(ts, fpc, symlinks);
 
     /* ===============================================
      * Check fingerprints if they contain symlinks
@@ -1238,13 +1334,35 @@ int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
 		(okProbs == NULL || rpmpsTrim(ts->probs, okProbs)))
        )
     {
+	if (hdrcache)
+	    rpmdbHeaderCacheEnd(rpmtsGetRdb(ts));
 	rpmtsFreeLock(lock);
 	return ts->orderCount;
     }
 
+    /* Readers keep using the rpmdb snapshot (if any) until rewritten below */
+    if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_TEST))
+	xx = rpmdbSnapshotBegin(rpmtsGetRdb(ts));
+
+    /* Batch rpmdb index updates over the whole transaction if enabled */
+    if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_TEST) &&
+	rpmExpandNumeric("%{?_rpmdb_writebatch}"))
+	xx = rpmdbBeginBatch(rpmtsGetRdb(ts));
+
     /* Actually install and remove packages */
     rc = rpmtsProcess(ts);
 
+    xx = rpmdbEndBatch(rpmtsGetRdb(ts));
+
+    /* Run scriptlets deferred to the end of the transaction (if any) */
+    {	rpmpsm psm = rpmpsmNew(ts, NULL);
+	xx = rpmpsmStage(psm, PSM_DEFERRED);
+	psm = rpmpsmFree(psm);
+    }
+
+    if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_TEST))
+	xx = rpmdbSnapshotWrite(rpmtsGetRdb(ts));
+
     if (!(rpmtsFlags(ts) & (RPMTRANS_FLAG_TEST|RPMTRANS_FLAG_NOPOST))) {
 	rpmlog(RPMLOG_DEBUG, "running post-transaction scripts\n");
 	runTransScripts(ts, RPMTAG_POSTTRANS);
@@ -1254,6 +1372,8 @@ int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
 	matchpathcon_fini();
     }
 
+    if (hdrcache)
+	rpmdbHeaderCacheEnd(rpmtsGetRdb(ts));
     rpmtsFreeLock(lock);
 
     /* FIX: ts->flList may be NULL */
@@ -258,29 +258,42 @@ static PyObject * hdrFullFilelist(hdrObject * s)
     return Py_None;
 }
 
+/** \ingroup py_c
+ * Last compiled sprintf format, reused while the format string is the same
+ * (typically when formatting many headers in a loop). Protected by the GIL.
+ */
+static char * sprintfFmt = NULL;
+static headerFmt sprintfHf = NULL;
+
 /** \ingroup py_c
  */
 static PyObject * hdrSprintf(hdrObject * s, PyObject * args, PyObject * kwds)
 {
     char * fmt;
-    char * r;
-    errmsg_t err;
-    PyObject * result;
+    const char * r;
+    errmsg_t err = NULL;
     char * kwlist[] = {"format", NULL};
 
     if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &fmt))
 	return NULL;
 
-    r = headerFormat(s->h, fmt, &err);
+    if (sprintfHf == NULL || strcmp(sprintfFmt, fmt)) {
+	sprintfHf = headerFormatFree(sprintfHf);
+	sprintfFmt = _free(sprintfFmt);
+	if ((sprintfHf = headerFormatCompile(fmt, &err)) == NULL) {
+	    PyErr_SetString(pyrpmError, err);
+	    return NULL;
+	}
+	sprintfFmt = xstrdup(fmt);
+    }
+
+    r = headerFormatExec(sprintfHf, s->h, &err);
     if (!r) {
 	PyErr_SetString(pyrpmError, err);
 	return NULL;
     }
 
-    result = Py_BuildValue("s", r);
-    r = _free(r);
-
-    return result;
+    return Py_BuildValue("s", r);
 }
 
 /**
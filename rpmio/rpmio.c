@@ -24,6 +24,8 @@ extern int h_errno;
 #include <rpm/rpmlog.h>
 #include <rpm/rpmmacro.h>
 #include <rpm/rpmfileutil.h>
+#include <rpm/rpmstring.h>
+#include <rpm/argv.h>
 
 #include "rpmio/rpmio_internal.h"
 
@@ -779,6 +781,75 @@ ssize_t timedRead(FD_t fd, void * bufptr, size_t length)
     return ufdio->read(fd, bufptr, length);
 }
 
+FD_t ufdStream(const char * url, pid_t * pidp)
+{
+    FD_t fd = NULL;
+    ARGV_t argv = NULL;
+    char *cmd = NULL;
+    char *urlhelper = NULL;
+    int pipefd[2];
+    pid_t pid;
+
+    *pidp = -1;
+
+    /* The url helper writes to stdout when the destination is "-". */
+    urlhelper = rpmExpand("%{?_urlhelper}", NULL);
+    rasprintf(&cmd, "%s - %s\n", urlhelper, url);
+    urlhelper = _free(urlhelper);
+    /* Build argv before fork(), the child of a threaded parent can't malloc. */
+    (void) argvSplit(&argv, cmd, " ");
+    cmd = _free(cmd);
+    if (argv == NULL || argv[0] == NULL) {
+	argv = argvFree(argv);
+	return NULL;
+    }
+
+    /*
+     * Helpers for other packages may be started at the same time (from
+     * other threads), they must not inherit this pipe or we never see EOF.
+     */
+#if defined(HAVE_PIPE2)
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+	argv = argvFree(argv);
+	return NULL;
+    }
+#else
+    if (pipe(pipefd) < 0) {
+	argv = argvFree(argv);
+	return NULL;
+    }
+    (void) fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    (void) fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    if ((pid = fork()) == 0) {
+	/* dup2() clears close-on-exec of stdout. */
+	(void) dup2(pipefd[1], STDOUT_FILENO);
+	(void) close(pipefd[0]);
+	(void) close(pipefd[1]);
+	execvp(argv[0], argv);
+	_exit(127); /* exit with 127 for compatibility with bash(1) */
+    }
+    argv = argvFree(argv);
+    (void) close(pipefd[1]);
+
+    if (pid < 0) {
+	(void) close(pipefd[0]);
+	return NULL;
+    }
+
+    /* Use the read end as is, a dup() would lose close-on-exec. */
+    fd = fdNew(RPMDBG_M("open (ufdStream)"));
+    fdSetFdno(fd, pipefd[0]);
+    fdSetIo(fd, ufdio);
+    fd->rd_timeoutsecs = 600; /* XXX W2DO? same as stdin */
+    fd->bytesRemain = -1;
+    fd->urlType = URL_IS_DASH;
+    *pidp = pid;
+DBGIO(fd, (stderr, "==>\tufdStream(\"%s\") %s\n", url, fdbg(fd)));
+    return fd;
+}
+
 /* =============================================================== */
 /* Support for GZIP library.
  */
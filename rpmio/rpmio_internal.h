@@ -294,6 +294,15 @@ void fdFiniDigest(FD_t fd, pgpHashAlgo hashalgo,
 /* XXX Steal the digest-in-progress from the file handle. */
 void fdStealDigest(FD_t fd, pgpDig dig);
 
+/** \ingroup rpmio
+ * Open a URL for reading as it arrives: the url helper writes into a pipe
+ * instead of a temporary file. The returned fd is not seekable.
+ * @param url		url to retrieve
+ * @retval *pidp	url helper process, to be waited for by the caller
+ * @return		fd (NULL on error)
+ */
+FD_t ufdStream(const char * url, pid_t * pidp);
+
 /**
  * Read an entire file into a buffer.
  * @param fn		file name to read
@@ -304,6 +313,107 @@ void fdStealDigest(FD_t fd, pgpDig dig);
 int rpmioSlurp(const char * fn,
                 uint8_t ** bp, ssize_t * blenp);
 
+/** \ingroup rpmlog
+ * Log messages captured from a thread.
+ */
+typedef struct rpmlogCapture_s * rpmlogCapture;
+
+/** \ingroup rpmlog
+ * Capture rpmlog() messages of the calling thread instead of emitting them.
+ * Used by worker threads, whose messages are then replayed in a
+ * deterministic order by the main thread.
+ */
+void rpmlogCaptureBegin(void);
+
+/** \ingroup rpmlog
+ * Stop capturing rpmlog() messages of the calling thread.
+ * @return		captured messages (NULL if none)
+ */
+rpmlogCapture rpmlogCaptureEnd(void);
+
+/** \ingroup rpmlog
+ * Emit captured messages through rpmlog() and free them.
+ * @param cap		captured messages
+ * @return		NULL always
+ */
+rpmlogCapture rpmlogCaptureFlush(rpmlogCapture cap);
+
+/** \ingroup rpmlog
+ * Discard captured messages.
+ * @param cap		captured messages
+ * @return		NULL always
+ */
+rpmlogCapture rpmlogCaptureFree(rpmlogCapture cap);
+
+/** \ingroup rpmio
+ * Memory arena: objects allocated from it are freed together.
+ */
+typedef struct rpmArena_s * rpmArena;
+
+/** \ingroup rpmio
+ * Allocation counters (for --stats and benchmarks).
+ */
+struct rpmMallocStats_s {
+    uint64_t nallocs;		/*!< no. of objects allocated from arenas */
+    uint64_t allocbytes;	/*!< bytes allocated from arenas */
+    uint64_t nchunks;		/*!< no. of malloc(3) calls made by arenas */
+    uint64_t chunkbytes;	/*!< bytes malloc'ed by arenas */
+    uint64_t nresets;		/*!< no. of arena resets (including frees) */
+};
+
+/** \ingroup rpmio
+ * Create a memory arena.
+ * @param chunksize	size of memory chunks (0 uses default)
+ * @return		new arena
+ */
+rpmArena rpmArenaNew(size_t chunksize);
+
+/** \ingroup rpmio
+ * Allocate (suitably aligned) memory from an arena.
+ * @param arena		arena
+ * @param size		no. of bytes
+ * @return		memory, valid until the arena is reset
+ */
+void * rpmArenaAlloc(rpmArena arena, size_t size);
+
+/** \ingroup rpmio
+ * Allocate zeroed memory for an array from an arena.
+ * @param arena		arena
+ * @param nmemb		no. of elements
+ * @param size		element size
+ * @return		memory, valid until the arena is reset
+ */
+void * rpmArenaCalloc(rpmArena arena, size_t nmemb, size_t size);
+
+/** \ingroup rpmio
+ * Copy a string into an arena.
+ * @param arena		arena
+ * @param str		string
+ * @return		copy, valid until the arena is reset
+ */
+char * rpmArenaStrdup(rpmArena arena, const char * str);
+
+/** \ingroup rpmio
+ * Free everything allocated from an arena at once. The arena keeps its
+ * first chunk, and can be used again.
+ * @param arena		arena
+ */
+void rpmArenaReset(rpmArena arena);
+
+/** \ingroup rpmio
+ * Destroy an arena, and everything allocated from it.
+ * @param arena		arena
+ * @return		NULL always
+ */
+rpmArena rpmArenaFree(rpmArena arena);
+
+/** \ingroup rpmio
+ * Return allocation counters of all arenas. An arena adds its counters
+ * to the totals when it is reset or destroyed.
+ * @retval stats	allocation counters
+ */
+void rpmMallocStats(struct rpmMallocStats_s * stats);
+
 #ifdef __cplusplus
 }
 #endif
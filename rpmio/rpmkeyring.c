@@ -18,18 +18,25 @@ struct rpmPubkey_s {
     int nrefs;
 };
 
+#define KEYRING_BUCKETS	127
+
 struct rpmKeyring_s {
     struct rpmPubkey_s **keys;
     size_t numkeys;
+    size_t allockeys;
+    int buckets[KEYRING_BUCKETS];	/*!< keyid hash -> first key index */
+    int * chain;		/*!< key index -> next index in bucket */
+    rpmKeyringLoader load;	/*!< deferred key loader (or NULL) */
+    void * loadData;
+    uint8_t digest[20];		/*!< SHA1 over all keys (if valid) */
+    int digestValid;
     int nrefs;
 };
 
-static int keyidcmp(const void *k1, const void *k2)
+static unsigned int keyidHash(const uint8_t * keyid)
 {
-    const struct rpmPubkey_s *key1 = *(const struct rpmPubkey_s **) k1;
-    const struct rpmPubkey_s *key2 = *(const struct rpmPubkey_s **) k2;
-    
-    return memcmp(key1->keyid, key2->keyid, sizeof(key1->keyid));
+    /* Key ids are fingerprint tails, the low bits are as good as any. */
+    return ((keyid[4] << 24) | (keyid[5] << 16) | (keyid[6] << 8) | keyid[7]);
 }
 
 rpmKeyring rpmKeyringNew(void)
@@ -37,6 +44,13 @@ rpmKeyring rpmKeyringNew(void)
     rpmKeyring keyring = xcalloc(1, sizeof(*keyring));
     keyring->keys = NULL;
     keyring->numkeys = 0;
+    keyring->allockeys = 0;
+    for (int i = 0; i < KEYRING_BUCKETS; i++)
+	keyring->buckets[i] = -1;
+    keyring->chain = NULL;
+    keyring->load = NULL;
+    keyring->loadData = NULL;
+    keyring->digestValid = 0;
     keyring->nrefs = 0;
     return rpmKeyringLink(keyring);
 }
@@ -57,19 +71,63 @@ rpmKeyring rpmKeyringFree(rpmKeyring keyring)
 	}
 	free(keyring->keys);
     }
+    free(keyring->chain);
     free(keyring);
     return NULL;
 }
 
+void rpmKeyringSetLoader(rpmKeyring keyring, rpmKeyringLoader load,
+			 void * data)
+{
+    if (keyring) {
+	keyring->load = load;
+	keyring->loadData = data;
+    }
+}
+
+int rpmKeyringLoad(rpmKeyring keyring)
+{
+    rpmKeyringLoader load;
+    int nkeys = 0;
+
+    if (keyring && (load = keyring->load) != NULL) {
+	/* One shot, also guards against recursion from the loader. */
+	keyring->load = NULL;
+	nkeys = load(keyring, keyring->loadData);
+	keyring->loadData = NULL;
+    }
+    return nkeys;
+}
+
+rpmKeyring rpmKeyringDup(rpmKeyring keyring)
+{
+    rpmKeyring copy = rpmKeyringNew();
+
+    /* The copy must be self-contained, resolve deferred keys now. */
+    (void) rpmKeyringLoad(keyring);
+
+    if (keyring && keyring->numkeys > 0) {
+	for (int i = 0; i < keyring->numkeys; i++)
+	    (void) rpmKeyringAddKey(copy, keyring->keys[i]);
+    }
+    return copy;
+}
+
 static rpmPubkey rpmKeyringFindKeyid(rpmKeyring keyring, rpmPubkey key)
 {
-    rpmPubkey *found = NULL;
-    found = bsearch(&key, keyring->keys, keyring->numkeys, sizeof(*keyring->keys), keyidcmp);
-    return found ? *found : NULL;
+    int i = keyring->buckets[keyidHash(key->keyid) % KEYRING_BUCKETS];
+
+    for (; i >= 0; i = keyring->chain[i]) {
+	if (memcmp(keyring->keys[i]->keyid, key->keyid, sizeof(key->keyid)) == 0)
+	    return keyring->keys[i];
+    }
+    return NULL;
 }
 
 int rpmKeyringAddKey(rpmKeyring keyring, rpmPubkey key)
 {
+    unsigned int bucket;
+
     if (keyring == NULL || key == NULL)
 	return -1;
 
@@ -78,14 +136,64 @@ int rpmKeyringAddKey(rpmKeyring keyring, rpmPubkey key)
 	return 1;
     }
     
-    keyring->keys = xrealloc(keyring->keys, (keyring->numkeys + 1) * sizeof(rpmPubkey));
+    if (keyring->numkeys == keyring->allockeys) {
+	keyring->allockeys = keyring->allockeys ? 2 * keyring->allockeys : 8;
+	keyring->keys = xrealloc(keyring->keys,
+				 keyring->allockeys * sizeof(*keyring->keys));
+	keyring->chain = xrealloc(keyring->chain,
+				 keyring->allockeys * sizeof(*keyring->chain));
+    }
+    bucket = keyidHash(key->keyid) % KEYRING_BUCKETS;
     keyring->keys[keyring->numkeys] = rpmPubkeyLink(key);
+    keyring->chain[keyring->numkeys] = keyring->buckets[bucket];
+    keyring->buckets[bucket] = keyring->numkeys;
     keyring->numkeys++;
-    qsort(keyring->keys, keyring->numkeys, sizeof(*keyring->keys), keyidcmp);
+    keyring->digestValid = 0;
 
     return 0;
 }
 
+static int keyidcmp(const void *k1, const void *k2)
+{
+    const struct rpmPubkey_s *key1 = *(const struct rpmPubkey_s **) k1;
+    const struct rpmPubkey_s *key2 = *(const struct rpmPubkey_s **) k2;
+    
+    return memcmp(key1->keyid, key2->keyid, sizeof(key1->keyid));
+}
+
+int rpmKeyringDigest(rpmKeyring keyring, uint8_t digest[20])
+{
+    if (keyring == NULL)
+	return -1;
+
+    if (!keyring->digestValid) {
+	/* Hash the keys in keyid order, independent of insertion order. */
+	rpmPubkey *keys = xmalloc((keyring->numkeys + 1) * sizeof(*keys));
+	DIGEST_CTX ctx = rpmDigestInit(PGPHASHALGO_SHA1, RPMDIGEST_NONE);
+	void * d = NULL;
+	size_t dlen = 0;
+
+	memcpy(keys, keyring->keys, keyring->numkeys * sizeof(*keys));
+	qsort(keys, keyring->numkeys, sizeof(*keys), keyidcmp);
+	for (int i = 0; i < keyring->numkeys; i++) {
+	    (void) rpmDigestUpdate(ctx, keys[i]->keyid, sizeof(keys[i]->keyid));
+	    (void) rpmDigestUpdate(ctx, keys[i]->pkt, keys[i]->pktlen);
+	}
+	(void) rpmDigestFinal(ctx, &d, &dlen, 0);
+	free(keys);
+
+	if (d == NULL || dlen != sizeof(keyring->digest)) {
+	    free(d);
+	    return -1;
+	}
+	memcpy(keyring->digest, d, sizeof(keyring->digest));
+	keyring->digestValid = 1;
+	free(d);
+    }
+    memcpy(digest, keyring->digest, sizeof(keyring->digest));
+    return 0;
+}
+
 rpmKeyring rpmKeyringLink(rpmKeyring keyring)
 {
     if (keyring) {
@@ -207,7 +315,11 @@ rpmRC rpmKeyringLookup(rpmKeyring keyring, pgpDig sig)
 	needle.pktlen = 0;
 	memcpy(needle.keyid, sigp->signid, sizeof(needle.keyid));
 
-	if ((key = rpmKeyringFindKeyid(keyring, &needle))) {
+	key = rpmKeyringFindKeyid(keyring, &needle);
+	if (key == NULL && rpmKeyringLoad(keyring) > 0)
+	    key = rpmKeyringFindKeyid(keyring, &needle);
+
+	if (key) {
 	    /* Retrieve parameters from pubkey packet(s) */
 	    (void) pgpPrtPkts(key->pkt, key->pktlen, sig, 0);
 	    /* Do the parameters match the signature? */
@@ -24,6 +24,41 @@ rpmKeyring rpmKeyringNew(void);
  */
 rpmKeyring rpmKeyringFree(rpmKeyring keyring);
 
+/** \ingroup rpmkeyring
+ * Function to load more keys into a keyring on demand.
+ * @param keyring	keyring handle
+ * @param data		loader private data
+ * @return		no. of keys added
+ */
+typedef int (*rpmKeyringLoader) (rpmKeyring keyring, void * data);
+
+/** \ingroup rpmkeyring
+ * Set a function to load more keys on the first lookup miss.
+ * The loader is called at most once, a NULL loader cancels loading.
+ * @param keyring	keyring handle
+ * @param load		key loader (or NULL)
+ * @param data		loader private data
+ */
+void rpmKeyringSetLoader(rpmKeyring keyring, rpmKeyringLoader load,
+			 void * data);
+
+/** \ingroup rpmkeyring
+ * Load deferred keys now (if any).
+ * @param keyring	keyring handle
+ * @return		no. of keys added
+ */
+int rpmKeyringLoad(rpmKeyring keyring);
+
+/** \ingroup rpmkeyring
+ * Create a new keyring holding the same keys as another.
+ * The copy has its own reference count, so copies can be used from
+ * different threads while the original is unchanged. Deferred keys
+ * of the original are loaded first.
+ * @param keyring	keyring handle
+ * @return		new keyring handle
+ */
+rpmKeyring rpmKeyringDup(rpmKeyring keyring);
+
 /** \ingroup rpmkeyring
  * Add a public key to keyring.
  * @param keyring	keyring handle
@@ -32,6 +67,16 @@ rpmKeyring rpmKeyringFree(rpmKeyring keyring);
  */
 int rpmKeyringAddKey(rpmKeyring keyring, rpmPubkey key);
 
+/** \ingroup rpmkeyring
+ * Return a SHA1 digest identifying the set of keys in a keyring.
+ * Keyrings with the same keys have the same digest, independent of the
+ * order in which keys were added. Deferred keys are not loaded.
+ * @param keyring	keyring handle
+ * @retval digest	keyring digest
+ * @return		0 on success, -1 on error
+ */
+int rpmKeyringDigest(rpmKeyring keyring, uint8_t digest[20]);
+
 /** \ingroup rpmkeyring
  * Perform keyring lookup for a key matching a signature
  * @param keyring	keyring handle
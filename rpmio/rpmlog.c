@@ -4,7 +4,9 @@
 
 #include "system.h"
 #include <stdarg.h>
+#include <pthread.h>
 #include <rpm/rpmlog.h>
+#include "rpmio/rpmio_internal.h"
 #include "debug.h"
 
 static int nrecs = 0;
@@ -108,6 +110,75 @@ rpmlogCallback rpmlogSetCallback(rpmlogCallback cb, rpmlogCallbackData data)
 
 static FILE * _stdlog = NULL;
 
+struct rpmlogCapture_s {
+    int nrecs;
+    struct rpmlogRec_s * recs;
+};
+
+static pthread_key_t captureKey;
+static pthread_once_t captureOnce = PTHREAD_ONCE_INIT;
+
+static void captureKeyCreate(void)
+{
+    (void) pthread_key_create(&captureKey, NULL);
+}
+
+void rpmlogCaptureBegin(void)
+{
+    (void) pthread_once(&captureOnce, captureKeyCreate);
+    if (pthread_getspecific(captureKey) == NULL)
+	(void) pthread_setspecific(captureKey, xcalloc(1, sizeof(struct rpmlogCapture_s)));
+}
+
+rpmlogCapture rpmlogCaptureEnd(void)
+{
+    rpmlogCapture cap;
+
+    (void) pthread_once(&captureOnce, captureKeyCreate);
+    cap = pthread_getspecific(captureKey);
+    (void) pthread_setspecific(captureKey, NULL);
+    if (cap != NULL && cap->nrecs == 0)
+	cap = _free(cap);
+    return cap;
+}
+
+static rpmlogCapture captureFree(rpmlogCapture cap, int emit)
+{
+    int i;
+
+    if (cap == NULL)
+	return NULL;
+
+    for (i = 0; i < cap->nrecs; i++) {
+	rpmlogRec rec = cap->recs + i;
+	if (emit)
+	    rpmlog(rec->code, "%s", rec->message);
+	rec->message = _free(rec->message);
+    }
+    cap->recs = _free(cap->recs);
+    free(cap);
+    return NULL;
+}
+
+rpmlogCapture rpmlogCaptureFlush(rpmlogCapture cap)
+{
+    return captureFree(cap, 1);
+}
+
+rpmlogCapture rpmlogCaptureFree(rpmlogCapture cap)
+{
+    return captureFree(cap, 0);
+}
+
+/**
+ * Return the calling thread's message capture, if any.
+ */
+static rpmlogCapture rpmlogCaptured(void)
+{
+    (void) pthread_once(&captureOnce, captureKeyCreate);
+    return pthread_getspecific(captureKey);
+}
+
 static int rpmlogDefault(rpmlogRec rec)
 {
     FILE *msgout = (_stdlog ? _stdlog : stderr);
@@ -175,6 +246,7 @@ static void vrpmlog (unsigned code, const char *fmt, va_list ap)
     int msgnb = BUFSIZ, nb;
     int cbrc = RPMLOG_DEFAULT;
     int needexit = 0;
+    rpmlogCapture cap;
 
     struct rpmlogRec_s rec;
 
@@ -201,6 +273,16 @@ static void vrpmlog (unsigned code, const char *fmt, va_list ap)
     msgbuf[msgnb - 1] = '\0';
     msg = msgbuf;
 
+    /* Messages from capturing threads are emitted later by rpmlogCaptureFlush */
+    if ((cap = rpmlogCaptured()) != NULL) {
+	cap->recs = xrealloc(cap->recs, (cap->nrecs+1) * sizeof(*cap->recs));
+	cap->recs[cap->nrecs].code = code;
+	cap->recs[cap->nrecs].pri = pri;
+	cap->recs[cap->nrecs].message = xrealloc(msgbuf, strlen(msgbuf)+1);
+	cap->nrecs++;
+	return;
+    }
+
     rec.code = code;
     rec.message = msg;
     rec.pri = pri;
@@ -3,6 +3,10 @@
  */
 
 #include "system.h"
+
+#include <pthread.h>
+
+#include "rpmio/rpmio_internal.h"
 #include "debug.h"
 
 #if !defined(EXIT_FAILURE)
@@ -60,3 +64,172 @@ char * xstrdup (const char *str)
 }
 
 #endif	/* !(HAVE_MCHECK_H && defined(__GNUC__)) */
+
+/*
+ * Arenas hand out memory from large chunks and free all of it at once, for
+ * scopes (a transaction, a database iterator) that allocate many small
+ * objects with the same lifetime. An arena is not locked: it belongs to
+ * the thread (or is protected by the lock) of its owner.
+ */
+
+/* Strictest alignment of any type. */
+struct arenaAlign_s {
+    char c;
+    union {
+	long double ld;
+	long long ll;
+	void * p;
+	void (*fn) (void);
+    } u;
+};
+#define	ARENA_ALIGN	offsetof(struct arenaAlign_s, u)
+#define	ARENA_ROUND(_n)	(((_n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+#define	ARENA_CHUNK	4096	/* default chunk size */
+
+typedef struct arenaChunk_s * arenaChunk;
+
+struct arenaChunk_s {
+    arenaChunk next;		/*!< Previous chunk. */
+    size_t size;		/*!< Usable size. */
+    size_t used;		/*!< Bytes used. */
+};
+#define	CHUNK_HDR	ARENA_ROUND(sizeof(struct arenaChunk_s))
+#define	CHUNK_DATA(_c)	((char *)(_c) + CHUNK_HDR)
+
+struct rpmArena_s {
+    arenaChunk chunks;		/*!< Allocated chunks, current chunk first. */
+    arenaChunk first;		/*!< Chunk allocated with the arena. */
+    size_t chunksize;		/*!< Usable size of a chunk. */
+    struct rpmMallocStats_s stats;	/*!< Not yet added to the totals. */
+};
+#define	ARENA_HDR	ARENA_ROUND(sizeof(struct rpmArena_s))
+
+static struct rpmMallocStats_s mallocStats;
+static pthread_mutex_t mallocStatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Add the counters of an arena to the totals, and clear them.
+ * @param arena		arena
+ */
+static void arenaFlushStats(rpmArena arena)
+{
+    struct rpmMallocStats_s * s = &arena->stats;
+
+    (void) pthread_mutex_lock(&mallocStatsLock);
+    mallocStats.nallocs += s->nallocs;
+    mallocStats.allocbytes += s->allocbytes;
+    mallocStats.nchunks += s->nchunks;
+    mallocStats.chunkbytes += s->chunkbytes;
+    mallocStats.nresets += s->nresets;
+    (void) pthread_mutex_unlock(&mallocStatsLock);
+    memset(s, 0, sizeof(*s));
+}
+
+rpmArena rpmArenaNew(size_t chunksize)
+{
+    rpmArena arena;
+
+    if (chunksize == 0)
+	chunksize = ARENA_CHUNK;
+    chunksize = ARENA_ROUND(chunksize);
+
+    /* The first chunk comes with the arena, small scopes need one malloc. */
+    arena = xmalloc(ARENA_HDR + CHUNK_HDR + chunksize);
+    memset(arena, 0, sizeof(*arena));
+    arena->first = (arenaChunk) ((char *)arena + ARENA_HDR);
+    arena->first->next = NULL;
+    arena->first->size = chunksize;
+    arena->first->used = 0;
+    arena->chunks = arena->first;
+    arena->chunksize = chunksize;
+    arena->stats.nchunks++;
+    arena->stats.chunkbytes += ARENA_HDR + CHUNK_HDR + chunksize;
+    return arena;
+}
+
+void * rpmArenaAlloc(rpmArena arena, size_t size)
+{
+    arenaChunk c = arena->chunks;
+    void * p;
+
+    size = ARENA_ROUND(size ? size : 1);
+    arena->stats.nallocs++;
+    arena->stats.allocbytes += size;
+
+    if (size > c->size - c->used) {
+	size_t csize = arena->chunksize;
+	arenaChunk n;
+
+	/* Large objects get a chunk of their own, behind the current one. */
+	if (size > csize / 4)
+	    csize = size;
+	n = xmalloc(CHUNK_HDR + csize);
+	n->size = csize;
+	n->used = 0;
+	arena->stats.nchunks++;
+	arena->stats.chunkbytes += CHUNK_HDR + csize;
+	if (csize == size && c->size - c->used > 0) {
+	    n->next = c->next;
+	    c->next = n;
+	} else {
+	    n->next = c;
+	    arena->chunks = n;
+	}
+	c = n;
+    }
+    p = CHUNK_DATA(c) + c->used;
+    c->used += size;
+    return p;
+}
+
+void * rpmArenaCalloc(rpmArena arena, size_t nmemb, size_t size)
+{
+    size_t n = nmemb * size;
+
+    if (size != 0 && n / size != nmemb)
+	return vmefail(n);
+    return memset(rpmArenaAlloc(arena, n), 0, n);
+}
+
+char * rpmArenaStrdup(rpmArena arena, const char * str)
+{
+    size_t n = strlen(str) + 1;
+    return memcpy(rpmArenaAlloc(arena, n), str, n);
+}
+
+void rpmArenaReset(rpmArena arena)
+{
+    arenaChunk c, next;
+
+    if (arena == NULL)
+	return;
+
+    /* Keep the first chunk for reuse, release everything else. */
+    for (c = arena->chunks; c != NULL; c = next) {
+	next = c->next;
+	if (c != arena->first)
+	    free(c);
+    }
+    arena->first->next = NULL;	/* large chunks may be linked behind it */
+    arena->first->used = 0;
+    arena->chunks = arena->first;
+    arena->stats.nresets++;
+    arenaFlushStats(arena);
+}
+
+rpmArena rpmArenaFree(rpmArena arena)
+{
+    if (arena != NULL) {
+	rpmArenaReset(arena);
+	free(arena);
+    }
+    return NULL;
+}
+
+void rpmMallocStats(struct rpmMallocStats_s * stats)
+{
+    (void) pthread_mutex_lock(&mallocStatsLock);
+    *stats = mallocStats;
+    (void) pthread_mutex_unlock(&mallocStatsLock);
+}
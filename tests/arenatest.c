@@ -0,0 +1,71 @@
+/*
+ * Exercise memory arenas: alignment, large allocations linked behind the
+ * first chunk, and reuse of an arena after (repeated) resets.
+ *
+ * usage: arenatest
+ * Prints the no. of failures on stdout.
+ */
+
+#include "system.h"
+
+#include "rpmio/rpmio_internal.h"
+
+#include "debug.h"
+
+#define	CHUNKSIZE	65536
+
+static int failures = 0;
+
+static void check(int ok, const char * what)
+{
+    if (!ok) {
+	fprintf(stderr, "failed: %s\n", what);
+	failures++;
+    }
+}
+
+/* Fill some allocations, and check they don't overlap. */
+static void fill(rpmArena arena, int n, size_t size)
+{
+    unsigned char ** p = xcalloc(n, sizeof(*p));
+    int i;
+
+    for (i = 0; i < n; i++) {
+	p[i] = rpmArenaAlloc(arena, size);
+	check(((uintptr_t) p[i] % sizeof(void *)) == 0, "alignment");
+	memset(p[i], i & 0xff, size);
+    }
+    for (i = 0; i < n; i++)
+	check(p[i][0] == (i & 0xff) && p[i][size-1] == (i & 0xff), "overlap");
+    free(p);
+}
+
+int main(void)
+{
+    rpmArena arena = rpmArenaNew(CHUNKSIZE);
+    int * z;
+    int i;
+
+    /* A large object is linked behind the (partly used) first chunk. */
+    fill(arena, 1, 100);
+    fill(arena, 1, CHUNKSIZE + 4464);
+    rpmArenaReset(arena);
+    rpmArenaReset(arena);
+
+    /* The arena is usable again, for small and large objects alike. */
+    fill(arena, 100, 100);
+    fill(arena, 3, CHUNKSIZE / 2);
+    fill(arena, 1000, 300);
+    check(strcmp(rpmArenaStrdup(arena, "arena"), "arena") == 0, "strdup");
+    z = rpmArenaCalloc(arena, 1000, sizeof(*z));
+    for (i = 0; i < 1000; i++)
+	check(z[i] == 0, "calloc");
+    rpmArenaReset(arena);
+
+    fill(arena, 1, 100);
+    fill(arena, 1, CHUNKSIZE * 2);
+    arena = rpmArenaFree(arena);
+
+    printf("%d failures\n", failures);
+    return (failures ? 1 : 0);
+}
@@ -0,0 +1,19 @@
+Name:		loop%{pkg}
+Version:	1.0
+Release:	1
+Summary:	Testing dependency loop behavior
+
+Group:		Testing
+License:	GPL
+BuildArch:	noarch
+%{?reqs:Requires:	%{reqs}}
+%{?prereqs:Requires(pre):	%{prereqs}}
+
+%description
+%{summary}
+
+%clean
+rm -rf $RPM_BUILD_ROOT
+
+%files
+%defattr(-,root,root,-)
@@ -0,0 +1,189 @@
+/*
+ * Microbenchmark for rpmdsCompare(): checks its results against comparing
+ * with rpmvercmp() on copies of the EVR strings (what rpmdsCompare() used
+ * to do). Given a no. of rounds, also reports how long either takes on
+ * stderr.
+ *
+ * usage: evrbench [rounds]
+ * Prints the no. of mismatches on stdout. Without rounds (or 0), only the
+ * results are checked.
+ */
+
+#include "system.h"
+
+#include <time.h>
+
+#include <rpm/rpmlib.h>		/* rpmvercmp */
+#include <rpm/rpmds.h>
+#include <rpm/rpmstring.h>
+
+#include "debug.h"
+
+static const char * evrs[] = {
+    "1", "1.0", "1.0.", "1_0", "1.00", "1.0a", "1.a", "1.0.0", "01.0",
+    "2.0", "10.0", "1.0-1", "1.0-1.", "1.0-01", "1.0-2", "1.0-1.fc9",
+    "1.0-1.el5", "1.0-", "0:1.0", ":1.0", "0:1.0-1", "1:1.0", "1:0.9-9",
+    "2:1.0-1", "10:1.0", "01:1.0", "1.0alpha", "1.0beta2", "1.0rc1-3",
+    "a", "b", "1..0", "1.0~rc1", "20081231", "2.6.27-0.1.rc8.git7",
+    "2.6.27-0.1.rc8.git10", "123456789012345678901234567890",
+    "123456789012345678901234567891", "1.0-1-1", "-1",
+};
+#define	NEVRS	(sizeof(evrs) / sizeof(evrs[0]))
+
+static const rpmsenseFlags senses[] = {
+    RPMSENSE_LESS,
+    RPMSENSE_LESS | RPMSENSE_EQUAL,
+    RPMSENSE_EQUAL,
+    RPMSENSE_GREATER | RPMSENSE_EQUAL,
+    RPMSENSE_GREATER,
+};
+#define	NSENSES	(sizeof(senses) / sizeof(senses[0]))
+
+static void parseEVR(char * evr,
+		const char ** ep, const char ** vp, const char ** rp)
+{
+    char *s, *se;
+
+    s = evr;
+    while (*s && risdigit(*s)) s++;
+    se = strrchr(s, '-');
+
+    if (*s == ':') {
+	*ep = evr;
+	*s++ = '\0';
+	*vp = s;
+	if (**ep == '\0') *ep = "0";
+    } else {
+	*ep = NULL;
+	*vp = evr;
+    }
+    if (se) {
+	*se++ = '\0';
+	*rp = se;
+    } else {
+	*rp = NULL;
+    }
+}
+
+/* rpmdsCompare() the way it used to be (same names, EVRs non-empty). */
+static int refCompare(const char * A, rpmsenseFlags aF,
+		const char * B, rpmsenseFlags bF, int nopromote)
+{
+    char *aEVR, *bEVR;
+    const char *aE, *aV, *aR, *bE, *bV, *bR;
+    int sense;
+
+    aEVR = xstrdup(A);
+    parseEVR(aEVR, &aE, &aV, &aR);
+    bEVR = xstrdup(B);
+    parseEVR(bEVR, &bE, &bV, &bR);
+
+    sense = 0;
+    if (aE && *aE && bE && *bE)
+	sense = rpmvercmp(aE, bE);
+    else if (aE && *aE && atol(aE) > 0)
+	sense = (nopromote ? 1 : 0);
+    else if (bE && *bE && atol(bE) > 0)
+	sense = -1;
+
+    if (sense == 0) {
+	sense = rpmvercmp(aV, bV);
+	if (sense == 0 && aR && *aR && bR && *bR)
+	    sense = rpmvercmp(aR, bR);
+    }
+    free(aEVR);
+    free(bEVR);
+
+    if (sense < 0 && ((aF & RPMSENSE_GREATER) || (bF & RPMSENSE_LESS)))
+	return 1;
+    if (sense > 0 && ((aF & RPMSENSE_LESS) || (bF & RPMSENSE_GREATER)))
+	return 1;
+    if (sense == 0 && (((aF & RPMSENSE_EQUAL) && (bF & RPMSENSE_EQUAL)) ||
+		       ((aF & RPMSENSE_LESS) && (bF & RPMSENSE_LESS)) ||
+		       ((aF & RPMSENSE_GREATER) && (bF & RPMSENSE_GREATER))))
+	return 1;
+    return 0;
+}
+
+static double elapsed(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+    rpmds provides[NEVRS];
+    rpmds requires[NEVRS * NSENSES];
+    int rounds = (argc > 1 ? atoi(argv[1]) : 0);
+    int nreqs = 0;
+    int mismatches = 0;
+    int ncmp = 0;
+    int r, sum;
+    unsigned int i, j;
+    clock_t start;
+    double tds, tref;
+
+    for (i = 0; i < NEVRS; i++) {
+	provides[i] = rpmdsSingle(RPMTAG_PROVIDENAME, "bench", evrs[i],
+				  RPMSENSE_EQUAL);
+	for (j = 0; j < NSENSES; j++) {
+	    rpmds req = rpmdsSingle(RPMTAG_REQUIRENAME, "bench", evrs[i],
+				    senses[j]);
+	    (void) rpmdsSetNoPromote(req, (nreqs % 2));
+	    requires[nreqs++] = req;
+	}
+    }
+
+    /* Both ways around, the comparison isn't symmetric wrt. epochs. */
+    for (i = 0; i < NEVRS; i++) {
+	for (r = 0; r < nreqs; r++) {
+	    rpmds P = provides[i];
+	    rpmds R = requires[r];
+	    if (rpmdsCompare(R, P) != refCompare(rpmdsEVR(R), rpmdsFlags(R),
+			rpmdsEVR(P), rpmdsFlags(P), rpmdsNoPromote(P))) {
+		fprintf(stderr, "mismatch: %s vs %s\n", rpmdsDNEVR(R), rpmdsDNEVR(P));
+		mismatches++;
+	    }
+	    if (rpmdsCompare(P, R) != refCompare(rpmdsEVR(P), rpmdsFlags(P),
+			rpmdsEVR(R), rpmdsFlags(R), rpmdsNoPromote(R))) {
+		fprintf(stderr, "mismatch: %s vs %s\n", rpmdsDNEVR(P), rpmdsDNEVR(R));
+		mismatches++;
+	    }
+	}
+    }
+
+    if (rounds <= 0)
+	goto exit;
+
+    sum = 0;
+    start = clock();
+    for (ncmp = 0; ncmp < rounds; ncmp++)
+	for (i = 0; i < NEVRS; i++)
+	    for (r = 0; r < nreqs; r++)
+		sum += rpmdsCompare(requires[r], provides[i]);
+    tds = elapsed(start);
+
+    start = clock();
+    for (ncmp = 0; ncmp < rounds; ncmp++)
+	for (i = 0; i < NEVRS; i++)
+	    for (r = 0; r < nreqs; r++)
+		sum -= refCompare(rpmdsEVR(requires[r]), rpmdsFlags(requires[r]),
+			evrs[i], RPMSENSE_EQUAL, rpmdsNoPromote(provides[i]));
+    tref = elapsed(start);
+
+    fprintf(stderr, "%d comparisons: rpmdsCompare %.3fs, rpmvercmp %.3fs\n",
+		rounds * (int) NEVRS * nreqs, tds, tref);
+    if (sum != 0) {
+	fprintf(stderr, "benchmark results differ\n");
+	mismatches++;
+    }
+
+exit:
+    for (i = 0; i < NEVRS; i++)
+	provides[i] = rpmdsFree(provides[i]);
+    for (r = 0; r < nreqs; r++)
+	requires[r] = rpmdsFree(requires[r]);
+
+    printf("%d mismatches\n", mismatches);
+    return (mismatches ? 1 : 0);
+}
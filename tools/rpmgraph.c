@@ -206,6 +206,8 @@ maybe_manifest:
 	rpmte p;
 	rpmte q;
 	int oType = TR_ADDED;
+	int nloops = 0;
+	int loop;
 
 	fprintf(stdout, "digraph XXX {\n");
 
@@ -214,7 +216,10 @@ maybe_manifest:
 	fprintf(stdout, "//===== Packages:\n");
 	pi = rpmtsiInit(ts);
 	while ((p = rpmtsiNext(pi, oType)) != NULL) {
-	    fprintf(stdout, "//%5d%5d %s\n", rpmteTree(p), rpmteDepth(p), rpmteN(p));
+	    fprintf(stdout, "//%5d%5d%5d %s\n", rpmteTree(p), rpmteDepth(p),
+			rpmteLoop(p), rpmteN(p));
+	    if (rpmteLoop(p) > nloops)
+		nloops = rpmteLoop(p);
 	    q = rpmteParent(p);
 	    if (q != NULL)
 		fprintf(stdout, "  \"%s\" -> \"%s\"\n", rpmteN(p), rpmteN(q));
@@ -225,6 +230,19 @@ maybe_manifest:
 	}
 	pi = rpmtsiFree(pi);
 
+	fprintf(stdout, "//===== Loops:\n");
+	for (loop = 1; loop <= nloops; loop++) {
+	    fprintf(stdout, "  subgraph \"cluster_loop%d\" {\n", loop);
+	    fprintf(stdout, "    label=\"LOOP %d\"\n", loop);
+	    pi = rpmtsiInit(ts);
+	    while ((p = rpmtsiNext(pi, oType)) != NULL) {
+		if (rpmteLoop(p) == loop)
+		    fprintf(stdout, "    \"%s\"\n", rpmteN(p));
+	    }
+	    pi = rpmtsiFree(pi);
+	    fprintf(stdout, "  }\n");
+	}
+
 	fprintf(stdout, "}\n");
     }
 